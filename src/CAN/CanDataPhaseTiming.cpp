@@ -0,0 +1,134 @@
+/*
+ * CanDataPhaseTiming.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "CanDataPhaseTiming.h"
+
+constexpr uint32_t MinTdcBitRate = 1000000;			// below this the transceiver loop delay is small compared to the bit time, so we don't need delay compensation
+
+// Calculate the data phase bit timing from the timing in CAN clocks. Return false if it can't be represented or is faster than we support.
+// Unlike the nominal bit timing, the data phase bit rate must be exact, so we only consider prescalers that divide the period exactly.
+bool DataBitTiming::Calculate(const CanTiming& timing)
+{
+	const uint32_t period = timing.period;
+	if (period == 0 || timing.tseg1 == 0 || timing.tseg1 >= period || timing.jumpWidth == 0 || CanTiming::ClockFrequency > MaxBitRate * period)
+	{
+		return false;
+	}
+
+	for (uint32_t p = 1; p <= MaxPrescaler; ++p)
+	{
+		if (period % p != 0)
+		{
+			continue;
+		}
+
+		const uint32_t quanta = period/p;
+		if (quanta < 3)
+		{
+			break;										// the quanta only get fewer as the prescaler increases
+		}
+		if (quanta > 1 + MaxTseg1 + MaxTseg2)
+		{
+			continue;
+		}
+
+		// Round the sample point to the nearest time quantum, keeping at least one quantum after it
+		uint32_t t1 = (timing.tseg1 + p/2)/p;
+		if (t1 == 0)
+		{
+			t1 = 1;
+		}
+		else if (t1 > quanta - 2)
+		{
+			t1 = quanta - 2;
+		}
+		if (t1 > MaxTseg1)
+		{
+			continue;
+		}
+		const uint32_t t2 = quanta - 1 - t1;
+		if (t2 > MaxTseg2)
+		{
+			continue;
+		}
+
+		uint32_t jw = (timing.jumpWidth + p/2)/p;
+		if (jw == 0)
+		{
+			jw = 1;
+		}
+		if (jw > t2)
+		{
+			jw = t2;
+		}
+		if (jw > MaxJumpWidth)
+		{
+			jw = MaxJumpWidth;
+		}
+
+		prescaler = p;
+		tseg1 = t1;
+		tseg2 = t2;
+		jumpWidth = jw;
+
+		// With delay compensation, the secondary sample point is the measured transceiver delay plus this offset. Put it at the data sample point.
+		const uint32_t offset = p * (1 + t1);
+		tdcOffset = (p <= MaxTdcPrescaler && GetBitRate() >= MinTdcBitRate) ? ((offset > MaxTdcOffset) ? MaxTdcOffset : offset) : 0;
+		return true;
+	}
+	return false;
+}
+
+void DataBitTiming::GetTiming(CanTiming& timing) const
+{
+	timing.period = prescaler * (1u + tseg1 + tseg2);
+	timing.tseg1 = prescaler * tseg1;
+	timing.jumpWidth = prescaler * jumpWidth;
+}
+
+// Start a trial of a new timing. If a trial is already running, keep the timing that we had before it as the one to fall back to.
+void DataPhaseTrial::Start(uint32_t now, uint32_t trialMillis, uint32_t errorsAllowed, const DataBitTiming& newTiming, const DataBitTiming& currentTiming, bool currentBitRateSwitch)
+{
+	if (!running)
+	{
+		fallbackTiming = currentTiming;
+		fallbackBitRateSwitch = currentBitRateSwitch;
+	}
+	trialTiming = newTiming;
+	startTime = now;
+	duration = trialMillis;
+	maxErrors = errorsAllowed;
+	errors = 0;
+	running = true;
+}
+
+// Account for any new bus errors and decide whether the trial has finished. This must only be called while the trial is running.
+// If it returns 'failed' then the caller must go back to the fallback timing.
+DataPhaseTrial::Result DataPhaseTrial::Check(uint32_t now, uint32_t newErrors, bool errorPassive)
+{
+	errors += newErrors;
+	Result result;
+	if (errorPassive || errors > maxErrors)
+	{
+		result = Result::failed;
+		++fallbacks;
+	}
+	else if (now - startTime >= duration)
+	{
+		result = Result::passed;
+	}
+	else
+	{
+		return Result::running;
+	}
+
+	running = false;
+	lastResult = result;
+	lastErrors = errors;
+	return result;
+}
+
+// End
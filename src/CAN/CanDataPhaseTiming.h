@@ -0,0 +1,75 @@
+/*
+ * CanDataPhaseTiming.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Calculation of CAN-FD data phase bit timing, and the trial that we run when the main board asks us to use a faster data phase bit rate.
+ *  Nothing in this file accesses the hardware, so that it can be compiled and exercised on a PC.
+ */
+
+#ifndef SRC_CAN_CANDATAPHASETIMING_H_
+#define SRC_CAN_CANDATAPHASETIMING_H_
+
+#include <cstdint>
+#include <CanSettings.h>
+
+// Data phase bit timing in the form that the M_CAN DBTP and TDCR registers need it
+struct DataBitTiming
+{
+	static constexpr uint32_t MaxBitRate = 5000000;					// the fastest data phase bit rate that our transceivers are rated for
+	static constexpr uint32_t MaxPrescaler = 32;
+	static constexpr uint32_t MaxTseg1 = 32;
+	static constexpr uint32_t MaxTseg2 = 16;
+	static constexpr uint32_t MaxJumpWidth = 16;
+	static constexpr uint32_t MaxTdcPrescaler = 2;					// transceiver delay compensation only works with prescalers of 1 and 2
+	static constexpr uint32_t MaxTdcOffset = 127;
+
+	uint8_t prescaler;												// CAN clocks per time quantum
+	uint8_t tseg1;													// time quanta from the end of the sync segment to the sample point
+	uint8_t tseg2;													// time quanta from the sample point to the end of the bit
+	uint8_t jumpWidth;												// resynchronisation jump width in time quanta
+	uint8_t tdcOffset;												// secondary sample point offset in CAN clocks, or 0 if delay compensation is disabled
+
+	bool Calculate(const CanTiming& timing);
+	void GetTiming(CanTiming& timing) const;
+	bool UsesDelayCompensation() const { return tdcOffset != 0; }
+	uint32_t GetBitRate() const { return CanTiming::ClockFrequency/((uint32_t)prescaler * (1u + tseg1 + tseg2)); }
+};
+
+// Trial of a new data phase bit timing. We accept it if the bus stays healthy for the whole trial period, else we fall back to the timing we had before.
+class DataPhaseTrial
+{
+public:
+	enum class Result : uint8_t { running, passed, failed };		// 'running' as the last result means that we haven't finished any trials
+
+	DataPhaseTrial() : startTime(0), duration(0), maxErrors(0), errors(0), lastErrors(0), fallbacks(0),
+						running(false), fallbackBitRateSwitch(false), lastResult(Result::running) { }
+
+	void Start(uint32_t now, uint32_t trialMillis, uint32_t errorsAllowed, const DataBitTiming& newTiming, const DataBitTiming& currentTiming, bool currentBitRateSwitch);
+	Result Check(uint32_t now, uint32_t newErrors, bool errorPassive);
+	void Cancel() { running = false; }
+
+	bool IsRunning() const { return running; }
+	uint32_t GetErrors() const { return errors; }
+	const DataBitTiming& GetTrialTiming() const { return trialTiming; }
+	const DataBitTiming& GetFallbackTiming() const { return fallbackTiming; }
+	bool GetFallbackBitRateSwitch() const { return fallbackBitRateSwitch; }
+	Result GetLastResult() const { return lastResult; }
+	uint32_t GetLastErrors() const { return lastErrors; }
+	uint32_t GetFallbacks() const { return fallbacks; }
+
+private:
+	uint32_t startTime;
+	uint32_t duration;
+	uint32_t maxErrors;
+	uint32_t errors;
+	uint32_t lastErrors;											// the errors seen in the last trial that finished
+	uint32_t fallbacks;												// how many trials have failed
+	DataBitTiming trialTiming;										// the timing being tried
+	DataBitTiming fallbackTiming;									// the timing to go back to if the trial fails
+	bool running;
+	bool fallbackBitRateSwitch;										// whether we were using bit rate switching before the trial
+	Result lastResult;
+};
+
+#endif /* SRC_CAN_CANDATAPHASETIMING_H_ */
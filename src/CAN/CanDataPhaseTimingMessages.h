@@ -0,0 +1,40 @@
+/*
+ * CanDataPhaseTimingMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used by the main board to switch expansion boards to a faster CAN-FD data phase bit rate.
+ *  The corresponding message type is CanMessageType::setDataPhaseTiming. This is a new type, because the trial and fallback protocol needs a different
+ *  layout from CanMessageSetFastTiming, so a board that doesn't support the trial ignores the request instead of misreading it.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ *
+ *  The data phase timing must be the same on every node, so the main board drives the negotiation. It switches its own data phase timing,
+ *  asks each expansion board to try the same timing, and after the trial period it asks each board for a report. A board that sees too many
+ *  bus errors during the trial, or becomes error passive, falls back to the timing it was using before and reports that the trial failed.
+ *  The main board can then fall back too and try a slower rate.
+ */
+
+#ifndef SRC_CAN_CANDATAPHASETIMINGMESSAGES_H_
+#define SRC_CAN_CANDATAPHASETIMINGMESSAGES_H_
+
+#include <cstdint>
+#include <CanSettings.h>
+
+struct __attribute__((packed)) CanMessageSetDataPhaseTiming
+{
+	static constexpr uint8_t ModeReport = 0;		// just report the data phase timing and the result of the last trial
+	static constexpr uint8_t ModeTry = 1;			// start a trial of the new timing with bit rate switching enabled
+	static constexpr uint8_t ModeDisable = 2;		// stop using bit rate switching in the messages we send
+
+	uint16_t requestId : 12,
+			 zero : 4;
+	uint8_t mode;
+	uint8_t zero2;
+	uint16_t trialMillis;							// how long to monitor the bus before accepting the new timing
+	uint16_t maxErrors;								// how many bus errors we allow during the trial
+	CanTiming dataTiming;							// the data phase timing in CAN clocks, only used by ModeTry
+};
+
+static_assert(sizeof(CanMessageSetDataPhaseTiming) <= 64, "Message too long");
+
+#endif /* SRC_CAN_CANDATAPHASETIMINGMESSAGES_H_ */
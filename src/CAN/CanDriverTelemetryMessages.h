@@ -0,0 +1,46 @@
+/*
+ * CanDriverTelemetryMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used to stream stepper driver load telemetry to the main board.
+ *  The corresponding message type is CanMessageType::driverTelemetryReport. These messages are sent without being requested once telemetry has been enabled.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANDRIVERTELEMETRYMESSAGES_H_
+#define SRC_CAN_CANDRIVERTELEMETRYMESSAGES_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <CanId.h>
+
+struct __attribute__((packed)) CanDriverTelemetrySample
+{
+	static constexpr uint8_t StandstillFlag = 0x80;
+
+	uint16_t timeOffset;							// milliseconds after the time stamp in the message
+	uint8_t driver;
+	uint8_t currentScale;							// CS_ACTUAL from 0 to 31, with StandstillFlag set if the driver reported standstill
+	uint16_t sgResult;								// SG_RESULT from 0 to 1023. Only meaningful when not at standstill.
+	uint16_t fullStepsPerSecond;					// the speed of the driver when the sample was taken
+	int32_t position;								// the position of the driver in microsteps, counted from when we started up
+};
+
+struct __attribute__((packed)) CanMessageDriverTelemetry
+{
+	static constexpr CanMessageType messageType = CanMessageType::driverTelemetryReport;
+	static constexpr size_t MaxSamples = 4;
+
+	uint32_t timeStamp;								// our millisecond clock when the first sample was taken
+	uint8_t numSamples;
+	uint8_t zero;
+	uint16_t samplesDropped;						// the number of samples dropped since telemetry was enabled, saturating at 65535
+	CanDriverTelemetrySample samples[MaxSamples];
+
+	size_t GetActualDataLength() const { return 8 + numSamples * sizeof(CanDriverTelemetrySample); }
+};
+
+static_assert(sizeof(CanMessageDriverTelemetry) <= 64, "Message too long");
+
+#endif /* SRC_CAN_CANDRIVERTELEMETRYMESSAGES_H_ */
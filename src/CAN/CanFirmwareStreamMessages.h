@@ -0,0 +1,56 @@
+/*
+ * CanFirmwareStreamMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message formats used to stream a new firmware image to expansion boards while they are running.
+ *  The corresponding message types are CanMessageType::firmwareStreamStart, firmwareStreamData and firmwareStreamCommit.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANFIRMWARESTREAMMESSAGES_H_
+#define SRC_CAN_CANFIRMWARESTREAMMESSAGES_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// Message sent to each board to be updated. The board prepares the inactive flash bank and replies when it is ready to receive data.
+struct __attribute__((packed)) CanMessageFirmwareStreamStart
+{
+	static constexpr size_t MaxBoardTypeLength = 44;
+
+	uint16_t requestId : 12,
+			 zero : 4;
+	uint16_t zero2;
+	uint32_t imageSize;								// the number of bytes in the image, excluding the bootloader
+	uint32_t imageCrc;								// CRC32 of the image
+	char boardType[MaxBoardTypeLength];				// the board type that the image is for, null terminated
+};
+
+// Message carrying a block of image data. These may be addressed to a single board or broadcast, and are not acknowledged.
+struct __attribute__((packed)) CanMessageFirmwareStreamData
+{
+	static constexpr size_t MaxDataLength = 60;
+
+	uint32_t offset;								// the offset into the image of the first byte of data
+	uint8_t data[MaxDataLength];					// the data, the actual length is inferred from the message length
+
+	static constexpr size_t GetDataLength(size_t messageLength) { return (messageLength > sizeof(offset)) ? messageLength - sizeof(offset) : 0; }
+};
+
+// Message sent to each board when all the data has been sent. The board verifies the image and if it is good, switches to it and restarts.
+// If the board hasn't received all the data, the reply is an error that reports the offset of the first missing byte,
+// so that the sender can re-send data from that point and then commit again.
+struct __attribute__((packed)) CanMessageFirmwareStreamCommit
+{
+	uint16_t requestId : 12,
+			 zero : 4;
+	uint16_t zero2;
+	uint32_t imageSize;								// must match the size in the start message
+	uint32_t imageCrc;								// must match the CRC in the start message
+};
+
+static_assert(sizeof(CanMessageFirmwareStreamStart) <= 64, "Message too long");
+static_assert(sizeof(CanMessageFirmwareStreamData) == 64, "Message has wrong length");
+
+#endif /* SRC_CAN_CANFIRMWARESTREAMMESSAGES_H_ */
@@ -0,0 +1,58 @@
+/*
+ * CanInputChangesMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used to report the state changes of several input monitors in a single CAN-FD frame, with the number of times each input
+ *  has changed state since it was last reported and the time of its latest change. This lets us coalesce the reports of inputs that change
+ *  often, such as a bouncing filament sensor, without losing the timing of the edges.
+ *  The corresponding message type is CanMessageType::inputChangesTimed.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANINPUTCHANGESMESSAGES_H_
+#define SRC_CAN_CANINPUTCHANGESMESSAGES_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <CanId.h>
+
+struct __attribute__((packed)) CanInputChangeEntry
+{
+	uint16_t handle;
+	uint8_t state : 1,								// the state of the input when we built the message
+			numChanges : 7;							// how many times the input has changed state since it was last reported, saturating at MaxChanges
+	uint8_t zero;
+	uint32_t whenChanged;							// the master step clock time of the latest change
+
+	static constexpr unsigned int MaxChanges = 127;
+};
+
+struct __attribute__((packed)) CanMessageInputChangesTimed
+{
+	static constexpr CanMessageType messageType = CanMessageType::inputChangesTimed;
+	static constexpr size_t MaxEntries = 7;
+
+	uint8_t numEntries;
+	uint8_t zero[3];
+	CanInputChangeEntry entries[MaxEntries];
+
+	void Init() { numEntries = 0; zero[0] = zero[1] = zero[2] = 0; }
+	bool IsFull() const { return numEntries == MaxEntries; }
+	size_t GetActualDataLength() const { return 4 + numEntries * sizeof(CanInputChangeEntry); }
+
+	// Append an entry. The caller must check that the message is not full.
+	void AddEntry(uint16_t h, bool st, unsigned int changes, uint32_t when)
+	{
+		CanInputChangeEntry& entry = entries[numEntries++];
+		entry.handle = h;
+		entry.state = st;
+		entry.numChanges = (changes < CanInputChangeEntry::MaxChanges) ? changes : CanInputChangeEntry::MaxChanges;
+		entry.zero = 0;
+		entry.whenChanged = when;
+	}
+};
+
+static_assert(sizeof(CanMessageInputChangesTimed) <= 64, "Message is too long");
+
+#endif /* SRC_CAN_CANINPUTCHANGESMESSAGES_H_ */
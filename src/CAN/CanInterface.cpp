@@ -18,6 +18,13 @@
 #include <Hardware/CanDriver.h>
 #include <Hardware/IoPorts.h>
 #include <Version.h>
+#include <EventLog.h>
+#include <FirmwareUpdater.h>
+#include "CanFirmwareStreamMessages.h"
+#include "CanDataPhaseTiming.h"
+#include "CanDataPhaseTimingMessages.h"
+#include "CanInputChangesMessages.h"
+#include "CanPowerFailMessages.h"
 #include <peripheral_clk_config.h>
 #include <hpl_user_area.h>
 
@@ -42,10 +49,16 @@ constexpr size_t CanAsyncSenderTaskStackWords = 400;
 static Task<CanAsyncSenderTaskStackWords> canAsyncSenderTask;
 
 static TaskHandle sendingTaskHandle = nullptr;
+static Mutex canSendMutex;							// taken while queueing a message to send, and while we change the data phase timing
 
 static bool mainBoardAcknowledgedAnnounce = false;	// true after the main board has acknowledged our announcement
 static bool isProgrammed = false;					// true after the main board has sent us any configuration commands
 
+// CAN-FD data phase timing trial
+static DataPhaseTrial dataPhaseTrial;
+static uint32_t dataPhaseMessagesRequeued = 0;		// messages waiting to be sent when we changed the data phase timing, which we sent afterwards
+static uint32_t dataPhaseMessagesLost = 0;			// received messages that we had to discard when we changed the data phase timing
+
 class CanMessageQueue
 {
 public:
@@ -95,7 +108,10 @@ CanMessageBuffer *CanMessageQueue::GetMessage()
 }
 
 static CanMessageQueue PendingMoves;
+static uint32_t movesReceived = 0;						// the number of movement messages added to PendingMoves
+static uint32_t movesReceivedBeforeM669 = 0;			// the value of movesReceived when the last M669 request arrived
 static CanMessageQueue PendingCommands;
+static CanMessageQueue PendingResponses;				// responses waiting to be sent by the async sender task
 
 static can_async_descriptor CAN_0;
 
@@ -146,6 +162,9 @@ namespace CanInterface
 	void ProcessReceivedMessage(CanMessageBuffer *buf);
 }
 
+static void AppendDataPhaseDetails(const StringRef& reply);
+static unsigned int ChangeDataTiming(const DataBitTiming& timing, bool enableBitRateSwitch);
+
 extern "C" void CAN_0_tx_callback(struct can_async_descriptor *const descr)
 {
 	if (sendingTaskHandle != nullptr)
@@ -231,17 +250,52 @@ extern "C" [[noreturn]] void CanAsyncSenderLoop(void *)
 
 	for (;;)
 	{
-		// Set up a message ready
-		auto msg = buf->SetupStatusMessage<CanMessageInputChanged>(CanInterface::GetCanAddress(), CanId::MasterAddress);
-		msg->states = 0;
-		msg->spare = 0;
-		msg->numHandles = 0;
+		// Send any responses that the command processor has queued
+		CanMessageBuffer *responseBuf;
+		while ((responseBuf = PendingResponses.GetMessage()) != nullptr)
+		{
+			CanInterface::SendAndFree(responseBuf);
+		}
 
-		const uint32_t timeToWait = InputMonitor::AddStateChanges(msg);
-		if (msg->numHandles != 0)
+#if SUPPORT_POWER_FAIL_DETECTION
+		// Report a power failure before anything else, so that the main board can save the position while it still has power
 		{
-			buf->dataLength = msg->GetActualDataLength();
-			CanInterface::SendAsync(buf);					// this doesn't free the buffer, so we can re-use it
+			auto pfMsg = buf->SetupStatusMessage<CanMessagePowerFailEvent>(CanInterface::GetCanAddress(), CanId::MasterAddress);
+			if (Platform::GetPowerFailReport(*pfMsg))
+			{
+				buf->dataLength = pfMsg->GetActualDataLength();
+				CanInterface::SendAsync(buf);				// this doesn't free the buffer, so we can re-use it
+			}
+		}
+#endif
+
+		// Set up a message ready. We only use the timed format if the main board has asked for it by setting a report window.
+		uint32_t timeToWait;
+		if (InputMonitor::UseTimedReports())
+		{
+			auto msg = buf->SetupStatusMessage<CanMessageInputChangesTimed>(CanInterface::GetCanAddress(), CanId::MasterAddress);
+			msg->Init();
+
+			timeToWait = InputMonitor::AddStateChanges(msg);
+			if (msg->numEntries != 0)
+			{
+				buf->dataLength = msg->GetActualDataLength();
+				CanInterface::SendAsync(buf);				// this doesn't free the buffer, so we can re-use it
+			}
+		}
+		else
+		{
+			auto msg = buf->SetupStatusMessage<CanMessageInputChanged>(CanInterface::GetCanAddress(), CanId::MasterAddress);
+			msg->states = 0;
+			msg->spare = 0;
+			msg->numHandles = 0;
+
+			timeToWait = InputMonitor::AddStateChanges(msg);
+			if (msg->numHandles != 0)
+			{
+				buf->dataLength = msg->GetActualDataLength();
+				CanInterface::SendAsync(buf);				// this doesn't free the buffer, so we can re-use it
+			}
 		}
 		TaskBase::Take(timeToWait);						// wait until we are woken up because a message is available, or we time out
 	}
@@ -264,6 +318,7 @@ void CanInterface::Init(CanAddress defaultBoardAddress)
 	can_async_register_callback(&CAN_0, CAN_ASYNC_RX_CB, (FUNC_PTR)CAN_0_rx_callback);
 	can_async_register_callback(&CAN_0, CAN_ASYNC_TX_CB, (FUNC_PTR)CAN_0_tx_callback);
 
+	canSendMutex.Create("CanSend");
 	enabled = true;
 
 	// Create the task that receives CAN messages
@@ -297,7 +352,7 @@ bool CanInterface::Send(CanMessageBuffer *buf)
 	for (unsigned int tries = 0; tries < 5; ++tries)
 	{
 		{
-			TaskCriticalSectionLocker lock;
+			MutexLocker lock(canSendMutex);
 			if (can_async_write(&CAN_0, &msg) == ERR_NONE)
 			{
 				return true;
@@ -305,6 +360,7 @@ bool CanInterface::Send(CanMessageBuffer *buf)
 		}
 		delay(2);
 	}
+	EventLog::Record(EventLogType::canSendFailed, (uint32_t)buf->id.MsgType());
 	return false;
 }
 
@@ -321,6 +377,14 @@ bool CanInterface::SendAndFree(CanMessageBuffer *buf)
 	return ok;
 }
 
+// Queue a response to be sent and freed by the async sender task, so that the caller can get on with processing the next request.
+// Responses are sent in the order in which they were queued.
+void CanInterface::QueueResponse(CanMessageBuffer *buf)
+{
+	PendingResponses.AddMessage(buf);
+	canAsyncSenderTask.Give();
+}
+
 bool CanInterface::GetCanMove(CanMessageMovement& msg)
 {
 	// See if there is a movement message
@@ -334,6 +398,13 @@ bool CanInterface::GetCanMove(CanMessageMovement& msg)
 	return false;
 }
 
+// Return the number of movement messages that had been received when the last M669 request arrived.
+// The main board waits for the reply to M669 before sending another, so only the most recent one matters.
+uint32_t CanInterface::GetMovesReceivedBeforeM669()
+{
+	return movesReceivedBeforeM669;
+}
+
 CanMessageBuffer *CanInterface::GetCanCommand()
 {
 	return PendingCommands.GetMessage();
@@ -354,6 +425,7 @@ void CanInterface::ProcessReceivedMessage(CanMessageBuffer *buf)
 		//TODO if we haven't established time sync yet then we should defer this
 		buf->msg.move.whenToExecute += StepTimer::GetLocalTimeOffset();
 		PendingMoves.AddMessage(buf);
+		++movesReceived;
 		Platform::OnProcessingCanMessage();
 		break;
 
@@ -385,6 +457,16 @@ void CanInterface::ProcessReceivedMessage(CanMessageBuffer *buf)
 		Platform::OnProcessingCanMessage();
 		break;
 
+	case CanMessageType::firmwareStreamData:
+#if SAME5x
+		if (buf->id.Dst() == GetCanAddress() || buf->id.Dst() == CanId::BroadcastAddress)
+		{
+			FirmwareUpdater::ProcessData(reinterpret_cast<const CanMessageFirmwareStreamData&>(buf->msg), buf->dataLength);
+		}
+#endif
+		CanMessageBuffer::Free(buf);
+		break;
+
 	case CanMessageType::controlledStop:
 		debugPrintf("Unsupported CAN message type %u\n", (unsigned int)(buf->id.MsgType()));
 		CanMessageBuffer::Free(buf);
@@ -398,6 +480,10 @@ void CanInterface::ProcessReceivedMessage(CanMessageBuffer *buf)
 			{
 				isProgrammed = true;			// record that we've had a communication from the master since we started up
 			}
+			if (buf->id.MsgType() == CanMessageType::m669)
+			{
+				movesReceivedBeforeM669 = movesReceived;	// record where the request came in the move stream, so that a Z reset can be applied at that point
+			}
 			PendingCommands.AddMessage(buf);	// it's addressed to us, so queue it for processing
 		}
 		else
@@ -411,6 +497,20 @@ void CanInterface::ProcessReceivedMessage(CanMessageBuffer *buf)
 void CanInterface::Diagnostics(const StringRef& reply)
 {
 	reply.lcatf("Free CAN buffers: %u", CanMessageBuffer::FreeBuffers());
+	reply.lcat("CAN data phase: ");
+	AppendDataPhaseDetails(reply);
+}
+
+// Check how a trial of a new data phase timing is going. Called from the main task.
+void CanInterface::Spin()
+{
+	if (   dataPhaseTrial.IsRunning()
+		&& dataPhaseTrial.Check(millis(), GetAndClearCanErrorCount(&CAN_0), IsCanErrorPassive(&CAN_0)) == DataPhaseTrial::Result::failed
+	   )
+	{
+		(void)ChangeDataTiming(dataPhaseTrial.GetFallbackTiming(), dataPhaseTrial.GetFallbackBitRateSwitch());	// any messages lost are counted in the diagnostics
+		EventLog::Record(EventLogType::canDataRateFallback, dataPhaseTrial.GetTrialTiming().GetBitRate(), dataPhaseTrial.GetLastErrors());
+	}
 }
 
 // Send an announcement message if we haven't had an announce acknowledgement form the main board. On return the buffer is available to use again.
@@ -487,4 +587,169 @@ GCodeResult CanInterface::ChangeAddressAndDataRate(const CanMessageSetAddressAnd
 	return GCodeResult::error;
 }
 
+static void AppendDataPhaseDetails(const StringRef& reply)
+{
+	DataBitTiming timing;
+	const bool bitRateSwitch = GetLocalCanDataTiming(&CAN_0, timing);
+	reply.catf("%s %.2fMbps, sample point %u%%, ",
+				(bitRateSwitch) ? "switching to" : "not switching,", (double)((float)timing.GetBitRate() * 1.0e-6),
+				(unsigned int)((100u * (1u + timing.tseg1))/(1u + timing.tseg1 + timing.tseg2)));
+	if (timing.UsesDelayCompensation())
+	{
+		reply.catf("delay compensation offset %u measured %" PRIu32 ", ", timing.tdcOffset, GetCanTransceiverDelay(&CAN_0));
+	}
+	else
+	{
+		reply.cat("no delay compensation, ");
+	}
+
+	if (dataPhaseTrial.IsRunning())
+	{
+		reply.catf("trial running with %" PRIu32 " errors", dataPhaseTrial.GetErrors());
+	}
+	else if (dataPhaseTrial.GetLastResult() == DataPhaseTrial::Result::running)
+	{
+		reply.cat("no trials");
+	}
+	else
+	{
+		reply.catf("last trial %s with %" PRIu32 " errors",
+					(dataPhaseTrial.GetLastResult() == DataPhaseTrial::Result::passed) ? "passed" : "failed", dataPhaseTrial.GetLastErrors());
+	}
+	reply.catf(", fallbacks %" PRIu32 ", queued messages resent %" PRIu32 " lost %" PRIu32, dataPhaseTrial.GetFallbacks(), dataPhaseMessagesRequeued, dataPhaseMessagesLost);
+}
+
+// Change the data phase timing. The CAN controller has to be stopped to do this, so we hold the send mutex to stop other tasks queueing messages,
+// and we give the messages already queued a chance to be sent first. We don't wait for ever, because they may be failing to go because of the data rate.
+// Reconfiguring the controller resets its FIFOs. The driver puts back the messages that were waiting to be sent, and we take the received messages
+// out of the receive FIFO first. Return the number of received messages that we had to discard because we had no buffers.
+static unsigned int ChangeDataTiming(const DataBitTiming& timing, bool enableBitRateSwitch)
+{
+	constexpr uint32_t MaxTransmitWaitMillis = 20;
+
+	MutexLocker lock(canSendMutex);
+	const uint32_t startTime = millis();
+	while (IsCanTransmitPending(&CAN_0) && millis() - startTime < MaxTransmitWaitMillis)
+	{
+		delay(1);
+	}
+
+	StopLocalCan(&CAN_0);
+	CanMessageBuffer *receivedMessages = nullptr;
+	CanMessageBuffer *lastReceivedMessage = nullptr;
+	unsigned int numLost = 0;
+	{
+		TaskCriticalSectionLocker lock2;					// stop the receiver task reading the FIFO at the same time
+		for (;;)
+		{
+			CanMessageBuffer * const buf = CanMessageBuffer::Allocate();
+			uint8_t discard[64];
+			can_message msg;
+			msg.data = (buf != nullptr) ? reinterpret_cast<uint8_t*>(&(buf->msg)) : discard;
+			if (can_async_read(&CAN_0, &msg) != ERR_NONE)
+			{
+				if (buf != nullptr)
+				{
+					CanMessageBuffer::Free(buf);
+				}
+				break;
+			}
+			if (buf == nullptr)
+			{
+				++numLost;
+			}
+			else
+			{
+				buf->dataLength = msg.len;
+				buf->id.SetReceivedId(msg.id);
+				buf->next = nullptr;
+				if (receivedMessages == nullptr)
+				{
+					receivedMessages = buf;
+				}
+				else
+				{
+					lastReceivedMessage->next = buf;
+				}
+				lastReceivedMessage = buf;
+			}
+		}
+	}
+
+	// Process the messages while the controller is still stopped, so that none that arrive later can overtake them
+	while (receivedMessages != nullptr)
+	{
+		CanMessageBuffer * const buf = receivedMessages;
+		receivedMessages = buf->next;
+		if (enabled)
+		{
+			CanInterface::ProcessReceivedMessage(buf);
+		}
+		else
+		{
+			CanMessageBuffer::Free(buf);
+		}
+	}
+
+	dataPhaseMessagesRequeued += SetLocalCanDataTiming(&CAN_0, timing, enableBitRateSwitch);
+	dataPhaseMessagesLost += numLost;
+
+	return numLost;
+}
+
+// Process a request from the main board to change the CAN-FD data phase timing.
+// We don't store the data phase timing in NVM, because after we restart we need to be able to hear the main board ask us to use it again.
+GCodeResult CanInterface::SetDataPhaseTiming(const CanMessageSetDataPhaseTiming& msg, const StringRef& reply)
+{
+	switch (msg.mode)
+	{
+	case CanMessageSetDataPhaseTiming::ModeReport:
+		reply.printf("Board %u CAN data phase: ", boardAddress);
+		AppendDataPhaseDetails(reply);
+		return (dataPhaseTrial.GetLastResult() == DataPhaseTrial::Result::failed && !dataPhaseTrial.IsRunning()) ? GCodeResult::warning : GCodeResult::ok;
+
+	case CanMessageSetDataPhaseTiming::ModeTry:
+		{
+			DataBitTiming newTiming;
+			if (!newTiming.Calculate(msg.dataTiming))
+			{
+				reply.printf("Board %u does not support the requested CAN data phase timing", boardAddress);
+				return GCodeResult::error;
+			}
+
+			DataBitTiming currentTiming;
+			const bool currentBitRateSwitch = GetLocalCanDataTiming(&CAN_0, currentTiming);
+			const unsigned int numLost = ChangeDataTiming(newTiming, true);
+			(void)GetAndClearCanErrorCount(&CAN_0);
+			dataPhaseTrial.Start(millis(), msg.trialMillis, msg.maxErrors, newTiming, currentTiming, currentBitRateSwitch);
+			reply.printf("Board %u trying CAN data phase rate %.2fMbps", boardAddress, (double)((float)newTiming.GetBitRate() * 1.0e-6));
+			if (numLost != 0)
+			{
+				reply.catf(", %u received messages lost", numLost);
+				return GCodeResult::warning;
+			}
+		}
+		return GCodeResult::ok;
+
+	case CanMessageSetDataPhaseTiming::ModeDisable:
+		{
+			dataPhaseTrial.Cancel();
+			DataBitTiming timing;
+			(void)GetLocalCanDataTiming(&CAN_0, timing);
+			const unsigned int numLost = ChangeDataTiming(timing, false);
+			reply.printf("Board %u CAN bit rate switching disabled", boardAddress);
+			if (numLost != 0)
+			{
+				reply.catf(", %u received messages lost", numLost);
+				return GCodeResult::warning;
+			}
+		}
+		return GCodeResult::ok;
+
+	default:
+		reply.printf("Bad CAN data phase timing mode %u", msg.mode);
+		return GCodeResult::error;
+	}
+}
+
 // End
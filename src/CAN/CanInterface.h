@@ -14,6 +14,7 @@
 #include <GCodes/GCodeResult.h>
 
 struct CanMessageMovement;
+struct CanMessageSetDataPhaseTiming;
 class CanMessageBuffer;
 
 namespace CanInterface
@@ -21,13 +22,17 @@ namespace CanInterface
 	void Init(CanAddress defaultBoardAddress);
 	void Shutdown();
 	void Diagnostics(const StringRef& reply);
+	void Spin();
 
 	CanAddress GetCanAddress();
 	GCodeResult ChangeAddressAndDataRate(const CanMessageSetAddressAndNormalTiming& msg, const StringRef& reply);
+	GCodeResult SetDataPhaseTiming(const CanMessageSetDataPhaseTiming& msg, const StringRef& reply);
 	bool GetCanMove(CanMessageMovement& move);
+	uint32_t GetMovesReceivedBeforeM669();
 	bool Send(CanMessageBuffer *buf);
 	bool SendAsync(CanMessageBuffer *buf);
 	bool SendAndFree(CanMessageBuffer *buf);
+	void QueueResponse(CanMessageBuffer *buf);
 	CanMessageBuffer *GetCanCommand();
 
 	void SendAnnounce(CanMessageBuffer *buf);
@@ -0,0 +1,34 @@
+/*
+ * CanMainBoardCapabilitiesMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used by the main board to tell us which optional message formats it understands.
+ *  The corresponding message type is CanMessageType::mainBoardCapabilities.
+ *  Main board firmware that doesn't send this message only understands the original formats, so all the capability bits default to off.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANMAINBOARDCAPABILITIESMESSAGES_H_
+#define SRC_CAN_CANMAINBOARDCAPABILITIESMESSAGES_H_
+
+#include <cstdint>
+#include <CanId.h>
+
+struct __attribute__((packed)) CanMessageMainBoardCapabilities
+{
+	static constexpr CanMessageType messageType = CanMessageType::mainBoardCapabilities;
+
+	static constexpr uint32_t CapabilityMultipleStandardReplies = 1u << 0;	// the main board can unpack a multipleStandardReplies message
+
+	void SetRequestId(CanRequestId rid) { requestId = rid; zero = 0; }
+
+	uint16_t requestId : 12,
+			 zero : 4;
+	uint16_t zero2;
+	uint32_t capabilities;								// bitmap of the Capability values above
+};
+
+static_assert(sizeof(CanMessageMainBoardCapabilities) <= 64, "Message too long");
+
+#endif /* SRC_CAN_CANMAINBOARDCAPABILITIESMESSAGES_H_ */
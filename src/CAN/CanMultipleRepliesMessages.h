@@ -0,0 +1,57 @@
+/*
+ * CanMultipleRepliesMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used to send several short standard replies to the same board in a single CAN-FD frame.
+ *  The corresponding message type is CanMessageType::multipleStandardReplies.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANMULTIPLEREPLIESMESSAGES_H_
+#define SRC_CAN_CANMULTIPLEREPLIESMESSAGES_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <CanId.h>
+
+// Each reply in the message is an entry header followed by the reply text, which is not null terminated and never fragmented
+struct __attribute__((packed)) CanReplyEntryHeader
+{
+	uint16_t requestId;								// the request ID of the request that this is the reply to
+	uint8_t resultCode;								// a GCodeResult
+	uint8_t extra;									// as for the 'extra' field in a standard reply
+	uint8_t textLength;
+};
+
+struct __attribute__((packed)) CanMessageMultipleStandardReplies
+{
+	static constexpr CanMessageType messageType = CanMessageType::multipleStandardReplies;
+	static constexpr size_t MaxDataLength = 60;
+
+	void SetRequestId(CanRequestId rid) { requestId = rid; zero = 0; }
+
+	uint16_t requestId : 12,						// not used, always CanRequestIdAcceptAlways
+			 zero : 4;
+	uint8_t numReplies;
+	uint8_t zero2;
+	uint8_t data[MaxDataLength];					// the entries, packed one after another
+
+	static constexpr size_t GetEntryLength(size_t textLength) { return sizeof(CanReplyEntryHeader) + textLength; }
+	static constexpr size_t GetActualDataLength(size_t dataUsed) { return 4 + dataUsed; }
+
+	// Append a reply at the specified offset in the data. The caller must check that there is room for it.
+	size_t AddEntry(size_t offset, uint16_t rid, uint8_t rslt, uint8_t ext, const char *text, size_t textLength)
+	{
+		const CanReplyEntryHeader hdr = { rid, rslt, ext, (uint8_t)textLength };
+		memcpy(data + offset, &hdr, sizeof(hdr));
+		memcpy(data + offset + sizeof(hdr), text, textLength);
+		++numReplies;
+		return offset + GetEntryLength(textLength);
+	}
+};
+
+static_assert(sizeof(CanMessageMultipleStandardReplies) == 64, "Message has wrong length");
+
+#endif /* SRC_CAN_CANMULTIPLEREPLIESMESSAGES_H_ */
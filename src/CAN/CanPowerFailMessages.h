@@ -0,0 +1,37 @@
+/*
+ * CanPowerFailMessages.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Message format used to tell the main board that we detected a power failure and froze the steps, so that it can save the position to resume from.
+ *  The corresponding message type is CanMessageType::powerFailEvent.
+ *  These definitions must be kept in step with the versions in the main board firmware.
+ */
+
+#ifndef SRC_CAN_CANPOWERFAILMESSAGES_H_
+#define SRC_CAN_CANPOWERFAILMESSAGES_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <CanId.h>
+
+struct __attribute__((packed)) CanMessagePowerFailEvent
+{
+	static constexpr CanMessageType messageType = CanMessageType::powerFailEvent;
+	static constexpr size_t MaxDrivers = 12;
+
+	static constexpr uint8_t CauseVin = 0x01;			// VIN fell below the power fail threshold
+	static constexpr uint8_t CauseV12 = 0x02;			// V12 fell below the driver under-voltage threshold
+
+	uint32_t whenDetected;								// the master step clock time of the reading that fell below the threshold
+	uint8_t cause;
+	uint8_t numDrivers;
+	uint16_t zero;
+	int32_t positions[MaxDrivers];						// the microstep position of each driver after we froze the steps
+
+	size_t GetActualDataLength() const { return 8 + numDrivers * sizeof(positions[0]); }
+};
+
+static_assert(sizeof(CanMessagePowerFailEvent) <= 64, "Message is too long");
+
+#endif /* SRC_CAN_CANPOWERFAILMESSAGES_H_ */
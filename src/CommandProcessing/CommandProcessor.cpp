@@ -6,6 +6,7 @@
  */
 
 #include "CommandProcessor.h"
+#include "ReplySender.h"
 #include <CAN/CanInterface.h>
 #include "CanMessageBuffer.h"
 #include "GCodes/GCodeResult.h"
@@ -17,6 +18,11 @@
 #include <Platform.h>
 #include <Movement/Move.h>
 #include <Tasks.h>
+#include <EventLog.h>
+#include <FirmwareUpdater.h>
+#include <CAN/CanFirmwareStreamMessages.h>
+#include <CAN/CanDataPhaseTimingMessages.h>
+#include <CAN/CanMainBoardCapabilitiesMessages.h>
 #include <Version.h>
 #include <Hardware/AnalogIn.h>
 #include <hpl_user_area.h>
@@ -31,6 +37,17 @@
 #if SUPPORT_CLOSED_LOOP
 # include <ClosedLoop/ClosedLoop.h>
 #endif
+#if SUPPORT_DRIVER_TELEMETRY
+# include "Movement/StepperDrivers/DriverTelemetry.h"
+#endif
+#if SUPPORT_STALL_CALIBRATION
+# include "Movement/StepperDrivers/StallCalibrator.h"
+#endif
+#if SUPPORT_HARDWARE_TACHO
+# include "Fans/HardwareTacho.h"
+#endif
+
+constexpr unsigned int MaxRequestsPerSpin = 16;
 
 constexpr float MinVin = 11.0;
 constexpr float MaxVin = 32.0;
@@ -509,6 +526,77 @@ static GCodeResult ProcessM915(const CanMessageGeneric& msg, const StringRef& re
 #endif
 }
 
+#if SUPPORT_STALL_CALIBRATION
+
+// Calibrate the stall detection of a driver. The main board commands the moves at a range of speeds while we collect the StallGuard results.
+// S1 starts collecting results, S2 stops collecting and applies the recommended settings, and S0 or no S parameter stops collecting and reports the results.
+static GCodeResult ProcessStallCalibration(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, StallCalibrationParams);
+	uint8_t driver;
+	if (!parser.GetUintParam('P', driver))
+	{
+		reply.copy("missing parameter in stall calibration message");
+		return GCodeResult::error;
+	}
+	if (driver >= NumDrivers)
+	{
+		reply.printf("Driver number %u.%u out of range", CanInterface::GetCanAddress(), driver);
+		return GCodeResult::error;
+	}
+
+	uint8_t action = 0;
+	parser.GetUintParam('S', action);
+	if (action == 1)
+	{
+		SmartDrivers::StartStallCalibration(driver);
+		reply.printf("Driver %u.%u stall calibration started, current threshold %d",
+						CanInterface::GetCanAddress(), driver, SmartDrivers::GetStallThreshold(driver));
+		return GCodeResult::ok;
+	}
+
+	if (!SmartDrivers::IsCalibratingStall(driver))
+	{
+		reply.printf("Driver %u.%u stall calibration not started", CanInterface::GetCanAddress(), driver);
+		return GCodeResult::error;
+	}
+
+	const StallCalibrator& calibrator = SmartDrivers::StopStallCalibration();
+	int8_t currentThresholds[StallCalibrator::NumSpeedBands];
+	SmartDrivers::GetStallThresholds(driver, currentThresholds);
+	StallRecommendation rec;
+	const bool ok = calibrator.Calculate(currentThresholds, rec);
+	reply.printf("Driver %u.%u stall calibration:", CanInterface::GetCanAddress(), driver);
+	for (size_t band = 0; band < StallCalibrator::NumSpeedBands; ++band)
+	{
+		const uint32_t numSamples = calibrator.GetNumSamples(band);
+		if (numSamples != 0)
+		{
+			reply.lcatf("%" PRIu32 " steps/sec: samples %" PRIu32 ", SG min/p10/max %" PRIu32 "/%" PRIu32 "/%" PRIu32 ", threshold %d%s",
+						StallCalibrator::GetBandLowerLimit(band), numSamples,
+						calibrator.GetMinResult(band), calibrator.GetLowPercentileResult(band), calibrator.GetMaxResult(band),
+						rec.thresholds[band], (rec.bandUsable[band]) ? "" : " (unreliable)");
+		}
+	}
+
+	if (!ok)
+	{
+		reply.lcat("Not enough data for a recommendation");
+		return (action == 0) ? GCodeResult::warning : GCodeResult::error;
+	}
+
+	reply.lcatf("Recommended threshold %d, minimum steps/sec %u", rec.overallThreshold, rec.minimumStepsPerSecond);
+	if (action == 2)
+	{
+		SmartDrivers::SetStallThresholdTable(driver, rec.thresholds);
+		SmartDrivers::SetStallMinimumStepsPerSecond(driver, rec.minimumStepsPerSecond);
+		reply.cat(", speed-dependent thresholds applied");
+	}
+	return GCodeResult::ok;
+}
+
+#endif
+
 static GCodeResult InitiateFirmwareUpdate(const CanMessageUpdateYourFirmware& msg, const StringRef& reply)
 {
 	if (msg.boardId != CanInterface::GetCanAddress() || msg.invertedBoardId != (uint8_t)~CanInterface::GetCanAddress())
@@ -571,6 +659,10 @@ static GCodeResult GetInfo(const CanMessageReturnInfo& msg, const StringRef& rep
 		{
 			GenerateTestReport(reply);
 		}
+		else if (msg.param == 2)
+		{
+			return EventLog::Report(reply);
+		}
 		else
 		{
 			extra = LastDiagnosticsPart;
@@ -617,6 +709,17 @@ static GCodeResult GetInfo(const CanMessageReturnInfo& msg, const StringRef& rep
 		extra = LastDiagnosticsPart;
 		Heat::Diagnostics(reply);
 		CanInterface::Diagnostics(reply);
+		ReplySender::Diagnostics(reply);
+#if SUPPORT_DRIVER_TELEMETRY
+		DriverTelemetry::Diagnostics(reply);
+#endif
+#if SUPPORT_HARDWARE_TACHO
+		HardwareTacho::Diagnostics(reply);
+#endif
+		EventLog::Diagnostics(reply);
+#if SAME5x
+		FirmwareUpdater::Diagnostics(reply);
+#endif
 		{
 			uint32_t nvmUserRow0 = *reinterpret_cast<const uint32_t*>(NVMCTRL_USER);
 			uint32_t nvmUserRow1 = *reinterpret_cast<const uint32_t*>(NVMCTRL_USER+4);
@@ -644,11 +747,18 @@ static GCodeResult GetInfo(const CanMessageReturnInfo& msg, const StringRef& rep
 	return GCodeResult::ok;
 }
 
+// Process all the requests that are waiting, up to a limit so that the other jobs in the main loop still get done.
+// The replies are queued for sending by another task, so we don't wait for them to be transmitted.
 void CommandProcessor::Spin()
 {
-	CanMessageBuffer *buf = CanInterface::GetCanCommand();
-	if (buf != nullptr)
+	for (unsigned int numProcessed = 0; numProcessed < MaxRequestsPerSpin; ++numProcessed)
 	{
+		CanMessageBuffer *buf = CanInterface::GetCanCommand();
+		if (buf == nullptr)
+		{
+			break;
+		}
+
 		Platform::OnProcessingCanMessage();
 		String<FormatStringLength> reply;
 		const StringRef& replyRef = reply.GetRef();
@@ -699,6 +809,16 @@ void CommandProcessor::Spin()
 			rslt = GpioPorts::HandleGpioWrite(buf->msg.writeGpio, replyRef);
 			break;
 
+		case CanMessageType::writeGpioMultiple:
+			requestId = buf->msg.generic.requestId;
+			rslt = GpioPorts::HandleGpioWriteMultiple(buf->msg.generic, replyRef);
+			break;
+
+		case CanMessageType::servoMove:
+			requestId = buf->msg.generic.requestId;
+			rslt = GpioPorts::HandleServoMove(buf->msg.generic, replyRef);
+			break;
+
 		case CanMessageType::setMotorCurrents:
 			requestId = buf->msg.multipleDrivesRequest.requestId;
 			rslt = SetMotorCurrents(buf->msg.multipleDrivesRequest, replyRef);
@@ -709,6 +829,43 @@ void CommandProcessor::Spin()
 			rslt = ProcessM569(buf->msg.generic, replyRef);
 			break;
 
+		case CanMessageType::m669:
+			requestId = buf->msg.generic.requestId;
+			rslt = moveInstance->ProcessM669(buf->msg.generic, replyRef);
+			break;
+
+		case CanMessageType::driverTelemetry:
+			requestId = buf->msg.generic.requestId;
+#if SUPPORT_DRIVER_TELEMETRY
+			rslt = DriverTelemetry::Configure(buf->msg.generic, replyRef);
+#else
+			rslt = GCodeResult::errorNotSupported;
+#endif
+			break;
+
+		case CanMessageType::m593:
+			requestId = buf->msg.generic.requestId;
+#if SUPPORT_INPUT_SHAPING
+			rslt = moveInstance->ProcessM593(buf->msg.generic, replyRef);
+#else
+			rslt = GCodeResult::errorNotSupported;
+#endif
+			break;
+
+		case CanMessageType::powerFailConfig:
+			requestId = buf->msg.generic.requestId;
+#if SUPPORT_POWER_FAIL_DETECTION
+			rslt = Platform::ConfigurePowerFail(buf->msg.generic, replyRef);
+#else
+			rslt = GCodeResult::errorNotSupported;
+#endif
+			break;
+
+		case CanMessageType::babystep:
+			requestId = buf->msg.generic.requestId;
+			rslt = moveInstance->ProcessBabystep(buf->msg.generic, replyRef);
+			break;
+
 		case CanMessageType::m569p1:
 			requestId = buf->msg.generic.requestId;
 #if SUPPORT_CLOSED_LOOP
@@ -748,6 +905,11 @@ void CommandProcessor::Spin()
 			rslt = FansManager::SetFanSpeed(buf->msg.setFanSpeed, replyRef);
 			break;
 
+		case CanMessageType::fanTachoParameters:
+			requestId = buf->msg.generic.requestId;
+			rslt = FansManager::ConfigureTachoMonitoring(buf->msg.generic, replyRef);
+			break;
+
 		case CanMessageType::setHeaterFaultDetection:
 			requestId = buf->msg.setHeaterFaultDetection.requestId;
 			rslt = Heat::SetFaultDetection(buf->msg.setHeaterFaultDetection, replyRef);
@@ -768,6 +930,15 @@ void CommandProcessor::Spin()
 			rslt = ProcessM915(buf->msg.generic, replyRef);
 			break;
 
+		case CanMessageType::stallCalibration:
+			requestId = buf->msg.generic.requestId;
+#if SUPPORT_STALL_CALIBRATION
+			rslt = ProcessStallCalibration(buf->msg.generic, replyRef);
+#else
+			rslt = GCodeResult::errorNotSupported;
+#endif
+			break;
+
 		case CanMessageType::setPressureAdvance:
 			requestId = buf->msg.multipleDrivesRequest.requestId;
 			rslt = HandlePressureAdvance(buf->msg.multipleDrivesRequest, replyRef);
@@ -788,18 +959,46 @@ void CommandProcessor::Spin()
 			rslt = CanInterface::ChangeAddressAndDataRate(buf->msg.setAddressAndNormalTiming, replyRef);
 			break;
 
-#if 0
-		case CanMessageType::setFastTiming:
-			requestId = buf->msg.setFastTiming.requestId;
-			rslt = CanInterface::SetFastTiming(buf->msg.setFastTiming, replyRef);
+		case CanMessageType::setDataPhaseTiming:
+			{
+				const CanMessageSetDataPhaseTiming& msg = reinterpret_cast<const CanMessageSetDataPhaseTiming&>(buf->msg);
+				requestId = msg.requestId;
+				rslt = CanInterface::SetDataPhaseTiming(msg, replyRef);
+			}
+			break;
+
+		case CanMessageType::mainBoardCapabilities:
+			{
+				const CanMessageMainBoardCapabilities& msg = reinterpret_cast<const CanMessageMainBoardCapabilities&>(buf->msg);
+				requestId = msg.requestId;
+				ReplySender::SetMainBoardCapabilities(msg.capabilities);
+				rslt = GCodeResult::ok;
+			}
 			break;
-#endif
 
 		case CanMessageType::diagnosticTest:
 			requestId = buf->msg.diagnosticTest.requestId;
 			rslt = Platform::DoDiagnosticTest(buf->msg.diagnosticTest, replyRef);
 			break;
 
+#if SAME5x
+		case CanMessageType::firmwareStreamStart:
+			{
+				const CanMessageFirmwareStreamStart& msg = reinterpret_cast<const CanMessageFirmwareStreamStart&>(buf->msg);
+				requestId = msg.requestId;
+				rslt = FirmwareUpdater::Start(msg, replyRef);
+			}
+			break;
+
+		case CanMessageType::firmwareStreamCommit:
+			{
+				const CanMessageFirmwareStreamCommit& msg = reinterpret_cast<const CanMessageFirmwareStreamCommit&>(buf->msg);
+				requestId = msg.requestId;
+				rslt = FirmwareUpdater::Commit(msg, replyRef);
+			}
+			break;
+#endif
+
 		default:
 			requestId = CanRequestIdAcceptAlways;
 			reply.printf("Board %u received unknown msg type %u", CanInterface::GetCanAddress(), (unsigned int)buf->id.MsgType());
@@ -807,37 +1006,11 @@ void CommandProcessor::Spin()
 			break;
 		}
 
-		// Re-use the message buffer to send a standard reply
-		const CanAddress srcAddress = buf->id.Src();
-		CanMessageStandardReply *msg = buf->SetupResponseMessage<CanMessageStandardReply>(requestId, CanInterface::GetCanAddress(), srcAddress);
-		msg->resultCode = (uint16_t)rslt;
-		msg->extra = extra;
-		const size_t totalLength = reply.strlen();
-		size_t lengthDone = 0;
-		uint8_t fragmentNumber = 0;
-		for (;;)
-		{
-			size_t fragmentLength = min<size_t>(totalLength - lengthDone, CanMessageStandardReply::MaxTextLength);
-			memcpy(msg->text, reply.c_str() + lengthDone, fragmentLength);
-			lengthDone += fragmentLength;
-			if (fragmentLength < ARRAY_SIZE(msg->text))
-			{
-				msg->text[fragmentLength] = 0;
-				++fragmentLength;
-			}
-			buf->dataLength = msg->GetActualDataLength(fragmentLength);
-			msg->fragmentNumber = fragmentNumber;
-			if (lengthDone == totalLength)
-			{
-				msg->moreFollows = false;
-				CanInterface::SendAndFree(buf);
-				break;
-			}
-			msg->moreFollows = true;
-			CanInterface::Send(buf);
-			++fragmentNumber;
-		}
+		// Re-use the message buffer to send the reply
+		ReplySender::AddReply(buf, buf->id.Src(), requestId, rslt, extra, replyRef);
 	}
+
+	ReplySender::FlushReplies();
 }
 
 // End
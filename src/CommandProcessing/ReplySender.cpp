@@ -0,0 +1,153 @@
+/*
+ * ReplySender.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "ReplySender.h"
+#include <CAN/CanInterface.h>
+#include "CanMessageBuffer.h"
+#include <CAN/CanMultipleRepliesMessages.h>
+#include <CAN/CanMainBoardCapabilitiesMessages.h>
+
+// The longest reply is a FormatStringLength string, so this is the most fragments we ever need
+constexpr size_t MaxFragments = (FormatStringLength + CanMessageStandardReply::MaxTextLength - 1)/CanMessageStandardReply::MaxTextLength;
+
+static uint32_t numTruncatedReplies = 0;
+
+// Send a standard reply, splitting the text into fragments if necessary. The buffer is queued for sending, so the caller must not use it again.
+// We get the buffers for all the fragments before we queue any of them, so we never wait for a buffer part way through a reply.
+// If we can't get enough buffers, we send as much of the reply as fits in the buffers that we did get, ending with "..." to show that it was cut short.
+static void SendStandardReply(CanMessageBuffer *buf, CanAddress dest, CanRequestId requestId, GCodeResult rslt, uint8_t extra, const char *text, size_t totalLength)
+{
+	CanMessageBuffer *buffers[MaxFragments];
+	buffers[0] = buf;
+	size_t numFragments = 1;
+	const size_t fragmentsNeeded = min<size_t>((totalLength + CanMessageStandardReply::MaxTextLength - 1)/CanMessageStandardReply::MaxTextLength, MaxFragments);
+	while (numFragments < fragmentsNeeded)
+	{
+		CanMessageBuffer * const nextBuf = CanMessageBuffer::Allocate();
+		if (nextBuf == nullptr)
+		{
+			break;
+		}
+		buffers[numFragments++] = nextBuf;
+	}
+
+	const size_t lengthToSend = min<size_t>(totalLength, numFragments * CanMessageStandardReply::MaxTextLength);
+	const bool truncated = (lengthToSend < totalLength);
+	if (truncated)
+	{
+		++numTruncatedReplies;
+	}
+
+	size_t lengthDone = 0;
+	for (size_t fragmentNumber = 0; fragmentNumber < numFragments; ++fragmentNumber)
+	{
+		CanMessageBuffer * const fragmentBuf = buffers[fragmentNumber];
+		CanMessageStandardReply *msg = fragmentBuf->SetupResponseMessage<CanMessageStandardReply>(requestId, CanInterface::GetCanAddress(), dest);
+		msg->resultCode = (uint16_t)rslt;
+		msg->extra = extra;
+		size_t fragmentLength = min<size_t>(lengthToSend - lengthDone, CanMessageStandardReply::MaxTextLength);
+		memcpy(msg->text, text + lengthDone, fragmentLength);
+		lengthDone += fragmentLength;
+		if (truncated && lengthDone == lengthToSend)
+		{
+			memcpy(msg->text + fragmentLength - 3, "...", 3);
+		}
+		if (fragmentLength < ARRAY_SIZE(msg->text))
+		{
+			msg->text[fragmentLength] = 0;
+			++fragmentLength;
+		}
+		fragmentBuf->dataLength = msg->GetActualDataLength(fragmentLength);
+		msg->fragmentNumber = fragmentNumber;
+		msg->moreFollows = (lengthDone != lengthToSend);
+		CanInterface::QueueResponse(fragmentBuf);
+	}
+}
+
+// Short replies to the same board that are ready at the same time are packed into a single message, to save bus time and buffers.
+// This is typically the case when the main board sends us a burst of configuration commands.
+// We only do this if the main board has told us that it can unpack the message.
+static uint32_t mainBoardCapabilities = 0;					// the CanMessageMainBoardCapabilities bits that the main board last sent us
+static CanMessageBuffer *coalesceBuf = nullptr;				// the buffer that we are packing replies into
+static CanAddress coalesceDest;
+static size_t coalescedLength;								// how much of the data in the packed message we have used
+static uint32_t numRepliesCoalesced = 0, numPackedMessages = 0;
+
+void ReplySender::SetMainBoardCapabilities(uint32_t capabilities)
+{
+	mainBoardCapabilities = capabilities;
+}
+
+// Send any replies that we have been holding on to
+void ReplySender::FlushReplies()
+{
+	if (coalesceBuf != nullptr)
+	{
+		CanMessageMultipleStandardReplies * const msg = reinterpret_cast<CanMessageMultipleStandardReplies*>(&coalesceBuf->msg);
+		if (msg->numReplies == 1)
+		{
+			// Only one reply, so send it in the standard format
+			CanReplyEntryHeader hdr;
+			memcpy(&hdr, msg->data, sizeof(hdr));
+			char text[CanMessageMultipleStandardReplies::MaxDataLength];
+			memcpy(text, msg->data + sizeof(hdr), hdr.textLength);
+			SendStandardReply(coalesceBuf, coalesceDest, hdr.requestId, (GCodeResult)hdr.resultCode, hdr.extra, text, hdr.textLength);
+		}
+		else
+		{
+			numRepliesCoalesced += msg->numReplies;
+			++numPackedMessages;
+			coalesceBuf->dataLength = msg->GetActualDataLength(coalescedLength);
+			CanInterface::QueueResponse(coalesceBuf);
+		}
+		coalesceBuf = nullptr;
+	}
+}
+
+// Send a reply, or hold on to it so that we can pack it with the replies to the following requests. The buffer is re-used or freed.
+void ReplySender::AddReply(CanMessageBuffer *buf, CanAddress dest, CanRequestId requestId, GCodeResult rslt, uint8_t extra, const StringRef& reply)
+{
+	const size_t textLength = reply.strlen();
+	const size_t entryLength = CanMessageMultipleStandardReplies::GetEntryLength(textLength);
+	if (   (mainBoardCapabilities & CanMessageMainBoardCapabilities::CapabilityMultipleStandardReplies) == 0
+		|| entryLength > CanMessageMultipleStandardReplies::MaxDataLength
+	   )
+	{
+		FlushReplies();												// keep the replies in order
+		SendStandardReply(buf, dest, requestId, rslt, extra, reply.c_str(), textLength);
+		return;
+	}
+
+	if (coalesceBuf != nullptr && (dest != coalesceDest || coalescedLength + entryLength > CanMessageMultipleStandardReplies::MaxDataLength))
+	{
+		FlushReplies();
+	}
+
+	CanMessageMultipleStandardReplies *msg;
+	if (coalesceBuf == nullptr)
+	{
+		coalesceBuf = buf;
+		coalesceDest = dest;
+		coalescedLength = 0;
+		msg = buf->SetupResponseMessage<CanMessageMultipleStandardReplies>(CanRequestIdAcceptAlways, CanInterface::GetCanAddress(), dest);
+		msg->numReplies = 0;
+		msg->zero2 = 0;
+	}
+	else
+	{
+		CanMessageBuffer::Free(buf);
+		msg = reinterpret_cast<CanMessageMultipleStandardReplies*>(&coalesceBuf->msg);
+	}
+	coalescedLength = msg->AddEntry(coalescedLength, requestId, (uint8_t)rslt, extra, reply.c_str(), textLength);
+}
+
+void ReplySender::Diagnostics(const StringRef& reply)
+{
+	reply.lcatf("Replies packed %" PRIu32 " into %" PRIu32 " messages, truncated for lack of buffers %" PRIu32,
+					numRepliesCoalesced, numPackedMessages, numTruncatedReplies);
+}
+
+// End
@@ -0,0 +1,27 @@
+/*
+ * ReplySender.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Sends the replies to the requests that the command processor has processed. Long replies are split into fragments, and short replies
+ *  to the same board are packed into a single message if the main board has told us that it can unpack them.
+ */
+
+#ifndef SRC_COMMANDPROCESSING_REPLYSENDER_H_
+#define SRC_COMMANDPROCESSING_REPLYSENDER_H_
+
+#include "RepRapFirmware.h"
+#include "GCodes/GCodeResult.h"
+#include <CanId.h>
+
+class CanMessageBuffer;
+
+namespace ReplySender
+{
+	void SetMainBoardCapabilities(uint32_t capabilities);
+	void AddReply(CanMessageBuffer *buf, CanAddress dest, CanRequestId requestId, GCodeResult rslt, uint8_t extra, const StringRef& reply);
+	void FlushReplies();
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif /* SRC_COMMANDPROCESSING_REPLYSENDER_H_ */
@@ -38,6 +38,52 @@ constexpr float DefaultThermistorC = 0.0;
 # define SUPPORT_CLOSED_LOOP		0
 #endif
 
+#ifndef SUPPORT_INPUT_SHAPING
+# define SUPPORT_INPUT_SHAPING		0
+#endif
+
+#ifndef SUPPORT_STEP_TIME_BUFFER
+# define SUPPORT_STEP_TIME_BUFFER	0
+#endif
+
+#ifndef SUPPORT_DRIVER_TELEMETRY
+# define SUPPORT_DRIVER_TELEMETRY	0
+#endif
+
+#ifndef SUPPORT_STALL_CALIBRATION
+# define SUPPORT_STALL_CALIBRATION	0
+#endif
+
+#ifndef SUPPORT_HARDWARE_STEP_GENERATION
+# define SUPPORT_HARDWARE_STEP_GENERATION	0
+#endif
+
+#ifndef SUPPORT_HARDWARE_TACHO
+# define SUPPORT_HARDWARE_TACHO			0
+#endif
+
+#ifndef SUPPORT_INPUT_SCANNER
+# define SUPPORT_INPUT_SCANNER			0
+#endif
+
+// Power fail detection compares the raw VIN and V12 readings with thresholds in the ADC DMA completion interrupt, which only the SAME5x ADC driver supports.
+// The SAMC21 boards don't support it. The freeze comes at the end of the first ADC sequence with a reading below the threshold, about 3.4ms on the EXP3HC.
+#ifndef SUPPORT_POWER_FAIL_DETECTION
+# define SUPPORT_POWER_FAIL_DETECTION	0
+#endif
+
+#ifndef SUPPORT_FIXED_POINT_PREPARE
+# define SUPPORT_FIXED_POINT_PREPARE	0
+#endif
+
+#if SUPPORT_FIXED_POINT_PREPARE && SUPPORT_INPUT_SHAPING
+# error Input shaping needs the floating point move parameters, so it can't be used with fixed point move preparation
+#endif
+
+#if SUPPORT_POWER_FAIL_DETECTION && !(SAME5x && HAS_VOLTAGE_MONITOR && SUPPORT_DRIVER_TELEMETRY)
+# error Power fail detection needs the SAME5x ADC driver, a VIN monitor and the driver positions kept for telemetry
+#endif
+
 constexpr float DefaultMinFanPwm = 0.1;					// minimum fan PWM
 constexpr uint32_t DefaultFanBlipTime = 100;			// fan blip time in milliseconds
 
@@ -35,6 +35,7 @@ constexpr const char* BoardTypeName = "EXP1HCE";
 #define SUPPORT_CLOSED_LOOP		1
 
 constexpr size_t NumDrivers = 1;
+constexpr size_t MoveQueueRamBudget = 3584;		// bytes of RAM for the move queue, from which the DDA ring length and the number of DMs are calculated
 constexpr size_t MaxSmartDrivers = 1;
 constexpr float MaxTmc5160Current = 6300.0;			// The maximum current we allow the TMC5160/5161 drivers to be set to
 
@@ -60,6 +61,7 @@ constexpr Pin DiagPins[NumDrivers] = { PortAPin(28) };
 #define SINGLE_DRIVER			1
 #define SUPPORT_SLOW_DRIVERS	0
 #define SUPPORT_DELTA_MOVEMENT	1
+#define SUPPORT_FIXED_POINT_PREPARE	1		// no FPU, so prepare Cartesian and extruder moves using integer arithmetic
 #define USE_EVEN_STEPS			1
 #define SUPPORT_SPI_SENSORS		0
 #define SUPPORT_DHT_SENSOR		0
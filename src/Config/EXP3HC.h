@@ -32,14 +32,23 @@ constexpr const char* BoardTypeName = "EXP3HC";
 #define SINGLE_DRIVER			0
 #define SUPPORT_SLOW_DRIVERS	0
 #define SUPPORT_DELTA_MOVEMENT	1
+#define SUPPORT_INPUT_SHAPING	1
+#define SUPPORT_STEP_TIME_BUFFER	1
+#define SUPPORT_DRIVER_TELEMETRY	1
+#define SUPPORT_STALL_CALIBRATION	1
+#define SUPPORT_HARDWARE_STEP_GENERATION	0	// set to 1 to generate the steps for HardwareStepDriver from the step timer
+#define SUPPORT_HARDWARE_TACHO	1
 #define USE_EVEN_STEPS			0
 #define SUPPORT_DHT_SENSOR		0	//TEMP!!!
 #define SUPPORT_SPI_SENSORS		1
+#define SUPPORT_INPUT_SCANNER	1
+#define SUPPORT_POWER_FAIL_DETECTION	1
 
 #define USE_MPU					0
 #define USE_CACHE				1
 
 constexpr size_t NumDrivers = 3;
+constexpr size_t MoveQueueRamBudget = 48 * 1024;		// bytes of RAM for the move queue, from which the DDA ring length and the number of DMs are calculated
 constexpr size_t MaxSmartDrivers = 3;
 constexpr float MaxTmc5160Current = 6300.0;			// The maximum current we allow the TMC5160/5161 drivers to be set to
 
@@ -216,6 +225,21 @@ constexpr IRQn StepTcIRQn = TC6_IRQn;
 constexpr unsigned int StepTcNumber = 6;
 #define STEP_TC_HANDLER		TC6_Handler
 
+#if SUPPORT_HARDWARE_STEP_GENERATION
+// Hardware step generation. The driver is stepped on both edges of the step signal, so it can't be stepped by the step ISR as well.
+constexpr size_t HardwareStepDriver = 2;
+constexpr unsigned int StepTcMc1EventGenerator = EVSYS_ID_GEN_TC6_MC_1;
+constexpr uint8_t StepTcMc1DmacId = TC6_DMAC_ID_MC_1;
+constexpr unsigned int HardwareStepEventChannel = 0;	// EVSYS channel that carries the compare match events to the PORT
+constexpr unsigned int HardwarePortEventInput = 0;		// PORT event input 0-3 in the port group of the step pin
+#endif
+
+#if SUPPORT_HARDWARE_TACHO
+// Fan tacho inputs that are time stamped by the DMAC instead of interrupting the CPU
+constexpr size_t NumHardwareTachos = 3;					// one for each fan output that has a tacho input
+constexpr unsigned int TachoEventChannelBase = 1;		// EVSYS channels that carry the tacho edges to the DMAC
+#endif
+
 // Diagnostic LEDs
 constexpr Pin LedPins[] = { PortCPin(10) };
 constexpr bool LedActiveHigh = true;
@@ -226,19 +250,32 @@ constexpr IRQn Serial0_IRQn = SERCOM3_0_IRQn;
 constexpr IRQn Serial1_IRQn = SERCOM5_0_IRQn;
 
 // DMA channel assignments. Channels 0-3 have individual interrupt vectors, channels 4-31 share an interrupt vector.
+// Only channels 0-7 have event inputs, so channels 4-6 are kept for the tacho inputs.
 constexpr DmaChannel DmacChanTmcTx = 0;
 constexpr DmaChannel DmacChanTmcRx = 1;
 constexpr DmaChannel DmacChanAdc0Tx = 2;
 // Next channel is used by ADC0 for receive
-constexpr DmaChannel DmacChanAdc1Tx = 4;
+#if SUPPORT_HARDWARE_TACHO
+constexpr DmaChannel DmacChanTachoBase = 4;				// one channel per hardware tacho, triggered by its tacho event
+#endif
+#if SUPPORT_HARDWARE_STEP_GENERATION
+constexpr DmaChannel DmacChanStepGen = 7;
+#endif
+constexpr DmaChannel DmacChanAdc1Tx = 8;
 // Next channel is used by ADC1 for receive
 
-constexpr unsigned int NumDmaChannelsUsed = 6;			// must be at least the number of channels used, may be larger. Max 32 on the SAME51.
+constexpr unsigned int NumDmaChannelsUsed = 10;			// must be at least the number of channels used, may be larger. Max 32 on the SAME51.
 
 constexpr DmaPriority DmacPrioTmcTx = 0;
 constexpr DmaPriority DmacPrioTmcRx = 3;
 constexpr DmaPriority DmacPrioAdcTx = 0;
 constexpr DmaPriority DmacPrioAdcRx = 2;
+#if SUPPORT_HARDWARE_STEP_GENERATION
+constexpr DmaPriority DmacPrioStepGen = 3;				// the next step time must be loaded before the step after it is due
+#endif
+#if SUPPORT_HARDWARE_TACHO
+constexpr DmaPriority DmacPrioTacho = 1;				// the time stamp must be read soon after the tacho edge
+#endif
 
 // Interrupt priorities, lower means higher priority. 0-2 can't make RTOS calls.
 const NvicPriority NvicPriorityStep = 2;				// step interrupt is next highest, it can preempt most other interrupts
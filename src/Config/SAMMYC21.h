@@ -35,6 +35,7 @@ constexpr const char* BoardTypeName = "SAMMYC21";
 #define SUPPORT_TMC22xx			0
 
 constexpr size_t NumDrivers = 1;
+constexpr size_t MoveQueueRamBudget = 3584;		// bytes of RAM for the move queue, from which the DDA ring length and the number of DMs are calculated
 
 PortGroup * const StepPio = &(PORT->Group[0]);		// the PIO that all the step pins are on
 constexpr Pin EnablePins[NumDrivers] = { PortAPin(9) };
@@ -44,6 +45,7 @@ constexpr Pin DirectionPins[NumDrivers] = { PortAPin(10) };
 #define SINGLE_DRIVER			1
 #define SUPPORT_SLOW_DRIVERS	1
 #define SUPPORT_DELTA_MOVEMENT	1
+#define SUPPORT_FIXED_POINT_PREPARE	1		// no FPU, so prepare Cartesian and extruder moves using integer arithmetic
 #define USE_EVEN_STEPS			1
 #define SUPPORT_SPI_SENSORS		0
 #define SUPPORT_DHT_SENSOR		0
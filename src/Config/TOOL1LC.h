@@ -33,6 +33,7 @@ constexpr const char* BoardTypeName = "TOOL1LC";
 #define SUPPORT_TMC22xx			1
 
 constexpr size_t NumDrivers = 1;
+constexpr size_t MoveQueueRamBudget = 3584;		// bytes of RAM for the move queue, from which the DDA ring length and the number of DMs are calculated
 constexpr size_t MaxSmartDrivers = 1;
 
 #define TMC22xx_USES_SERCOM				1
@@ -70,6 +71,7 @@ constexpr Pin DriverDiagPins[NumDrivers] = { PortBPin(3) };
 #define SINGLE_DRIVER			1
 #define SUPPORT_SLOW_DRIVERS	0
 #define SUPPORT_DELTA_MOVEMENT	0
+#define SUPPORT_FIXED_POINT_PREPARE	1		// no FPU, so prepare Cartesian and extruder moves using integer arithmetic
 #define USE_EVEN_STEPS			0
 #define SUPPORT_SPI_SENSORS		0
 #define SUPPORT_DHT_SENSOR		0
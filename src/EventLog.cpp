@@ -0,0 +1,246 @@
+/*
+ * EventLog.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "EventLog.h"
+#include "Hardware/EEPROM.h"
+#include <RTOSIface/RTOSIface.h>
+
+// The following must be kept in line with enum class EventLogType
+static const char *const EventLogTypeText[] =
+{
+	"none",
+	"startup",
+	"software reset",
+	"heater fault",
+	"driver stall",
+	"driver over temperature",
+	"driver short to ground",
+	"CAN send failed",
+	"under voltage",
+	"CAN data rate fallback",
+	"fan fault",
+	"power fail"
+};
+
+static_assert(ARRAY_SIZE(EventLogTypeText) == (size_t)EventLogType::numTypes, "EventLogTypeText is the wrong length");
+
+// Compute the checksum of a record. We don't need anything as strong as a CRC because we only need to detect records that were partially written.
+uint32_t EventLogRecord::CalcChecksum() const
+{
+	const uint32_t *p = reinterpret_cast<const uint32_t*>(this);
+	uint32_t sum = 0x5A5A5A5A;
+	for (size_t i = 0; i < offsetof(EventLogRecord, checksum)/sizeof(uint32_t); ++i)
+	{
+		sum = ((sum << 3) | (sum >> 29)) ^ p[i];
+	}
+	return sum;
+}
+
+namespace EventLog
+{
+	constexpr uint32_t MinWriteInterval = 2000;			// minimum interval in milliseconds between NVM writes, to bound the wear rate if events occur continuously
+	constexpr size_t MaxPendingRecords = 8;				// the number of events we can queue while waiting to write them
+
+	static uint32_t numSlots = 0;						// the number of records that the NVM area can hold, zero if there is no NVM area
+	static uint32_t nextSlot = 0;						// the slot we will write next, which holds the oldest record if the log has wrapped round
+	static uint32_t nextSequence = 0;
+	static uint32_t session = 0;
+	static uint32_t whenLastWritten = 0;
+	static uint32_t recordsWritten = 0;
+	static uint32_t eventsDropped = 0;
+
+	static EventLogRecord pendingRecords[MaxPendingRecords];
+	static size_t numPendingRecords = 0;
+
+	static Mutex nvmMutex;								// held by Spin and Clear while they write the NVM and update nextSlot and nextSequence
+
+	// Write a record to the next slot. Called with the pending records locked, or from a fault handler.
+	static void WriteRecord(EventLogRecord& rec)
+	{
+		rec.magic = EventLogRecord::magicValue;
+		rec.sequence = nextSequence;
+		rec.session = session;
+		rec.checksum = rec.CalcChecksum();
+		if (EEPROM::Write(reinterpret_cast<const char*>(&rec), nextSlot * sizeof(EventLogRecord), sizeof(EventLogRecord)))
+		{
+			++nextSequence;
+			++recordsWritten;
+			nextSlot = (nextSlot + 1) % numSlots;
+		}
+	}
+
+	static bool ReadRecord(uint32_t slot, EventLogRecord& rec)
+	{
+		return EEPROM::Read(reinterpret_cast<char*>(&rec), slot * sizeof(EventLogRecord), sizeof(EventLogRecord)) && rec.IsValid();
+	}
+}
+
+// Find the most recent record so that we know where to continue writing, then log the startup
+void EventLog::Init()
+{
+	nvmMutex.Create("EventLog");
+	numSlots = EEPROM::GetSize()/sizeof(EventLogRecord);
+	nextSlot = nextSequence = session = 0;
+
+	bool found = false;
+	for (uint32_t slot = 0; slot < numSlots; ++slot)
+	{
+		EventLogRecord rec;
+		if (ReadRecord(slot, rec) && (!found || (int32_t)(rec.sequence - nextSequence) >= 0))
+		{
+			found = true;
+			nextSequence = rec.sequence + 1;
+			session = rec.session + 1;
+			nextSlot = (slot + 1) % numSlots;
+		}
+	}
+
+	Record(EventLogType::startup, RSTC->RCAUSE.reg);
+}
+
+// Queue an event to be logged. If an identical event is already queued, just increase its repeat count.
+void EventLog::Record(EventLogType type, uint32_t d0, uint32_t d1, uint32_t d2)
+{
+	if (numSlots != 0)
+	{
+		const uint32_t upTime = (uint32_t)(millis64()/1000u);
+		AtomicCriticalSectionLocker lock;
+		for (size_t i = 0; i < numPendingRecords; ++i)
+		{
+			EventLogRecord& rec = pendingRecords[i];
+			if (rec.type == (uint8_t)type && rec.data[0] == d0 && rec.data[1] == d1 && rec.data[2] == d2)
+			{
+				if (rec.repeats != 0xFF)
+				{
+					++rec.repeats;
+				}
+				return;
+			}
+		}
+
+		if (numPendingRecords == MaxPendingRecords)
+		{
+			++eventsDropped;
+			return;
+		}
+
+		EventLogRecord& rec = pendingRecords[numPendingRecords++];
+		rec.type = (uint8_t)type;
+		rec.repeats = 0;
+		rec.upTime = upTime;
+		rec.data[0] = d0;
+		rec.data[1] = d1;
+		rec.data[2] = d2;
+	}
+}
+
+// Write all pending records followed by this one. Called when we are about to reset, so we ignore the write rate limit.
+void EventLog::RecordImmediate(EventLogType type, uint32_t d0, uint32_t d1, uint32_t d2)
+{
+	if (numSlots != 0)
+	{
+		AtomicCriticalSectionLocker lock;
+		for (size_t i = 0; i < numPendingRecords; ++i)
+		{
+			WriteRecord(pendingRecords[i]);
+		}
+		numPendingRecords = 0;
+
+		EventLogRecord rec;
+		rec.type = (uint8_t)type;
+		rec.repeats = 0;
+		rec.upTime = (uint32_t)(millis64()/1000u);
+		rec.data[0] = d0;
+		rec.data[1] = d1;
+		rec.data[2] = d2;
+		WriteRecord(rec);
+	}
+}
+
+// Write the oldest pending record if we haven't written one recently
+void EventLog::Spin()
+{
+	if (numPendingRecords != 0 && millis() - whenLastWritten >= MinWriteInterval)
+	{
+		EventLogRecord rec;
+		{
+			AtomicCriticalSectionLocker lock;
+			rec = pendingRecords[0];
+			--numPendingRecords;
+			memmove(pendingRecords, pendingRecords + 1, numPendingRecords * sizeof(EventLogRecord));
+		}
+		MutexLocker lock(nvmMutex);
+		WriteRecord(rec);
+		whenLastWritten = millis();
+	}
+}
+
+// Report the most recent records, newest first. Stop when the reply buffer is nearly full.
+GCodeResult EventLog::Report(const StringRef& reply)
+{
+	if (numSlots == 0)
+	{
+		reply.copy("Event log not available because EEPROM size is zero");
+		return GCodeResult::error;
+	}
+
+	reply.printf("Event log, session %" PRIu32 ":", session);
+	unsigned int numReported = 0;
+	uint32_t slot = nextSlot;
+	for (uint32_t i = 0; i < numSlots; ++i)
+	{
+		slot = (slot == 0) ? numSlots - 1 : slot - 1;
+		EventLogRecord rec;
+		if (!ReadRecord(slot, rec))
+		{
+			break;											// we have reached the end of the valid records
+		}
+		if (reply.strlen() + 80 > reply.Capacity())
+		{
+			reply.lcat("...");
+			break;
+		}
+		reply.lcatf("%" PRIu32 " s%" PRIu32 " %02u:%02u:%02u %s %" PRIx32 " %" PRIx32 " %" PRIx32,
+					rec.sequence, rec.session,
+					(unsigned int)(rec.upTime/3600), (unsigned int)((rec.upTime % 3600)/60), (unsigned int)(rec.upTime % 60),
+					(rec.type < ARRAY_SIZE(EventLogTypeText)) ? EventLogTypeText[rec.type] : "unknown",
+					rec.data[0], rec.data[1], rec.data[2]);
+		if (rec.repeats != 0)
+		{
+			reply.catf(" (+%u)", rec.repeats);
+		}
+		++numReported;
+	}
+
+	if (numReported == 0)
+	{
+		reply.lcat("no entries");
+	}
+	return GCodeResult::ok;
+}
+
+// Invalidate all records and start the sequence numbers again. Each slot is written, so don't do this often.
+// This is called by the command processor, so we hold the mutex to stop Spin writing a record part way through.
+void EventLog::Clear()
+{
+	MutexLocker lock(nvmMutex);
+	EventLogRecord rec;
+	memset(&rec, 0xFF, sizeof(rec));
+	for (uint32_t slot = 0; slot < numSlots; ++slot)
+	{
+		(void)EEPROM::Write(reinterpret_cast<const char*>(&rec), slot * sizeof(EventLogRecord), sizeof(EventLogRecord));
+	}
+	nextSlot = nextSequence = 0;
+}
+
+void EventLog::Diagnostics(const StringRef& reply)
+{
+	reply.lcatf("Event log: slots %" PRIu32 ", next sequence %" PRIu32 ", written %" PRIu32 ", pending %u, dropped %" PRIu32,
+					numSlots, nextSequence, recordsWritten, (unsigned int)numPendingRecords, eventsDropped);
+	eventsDropped = 0;
+}
+
+// End
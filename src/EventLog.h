@@ -0,0 +1,70 @@
+/*
+ * EventLog.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Persistent log of significant events (crashes, heater faults, driver faults, CAN errors) that survives power cycles.
+ *  The log is stored in the EEPROM area (SmartEEPROM on the SAME5x, RWWEE on the SAMC21) as a circular array of fixed-size records.
+ *  Each record carries a sequence number, so the oldest record is always overwritten next and writes are spread evenly across the area.
+ */
+
+#ifndef SRC_EVENTLOG_H_
+#define SRC_EVENTLOG_H_
+
+#include "RepRapFirmware.h"
+#include "GCodes/GCodeResult.h"
+
+// Types of event that we record. Don't change the values of existing entries because they are stored in NVM.
+// IMPORTANT! When changing this, also update table EventLogTypeText
+enum class EventLogType : uint8_t
+{
+	none = 0,					// unused record
+	startup,					// data[0] = reset cause register
+	softwareReset,				// data[0] = reset reason, data[1] = program counter, data[2] = CFSR
+	heaterFault,				// data[0] = heater number
+	driverStall,				// data[0] = driver bitmap
+	driverOverTemperature,		// data[0] = driver bitmap, data[1] = 1 if shutdown, 0 if warning
+	driverShortToGround,		// data[0] = driver bitmap
+	canSendFailed,				// data[0] = CAN message type
+	underVoltage,				// data[0] = VIN ADC reading, data[1] = V12 ADC reading if monitored
+	canDataRateFallback,		// data[0] = CAN data phase bit rate tried, data[1] = number of bus errors
+	fanFault,					// data[0] = fan number, data[1] = FanTachoFault, data[2] = RPM
+	powerFail,					// data[0] = cause (1 = VIN, 2 = V12), data[1] = VIN ADC reading, data[2] = V12 ADC reading if monitored
+	numTypes
+};
+
+// The record that we store in NVM. It must have no virtual members because it is read/written directly from/to NVM.
+struct EventLogRecord
+{
+	uint16_t magic;								// the magic number, including the version
+	uint8_t type;								// an EventLogType
+	uint8_t repeats;							// number of further identical events merged into this record, saturating at 255
+	uint32_t sequence;							// sequence number, incremented for each record written
+	uint32_t session;							// incremented at each startup so that records can be grouped by session
+	uint32_t upTime;							// seconds since startup when the event occurred
+	uint32_t data[3];							// event-dependent data
+	uint32_t checksum;							// checksum of the preceding fields
+
+	uint32_t CalcChecksum() const;
+	bool IsValid() const { return magic == magicValue && checksum == CalcChecksum(); }
+
+	static const uint16_t versionValue = 1;		// increment this whenever this struct changes
+	static const uint16_t magicValue = 0x4C00 | versionValue;
+};
+
+static_assert(sizeof(EventLogRecord) == 32, "EventLogRecord has wrong size");
+
+namespace EventLog
+{
+	void Init();
+	void Spin();															// write any pending records, call this only from the Main task
+
+	void Record(EventLogType type, uint32_t d0 = 0, uint32_t d1 = 0, uint32_t d2 = 0);		// queue an event to be logged, may be called from any task
+	void RecordImmediate(EventLogType type, uint32_t d0, uint32_t d1, uint32_t d2);			// log an event immediately, used when we are about to reset
+
+	GCodeResult Report(const StringRef& reply);								// report the most recent records
+	void Clear();															// invalidate all records and restart the sequence numbers
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif /* SRC_EVENTLOG_H_ */
@@ -8,6 +8,9 @@
 #include "Fan.h"
 
 #include "CanMessageFormats.h"
+#include "CanMessageGenericParser.h"
+#include <CAN/CanInterface.h>
+#include <EventLog.h>
 
 Fan::Fan(unsigned int fanNum)
 	: fanNumber(fanNum),
@@ -15,6 +18,7 @@ Fan::Fan(unsigned int fanNum)
 	  minVal(DefaultMinFanPwm),
 	  maxVal(1.0),										// 100% maximum fan speed
 	  blipTime(DefaultFanBlipTime),
+	  tachoFaultTime(0), lastTachoOkTime(0), minRpm(0), maxRpm(0), tachoFault(FanTachoFault::none),
 	  isConfigured(false)
 {
 	triggerTemperatures[0] = triggerTemperatures[1] = DefaultHotEndFanTemperature;
@@ -42,4 +46,111 @@ void Fan::SetPwm(float speed)
 	Refresh(true);
 }
 
+// Configure monitoring of the fan speed. T is how long in milliseconds the speed must be wrong before we report a fault, 0 to disable monitoring.
+// L is the lowest acceptable speed in RPM when the fan is running and H is the highest, 0 for no limit. A running fan with no tacho pulses is always a fault.
+// R is the speed of the fan in RPM at full PWM. If it is nonzero then the fan speed is controlled using the tacho, and the requested fan value is the fraction of R wanted.
+// P and I are the proportional and integral gains used for closed loop control.
+GCodeResult Fan::ConfigureTachoMonitoring(CanMessageGenericParser& parser, const StringRef& reply)
+{
+	bool seen = parser.GetUintParam('T', tachoFaultTime);
+	seen = parser.GetUintParam('L', minRpm) || seen;
+	seen = parser.GetUintParam('H', maxRpm) || seen;
+	if (seen)
+	{
+		if (maxRpm != 0 && maxRpm < minRpm)
+		{
+			reply.copy("Maximum RPM must not be less than minimum RPM");
+			return GCodeResult::error;
+		}
+		lastTachoOkTime = millis();
+		tachoFault = FanTachoFault::none;
+	}
+
+	float kP = speedController.GetProportionalGain(), kI = speedController.GetIntegralGain();
+	bool seenGains = parser.GetFloatParam('P', kP);
+	seenGains = parser.GetFloatParam('I', kI) || seenGains;
+	if (seenGains)
+	{
+		if (kP < 0.0 || kI < 0.0)
+		{
+			reply.copy("Control gains must not be negative");
+			return GCodeResult::error;
+		}
+		speedController.SetGains(kP, kI);
+	}
+
+	uint32_t ratedRpm;
+	if (parser.GetUintParam('R', ratedRpm))
+	{
+		if (ratedRpm != 0 && GetRPM() < 0)
+		{
+			reply.copy("Closed loop speed control needs a tacho");
+			return GCodeResult::error;
+		}
+		speedController.SetRatedRpm(ratedRpm);
+		Refresh(true);
+	}
+
+	if (tachoFaultTime == 0)
+	{
+		reply.printf("Fan %u.%u speed monitoring disabled", CanInterface::GetCanAddress(), fanNumber);
+	}
+	else
+	{
+		reply.printf("Fan %u.%u speed monitoring: fault after %" PRIu32 "ms, RPM min %u max %u, current RPM %" PRIi32 ", %s",
+						CanInterface::GetCanAddress(), fanNumber, tachoFaultTime, minRpm, maxRpm, GetRPM(),
+						(tachoFault == FanTachoFault::stalled) ? "stalled"
+							: (tachoFault == FanTachoFault::tooSlow) ? "too slow"
+								: (tachoFault == FanTachoFault::tooFast) ? "too fast"
+									: "ok");
+	}
+
+	if (speedController.IsEnabled())
+	{
+		reply.catf(", closed loop control with rated speed %" PRIu32 " RPM, P %.2f I %.2f, PWM %.2f, stalls %" PRIu32,
+					speedController.GetRatedRpm(), (double)speedController.GetProportionalGain(), (double)speedController.GetIntegralGain(),
+					(double)speedController.GetPwm(), speedController.GetNumStalls());
+	}
+	return GCodeResult::ok;
+}
+
+// Check the fan speed and record a fault if it has been wrong for too long. 'shouldBeRunning' is true if we are driving the fan and it has had time to spin up.
+void Fan::CheckTacho(bool shouldBeRunning)
+{
+	if (tachoFaultTime == 0)
+	{
+		return;
+	}
+
+	const int32_t rpm = GetRPM();
+	if (rpm < 0)
+	{
+		return;													// no tacho configured
+	}
+
+	FanTachoFault fault = FanTachoFault::none;
+	if (maxRpm != 0 && rpm > (int32_t)maxRpm)
+	{
+		fault = FanTachoFault::tooFast;
+	}
+	else if (shouldBeRunning)
+	{
+		fault = (rpm == 0) ? FanTachoFault::stalled
+				: (rpm < (int32_t)minRpm) ? FanTachoFault::tooSlow
+					: FanTachoFault::none;
+	}
+
+	const uint32_t now = millis();
+	if (fault == FanTachoFault::none)
+	{
+		lastTachoOkTime = now;
+		tachoFault = FanTachoFault::none;
+	}
+	else if (fault != tachoFault && now - lastTachoOkTime >= tachoFaultTime)
+	{
+		tachoFault = fault;
+		EventLog::Record(EventLogType::fanFault, fanNumber, (uint32_t)fault, (uint32_t)rpm);
+	}
+}
+
 // End
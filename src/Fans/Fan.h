@@ -11,9 +11,20 @@
 #include "RepRapFirmware.h"
 #include "Hardware/IoPorts.h"
 #include "GCodes/GCodeResult.h"
+#include "FanSpeedController.h"
 
 class GCodeBuffer;
 class CanMessageFanParameters;
+class CanMessageGenericParser;
+
+// Fan speed faults detected from the tacho. These values are recorded in the event log, so don't change them.
+enum class FanTachoFault : uint8_t
+{
+	none = 0,
+	stalled,
+	tooSlow,
+	tooFast
+};
 
 class Fan
 {
@@ -43,10 +54,15 @@ public:
 	void SetPwm(float speed);
 	bool HasMonitoredSensors() const { return !sensorsMonitored.IsEmpty(); }
 
+	GCodeResult ConfigureTachoMonitoring(CanMessageGenericParser& parser, const StringRef& reply);
+	FanTachoFault GetTachoFault() const { return tachoFault; }
+
 protected:
 	virtual void Refresh(bool checkSensors) = 0;
 	virtual bool UpdateFanConfiguration(const StringRef& reply) = 0;
 
+	void CheckTacho(bool shouldBeRunning);
+
 	unsigned int fanNumber;
 
 	// Variables that control the fan
@@ -58,6 +74,14 @@ protected:
 	uint32_t blipTime;										// in milliseconds
 	SensorsBitmap sensorsMonitored;
 
+	// Variables used to monitor the fan speed
+	uint32_t tachoFaultTime;								// how long in milliseconds the speed must be wrong before we report a fault, or 0 if monitoring is disabled
+	uint32_t lastTachoOkTime;								// when the speed was last correct
+	uint16_t minRpm;										// the lowest acceptable speed when running, or 0 if we only check for a stall
+	uint16_t maxRpm;										// the highest acceptable speed, or 0 if there is no limit
+	FanTachoFault tachoFault;								// the fault we most recently reported
+	FanSpeedController speedController;						// used when the speed is controlled using the tacho
+
 	bool isConfigured;
 };
 
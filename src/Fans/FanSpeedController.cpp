@@ -0,0 +1,120 @@
+/*
+ * FanSpeedController.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "FanSpeedController.h"
+#include <cmath>
+
+constexpr float MaxTimeStep = 2 * FanSpeedController::ControlInterval * 0.001;	// the longest interval in seconds that we integrate over in one update
+constexpr float IntegrationBand = 0.1;											// we always integrate the error when it is less than this fraction of the rated speed
+
+void FanSpeedController::Reset()
+{
+	integral = lastError = 0.0;
+	pwm = 0.0;
+	lastRequestedSpeed = 0.0;
+	lastUpdateTime = lastRunningTime = kickStartTime = 0;
+	kickDuration = 0;
+	numStalls = 0;
+	kicking = false;
+}
+
+void FanSpeedController::StartKick(uint32_t now, uint32_t duration)
+{
+	kicking = true;
+	kickStartTime = now;
+	kickDuration = duration;
+	pwm = 1.0;
+}
+
+// Return true if we need to call Update because the requested speed has changed, a kick has finished or it is time to adjust the PWM
+bool FanSpeedController::IsUpdateDue(uint32_t now, float requestedSpeed) const
+{
+	return requestedSpeed != lastRequestedSpeed
+		|| now - lastUpdateTime >= ControlInterval
+		|| (kicking && now - kickStartTime >= kickDuration);
+}
+
+// Calculate the new PWM. 'requestedSpeed' is the requested fraction of the rated speed and 'kickTime' is how long to give full PWM when starting the fan, in milliseconds.
+void FanSpeedController::Update(uint32_t now, float requestedSpeed, int32_t measuredRpm, uint32_t kickTime)
+{
+	float timeStep = (float)(now - lastUpdateTime) * 0.001;
+	if (timeStep > MaxTimeStep)
+	{
+		timeStep = MaxTimeStep;
+	}
+	lastUpdateTime = now;
+
+	if (requestedSpeed <= 0.0)
+	{
+		lastRequestedSpeed = 0.0;
+		kicking = false;
+		pwm = 0.0;
+		return;
+	}
+
+	if (lastRequestedSpeed <= 0.0)
+	{
+		// Starting the fan from standstill, so kick it
+		lastRunningTime = now;
+		if (kickTime != 0)
+		{
+			StartKick(now, kickTime);
+		}
+	}
+	lastRequestedSpeed = requestedSpeed;
+
+	if (kicking)
+	{
+		if (now - kickStartTime < kickDuration)
+		{
+			return;
+		}
+		kicking = false;
+		lastRunningTime = now;
+	}
+
+	if (measuredRpm > 0)
+	{
+		lastRunningTime = now;
+	}
+	else if (now - lastRunningTime >= StallTime)
+	{
+		++numStalls;
+		StartKick(now, StallKickTime);
+		return;
+	}
+
+	const float feedForward = (requestedSpeed < 1.0) ? requestedSpeed : 1.0;
+	if (measuredRpm > 0)
+	{
+		const float error = requestedSpeed - (float)measuredRpm/(float)ratedRpm;
+		// Integrating a large error while the fan is still approaching the requested speed quickly causes overshoot
+		if (fabsf(error) < IntegrationBand || fabsf(error) >= 0.9 * fabsf(lastError))
+		{
+			integral += kI * error * timeStep;
+		}
+		lastError = error;
+		pwm = feedForward + kP * error + integral;
+	}
+	else
+	{
+		pwm = feedForward + integral;									// we have no speed reading yet, so don't let the integral term wind up
+	}
+
+	// Clamp the PWM, and adjust the integral term so that it doesn't wind up while the PWM is saturated
+	if (pwm > 1.0)
+	{
+		integral -= pwm - 1.0;
+		pwm = 1.0;
+	}
+	else if (pwm < 0.0)
+	{
+		integral -= pwm;
+		pwm = 0.0;
+	}
+}
+
+// End
@@ -0,0 +1,66 @@
+/*
+ * FanSpeedController.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Closed loop control of the speed of a fan that has a tacho. The requested speed is a fraction of the rated speed, which is the speed
+ *  of the fan at full PWM. A PI controller adds a correction to the PWM that would give the requested speed if the fan speed were
+ *  proportional to PWM. The integral term learns the offset and nonlinearity of the fan, so it is kept when the requested speed changes.
+ *  The integral term is clamped when the PWM saturates to prevent windup.
+ *  A fan that is started from standstill is given full PWM for the kick time. If a fan that should be running produces no tacho pulses
+ *  for the stall time then we give it another, longer kick.
+ *
+ *  This file doesn't depend on the hardware, so that the controller can be exercised on a PC using a model of the fan.
+ */
+
+#ifndef SRC_FANS_FANSPEEDCONTROLLER_H_
+#define SRC_FANS_FANSPEEDCONTROLLER_H_
+
+#include <cstdint>
+
+class FanSpeedController
+{
+public:
+	static constexpr uint32_t ControlInterval = 200;			// how often we adjust the PWM, in milliseconds
+	static constexpr uint32_t StallTime = 3000;					// how long we allow a running fan to produce no tacho pulses before we kick it, in milliseconds
+	static constexpr uint32_t StallKickTime = 500;				// how long we give a stalled fan full PWM, in milliseconds
+	static constexpr float DefaultProportionalGain = 0.4;
+	static constexpr float DefaultIntegralGain = 1.0;			// per second
+
+	FanSpeedController() : ratedRpm(0), kP(DefaultProportionalGain), kI(DefaultIntegralGain) { Reset(); }
+
+	void Reset();
+	void SetRatedRpm(uint32_t rpm) { ratedRpm = rpm; Reset(); }
+	void SetGains(float p, float i) { kP = p; kI = i; }
+
+	bool IsEnabled() const { return ratedRpm != 0; }
+	uint32_t GetRatedRpm() const { return ratedRpm; }
+	float GetProportionalGain() const { return kP; }
+	float GetIntegralGain() const { return kI; }
+
+	bool IsUpdateDue(uint32_t now, float requestedSpeed) const;
+	void Update(uint32_t now, float requestedSpeed, int32_t measuredRpm, uint32_t kickTime);
+	float GetPwm() const { return pwm; }
+	bool IsKicking() const { return kicking; }
+	uint32_t GetNumStalls() const { return numStalls; }
+
+private:
+	void StartKick(uint32_t now, uint32_t duration);
+
+	uint32_t ratedRpm;											// the speed at full PWM, or 0 if closed loop control is disabled
+	float kP;													// PWM per fraction of the rated speed
+	float kI;													// PWM per fraction of the rated speed per second
+
+	float integral;
+	float lastError;
+	float pwm;
+	float lastRequestedSpeed;
+	uint32_t lastUpdateTime;
+	uint32_t lastRunningTime;									// when we last saw tacho pulses, or the end of the last kick
+	uint32_t kickStartTime;
+	uint32_t kickDuration;
+	uint32_t numStalls;
+	bool kicking;
+};
+
+#endif /* SRC_FANS_FANSPEEDCONTROLLER_H_ */
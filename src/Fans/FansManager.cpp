@@ -8,6 +8,7 @@
 #include "FansManager.h"
 
 #include "LocalFan.h"
+#include "HardwareTacho.h"
 #include "CanMessageFormats.h"
 #include "CanMessageGenericParser.h"
 #include "CAN/CanInterface.h"
@@ -41,6 +42,10 @@ static LocalFan *CreateLocalFan(uint32_t fanNum, const char *pinNames, PwmFreque
 // Check and if necessary update all fans. Return true if a thermostatic fan is running.
 bool FansManager::CheckFans(bool checkSensors)
 {
+#if SUPPORT_HARDWARE_TACHO
+	HardwareTacho::Spin();
+#endif
+
 	ReadLocker lock(fansLock);
 	bool thermostaticFanRunning = false;
 	for (Fan* fan : fans)
@@ -134,6 +139,27 @@ GCodeResult FansManager::SetFanSpeed(const CanMessageSetFanSpeed& msg, const Str
 	return GCodeResult::ok;
 }
 
+// Configure or report the monitoring of the speed of a fan that has a tacho
+GCodeResult FansManager::ConfigureTachoMonitoring(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, FanTachoParams);
+	uint16_t fanNum;
+	if (!parser.GetUintParam('F', fanNum))
+	{
+		reply.copy("Missing F parameter");
+		return GCodeResult::error;
+	}
+
+	auto fan = FindFan(fanNum);
+	if (fan.IsNull())
+	{
+		reply.printf("Board %u doesn't have fan %u", CanInterface::GetCanAddress(), fanNum);
+		return GCodeResult::error;
+	}
+
+	return fan->ConfigureTachoMonitoring(parser, reply);
+}
+
 #if 0
 
 void FansManager::SetFanValue(uint32_t fanNum, float speed)
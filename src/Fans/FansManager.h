@@ -25,6 +25,7 @@ namespace FansManager
 	GCodeResult ConfigureFanPort(const CanMessageGeneric& msg, const StringRef& reply);
 	GCodeResult ConfigureFan(const CanMessageFanParameters& gb, const StringRef& reply);
 	GCodeResult SetFanSpeed(const CanMessageSetFanSpeed& msg, const StringRef& reply);
+	GCodeResult ConfigureTachoMonitoring(const CanMessageGeneric& msg, const StringRef& reply);
 	unsigned int PopulateFansReport(CanMessageFansReport& msg);
 #if 0
 	void SetFanValue(uint32_t fanNum, float speed);
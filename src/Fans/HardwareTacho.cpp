@@ -0,0 +1,241 @@
+/*
+ * HardwareTacho.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "HardwareTacho.h"
+
+#if SUPPORT_HARDWARE_TACHO
+
+#if !SAME5x
+# error Hardware tacho measurement is only supported on the SAME5x
+#endif
+
+#include <Movement/StepTimer.h>
+#include <Hardware/DmacManager.h>
+#include <Hardware/Interrupts.h>
+
+// How it works:
+// Each falling edge on the tacho pin makes the DMA channel copy the RTC count into the next entry of a circular buffer, so the most recent time stamp
+// is the one with the smallest age. We average the tacho period over the earlier time stamps that are recent enough, stopping at any entry that is
+// older than the averaging window or that has been overwritten since we found the most recent one.
+// When a fan slows down or stops, the time since the last edge becomes longer than the average period, so we use that instead.
+namespace HardwareTacho
+{
+	constexpr size_t TimeStampsPerChannel = 16;
+	constexpr uint32_t NominalRtcRate = 32768;								// the nominal frequency of the RTC clock
+	constexpr uint32_t MaxAveragingTicks = NominalRtcRate/2;				// we average the tacho period over at most this many RTC ticks
+	constexpr uint32_t StoppedSeconds = 3;									// if there are no tacho pulses for this long then we report zero RPM
+	constexpr uint32_t EmptyAge = 1u << 29;									// how old we make empty entries look, about 4.5 hours
+	constexpr uint32_t CalibrationInterval = 4 * StepTimer::StepClockRate;	// how often we calibrate the RTC against the step clock
+
+	struct TachoChannel
+	{
+		volatile uint32_t timeStamps[TimeStampsPerChannel];					// written by the DMAC
+		bool inUse;
+	};
+
+	static TachoChannel channels[NumHardwareTachos];
+	static uint32_t rtcRate = NominalRtcRate;								// the measured frequency of the RTC clock
+	static uint32_t lastCalibrationStepTime, lastCalibrationRtcCount;
+	static uint32_t numCalibrations = 0;
+
+	static inline uint32_t ReadRtc()
+	{
+		return RTC->MODE0.COUNT.reg;										// continuous read synchronisation is enabled, so we don't need to wait
+	}
+
+	// Make all the time stamps of a channel look too old to use
+	static void MarkEmpty(TachoChannel& ch, uint32_t now)
+	{
+		for (volatile uint32_t& ts : ch.timeStamps)
+		{
+			ts = now - EmptyAge;
+		}
+	}
+
+	// Return the index of the most recent time stamp and set 'age' to its age
+	static size_t FindNewest(const TachoChannel& ch, uint32_t now, uint32_t& age)
+	{
+		size_t newest = 0;
+		age = now - ch.timeStamps[0];
+		for (size_t i = 1; i < TimeStampsPerChannel; ++i)
+		{
+			const uint32_t a = now - ch.timeStamps[i];
+			if (a < age)
+			{
+				age = a;
+				newest = i;
+			}
+		}
+		return newest;
+	}
+}
+
+void HardwareTacho::Init()
+{
+	// Run the RTC as a free running 32-bit counter clocked from the 32kHz internal oscillator, with continuous read synchronisation so that the DMAC can read it
+	OSC32KCTRL->RTCCTRL.reg = OSC32KCTRL_RTCCTRL_RTCSEL_ULP32K;
+	MCLK->APBAMASK.reg |= MCLK_APBAMASK_RTC;
+	RTC->MODE0.CTRLA.reg = RTC_MODE0_CTRLA_SWRST;
+	while ((RTC->MODE0.SYNCBUSY.reg & RTC_MODE0_SYNCBUSY_SWRST) != 0) { }
+	RTC->MODE0.CTRLA.reg = RTC_MODE0_CTRLA_MODE_COUNT32 | RTC_MODE0_CTRLA_PRESCALER_DIV1 | RTC_MODE0_CTRLA_COUNTSYNC;
+	while ((RTC->MODE0.SYNCBUSY.reg & RTC_MODE0_SYNCBUSY_COUNTSYNC) != 0) { }
+	RTC->MODE0.CTRLA.reg |= RTC_MODE0_CTRLA_ENABLE;
+	while ((RTC->MODE0.SYNCBUSY.reg & RTC_MODE0_SYNCBUSY_ENABLE) != 0) { }
+
+	// The event channels use the resynchronised path, so they need a clock
+	MCLK->APBBMASK.reg |= MCLK_APBBMASK_EVSYS;
+	for (size_t i = 0; i < NumHardwareTachos; ++i)
+	{
+		GCLK->PCHCTRL[EVSYS_GCLK_ID_0 + TachoEventChannelBase + i].reg = GCLK_PCHCTRL_GEN_GCLK0 | GCLK_PCHCTRL_CHEN;
+		channels[i].inUse = false;
+	}
+
+	lastCalibrationStepTime = StepTimer::GetTimerTicks();
+	lastCalibrationRtcCount = ReadRtc();
+}
+
+// Measure the RTC clock frequency against the step clock, and stop empty entries in the buffers of stopped fans wrapping round to look recent
+void HardwareTacho::Spin()
+{
+	uint32_t stepNow, rtcNow;
+	{
+		AtomicCriticalSectionLocker lock;									// so that we read the two counters at nearly the same time
+		stepNow = StepTimer::GetTimerTicks();
+		rtcNow = ReadRtc();
+	}
+
+	const uint32_t stepElapsed = stepNow - lastCalibrationStepTime;
+	if (stepElapsed >= CalibrationInterval)
+	{
+		const uint32_t rtcElapsed = rtcNow - lastCalibrationRtcCount;
+		rtcRate = (uint32_t)(((uint64_t)rtcElapsed * StepTimer::StepClockRate + stepElapsed/2)/stepElapsed);
+		lastCalibrationStepTime = stepNow;
+		lastCalibrationRtcCount = rtcNow;
+		++numCalibrations;
+	}
+
+	for (TachoChannel& ch : channels)
+	{
+		if (ch.inUse)
+		{
+			uint32_t age;
+			(void)FindNewest(ch, rtcNow, age);
+			if (age > EmptyAge)
+			{
+				MarkEmpty(ch, rtcNow);
+			}
+		}
+	}
+}
+
+// Start time stamping the falling edges on the specified pin. Return the channel number, or -1 if no channel is free or the pin can't generate events.
+int HardwareTacho::Attach(Pin pin)
+{
+	for (size_t i = 0; i < NumHardwareTachos; ++i)
+	{
+		TachoChannel& ch = channels[i];
+		if (!ch.inUse)
+		{
+			unsigned int exintNumber;
+			if (!AttachEvent(pin, InterruptMode::falling, exintNumber))
+			{
+				return -1;
+			}
+
+			const DmaChannel dmaChan = DmacChanTachoBase + i;
+			DmacManager::DisableChannel(dmaChan);
+			MarkEmpty(ch, ReadRtc());
+
+			const unsigned int eventChan = TachoEventChannelBase + i;
+			EVSYS->Channel[eventChan].CHANNEL.reg = EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_EIC_EXTINT_0 + exintNumber) | EVSYS_CHANNEL_PATH_RESYNCHRONIZED | EVSYS_CHANNEL_EDGSEL_RISING_EDGE;
+			EVSYS->USER[EVSYS_ID_USER_DMAC_CH_0 + dmaChan].reg = EVSYS_USER_CHANNEL(eventChan + 1);
+
+			DmacManager::SetBtctrl(dmaChan, DMAC_BTCTRL_VALID | DMAC_BTCTRL_EVOSEL_DISABLE | DMAC_BTCTRL_BLOCKACT_NOACT | DMAC_BTCTRL_BEATSIZE_WORD
+											| DMAC_BTCTRL_DSTINC | DMAC_BTCTRL_STEPSEL_DST | DMAC_BTCTRL_STEPSIZE_X1);
+			DmacManager::SetSourceAddress(dmaChan, &RTC->MODE0.COUNT.reg);
+			DmacManager::SetDestinationAddress(dmaChan, ch.timeStamps);
+			DmacManager::SetDataLength(dmaChan, TimeStampsPerChannel);
+			DmacManager::SetCircular(dmaChan);
+			DmacManager::SetEventTrigger(dmaChan);
+			DmacManager::EnableChannel(dmaChan, DmacPrioTacho);
+			ch.inUse = true;
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+// Stop using a channel. The caller is responsible for detaching the pin.
+void HardwareTacho::Detach(int channel)
+{
+	if (channel >= 0 && (size_t)channel < NumHardwareTachos)
+	{
+		const DmaChannel dmaChan = DmacChanTachoBase + channel;
+		DmacManager::DisableChannel(dmaChan);
+		EVSYS->USER[EVSYS_ID_USER_DMAC_CH_0 + dmaChan].reg = 0;
+		EVSYS->Channel[TachoEventChannelBase + channel].CHANNEL.reg = 0;
+		channels[channel].inUse = false;
+	}
+}
+
+int32_t HardwareTacho::GetRPM(int channel)
+{
+	const TachoChannel& ch = channels[channel];
+	const uint32_t now = ReadRtc();
+	uint32_t newestAge;
+	const size_t newest = FindNewest(ch, now, newestAge);
+	if (newestAge >= StoppedSeconds * rtcRate)
+	{
+		return 0;
+	}
+
+	// Find the longest span of tacho periods within the averaging window that ends at the most recent time stamp
+	const uint32_t newestTime = now - newestAge;
+	uint32_t span = 0;
+	unsigned int numPeriods = 0;
+	for (size_t i = 1; i < TimeStampsPerChannel; ++i)
+	{
+		const uint32_t s = newestTime - ch.timeStamps[(newest + TimeStampsPerChannel - i) % TimeStampsPerChannel];
+		if (s > MaxAveragingTicks || s <= span)
+		{
+			break;
+		}
+		span = s;
+		numPeriods = i;
+	}
+
+	if (numPeriods == 0)
+	{
+		return 0;																			// we need at least two recent edges to measure the speed
+	}
+
+	if (newestAge * numPeriods > span + numPeriods)
+	{
+		// The fan has slowed down since the last edge, so the time since the last edge is a better estimate of the period.
+		// We allow one tick more than the average period, because newestAge can be up to one tick longer than the true time since the edge.
+		span = newestAge;
+		numPeriods = 1;
+	}
+
+	return (int32_t)((30 * rtcRate * numPeriods + span/2)/span);							// 2 pulses per revolution
+}
+
+void HardwareTacho::Diagnostics(const StringRef& reply)
+{
+	unsigned int numInUse = 0;
+	for (const TachoChannel& ch : channels)
+	{
+		if (ch.inUse)
+		{
+			++numInUse;
+		}
+	}
+	reply.lcatf("Hardware tachos in use %u of %u, RTC %" PRIu32 "Hz, calibrations %" PRIu32, numInUse, NumHardwareTachos, rtcRate, numCalibrations);
+}
+
+#endif
+
+// End
@@ -0,0 +1,32 @@
+/*
+ * HardwareTacho.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Measures fan speeds without a CPU interrupt per tacho pulse. Each tacho pin generates an EIC event instead of an interrupt.
+ *  The event system routes the event to a DMA channel, which copies the RTC count into a circular buffer of time stamps.
+ *  We calculate the speed from the time stamps when it is asked for. The RTC runs from the internal 32kHz oscillator,
+ *  which isn't accurate, so we calibrate it against the step clock.
+ */
+
+#ifndef SRC_FANS_HARDWARETACHO_H_
+#define SRC_FANS_HARDWARETACHO_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_HARDWARE_TACHO
+
+namespace HardwareTacho
+{
+	void Init();
+	void Spin();												// called from the main task to calibrate the RTC and tidy up the buffers of stopped fans
+	int Attach(Pin pin);										// start time stamping the falling edges on a pin, returning the channel number or -1 if we can't
+	void Detach(int channel);
+	int32_t GetRPM(int channel);								// get the speed assuming 2 tacho pulses per revolution
+
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif
+
+#endif /* SRC_FANS_HARDWARETACHO_H_ */
@@ -11,6 +11,7 @@
 #include "Platform.h"
 #include "Heating/Heat.h"
 #include "Heating/Sensors/TemperatureSensor.h"
+#include "HardwareTacho.h"
 
 void FanInterrupt(CallbackParameter cb)
 {
@@ -19,6 +20,9 @@ void FanInterrupt(CallbackParameter cb)
 
 LocalFan::LocalFan(unsigned int fanNum)
 	: Fan(fanNum),
+#if SUPPORT_HARDWARE_TACHO
+	  hardwareTachoChannel(-1),
+#endif
 	  fanInterruptCount(0), fanLastResetTime(0), fanInterval(0),
 	  blipping(false)
 {
@@ -28,6 +32,9 @@ LocalFan::~LocalFan()
 {
 	port.WriteAnalog(0.0);
 	port.Release();
+#if SUPPORT_HARDWARE_TACHO
+	HardwareTacho::Detach(hardwareTachoChannel);
+#endif
 	tachoPort.Release();
 }
 
@@ -39,6 +46,12 @@ void LocalFan::ReportPortDetails(const StringRef& str) const
 	{
 		str.cat(" tacho");
 		tachoPort.AppendDetails(str);
+#if SUPPORT_HARDWARE_TACHO
+		if (hardwareTachoChannel >= 0)
+		{
+			str.cat(" (hardware)");
+		}
+#endif
 	}
 }
 
@@ -121,7 +134,7 @@ void LocalFan::Refresh(bool checkSensors)
 				reprap.GetPlatform().DriverCoolingFansOnOff(driverChannelsMonitored, true);		// tell Platform that we have started a fan that cools drivers
 			}
 #endif
-			if (reqVal < 1.0 && blipTime != 0)
+			if (reqVal < 1.0 && blipTime != 0 && !speedController.IsEnabled())
 			{
 				// Starting the fan from standstill, so blip the fan
 				blipping = true;
@@ -145,7 +158,20 @@ void LocalFan::Refresh(bool checkSensors)
 	}
 
 	lastVal = reqVal;
-	SetHardwarePwm((blipping) ? 1.0 : reqVal);
+	if (speedController.IsEnabled())
+	{
+		// Closed loop control, so reqVal is the requested fraction of the rated speed. The controller kicks the fan itself when starting it.
+		const uint32_t now = millis();
+		if (speedController.IsUpdateDue(now, reqVal))
+		{
+			speedController.Update(now, reqVal, GetRPM(), blipTime);
+		}
+		SetHardwarePwm(speedController.GetPwm());
+	}
+	else
+	{
+		SetHardwarePwm((blipping) ? 1.0 : reqVal);
+	}
 }
 
 bool LocalFan::UpdateFanConfiguration(const StringRef& reply)
@@ -158,6 +184,10 @@ bool LocalFan::UpdateFanConfiguration(const StringRef& reply)
 bool LocalFan::Check(bool checkSensors)
 {
 	Refresh(checkSensors);
+	if (checkSensors)
+	{
+		CheckTacho(lastVal != 0.0 && !blipping && !speedController.IsKicking());
+	}
 	return !sensorsMonitored.IsEmpty() && lastVal != 0.0;
 }
 
@@ -174,10 +204,16 @@ bool LocalFan::AssignPorts(const char *pinNames, const StringRef& reply)
 		}
 	}
 
-	// Tacho initialisation
+	// Tacho initialisation. Use a hardware tacho channel if one is free, so that we don't get an interrupt for every tacho pulse.
 	if (tachoPort.IsValid())
 	{
-		tachoPort.AttachInterrupt(FanInterrupt, InterruptMode::falling, this);
+#if SUPPORT_HARDWARE_TACHO
+		hardwareTachoChannel = HardwareTacho::Attach(tachoPort.GetPin());
+		if (hardwareTachoChannel < 0)
+#endif
+		{
+			tachoPort.AttachInterrupt(FanInterrupt, InterruptMode::falling, this);
+		}
 	}
 
 	Refresh(true);
@@ -187,6 +223,13 @@ bool LocalFan::AssignPorts(const char *pinNames, const StringRef& reply)
 // Tacho support
 int32_t LocalFan::GetRPM()
 {
+#if SUPPORT_HARDWARE_TACHO
+	if (hardwareTachoChannel >= 0)
+	{
+		return HardwareTacho::GetRPM(hardwareTachoChannel);
+	}
+#endif
+
 	// The ISR sets fanInterval to the number of step interrupt clocks it took to get fanMaxInterruptCount interrupts.
 	// We get 2 tacho pulses per revolution, hence 2 interrupts per revolution.
 	// When the fan stops, we get no interrupts and fanInterval stops getting updated. We must recognise this and return zero.
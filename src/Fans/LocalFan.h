@@ -37,6 +37,9 @@ private:
 	IoPort tachoPort;										// port used to read the tacho
 
 	// Variables used to read the tacho
+#if SUPPORT_HARDWARE_TACHO
+	int hardwareTachoChannel;								// the hardware tacho channel we are using, or -1 if we are using interrupts
+#endif
 	static constexpr uint32_t fanMaxInterruptCount = 32;	// number of fan interrupts that we average over
 	uint32_t fanInterruptCount;								// accessed only in ISR, so no need to declare it volatile
 	volatile uint32_t fanLastResetTime;						// time (in step clocks) at which we last reset the interrupt count, accessed inside and outside ISR
@@ -0,0 +1,320 @@
+/*
+ * FirmwareUpdater.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "FirmwareUpdater.h"
+
+#if SAME5x
+
+#include "Platform.h"
+#include "Hardware/Flash.h"
+#include "CAN/CanInterface.h"
+#include "CAN/CanFirmwareStreamMessages.h"
+#include <RTOSIface/RTOSIface.h>
+
+namespace FirmwareUpdater
+{
+	constexpr uint32_t BootloaderSize = 0x00010000;						// must match the value of FirmwareFlashStart in Platform.cpp
+	constexpr uint32_t ImageStart = Flash::OtherBankStart + BootloaderSize;
+	constexpr size_t PageSize = Flash::FlashPageSize;
+	constexpr size_t NumPageBuffers = 4;								// the CAN receiver task fills one buffer while the writer task writes the others
+	constexpr uint32_t WriterTimeout = 1000;							// how long we wait for the writer task to catch up, in milliseconds
+
+	enum class UpdateState : uint8_t
+	{
+		idle = 0,
+		receiving,
+		failed
+	};
+
+	constexpr size_t FirmwareWriterTaskStackWords = 120;
+	static Task<FirmwareWriterTaskStackWords> writerTask;
+
+	static volatile UpdateState state = UpdateState::idle;
+	static uint32_t imageSize = 0;
+	static uint32_t expectedCrc = 0;
+	static uint32_t receivedCrc = 0;
+	static uint32_t bytesReceived = 0;									// the number of contiguous bytes received, only written by the CAN receiver task
+	static uint32_t bytesWritten = 0;									// the number of bytes written to flash, only written by the writer task
+	static uint32_t bytesErased = 0;									// the number of bytes erased ready for the image, only written by the writer task
+	static uint32_t eraseLength = 0;									// the number of bytes we need to erase to hold the image
+	static volatile bool writerBusy = false;							// true while the writer task is erasing or writing
+	static size_t fillIndex = 0;										// the page buffer that the CAN receiver task is filling
+	static size_t writeIndex = 0;										// the next page buffer that the writer task will write
+	static volatile size_t numFullBuffers = 0;
+	static uint32_t chunksOutOfOrder = 0, bufferOverruns = 0, pageWriteFailures = 0, blockEraseFailures = 0;
+	alignas(4) static uint8_t pageBuffers[NumPageBuffers][PageSize];
+
+	// Update a CRC32 using the same polynomial as zlib. We use a nibble-wide table to keep the code small.
+	static uint32_t UpdateCrc(uint32_t crc, const uint8_t *data, size_t length)
+	{
+		static constexpr uint32_t CrcTable[16] =
+		{
+			0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+			0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+		};
+
+		crc = ~crc;
+		while (length != 0)
+		{
+			crc ^= *data++;
+			crc = (crc >> 4) ^ CrcTable[crc & 0x0F];
+			crc = (crc >> 4) ^ CrcTable[crc & 0x0F];
+			--length;
+		}
+		return ~crc;
+	}
+
+	// Return the maximum image size. The SmartEEPROM, if configured, occupies blocks at the end of the flash.
+	static uint32_t GetMaxImageSize()
+	{
+		const uint64_t nvmUserRow0 = *reinterpret_cast<const uint64_t*>(NVMCTRL_USER);
+		const uint32_t seesblk = (nvmUserRow0 >> 32) & 0x0F;
+		return Flash::BankSize - BootloaderSize - (2 * seesblk * Flash::FlashBlockSize);
+	}
+
+	// Wait for the writer task to write all full buffers, and if requested to finish what it is doing. Return true if it did so before the timeout.
+	static bool WaitForWriter(bool waitUntilIdle)
+	{
+		const uint32_t startTime = millis();
+		while (numFullBuffers != 0 || (waitUntilIdle && writerBusy))
+		{
+			if (millis() - startTime > WriterTimeout)
+			{
+				return false;
+			}
+			delay(1);
+		}
+		return true;
+	}
+
+	// Pass the buffer we have been filling to the writer task
+	static void BufferFilled()
+	{
+		fillIndex = (fillIndex + 1) % NumPageBuffers;
+		{
+			AtomicCriticalSectionLocker lock;
+			++numFullBuffers;
+		}
+		writerTask.Give();
+	}
+
+	// Erase the next flash block of the area that will hold the image
+	static void EraseNextBlock()
+	{
+		if (!Flash::EraseOtherBank(ImageStart + bytesErased, Flash::FlashBlockSize))
+		{
+			++blockEraseFailures;
+			state = UpdateState::failed;
+		}
+		bytesErased += Flash::FlashBlockSize;
+	}
+
+	// Task that erases the flash for the image and writes filled page buffers to it and verifies them. Flash erases and writes to the other bank don't stall the processor.
+	// Erasing the whole image area takes a long time, so we erase it a block at a time, keeping ahead of the data when we can.
+	extern "C" [[noreturn]] void FirmwareWriterLoop(void *)
+	{
+		for (;;)
+		{
+			writerBusy = false;
+			TaskBase::Take();
+			writerBusy = true;
+			for (;;)
+			{
+				if (numFullBuffers != 0)
+				{
+					const uint8_t * const page = pageBuffers[writeIndex];
+					const uint32_t address = ImageStart + bytesWritten;
+					if (bytesWritten >= bytesErased)
+					{
+						EraseNextBlock();
+					}
+					if (   !Flash::WriteOtherBank(address, PageSize, page)
+						|| memcmp(reinterpret_cast<const void*>(address), page, PageSize) != 0
+					   )
+					{
+						++pageWriteFailures;
+						state = UpdateState::failed;
+					}
+					bytesWritten += PageSize;
+					writeIndex = (writeIndex + 1) % NumPageBuffers;
+					AtomicCriticalSectionLocker lock;
+					--numFullBuffers;
+				}
+				else if (state == UpdateState::receiving && bytesErased < eraseLength)
+				{
+					EraseNextBlock();
+				}
+				else
+				{
+					break;
+				}
+			}
+		}
+	}
+}
+
+void FirmwareUpdater::Init()
+{
+	(void)Flash::Init();
+	writerTask.Create(FirmwareWriterLoop, "FwWrite", nullptr, TaskPriority::FirmwareUpdatePriority);
+}
+
+// Prepare to receive a new firmware image. Our bootloader is copied to the other flash bank if it isn't already there.
+// We reply without waiting for the image area to be erased, because that takes several seconds. The writer task erases it a block at a time.
+GCodeResult FirmwareUpdater::Start(const CanMessageFirmwareStreamStart& msg, const StringRef& reply)
+{
+	state = UpdateState::idle;											// this stops the writer task erasing for any previous image
+	if (!WaitForWriter(true))
+	{
+		reply.copy("Timeout waiting for previous firmware update to finish");
+		return GCodeResult::error;
+	}
+
+	String<CanMessageFirmwareStreamStart::MaxBoardTypeLength> boardType;
+	boardType.copy(msg.boardType, CanMessageFirmwareStreamStart::MaxBoardTypeLength);
+	if (!StringEqualsIgnoreCase(boardType.c_str(), BoardTypeName))
+	{
+		reply.printf("Board %u is type %s but firmware is for %s", CanInterface::GetCanAddress(), BoardTypeName, boardType.c_str());
+		return GCodeResult::error;
+	}
+
+	if (msg.imageSize == 0 || msg.imageSize > GetMaxImageSize())
+	{
+		reply.printf("Firmware image size %" PRIu32 " is not in range 1 to %" PRIu32, msg.imageSize, GetMaxImageSize());
+		return GCodeResult::error;
+	}
+
+	// After we swap banks, the other bank will be the one we boot from, so it needs a copy of our bootloader
+	if (!Flash::Unlock(Flash::OtherBankStart, Flash::BankSize))
+	{
+		reply.copy("Failed to unlock flash");
+		return GCodeResult::error;
+	}
+
+	if (memcmp(reinterpret_cast<const void*>(FLASH_ADDR), reinterpret_cast<const void*>(Flash::OtherBankStart), BootloaderSize) != 0)
+	{
+		if (   !Flash::EraseOtherBank(Flash::OtherBankStart, BootloaderSize)
+			|| !Flash::WriteOtherBank(Flash::OtherBankStart, BootloaderSize, reinterpret_cast<const uint8_t*>(FLASH_ADDR))
+			|| memcmp(reinterpret_cast<const void*>(FLASH_ADDR), reinterpret_cast<const void*>(Flash::OtherBankStart), BootloaderSize) != 0
+		   )
+		{
+			reply.copy("Failed to copy bootloader");
+			return GCodeResult::error;
+		}
+	}
+
+	eraseLength = ((msg.imageSize + Flash::FlashBlockSize - 1)/Flash::FlashBlockSize) * Flash::FlashBlockSize;
+	imageSize = msg.imageSize;
+	expectedCrc = msg.imageCrc;
+	receivedCrc = 0;
+	bytesReceived = bytesWritten = bytesErased = 0;
+	fillIndex = writeIndex = 0;
+	chunksOutOfOrder = bufferOverruns = pageWriteFailures = blockEraseFailures = 0;
+	state = UpdateState::receiving;
+	writerTask.Give();													// start erasing
+	reply.printf("Board %u ready to receive firmware", CanInterface::GetCanAddress());
+	return GCodeResult::ok;
+}
+
+// Process a chunk of image data. Chunks must arrive in order. We ignore chunks that we already have, and chunks beyond the next byte we need.
+// If we have no buffer space, we drop the chunk. The sender will learn about any missing data when it commits the update.
+void FirmwareUpdater::ProcessData(const CanMessageFirmwareStreamData& msg, size_t dataLength)
+{
+	if (state != UpdateState::receiving || msg.offset != bytesReceived)
+	{
+		if (msg.offset > bytesReceived)
+		{
+			++chunksOutOfOrder;
+		}
+		return;
+	}
+
+	const size_t length = min<size_t>(CanMessageFirmwareStreamData::GetDataLength(dataLength), imageSize - bytesReceived);
+	const size_t offsetInPage = bytesReceived % PageSize;
+	const size_t pagesCompleted = (offsetInPage + length)/PageSize;
+	if (numFullBuffers + pagesCompleted >= NumPageBuffers)
+	{
+		++bufferOverruns;
+		return;
+	}
+
+	receivedCrc = UpdateCrc(receivedCrc, msg.data, length);
+	size_t done = 0;
+	while (done < length)
+	{
+		const size_t pageOffset = bytesReceived % PageSize;
+		const size_t thisLength = min<size_t>(length - done, PageSize - pageOffset);
+		memcpy(pageBuffers[fillIndex] + pageOffset, msg.data + done, thisLength);
+		done += thisLength;
+		bytesReceived += thisLength;
+		if (pageOffset + thisLength == PageSize)
+		{
+			BufferFilled();
+		}
+	}
+
+	// If this is the end of the image, pad and write the last partial page
+	if (bytesReceived == imageSize && bytesReceived % PageSize != 0)
+	{
+		const size_t pageOffset = bytesReceived % PageSize;
+		memset(pageBuffers[fillIndex] + pageOffset, 0xFF, PageSize - pageOffset);
+		BufferFilled();
+	}
+}
+
+// Check that we have received the whole image, verify it, and if it is good then arrange to swap banks and restart
+GCodeResult FirmwareUpdater::Commit(const CanMessageFirmwareStreamCommit& msg, const StringRef& reply)
+{
+	if (state == UpdateState::idle || msg.imageSize != imageSize || msg.imageCrc != expectedCrc)
+	{
+		reply.printf("Board %u has not been prepared for this firmware image", CanInterface::GetCanAddress());
+		return GCodeResult::error;
+	}
+
+	if (!WaitForWriter(false))
+	{
+		reply.copy("Timeout writing firmware to flash");
+		return GCodeResult::error;
+	}
+
+	if (state == UpdateState::failed)
+	{
+		reply.printf("Board %u failed to write firmware to flash", CanInterface::GetCanAddress());
+		return GCodeResult::error;
+	}
+
+	if (bytesReceived != imageSize)
+	{
+		reply.printf("Board %u firmware incomplete, resend from offset %" PRIu32, CanInterface::GetCanAddress(), bytesReceived);
+		return GCodeResult::error;
+	}
+
+	// Check the CRC of the data we received, then the CRC of what is in flash in case anything has been disturbed since we wrote it
+	if (receivedCrc != expectedCrc || UpdateCrc(0, reinterpret_cast<const uint8_t*>(ImageStart), imageSize) != expectedCrc)
+	{
+		state = UpdateState::failed;
+		reply.printf("Board %u firmware CRC mismatch", CanInterface::GetCanAddress());
+		return GCodeResult::error;
+	}
+
+	state = UpdateState::idle;
+	reply.printf("Board %u switching to new firmware", CanInterface::GetCanAddress());
+	Platform::StartBankSwap();
+	return GCodeResult::ok;
+}
+
+void FirmwareUpdater::Diagnostics(const StringRef& reply)
+{
+	if (state != UpdateState::idle || bytesReceived != 0)
+	{
+		reply.lcatf("Firmware update: state %u, received %" PRIu32 "/%" PRIu32 ", out of order %" PRIu32 ", overruns %" PRIu32 ", write failures %" PRIu32 ", erase failures %" PRIu32,
+					(unsigned int)state, bytesReceived, imageSize, chunksOutOfOrder, bufferOverruns, pageWriteFailures, blockEraseFailures);
+	}
+}
+
+#endif
+
+// End
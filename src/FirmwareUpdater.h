@@ -0,0 +1,34 @@
+/*
+ * FirmwareUpdater.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Support for receiving a new firmware image over CAN while the current firmware is running.
+ *  On the SAME5x the image is written to the flash bank that we are not executing from, along with a copy of the bootloader.
+ *  Only when the whole image has been received and verified do we swap banks and restart, so an interrupted update leaves the current firmware intact.
+ */
+
+#ifndef SRC_FIRMWAREUPDATER_H_
+#define SRC_FIRMWAREUPDATER_H_
+
+#include "RepRapFirmware.h"
+#include "GCodes/GCodeResult.h"
+
+#if SAME5x
+
+struct CanMessageFirmwareStreamStart;
+struct CanMessageFirmwareStreamData;
+struct CanMessageFirmwareStreamCommit;
+
+namespace FirmwareUpdater
+{
+	void Init();
+	GCodeResult Start(const CanMessageFirmwareStreamStart& msg, const StringRef& reply);
+	void ProcessData(const CanMessageFirmwareStreamData& msg, size_t dataLength);		// called by the CAN receiver task
+	GCodeResult Commit(const CanMessageFirmwareStreamCommit& msg, const StringRef& reply);
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif
+
+#endif /* SRC_FIRMWAREUPDATER_H_ */
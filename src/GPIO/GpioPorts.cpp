@@ -6,10 +6,112 @@
  */
 
 #include "GpioPorts.h"
+#include "ServoTrajectory.h"
+#include "GpioWriteQueue.h"
 #include <CAN/CanInterface.h>
 #include <CanMessageGenericParser.h>
+#include <Movement/StepTimer.h>
 
 static PwmPort ports[MaxGpOutPorts];
+static bool isServoPort[MaxGpOutPorts] = { 0 };
+static ServoTrajectory trajectories[MaxGpOutPorts];
+static uint32_t whenLastFrame[MaxGpOutPorts];				// step clock time of the last frame in which we advanced a servo move
+
+// Batched writes waiting for their start time are applied by the step timer interrupt, so that they line up with moves to within the interrupt latency.
+// The main task must only access the queue with interrupts disabled. It also writes ports with interrupts disabled, so that the interrupt never finds a port half written.
+// Setting up a PWM timer isn't safe in an interrupt, so when we queue a write we work out the register write that applies it, and the interrupt just does that.
+// When the main task writes a port it may change the way the port is driven, so then it works out the queued register writes for that port again.
+// The interrupt doesn't touch the servo trajectories. Instead it flags the servo ports it has written, and Spin updates their trajectories.
+static GpioWriteQueue pendingWrites;
+static StepTimer writeTimer;
+static volatile bool writtenByIsr[MaxGpOutPorts] = { 0 };
+static float pwmWrittenByIsr[MaxGpOutPorts];
+
+constexpr float MaxUnitsPerFrame = 1.0e6 * ServoTrajectory::UnitsPerMicrosecond;	// a speed or acceleration limit higher than this is as good as none
+
+// Convert between PWM and servo position. The position is the pulse width in units of 1/256 microsecond.
+static float PositionToPwm(int32_t position, PwmFrequency freq)
+{
+	return ((float)position * (float)freq)/(1.0e6 * ServoTrajectory::UnitsPerMicrosecond);
+}
+
+static int32_t PwmToPosition(float pwm, PwmFrequency freq)
+{
+	return lrintf((pwm * 1.0e6 * ServoTrajectory::UnitsPerMicrosecond)/(float)freq);
+}
+
+// Work out the register writes again for the queued writes to a port, because the main task has written it. Called with interrupts disabled.
+// If we can't, discard the queued writes to that port rather than have the interrupt write the wrong register.
+static void PrepareQueuedWrites(size_t portNumber)
+{
+	for (size_t i = 0; i < pendingWrites.GetNumPending(); ++i)
+	{
+		GpioWrite& write = pendingWrites.GetPending(i);
+		if (write.portNumber == portNumber && !ports[portNumber].PrepareWrite(write.pwm, write.prepared))
+		{
+			pendingWrites.Discard(portNumber);
+			break;
+		}
+	}
+}
+
+// Write a port from the main task, superseding any write by the interrupt that we haven't yet seen
+static void WriteHardware(size_t portNumber, float pwm)
+{
+	AtomicCriticalSectionLocker lock;
+	ports[portNumber].WriteAnalog(pwm);
+	writtenByIsr[portNumber] = false;
+	PrepareQueuedWrites(portNumber);
+}
+
+// Record where a servo has been sent so that a later servo move can start from there
+static void TrackServo(size_t portNumber, float pwm)
+{
+	const PwmPort& port = ports[portNumber];
+	if (isServoPort[portNumber])
+	{
+		if (pwm > 0.0 && port.GetFrequency() != 0)
+		{
+			trajectories[portNumber].SetPosition(PwmToPosition(pwm, port.GetFrequency()));
+		}
+		else
+		{
+			trajectories[portNumber].Forget();
+		}
+	}
+}
+
+// Write a port that has already been validated
+static void WritePort(size_t portNumber, float pwm)
+{
+	WriteHardware(portNumber, pwm);
+	TrackServo(portNumber, pwm);
+}
+
+// Step timer callback to apply the batched writes that are due. Also called from the main task with interrupts disabled if a batch is already due when we queue it.
+static void WriteTimerCallback(CallbackParameter)
+{
+	do
+	{
+		GpioWrite writes[GpioWriteQueue::MaxPendingWrites];
+		const size_t numDue = pendingWrites.TakeDue(StepTimer::GetTimerTicks(), writes);
+		for (size_t i = 0; i < numDue; ++i)
+		{
+			const size_t portNumber = writes[i].portNumber;
+			writes[i].prepared.Apply();
+			if (isServoPort[portNumber])
+			{
+				pwmWrittenByIsr[portNumber] = writes[i].pwm;
+				writtenByIsr[portNumber] = true;
+			}
+		}
+	} while (!pendingWrites.IsEmpty() && writeTimer.ScheduleCallbackFromIsr(pendingWrites.GetNextDue()));
+}
+
+void GpioPorts::Init()
+{
+	writeTimer.SetCallback(WriteTimerCallback, CallbackParameter());
+}
 
 GCodeResult GpioPorts::HandleM950Gpio(const CanMessageGeneric &msg, const StringRef &reply)
 {
@@ -44,12 +146,19 @@ GCodeResult GpioPorts::HandleM950Gpio(const CanMessageGeneric &msg, const String
 	String<StringLength50> pinName;
 	if (parser.GetStringParam('C', pinName.GetRef()))
 	{
-		// Creating or destroying a port
+		// Creating or destroying a port. Discard any pending writes first so that the interrupt can't write the port while we change it.
+		{
+			AtomicCriticalSectionLocker lock;
+			pendingWrites.Discard(gpioNumber);
+			writtenByIsr[gpioNumber] = false;
+		}
 		const bool ok = port.AssignPort(pinName.c_str(), reply, PinUsedBy::gpout, (isServo) ? PinAccess::servo : PinAccess::pwm);
 		if (ok && port.IsValid())
 		{
 			port.SetFrequency(freq);
 		}
+		isServoPort[gpioNumber] = ok && port.IsValid() && isServo;
+		trajectories[gpioNumber].Forget();
 		return (ok) ? GCodeResult::ok : GCodeResult::error;
 	}
 	else
@@ -64,6 +173,7 @@ GCodeResult GpioPorts::HandleM950Gpio(const CanMessageGeneric &msg, const String
 		if (seenFreq)
 		{
 			port.SetFrequency(freq);
+			trajectories[gpioNumber].Forget();				// the pulse width has changed, so we no longer know where the servo is
 		}
 		else
 		{
@@ -82,8 +192,195 @@ GCodeResult GpioPorts::HandleGpioWrite(const CanMessageWriteGpio &msg, const Str
 		return GCodeResult::error;
 	}
 
-	ports[msg.portNumber].WriteAnalog(msg.pwm);
+	WritePort(msg.portNumber, msg.pwm);
 	return GCodeResult::ok;
 }
 
+// Write several ports in one message. The P parameter lists the ports and the S parameter the PWM values.
+// If the T parameter is present then it is the master step clock time at which to write them, typically the start time of a move.
+// We check all the ports before writing any, so that either all of them are written or none.
+GCodeResult GpioPorts::HandleGpioWriteMultiple(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, WriteGpioMultipleParams);
+	size_t numPorts;
+	const uint8_t *portNumbers;
+	if (!parser.GetUint8ArrayParam('P', numPorts, portNumbers))
+	{
+		reply.copy("Missing port numbers parameter in WriteGpioMultiple message");
+		return GCodeResult::error;
+	}
+
+	float pwms[GpioWriteQueue::MaxPendingWrites];
+	size_t numPwms = ARRAY_SIZE(pwms);
+	if (!parser.GetFloatArrayParam('S', numPwms, pwms) || numPwms != numPorts)
+	{
+		reply.copy("Missing or wrong number of PWM values in WriteGpioMultiple message");
+		return GCodeResult::error;
+	}
+
+	GpioWrite writes[GpioWriteQueue::MaxPendingWrites];
+	for (size_t i = 0; i < numPorts; ++i)
+	{
+		if (portNumbers[i] >= MaxGpOutPorts || !ports[portNumbers[i]].IsValid())
+		{
+			reply.printf("Board %u does not have GPIO/servo port %u", CanInterface::GetCanAddress(), portNumbers[i]);
+			return GCodeResult::error;
+		}
+		writes[i].portNumber = portNumbers[i];
+		writes[i].pwm = pwms[i];
+	}
+
+	GCodeResult rslt = GCodeResult::ok;
+	uint32_t whenToWrite;
+	if (parser.GetUintParam('T', whenToWrite))
+	{
+		if (!StepTimer::IsSynced())
+		{
+			reply.copy("Clock not synchronised, ports written immediately");
+			rslt = GCodeResult::warning;
+		}
+		else
+		{
+			whenToWrite = StepTimer::ConvertToLocalTime(whenToWrite);
+			if ((int32_t)(whenToWrite - StepTimer::GetTimerTicks()) > 0)
+			{
+				AtomicCriticalSectionLocker lock;
+				for (size_t i = 0; i < numPorts; ++i)
+				{
+					if (!ports[writes[i].portNumber].PrepareWrite(writes[i].pwm, writes[i].prepared))
+					{
+						reply.printf("GPIO/servo port %u can't be written at a specified time", writes[i].portNumber);
+						return GCodeResult::error;
+					}
+				}
+				if (!pendingWrites.Add(whenToWrite, writes, numPorts))
+				{
+					reply.copy("Too many GPIO writes pending");
+					return GCodeResult::error;
+				}
+				if (writeTimer.ScheduleCallbackFromIsr(pendingWrites.GetNextDue()))
+				{
+					WriteTimerCallback(CallbackParameter());
+				}
+				return GCodeResult::ok;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < numPorts; ++i)
+	{
+		WritePort(writes[i].portNumber, writes[i].pwm);
+	}
+	return rslt;
+}
+
+// Start moving a servo towards a new position. The target is a pulse width in microseconds, the speed limit in microseconds/sec and the acceleration limit in microseconds/sec^2.
+// If no speed is given then the servo is sent straight to the target. If no acceleration is given then the servo reaches full speed in one frame.
+// The move is then advanced once per PWM frame by Spin, so the main board only needs to send one message per move.
+GCodeResult GpioPorts::HandleServoMove(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, ServoMoveParams);
+	uint16_t gpioNumber;
+	if (!parser.GetUintParam('P', gpioNumber))
+	{
+		reply.copy("Missing port number parameter in ServoMove message");
+		return GCodeResult::error;
+	}
+	if (gpioNumber >= MaxGpOutPorts || !ports[gpioNumber].IsValid() || !isServoPort[gpioNumber])
+	{
+		reply.printf("Board %u does not have servo port %u", CanInterface::GetCanAddress(), gpioNumber);
+		return GCodeResult::error;
+	}
+
+	PwmPort& port = ports[gpioNumber];
+	const PwmFrequency freq = port.GetFrequency();
+	float pulseWidth;
+	if (!parser.GetFloatParam('T', pulseWidth))
+	{
+		reply.copy("Missing target parameter in ServoMove message");
+		return GCodeResult::error;
+	}
+	if (freq == 0 || pulseWidth < 0.0 || pulseWidth * (float)freq >= 1.0e6)
+	{
+		reply.printf("Servo pulse width %.1fus is out of range", (double)pulseWidth);
+		return GCodeResult::error;
+	}
+
+	ServoTrajectory& trajectory = trajectories[gpioNumber];
+	const int32_t newTarget = lrintf(pulseWidth * ServoTrajectory::UnitsPerMicrosecond);
+	float maxSpeed;
+	if (parser.GetFloatParam('V', maxSpeed) && maxSpeed > 0.0)
+	{
+		float acceleration;
+		if (!parser.GetFloatParam('A', acceleration) || acceleration <= 0.0)
+		{
+			acceleration = maxSpeed * (float)freq;
+		}
+
+		// Convert the limits to units per frame and units per frame per frame
+		const float speedPerFrame = (maxSpeed * ServoTrajectory::UnitsPerMicrosecond)/(float)freq;
+		const float accelerationPerFrame = (acceleration * ServoTrajectory::UnitsPerMicrosecond)/((float)freq * (float)freq);
+		const bool wasMoving = trajectory.IsMoving();
+		trajectory.SetTarget(newTarget, lrintf(min<float>(speedPerFrame, MaxUnitsPerFrame)), lrintf(min<float>(accelerationPerFrame, MaxUnitsPerFrame)));
+		if (!wasMoving)
+		{
+			whenLastFrame[gpioNumber] = StepTimer::GetTimerTicks();
+		}
+	}
+	else
+	{
+		trajectory.SetPosition(newTarget);
+	}
+
+	if (!trajectory.IsMoving())
+	{
+		// We jumped straight to the target, or we were already there
+		WriteHardware(gpioNumber, PositionToPwm(trajectory.GetPosition(), freq));
+	}
+	return GCodeResult::ok;
+}
+
+// Advance any servo moves in progress. This is called from the main loop, which runs much more often than the servo frame rate.
+// The PWM compare register is double buffered, so it doesn't matter when during the frame we update it.
+// If we fall more than a frame behind then we skip the missed frames instead of catching up, so that the servo never exceeds the speed limit.
+void GpioPorts::Spin()
+{
+	const uint32_t now = StepTimer::GetTimerTicks();
+	for (size_t i = 0; i < MaxGpOutPorts; ++i)
+	{
+		// If the interrupt has written a servo port then a timed write has overridden any servo move in progress
+		if (writtenByIsr[i])
+		{
+			float pwm;
+			{
+				AtomicCriticalSectionLocker lock;
+				pwm = pwmWrittenByIsr[i];
+				writtenByIsr[i] = false;
+			}
+			TrackServo(i, pwm);
+		}
+
+		ServoTrajectory& trajectory = trajectories[i];
+		if (trajectory.IsMoving())
+		{
+			const PwmFrequency freq = ports[i].GetFrequency();
+			const uint32_t frameTicks = StepTimer::StepClockRate/freq;
+			const uint32_t ticksSinceLastFrame = now - whenLastFrame[i];
+			if (ticksSinceLastFrame >= frameTicks)
+			{
+				whenLastFrame[i] = (ticksSinceLastFrame >= 2 * frameTicks) ? now : whenLastFrame[i] + frameTicks;
+				if (trajectory.Advance())
+				{
+					AtomicCriticalSectionLocker lock;
+					if (!writtenByIsr[i])						// if the interrupt has just written the port then leave it alone, we will stop the move next time
+					{
+						ports[i].WriteAnalog(PositionToPwm(trajectory.GetPosition(), freq));
+						PrepareQueuedWrites(i);
+					}
+				}
+			}
+		}
+	}
+}
+
 // End
@@ -15,8 +15,12 @@
 
 namespace GpioPorts
 {
+	void Init();
 	GCodeResult HandleM950Gpio(const CanMessageGeneric& msg, const StringRef& reply);
 	GCodeResult HandleGpioWrite(const CanMessageWriteGpio& msg, const StringRef& reply);
+	GCodeResult HandleGpioWriteMultiple(const CanMessageGeneric& msg, const StringRef& reply);
+	GCodeResult HandleServoMove(const CanMessageGeneric& msg, const StringRef& reply);
+	void Spin();													// do any batched writes that are due and advance any servo moves in progress
 }
 
 #endif /* SRC_GPIO_GPODEVICE_H_ */
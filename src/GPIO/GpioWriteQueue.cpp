@@ -0,0 +1,71 @@
+/*
+ * GpioWriteQueue.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "GpioWriteQueue.h"
+
+bool GpioWriteQueue::Add(uint32_t when, const GpioWrite *writes, size_t numWrites)
+{
+	if (numWrites > MaxPendingWrites - numPending)
+	{
+		return false;
+	}
+
+	// Find where the batch goes. It goes after any writes due at the same time, so that they are applied in the order received.
+	size_t insertAt = numPending;
+	while (insertAt != 0 && IsBefore(when, pending[insertAt - 1].when))
+	{
+		--insertAt;
+	}
+
+	for (size_t i = numPending; i > insertAt; )
+	{
+		--i;
+		pending[i + numWrites] = pending[i];
+	}
+
+	for (size_t i = 0; i < numWrites; ++i)
+	{
+		pending[insertAt + i].when = when;
+		pending[insertAt + i].write = writes[i];
+	}
+	numPending += numWrites;
+	return true;
+}
+
+size_t GpioWriteQueue::TakeDue(uint32_t now, GpioWrite writes[MaxPendingWrites])
+{
+	size_t numDue = 0;
+	while (numDue < numPending && !IsBefore(now, pending[numDue].when))
+	{
+		writes[numDue] = pending[numDue].write;
+		++numDue;
+	}
+
+	if (numDue != 0)
+	{
+		for (size_t i = numDue; i < numPending; ++i)
+		{
+			pending[i - numDue] = pending[i];
+		}
+		numPending -= numDue;
+	}
+	return numDue;
+}
+
+void GpioWriteQueue::Discard(uint8_t portNumber)
+{
+	size_t numKept = 0;
+	for (size_t i = 0; i < numPending; ++i)
+	{
+		if (pending[i].write.portNumber != portNumber)
+		{
+			pending[numKept++] = pending[i];
+		}
+	}
+	numPending = numKept;
+}
+
+// End
@@ -0,0 +1,64 @@
+/*
+ * GpioWriteQueue.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Holds GPIO writes that are to be done at a particular step clock time, typically the start time of a move. A batch of writes to several ports
+ *  is added in one go and all of its writes fall due together, so they are applied in the same pass. Writes that are due at the same time are
+ *  applied in the order in which they were added, so a later batch to the same port wins.
+ *
+ *  This file doesn't depend on the hardware, so that the queue can be exercised on a PC.
+ */
+
+#ifndef SRC_GPIO_GPIOWRITEQUEUE_H_
+#define SRC_GPIO_GPIOWRITEQUEUE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <Hardware/PwmRegisterWrite.h>
+
+struct GpioWrite
+{
+	uint8_t portNumber;
+	float pwm;
+	PwmRegisterWrite prepared;											// the register write that applies this PWM value, worked out when the write was queued
+};
+
+class GpioWriteQueue
+{
+public:
+	static constexpr size_t MaxPendingWrites = 16;
+
+	GpioWriteQueue() : numPending(0) { }
+
+	// Add a batch of writes to be done at the specified time. Either the whole batch is added or, if there isn't room, none of it and we return false.
+	bool Add(uint32_t when, const GpioWrite *writes, size_t numWrites);
+
+	// Remove the writes that are due at the specified time and copy them to 'writes' in the order they should be applied, returning the number copied
+	size_t TakeDue(uint32_t now, GpioWrite writes[MaxPendingWrites]);
+
+	// Discard all pending writes to a port, e.g. because it is being reconfigured
+	void Discard(uint8_t portNumber);
+
+	// Get a pending write, so that its prepared register write can be updated
+	GpioWrite& GetPending(size_t index) { return pending[index].write; }
+
+	bool IsEmpty() const { return numPending == 0; }
+	uint32_t GetNextDue() const { return pending[0].when; }			// only valid if the queue is not empty
+	size_t GetNumPending() const { return numPending; }
+
+private:
+	struct PendingWrite
+	{
+		uint32_t when;
+		GpioWrite write;
+	};
+
+	// Return true if time 'a' is before time 'b', allowing for wraparound
+	static bool IsBefore(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+	PendingWrite pending[MaxPendingWrites];								// sorted by time due, soonest first
+	size_t numPending;
+};
+
+#endif /* SRC_GPIO_GPIOWRITEQUEUE_H_ */
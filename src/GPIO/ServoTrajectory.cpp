@@ -0,0 +1,101 @@
+/*
+ * ServoTrajectory.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "ServoTrajectory.h"
+
+void ServoTrajectory::SetPosition(int32_t pos)
+{
+	position = target = pos;
+	speed = 0;
+	positionKnown = true;
+	moving = false;
+}
+
+// Set a new target. If we don't know where the servo is then we have to jump straight to the target.
+void ServoTrajectory::SetTarget(int32_t newTarget, int32_t newMaxSpeed, int32_t newAcceleration)
+{
+	maxSpeed = (newMaxSpeed < 1) ? 1 : newMaxSpeed;
+	acceleration = (newAcceleration < 1) ? 1 : newAcceleration;
+	if (positionKnown)
+	{
+		target = newTarget;
+		moving = (position != target || speed != 0);
+	}
+	else
+	{
+		SetPosition(newTarget);
+	}
+}
+
+// Return the distance we travel if we start decelerating now from the specified speed, which must not be negative
+int64_t ServoTrajectory::BrakingDistance(int32_t currentSpeed) const
+{
+	const int64_t n = currentSpeed/acceleration;							// the number of frames in which we are still moving
+	return n * currentSpeed - (n * (n + 1) * acceleration)/2;
+}
+
+bool ServoTrajectory::Advance()
+{
+	if (!moving)
+	{
+		return false;
+	}
+
+	const int32_t remaining = target - position;
+	if ((speed > 0 && remaining < 0) || (speed < 0 && remaining > 0))
+	{
+		// We are moving away from the target, so slow down before we turn round
+		speed = (speed > 0)
+				? ((speed > acceleration) ? speed - acceleration : 0)
+					: ((-speed > acceleration) ? speed + acceleration : 0);
+		position += speed;
+		return true;
+	}
+
+	const int32_t distance = (remaining >= 0) ? remaining : -remaining;
+	const int32_t currentSpeed = (speed >= 0) ? speed : -speed;
+
+	// Choose the speed for this frame. If the maximum speed has been reduced below the current speed then slowing down towards it counts as accelerating.
+	const int32_t faster = (currentSpeed < maxSpeed)
+							? ((currentSpeed + acceleration < maxSpeed) ? currentSpeed + acceleration : maxSpeed)
+								: ((currentSpeed - acceleration > maxSpeed) ? currentSpeed - acceleration : maxSpeed);
+	int32_t newSpeed;
+	if (distance - faster >= BrakingDistance(faster))
+	{
+		newSpeed = faster;
+	}
+	else if (currentSpeed <= maxSpeed && distance - currentSpeed >= BrakingDistance(currentSpeed))
+	{
+		newSpeed = currentSpeed;
+	}
+	else
+	{
+		newSpeed = (currentSpeed > acceleration) ? currentSpeed - acceleration : 0;
+	}
+
+	// We can always stop within one frame from a speed no greater than the acceleration, so never go slower than that.
+	// This avoids creeping up to the target when the braking distance has been rounded.
+	const int32_t minSpeed = (acceleration < maxSpeed) ? acceleration : maxSpeed;
+	if (newSpeed < minSpeed)
+	{
+		newSpeed = (minSpeed < distance) ? minSpeed : distance;
+	}
+
+	if (newSpeed >= distance)
+	{
+		// We reach the target in this frame
+		position = target;
+		speed = 0;
+		moving = false;
+		return distance != 0;
+	}
+
+	speed = (remaining >= 0) ? newSpeed : -newSpeed;
+	position += speed;
+	return true;
+}
+
+// End
@@ -0,0 +1,51 @@
+/*
+ * ServoTrajectory.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Generates a trapezoidal speed profile for a servo one frame at a time, so that the servo can be moved to a target position with
+ *  limited speed and acceleration without needing a CAN message per frame. Positions are servo pulse widths in units of 1/256 microsecond,
+ *  speeds are in units per frame and accelerations in units per frame per frame. Each frame we accelerate if we could still stop at
+ *  the target after doing so, else cruise if we could still stop, else decelerate. This never overshoots the target.
+ *  A new target can be set while moving, in which case we decelerate first if we are moving the wrong way.
+ *
+ *  This file doesn't depend on the hardware, so that the trajectory generator can be exercised on a PC.
+ */
+
+#ifndef SRC_GPIO_SERVOTRAJECTORY_H_
+#define SRC_GPIO_SERVOTRAJECTORY_H_
+
+#include <cstdint>
+
+class ServoTrajectory
+{
+public:
+	static constexpr int32_t UnitsPerMicrosecond = 256;
+
+	ServoTrajectory() : position(0), target(0), speed(0), maxSpeed(1), acceleration(1), positionKnown(false), moving(false) { }
+
+	void SetPosition(int32_t pos);											// jump to the specified position, stopping any movement
+	void SetTarget(int32_t newTarget, int32_t newMaxSpeed, int32_t newAcceleration);
+	void Forget() { positionKnown = moving = false; }						// called when the servo output is turned off
+
+	bool Advance();															// advance by one frame, returning true if the position changed
+
+	int32_t GetPosition() const { return position; }
+	int32_t GetTarget() const { return target; }
+	int32_t GetSpeed() const { return speed; }
+	bool IsPositionKnown() const { return positionKnown; }
+	bool IsMoving() const { return moving; }
+
+private:
+	int64_t BrakingDistance(int32_t currentSpeed) const;
+
+	int32_t position;
+	int32_t target;
+	int32_t speed;															// signed
+	int32_t maxSpeed;
+	int32_t acceleration;
+	bool positionKnown;
+	bool moving;
+};
+
+#endif /* SRC_GPIO_SERVOTRAJECTORY_H_ */
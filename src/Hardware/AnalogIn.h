@@ -11,6 +11,7 @@
 #include "RepRapFirmware.h"
 
 typedef void (*AnalogInCallbackFunction)(CallbackParameter p, uint16_t reading);
+typedef void (*AnalogThresholdCallbackFunction)(CallbackParameter p, bool state, uint32_t whenChanged);
 
 namespace AnalogIn
 {
@@ -34,6 +35,13 @@ namespace AnalogIn
 	// Set ticksPerCall to 0 to get a callback on every reading.
 	bool SetCallback(Pin pin, AnalogInCallbackFunction fn, CallbackParameter param, uint32_t ticksPerCall, bool useAlternateAdc);
 
+#if SAME5x
+	// Compare every reading from an enabled channel with a pair of thresholds as soon as the ADC sequence completes.
+	// When the reading reaches the upper threshold or falls below the lower threshold, the callback function is called from the DMA interrupt
+	// with the new state and the step clock time at which the reading was taken. Pass a null callback function to stop comparing the readings.
+	bool SetThresholdCallback(Pin pin, AnalogThresholdCallbackFunction fn, CallbackParameter param, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState, bool useAlternateAdc);
+#endif
+
 	// Return whether or not the channel is enabled
 	bool IsChannelEnabled(Pin pin, bool useAlternateAdc = false);
 
@@ -14,6 +14,8 @@
 #include "DmacManager.h"
 #include "IoPorts.h"
 #include "Interrupts.h"
+#include "AnalogThresholds.h"
+#include <Movement/StepTimer.h>
 
 constexpr uint32_t AdcConversionTimeout = 5;		// milliseconds
 
@@ -53,6 +55,7 @@ public:
 	State GetState() const { return state; }
 	bool EnableChannel(unsigned int chan, AnalogInCallbackFunction fn, CallbackParameter param, uint32_t p_ticksPerCall);
 	bool SetCallback(unsigned int chan, AnalogInCallbackFunction fn, CallbackParameter param, uint32_t p_ticksPerCall);
+	bool SetThresholdCallback(unsigned int chan, AnalogThresholdCallbackFunction fn, CallbackParameter param, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState);
 	bool IsChannelEnabled(unsigned int chan) const;
 	bool StartConversion(TaskBase *p_taskToWake);
 	uint16_t ReadChannel(unsigned int chan) const { return resultsByChannel[chan]; }
@@ -69,6 +72,7 @@ private:
 
 	static constexpr size_t NumAdcChannels = 32;			// number of channels per ADC including temperature sensor inputs etc.
 	static constexpr size_t MaxSequenceLength = 16;			// the maximum length of the read sequence
+	static_assert(MaxSequenceLength <= AnalogThresholds::MaxReadings, "Too many readings for the threshold detector");
 
 	Adc * const device;
 	const IRQn irqn;
@@ -80,11 +84,15 @@ private:
 	volatile uint32_t channelsEnabled;
 	TaskBase * volatile taskToWake;
 	uint32_t whenLastConversionStarted;
+	uint32_t stepTicksAtConversionStart;					// the step clock when we started the conversion, so that we can time stamp threshold crossings
 	volatile State state;
 	AnalogInCallbackFunction callbackFunctions[MaxSequenceLength];
 	CallbackParameter callbackParams[MaxSequenceLength];
 	uint32_t ticksPerCall[MaxSequenceLength];
 	uint32_t ticksAtLastCall[MaxSequenceLength];
+	AnalogThresholds thresholds;							// threshold detector, checked in the DMA completion interrupt
+	AnalogThresholdCallbackFunction thresholdCallbackFunctions[MaxSequenceLength];
+	CallbackParameter thresholdCallbackParams[MaxSequenceLength];
 	uint32_t inputRegisters[MaxSequenceLength * DmaDwordsPerChannel];
 	volatile uint16_t results[MaxSequenceLength];
 	volatile uint16_t resultsByChannel[NumAdcChannels];		// must be large enough to handle PTAT and CTAT temperature sensor inputs
@@ -92,12 +100,14 @@ private:
 
 AdcClass::AdcClass(Adc * const p_device, IRQn p_irqn, DmaChannel p_dmaChan, DmaTrigSource p_trigSrc)
 	: device(p_device), irqn(p_irqn), dmaChan(p_dmaChan), trigSrc(p_trigSrc),
-	  numChannelsEnabled(0), numChannelsConverting(0), channelsEnabled(0), taskToWake(nullptr), whenLastConversionStarted(0), state(State::noChannels)
+	  numChannelsEnabled(0), numChannelsConverting(0), channelsEnabled(0), taskToWake(nullptr), whenLastConversionStarted(0), stepTicksAtConversionStart(0), state(State::noChannels)
 {
 	for (size_t i = 0; i < MaxSequenceLength; ++i)
 	{
 		callbackFunctions[i] = nullptr;
 		callbackParams[i].u32 = 0;
+		thresholdCallbackFunctions[i] = nullptr;
+		thresholdCallbackParams[i].u32 = 0;
 	}
 	for (volatile uint16_t& r : resultsByChannel)
 	{
@@ -136,6 +146,30 @@ bool AdcClass::SetCallback(unsigned int chan, AnalogInCallbackFunction fn, Callb
 	return false;
 }
 
+bool AdcClass::SetThresholdCallback(unsigned int chan, AnalogThresholdCallbackFunction fn, CallbackParameter param, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState)
+{
+	for (size_t i = 0; i < numChannelsEnabled; ++i)
+	{
+		if (GetChannel(i) == chan)
+		{
+			const irqflags_t flags = cpu_irq_save();
+			thresholdCallbackFunctions[i] = fn;
+			thresholdCallbackParams[i] = param;
+			if (fn == nullptr)
+			{
+				thresholds.Disable(i);
+			}
+			else
+			{
+				thresholds.Enable(i, lowerThreshold, upperThreshold, initialState);
+			}
+			cpu_irq_restore(flags);
+			return true;
+		}
+	}
+	return false;
+}
+
 bool AdcClass::IsChannelEnabled(unsigned int chan) const
 {
 	return (channelsEnabled & (1ul << chan)) != 0;
@@ -299,6 +333,7 @@ bool AdcClass::StartConversion(TaskBase *p_taskToWake)
 		InterruptCriticalSectionLocker lock;
 
 		dmaFinishedReason = DmaCallbackReason::none;
+		stepTicksAtConversionStart = StepTimer::GetTimerTicks();
 		DmacManager::EnableCompletedInterrupt(dmaChan + 1);
 
 		DmacManager::EnableChannel(dmaChan + 1, DmacPrioAdcRx);
@@ -339,6 +374,27 @@ void AdcClass::ResultReadyCallback(DmaCallbackReason reason)
 	++conversionsCompleted;
 	DmacManager::DisableChannel(dmaChan);			// disable the sequencer DMA, just in case it is out of sync
 	DmacManager::DisableChannel(dmaChan + 1);		// disable the reader DMA too
+
+	// Check the thresholds here rather than in the AIN task, so that a threshold crossing is reported as soon as the sequence completes.
+	// The channels are converted one after another, so we estimate when each reading was taken from its position in the sequence.
+	if (reason == DmaCallbackReason::complete && thresholds.IsAnyEnabled())
+	{
+		uint32_t changed = thresholds.Check(results, numChannelsConverting);
+		if (changed != 0)
+		{
+			const uint32_t sequenceTicks = StepTimer::GetTimerTicks() - stepTicksAtConversionStart;
+			for (size_t i = 0; changed != 0; ++i)
+			{
+				if ((changed & 1u) != 0 && thresholdCallbackFunctions[i] != nullptr)
+				{
+					const uint32_t whenChanged = stepTicksAtConversionStart + (sequenceTicks * (i + 1))/numChannelsConverting;
+					thresholdCallbackFunctions[i](thresholdCallbackParams[i], thresholds.GetState(i), whenChanged);
+				}
+				changed >>= 1;
+			}
+		}
+	}
+
 	if (taskToWake != nullptr)
 	{
 		taskToWake->GiveFromISR();
@@ -454,6 +510,20 @@ bool AnalogIn::SetCallback(Pin pin, AnalogInCallbackFunction fn, CallbackParamet
 	return false;
 }
 
+// Compare every reading with a pair of thresholds in the DMA completion interrupt, calling the callback function when the state changes
+bool AnalogIn::SetThresholdCallback(Pin pin, AnalogThresholdCallbackFunction fn, CallbackParameter param, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState, bool useAlternateAdc)
+{
+	if (pin < ARRAY_SIZE(PinTable))
+	{
+		const AdcInput adcin = IoPort::PinToAdcInput(pin, useAlternateAdc);
+		if (adcin != AdcInput::none)
+		{
+			return Adcs[GetDeviceNumber(adcin)].SetThresholdCallback(GetInputNumber(adcin), fn, param, lowerThreshold, upperThreshold, initialState);
+		}
+	}
+	return false;
+}
+
 // Return whether or not the channel is enabled
 bool AnalogIn::IsChannelEnabled(Pin pin, bool useAlternateAdc)
 {
@@ -22,6 +22,32 @@
 
 namespace AnalogOut
 {
+	static volatile Tc* const TcDevices[] =
+	{
+		TC0, TC1, TC2, TC3, TC4,
+#if SAME5x
+		TC5		// TC6 and TC7 exist but are reserved for the step clock
+#endif
+	};
+	static uint16_t tcFreq[ARRAY_SIZE(TcDevices)] = { 0 };
+	static uint32_t tcTop[ARRAY_SIZE(TcDevices)] = { 0 };
+
+	static volatile Tcc* const TccDevices[] =
+	{
+		TCC0, TCC1, TCC2,
+#if SAME5x
+		TCC3, TCC4
+#endif
+	};
+	static constexpr unsigned int TccCounterBits[ARRAY_SIZE(TccDevices)] =
+	{
+		24, 24, 16,
+#if SAME5x
+		16, 16
+#endif
+	};
+	static uint16_t tccFreq[ARRAY_SIZE(TccDevices)] = { 0 };
+	static uint32_t tccTop[ARRAY_SIZE(TccDevices)] = { 0 };
 
 	// Convert a float in 0..1 to unsigned integer in 0..N
 	static inline uint32_t ConvertRange(float f, uint32_t top)
@@ -31,6 +57,12 @@ namespace AnalogOut
 		return lrintf(f * (float)(top + 1));
 	}
 
+	// Convert a float in 0..1 to a TC compare value, which must fit in 16 bits
+	static inline uint16_t ConvertRangeTc(float f, uint32_t top)
+	{
+		return (uint16_t)min<uint32_t>(ConvertRange(f, top), 0xFFFF);
+	}
+
 	// Choose the most appropriate prescaler for the PWM frequency we want.
 	// Some TCs share a clock selection, so we always use GCLK1 as the clock
 	// 'counterBits' is either 16 or 8
@@ -50,19 +82,76 @@ namespace AnalogOut
 		return ARRAY_SIZE(PrescalerShifts) - 1;
 	}
 
-	// Write PWM to the specified TC device. 'output' may be 0 or 1.
-	static bool AnalogWriteTc(Pin pin, unsigned int device, unsigned int output, float val, PwmFrequency freq)
+	// Return true if the pin is connected to the specified peripheral function
+	static bool IsPinFunction(Pin pin, uint32_t peri)
+	{
+		const PortGroup& group = PORT->Group[GPIO_PORT(pin)];
+		const uint32_t pinInGroup = GPIO_PIN(pin);
+		if (!group.PINCFG[pinInGroup].bit.PMUXEN)
+		{
+			return false;
+		}
+		const uint32_t pmux = (pinInGroup & 1) ? group.PMUX[pinInGroup >> 1].bit.PMUXO : group.PMUX[pinInGroup >> 1].bit.PMUXE;
+		return pmux == peri;
+	}
+
+	// Set up a TC to generate PWM at the specified frequency and start it. 'output' may be 0 or 1.
+	static void ConfigureTc(unsigned int device, unsigned int output, float val, PwmFrequency freq)
 	{
-		static volatile Tc* const TcDevices[] =
+		volatile Tc * const tcdev = TcDevices[device];
+		const uint32_t prescaler = ChoosePrescaler(freq, 16, tcTop[device]);
+		if (output == 0)
 		{
-			TC0, TC1, TC2, TC3, TC4,
+			// We need to use CC0 for the compare output, so we can't use it to define TOP. We will get a lower frequency than requested.
+			// TODO see if we can use 8-bit mode instead
+			tcTop[device] = 0xFFFF;
+		}
+
+		const uint16_t cc = ConvertRangeTc(val, tcTop[device]);
+
+		if (tcFreq[device] == 0)
+		{
+			EnableTcClock(device,
 #if SAME5x
-			TC5		// TC6 and TC7 exist but are reserved for the step clock
+				GCLK_PCHCTRL_GEN_GCLK1_Val
+#elif SAMC21
+				GCLK_PCHCTRL_GEN_GCLK0_Val
 #endif
-		};
-		static uint16_t tcFreq[ARRAY_SIZE(TcDevices)] = { 0 };
-		static uint32_t tcTop[ARRAY_SIZE(TcDevices)] = { 0 };
+				);
 
+			// Initialise the TC
+			hri_tc_clear_CTRLA_ENABLE_bit(tcdev);
+			hri_tc_set_CTRLA_SWRST_bit(tcdev);
+			tcdev->COUNT16.CTRLA.bit.MODE = TC_CTRLA_MODE_COUNT16_Val;
+			if (output == 0)
+			{
+				tcdev->COUNT16.WAVE.bit.WAVEGEN = TC_WAVE_WAVEGEN_NPWM_Val;
+			}
+			else
+			{
+				tcdev->COUNT16.WAVE.bit.WAVEGEN = TC_WAVE_WAVEGEN_MPWM_Val;
+			}
+		}
+		else
+		{
+			hri_tc_clear_CTRLA_ENABLE_bit(tcdev);
+		}
+		tcdev->COUNT16.CTRLA.bit.PRESCALER = prescaler;
+		if (output != 0)
+		{
+			tcdev->COUNT16.CC[0].bit.CC = tcTop[device];
+			tcdev->COUNT16.CCBUF[0].bit.CCBUF = tcTop[device];
+		}
+		tcdev->COUNT16.CC[output].bit.CC = cc;
+		tcdev->COUNT16.CCBUF[output].bit.CCBUF = cc;
+		hri_tc_set_CTRLA_ENABLE_bit(tcdev);
+		hri_tccount16_write_COUNT_COUNT_bf(tcdev, 0);
+		tcFreq[device] = freq;
+	}
+
+	// Write PWM to the specified TC device. 'output' may be 0 or 1.
+	static bool AnalogWriteTc(Pin pin, unsigned int device, unsigned int output, float val, PwmFrequency freq)
+	{
 		if (device < ARRAY_SIZE(TcDevices))
 		{
 			if (freq == 0)
@@ -71,63 +160,14 @@ namespace AnalogOut
 				return false;
 			}
 
-			volatile Tc * const tcdev = TcDevices[device];
 			if (freq != tcFreq[device])
 			{
-				const uint32_t prescaler = ChoosePrescaler(freq, 16, tcTop[device]);
-				if (output == 0)
-				{
-					// We need to use CC0 for the compare output, so we can't use it to define TOP. We will get a lower frequency than requested.
-					// TODO see if we can use 8-bit mode instead
-					tcTop[device] = 0xFFFF;
-				}
-
-				const uint32_t cc = ConvertRange(val, tcTop[device]);
-
-				if (tcFreq[device] == 0)
-				{
-					EnableTcClock(device,
-#if SAME5x
-						GCLK_PCHCTRL_GEN_GCLK1_Val
-#elif SAMC21
-						GCLK_PCHCTRL_GEN_GCLK0_Val
-#endif
-						);
-
-					// Initialise the TC
-					hri_tc_clear_CTRLA_ENABLE_bit(tcdev);
-					hri_tc_set_CTRLA_SWRST_bit(tcdev);
-					tcdev->COUNT16.CTRLA.bit.MODE = TC_CTRLA_MODE_COUNT16_Val;
-					if (output == 0)
-					{
-						tcdev->COUNT16.WAVE.bit.WAVEGEN = TC_WAVE_WAVEGEN_NPWM_Val;
-					}
-					else
-					{
-						tcdev->COUNT16.WAVE.bit.WAVEGEN = TC_WAVE_WAVEGEN_MPWM_Val;
-					}
-				}
-				else
-				{
-					hri_tc_clear_CTRLA_ENABLE_bit(tcdev);
-				}
-				tcdev->COUNT16.CTRLA.bit.PRESCALER = prescaler;
-				if (output != 0)
-				{
-					tcdev->COUNT16.CC[0].bit.CC = tcTop[device];
-					tcdev->COUNT16.CCBUF[0].bit.CCBUF = tcTop[device];
-				}
-				tcdev->COUNT16.CC[output].bit.CC = cc;
-				tcdev->COUNT16.CCBUF[output].bit.CCBUF = cc;
-				hri_tc_set_CTRLA_ENABLE_bit(tcdev);
-				hri_tccount16_write_COUNT_COUNT_bf(tcdev, 0);
-				tcFreq[device] = freq;
+				ConfigureTc(device, output, val, freq);
 			}
 			else
 			{
 				// Just update the compare register
-				const uint16_t cc = ConvertRange(val, tcTop[device]);
-				hri_tccount16_write_CCBUF_CCBUF_bf(tcdev, output, cc);
+				hri_tccount16_write_CCBUF_CCBUF_bf(TcDevices[device], output, ConvertRangeTc(val, tcTop[device]));
 			}
 
 			gpio_set_pin_function(pin, GPIO_PIN_FUNCTION_E);			// TCs are all on peripheral select E
@@ -136,26 +176,89 @@ namespace AnalogOut
 		return false;
 	}
 
-	// Write PWM to the specified TCC device. 'output' may be 0..5.
-	static bool AnalogWriteTcc(Pin pin, unsigned int device, unsigned int output, unsigned int peri, float val, PwmFrequency freq)
+	// Prepare a PWM write to the specified TC device that an interrupt can apply by writing the compare buffer register.
+	// If the pin is a digital output then we connect it to the TC with a compare value that keeps the output at its present level.
+	static bool PrepareWriteTc(Pin pin, unsigned int device, unsigned int output, float val, PwmFrequency freq, PwmRegisterWrite& pw)
 	{
-		static volatile Tcc* const TccDevices[] =
+		if (device >= ARRAY_SIZE(TcDevices) || freq == 0)
 		{
-			TCC0, TCC1, TCC2,
-#if SAME5x
-			TCC3, TCC4
-#endif
-		};
-		static constexpr unsigned int TccCounterBits[ARRAY_SIZE(TccDevices)] =
+			return false;
+		}
+
+		if (!IsPinFunction(pin, GPIO_PIN_FUNCTION_E))
 		{
-			24, 24, 16,
+			if (PORT->Group[GPIO_PORT(pin)].PINCFG[GPIO_PIN(pin)].bit.PMUXEN)
+			{
+				return false;											// the pin is in use by another peripheral
+			}
+			const float level = (PORT->Group[GPIO_PORT(pin)].OUT.reg & (1ul << GPIO_PIN(pin))) ? 1.0 : 0.0;
+			if (freq != tcFreq[device])
+			{
+				ConfigureTc(device, output, level, freq);
+			}
+			else
+			{
+				// The TC is running, so wait for the CC write to be synchronised before we connect the pin. Write CCBUF first so that a pending update can't overwrite CC.
+				const uint16_t cc = ConvertRangeTc(level, tcTop[device]);
+				hri_tccount16_write_CCBUF_CCBUF_bf(TcDevices[device], output, cc);
+				hri_tccount16_write_CC_CC_bf(TcDevices[device], output, cc);
+			}
+			gpio_set_pin_function(pin, GPIO_PIN_FUNCTION_E);
+		}
+		else if (freq != tcFreq[device])
+		{
+			return false;												// the pin is already generating PWM at a different frequency
+		}
+
+		pw.reg = &TcDevices[device]->COUNT16.CCBUF[output].reg;
+		pw.value = ConvertRangeTc(val, tcTop[device]);
+		pw.is16Bit = true;
+		return true;
+	}
+
+	// Set up a TCC to generate PWM at the specified frequency and start it. 'output' may be 0..5.
+	static void ConfigureTcc(unsigned int device, unsigned int output, float val, PwmFrequency freq)
+	{
+		volatile Tcc * const tccdev = TccDevices[device];
+		const uint32_t prescaler = ChoosePrescaler(freq, TccCounterBits[device], tccTop[device]);
+		const uint32_t cc = ConvertRange(val, tccTop[device]);
+
+		if (tccFreq[device] == 0)
+		{
+			EnableTccClock(device,
 #if SAME5x
-			16, 16
+				GCLK_PCHCTRL_GEN_GCLK1_Val
+#elif SAMC21
+				GCLK_PCHCTRL_GEN_GCLK0_Val
 #endif
-		};
-		static uint16_t tccFreq[ARRAY_SIZE(TccDevices)] = { 0 };
-		static uint32_t tccTop[ARRAY_SIZE(TccDevices)] = { 0 };
+				);
+
+			// Initialise the TCC
+			hri_tcc_clear_CTRLA_ENABLE_bit(tccdev);
+			hri_tcc_set_CTRLA_SWRST_bit(tccdev);
+			tccdev->CTRLA.bit.PRESCALER = prescaler;
+			tccdev->CTRLA.bit.RESOLUTION = 0;
+			hri_tcc_write_WAVE_WAVEGEN_bf(tccdev, TCC_WAVE_WAVEGEN_NPWM_Val);
+		}
+		else
+		{
+			hri_tcc_clear_CTRLA_ENABLE_bit(tccdev);
+			hri_tcc_write_CTRLA_PRESCALER_bf(tccdev, prescaler);
+		}
 
+		tccdev->PERBUF.bit.PERBUF = tccTop[device];
+		tccdev->PER.bit.PER = tccTop[device];
+		tccdev->CCBUF[output].bit.CCBUF = cc;
+		tccdev->CC[output].bit.CC = cc;
+		hri_tcc_set_CTRLA_ENABLE_bit(tccdev);
+		hri_tcc_write_COUNT_reg(tccdev, 0);
+
+		tccFreq[device] = freq;
+	}
+
+	// Write PWM to the specified TCC device. 'output' may be 0..5.
+	static bool AnalogWriteTcc(Pin pin, unsigned int device, unsigned int output, unsigned int peri, float val, PwmFrequency freq)
+	{
 		if (device < ARRAY_SIZE(TccDevices))
 		{
 			if (freq == 0)
@@ -164,49 +267,14 @@ namespace AnalogOut
 				return false;
 			}
 
-			volatile Tcc * const tccdev = TccDevices[device];
 			if (freq != tccFreq[device])
 			{
-				const uint32_t prescaler = ChoosePrescaler(freq, TccCounterBits[device], tccTop[device]);
-				const uint32_t cc = ConvertRange(val, tccTop[device]);
-
-				if (tccFreq[device] == 0)
-				{
-					EnableTccClock(device,
-#if SAME5x
-						GCLK_PCHCTRL_GEN_GCLK1_Val
-#elif SAMC21
-						GCLK_PCHCTRL_GEN_GCLK0_Val
-#endif
-						);
-
-					// Initialise the TCC
-					hri_tcc_clear_CTRLA_ENABLE_bit(tccdev);
-					hri_tcc_set_CTRLA_SWRST_bit(tccdev);
-					tccdev->CTRLA.bit.PRESCALER = prescaler;
-					tccdev->CTRLA.bit.RESOLUTION = 0;
-					hri_tcc_write_WAVE_WAVEGEN_bf(tccdev, TCC_WAVE_WAVEGEN_NPWM_Val);
-				}
-				else
-				{
-					hri_tcc_clear_CTRLA_ENABLE_bit(tccdev);
-					hri_tcc_write_CTRLA_PRESCALER_bf(tccdev, prescaler);
-				}
-
-				tccdev->PERBUF.bit.PERBUF = tccTop[device];
-				tccdev->PER.bit.PER = tccTop[device];
-				tccdev->CCBUF[output].bit.CCBUF = cc;
-				tccdev->CC[output].bit.CC = cc;
-				hri_tcc_set_CTRLA_ENABLE_bit(tccdev);
-				hri_tcc_write_COUNT_reg(tccdev, 0);
-
-				tccFreq[device] = freq;
+				ConfigureTcc(device, output, val, freq);
 			}
 			else
 			{
 				// Just update the compare register
-				const uint32_t cc = ConvertRange(val, tccTop[device]);
-				hri_tcc_write_CCBUF_CCBUF_bf(tccdev, output, cc);
+				hri_tcc_write_CCBUF_CCBUF_bf(TccDevices[device], output, ConvertRange(val, tccTop[device]));
 			}
 
 			gpio_set_pin_function(pin, peri);
@@ -214,6 +282,46 @@ namespace AnalogOut
 		}
 		return false;
 	}
+
+	// Prepare a PWM write to the specified TCC device that an interrupt can apply by writing the compare buffer register.
+	// If the pin is a digital output then we connect it to the TCC with a compare value that keeps the output at its present level.
+	static bool PrepareWriteTcc(Pin pin, unsigned int device, unsigned int output, unsigned int peri, float val, PwmFrequency freq, PwmRegisterWrite& pw)
+	{
+		if (device >= ARRAY_SIZE(TccDevices) || freq == 0)
+		{
+			return false;
+		}
+
+		if (!IsPinFunction(pin, peri))
+		{
+			if (PORT->Group[GPIO_PORT(pin)].PINCFG[GPIO_PIN(pin)].bit.PMUXEN)
+			{
+				return false;											// the pin is in use by another peripheral
+			}
+			const float level = (PORT->Group[GPIO_PORT(pin)].OUT.reg & (1ul << GPIO_PIN(pin))) ? 1.0 : 0.0;
+			if (freq != tccFreq[device])
+			{
+				ConfigureTcc(device, output, level, freq);
+			}
+			else
+			{
+				// The TCC is running, so wait for the CC write to be synchronised before we connect the pin. Write CCBUF first so that a pending update can't overwrite CC.
+				const uint32_t cc = ConvertRange(level, tccTop[device]);
+				hri_tcc_write_CCBUF_CCBUF_bf(TccDevices[device], output, cc);
+				hri_tcc_write_CC_CC_bf(TccDevices[device], output, cc);
+			}
+			gpio_set_pin_function(pin, peri);
+		}
+		else if (freq != tccFreq[device])
+		{
+			return false;												// the pin is already generating PWM at a different frequency
+		}
+
+		pw.reg = &TccDevices[device]->CCBUF[output].reg;
+		pw.value = ConvertRange(val, tccTop[device]);
+		pw.is16Bit = false;
+		return true;
+	}
 }
 
 // Initialise this module
@@ -262,4 +370,36 @@ void AnalogOut::Write(Pin pin, float val, PwmFrequency freq)
 	IoPort::SetPinMode(pin, (val < 0.5) ? OUTPUT_LOW : OUTPUT_HIGH);
 }
 
+// Prepare a write to a pin so that an interrupt can apply it later with a single register store. Called from task context.
+// We can do this if the value is 0 or 1 and the pin is a digital output, or if the pin can be driven by a TC or TCC.
+// Preparing a write may connect the pin to its timer, but doesn't change the output until the write is applied.
+// A prepared write to a timer compare register stays valid until the timer frequency is changed or the pin is reconfigured.
+bool AnalogOut::PrepareWrite(Pin pin, float val, PwmFrequency freq, PwmRegisterWrite& pw)
+{
+	if (pin >= ARRAY_SIZE(PinTable) || std::isnan(val))
+	{
+		return false;
+	}
+
+	val = constrain<float>(val, 0.0, 1.0);
+	PortGroup& group = PORT->Group[GPIO_PORT(pin)];
+	const uint32_t mask = 1ul << GPIO_PIN(pin);
+	if ((val == 0.0 || val == 1.0) && !group.PINCFG[GPIO_PIN(pin)].bit.PMUXEN && (group.DIR.reg & mask) != 0)
+	{
+		pw.reg = (val == 0.0) ? &group.OUTCLR.reg : &group.OUTSET.reg;
+		pw.value = mask;
+		pw.is16Bit = false;
+		return true;
+	}
+
+	const TcOutput tc = PinTable[pin].tc;
+	if (tc != TcOutput::none && PrepareWriteTc(pin, GetDeviceNumber(tc), GetOutputNumber(tc), val, freq, pw))
+	{
+		return true;
+	}
+
+	const TccOutput tcc = PinTable[pin].tcc;
+	return tcc != TccOutput::none && PrepareWriteTcc(pin, GetDeviceNumber(tcc), GetOutputNumber(tcc), GetPeriNumber(tcc), val, freq, pw);
+}
+
 // End
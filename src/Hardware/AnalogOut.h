@@ -9,6 +9,7 @@
 #define SRC_HARDWARE_ANALOGOUT_H_
 
 #include "RepRapFirmware.h"
+#include "PwmRegisterWrite.h"
 
 namespace AnalogOut
 {
@@ -17,6 +18,9 @@ namespace AnalogOut
 
 	// Write a PWM value to the specified pin. 'val' will be constrained to be between 0.0 and 1.0 in this module.
 	extern void Write(Pin pin, float val, PwmFrequency freq = 500);
+
+	// Prepare a write to the specified pin that an interrupt can apply later, returning false if the pin can't be written that way
+	extern bool PrepareWrite(Pin pin, float val, PwmFrequency freq, PwmRegisterWrite& pw);
 }
 
 #endif /* SRC_HARDWARE_ANALOGOUT_H_ */
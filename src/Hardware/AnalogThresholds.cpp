@@ -0,0 +1,45 @@
+/*
+ * AnalogThresholds.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "AnalogThresholds.h"
+
+void AnalogThresholds::Enable(size_t index, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState)
+{
+	const uint32_t bit = 1ul << index;
+	lower[index] = lowerThreshold;
+	upper[index] = upperThreshold;
+	states = (initialState) ? states | bit : states & ~bit;
+	enabled |= bit;
+}
+
+uint32_t AnalogThresholds::Check(const volatile uint16_t *readings, size_t numReadings)
+{
+	const uint32_t toCheck = (numReadings < MaxReadings) ? enabled & ((1ul << numReadings) - 1) : enabled;
+	uint32_t changed = 0;
+	for (size_t i = 0; (toCheck >> i) != 0; ++i)
+	{
+		const uint32_t bit = 1ul << i;
+		if ((toCheck & bit) != 0)
+		{
+			const uint16_t reading = readings[i];
+			if ((states & bit) != 0)
+			{
+				if (reading < lower[i])
+				{
+					changed |= bit;
+				}
+			}
+			else if (reading >= upper[i])
+			{
+				changed |= bit;
+			}
+		}
+	}
+	states ^= changed;
+	return changed;
+}
+
+// End
@@ -0,0 +1,42 @@
+/*
+ * AnalogThresholds.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Compares a batch of ADC readings with a pair of thresholds per reading, to detect when an analog input crosses a threshold.
+ *  The state of an input goes high when its reading reaches the upper threshold and low when its reading falls below the lower threshold,
+ *  so the gap between the thresholds provides hysteresis. The readings are indexed by their position in the ADC conversion sequence.
+ *
+ *  This file doesn't depend on the hardware, so that the detection can be exercised on a PC using synthetic waveforms.
+ */
+
+#ifndef SRC_HARDWARE_ANALOGTHRESHOLDS_H_
+#define SRC_HARDWARE_ANALOGTHRESHOLDS_H_
+
+#include <cstdint>
+#include <cstddef>
+
+class AnalogThresholds
+{
+public:
+	static constexpr size_t MaxReadings = 32;
+
+	AnalogThresholds() : enabled(0), states(0) { }
+
+	void Enable(size_t index, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState);
+	void Disable(size_t index) { enabled &= ~(1ul << index); }
+
+	// Compare the enabled readings with their thresholds, returning a bitmap of the readings whose state changed
+	uint32_t Check(const volatile uint16_t *readings, size_t numReadings);
+
+	bool IsAnyEnabled() const { return enabled != 0; }
+	bool GetState(size_t index) const { return (states & (1ul << index)) != 0; }
+
+private:
+	uint16_t lower[MaxReadings];
+	uint16_t upper[MaxReadings];
+	uint32_t enabled;
+	uint32_t states;
+};
+
+#endif /* SRC_HARDWARE_ANALOGTHRESHOLDS_H_ */
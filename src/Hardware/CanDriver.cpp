@@ -524,6 +524,12 @@ void CAN1_Handler(void)
 
 #define DRIVER_VERSION 0x00000001u
 
+// Return true if there are messages in the transmit FIFO that haven't been sent yet
+bool IsCanTransmitPending(const can_async_descriptor *descr)
+{
+	return hri_can_read_TXBRP_reg(descr->dev.hw) != 0;
+}
+
 /**
  * \internal Callback of CAN Message Write finished
  *
@@ -678,6 +684,139 @@ void GetLocalCanTiming(const can_async_descriptor *descr, CanTiming& timing)
 	timing.jumpWidth = (jw + 1) * (brp + 1);
 }
 
+// Stop the controller taking part in bus traffic, so that we can change its configuration. Any frame being sent or received is completed first.
+// Received messages stay in the receive FIFO, so the caller can read them before calling SetLocalCanDataTiming.
+void StopLocalCan(can_async_descriptor *descr)
+{
+	Can * const hw = descr->dev.hw;
+	hri_can_set_CCCR_INIT_bit(hw);
+	while (hri_can_get_CCCR_INIT_bit(hw) == 0) { }
+}
+
+// Get the transmit FIFO of a CAN device, the size of each element in it and the number of elements
+static volatile uint8_t *GetTxFifo(const _can_async_device *dev, size_t& elementSize, size_t& numElements)
+{
+#ifdef CONF_CAN0_ENABLED
+	if (dev->hw == CAN0)
+	{
+		elementSize = CONF_CAN0_TBDS;
+		numElements = CONF_CAN0_TXBC_TFQS;
+		return can0_tx_fifo;
+	}
+#endif
+#ifdef CONF_CAN1_ENABLED
+	if (dev->hw == CAN1)
+	{
+		elementSize = CONF_CAN1_TBDS;
+		numElements = CONF_CAN1_TXBC_TFQS;
+		return can1_tx_fifo;
+	}
+#endif
+	elementSize = numElements = 0;
+	return nullptr;
+}
+
+#ifdef CONF_CAN1_ENABLED
+alignas(4) static uint8_t savedTxFifo[sizeof(can1_tx_fifo)];
+#else
+alignas(4) static uint8_t savedTxFifo[sizeof(can0_tx_fifo)];
+#endif
+
+// Change the data phase bit timing and transceiver delay compensation, and enable or disable bit rate switching in the messages we send.
+// The controller has to be in configuration mode to do this, which resets the transmit and receive FIFOs. So we save the messages that are
+// still waiting to be sent and put them back in the transmit FIFO afterwards, with bit rate switching updated to match the new setting.
+// The caller must stop other tasks queueing messages, and should call StopLocalCan and read the receive FIFO first.
+// Return the number of messages that we put back in the transmit FIFO.
+unsigned int SetLocalCanDataTiming(can_async_descriptor *descr, const DataBitTiming& timing, bool enableBitRateSwitch)
+{
+	Can * const hw = descr->dev.hw;
+	StopLocalCan(descr);
+
+	// Save the messages that haven't been sent, in the order in which they will be sent
+	size_t elementSize, numElements;
+	volatile uint8_t * const txFifo = GetTxFifo(&descr->dev, elementSize, numElements);
+	const uint32_t pending = hri_can_read_TXBRP_reg(hw);
+	const uint32_t getIndex = hri_can_read_TXFQS_TFGI_bf(hw);
+	unsigned int numSaved = 0;
+	for (size_t i = 0; i < numElements; ++i)
+	{
+		const size_t index = (getIndex + i) % numElements;
+		if ((pending & (1u << index)) != 0)
+		{
+			memcpy(savedTxFifo + numSaved * elementSize, const_cast<const uint8_t*>(txFifo + index * elementSize), elementSize);
+			++numSaved;
+		}
+	}
+
+	hri_can_set_CCCR_CCE_bit(hw);
+	const uint32_t dbtp = CAN_DBTP_DBRP(timing.prescaler - 1) | CAN_DBTP_DTSEG1(timing.tseg1 - 1) | CAN_DBTP_DTSEG2(timing.tseg2 - 1) | CAN_DBTP_DSJW(timing.jumpWidth - 1)
+						| ((timing.UsesDelayCompensation()) ? CAN_DBTP_TDC : 0);
+	hri_can_write_DBTP_reg(hw, dbtp);
+	hri_can_write_TDCR_reg(hw, CAN_TDCR_TDCO(timing.tdcOffset));
+	if (enableBitRateSwitch)
+	{
+		hri_can_set_CCCR_BRSE_bit(hw);
+	}
+	else
+	{
+		hri_can_clear_CCCR_BRSE_bit(hw);
+	}
+	hri_can_clear_CCCR_CCE_bit(hw);
+
+	// Put the saved messages back, unless the controller kept its transmit requests
+	unsigned int numRequeued = 0;
+	if (numSaved != 0 && hri_can_read_TXBRP_reg(hw) == 0)
+	{
+		const uint32_t putIndex = hri_can_read_TXFQS_TFQPI_bf(hw);
+		uint32_t requests = 0;
+		for (unsigned int i = 0; i < numSaved; ++i)
+		{
+			const size_t index = (putIndex + i) % numElements;
+			volatile _can_tx_fifo_entry * const f = reinterpret_cast<volatile _can_tx_fifo_entry*>(txFifo + index * elementSize);
+			memcpy(const_cast<uint8_t*>(txFifo + index * elementSize), savedTxFifo + i * elementSize, elementSize);
+			f->T1.bit.BRS = enableBitRateSwitch;
+			requests |= 1u << index;
+		}
+		numRequeued = numSaved;
+		hri_can_write_TXBAR_reg(hw, requests);
+	}
+
+	hri_can_clear_CCCR_INIT_bit(hw);
+	while (hri_can_get_CCCR_INIT_bit(hw)) { }
+	return numRequeued;
+}
+
+// Read back the data phase bit timing. Return true if we are using bit rate switching.
+bool GetLocalCanDataTiming(const can_async_descriptor *descr, DataBitTiming& timing)
+{
+	const uint32_t dbtp = hri_can_read_DBTP_reg(descr->dev.hw);
+	timing.prescaler = ((dbtp & CAN_DBTP_DBRP_Msk) >> CAN_DBTP_DBRP_Pos) + 1;
+	timing.tseg1 = ((dbtp & CAN_DBTP_DTSEG1_Msk) >> CAN_DBTP_DTSEG1_Pos) + 1;
+	timing.tseg2 = ((dbtp & CAN_DBTP_DTSEG2_Msk) >> CAN_DBTP_DTSEG2_Pos) + 1;
+	timing.jumpWidth = ((dbtp & CAN_DBTP_DSJW_Msk) >> CAN_DBTP_DSJW_Pos) + 1;
+	timing.tdcOffset = (dbtp & CAN_DBTP_TDC) ? hri_can_read_TDCR_TDCO_bf(descr->dev.hw) : 0;
+	return hri_can_get_CCCR_BRSE_bit(descr->dev.hw);
+}
+
+// Return the number of times the transmit or receive error counter has been incremented since we last called this, saturating at 255
+uint32_t GetAndClearCanErrorCount(const can_async_descriptor *descr)
+{
+	return hri_can_read_ECR_CEL_bf(descr->dev.hw);					// reading ECR clears the CEL field
+}
+
+// Return true if the controller is error passive or bus off
+bool IsCanErrorPassive(const can_async_descriptor *descr)
+{
+	const uint32_t psr = hri_can_read_PSR_reg(descr->dev.hw);
+	return (psr & (CAN_PSR_EP | CAN_PSR_BO)) != 0;
+}
+
+// Return the transceiver loop delay measured during the last data phase, in CAN clocks
+uint32_t GetCanTransceiverDelay(const can_async_descriptor *descr)
+{
+	return hri_can_read_PSR_TDCV_bf(descr->dev.hw);
+}
+
 /**
  * \internal Callback of CAN Message Write finished
  */
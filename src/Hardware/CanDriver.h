@@ -35,6 +35,7 @@
 #define SRC_CAN_CANDRIVER_H_
 
 #include <CanSettings.h>
+#include <CAN/CanDataPhaseTiming.h>
 #include <hpl_irq.h>
 
 typedef void (*FUNC_PTR)(void);
@@ -477,5 +478,12 @@ int32_t can_async_set_filter(can_async_descriptor *const descr, uint8_t index, e
 uint32_t can_async_get_version(void);
 
 void GetLocalCanTiming(const can_async_descriptor *descr, CanTiming& timing);
+void StopLocalCan(can_async_descriptor *descr);
+unsigned int SetLocalCanDataTiming(can_async_descriptor *descr, const DataBitTiming& timing, bool enableBitRateSwitch);
+bool GetLocalCanDataTiming(const can_async_descriptor *descr, DataBitTiming& timing);
+uint32_t GetAndClearCanErrorCount(const can_async_descriptor *descr);
+bool IsCanErrorPassive(const can_async_descriptor *descr);
+uint32_t GetCanTransceiverDelay(const can_async_descriptor *descr);
+bool IsCanTransmitPending(const can_async_descriptor *descr);
 
 #endif /* SRC_CAN_CANDRIVER_H_ */
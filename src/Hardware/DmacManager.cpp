@@ -115,6 +115,12 @@ void DmacManager::SetDataLength(const uint8_t channel, const uint32_t amount)
 	hri_dmacdescriptor_write_BTCNT_reg(&descriptor_section[channel], amount);
 }
 
+// Link the descriptor to itself, so that when the block transfer completes the DMAC starts it again
+void DmacManager::SetCircular(const uint8_t channel)
+{
+	hri_dmacdescriptor_write_DESCADDR_reg(&descriptor_section[channel], reinterpret_cast<uint32_t>(&descriptor_section[channel]));
+}
+
 void DmacManager::SetTriggerSource(uint8_t channel, DmaTrigSource source)
 {
 #if SAME5x
@@ -160,6 +166,21 @@ void DmacManager::SetTriggerSourceSercomTx(uint8_t channel, uint8_t sercomNumber
 #endif
 }
 
+void DmacManager::SetEventTrigger(uint8_t channel)
+{
+#if SAME5x
+	DMAC->Channel[channel].CHCTRLA.reg = DMAC_CHCTRLA_TRIGSRC((uint32_t)DmaTrigSource::disable) | DMAC_CHCTRLA_TRIGACT_BURST
+											| DMAC_CHCTRLA_BURSTLEN_SINGLE | DMAC_CHCTRLA_THRESHOLD_1BEAT;
+	DMAC->Channel[channel].CHEVCTRL.reg = DMAC_CHEVCTRL_EVIE | DMAC_CHEVCTRL_EVACT_TRIG;
+#elif SAMC21
+	AtomicCriticalSectionLocker lock;
+	DMAC->CHID.reg = channel;
+	DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGSRC((uint8_t)DmaTrigSource::disable) | DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_EVIE | DMAC_CHCTRLB_EVACT_TRIG;
+#else
+# error Unsupported processor
+#endif
+}
+
 void DmacManager::SetArbitrationLevel(uint8_t channel, uint8_t level)
 {
 #if SAME5x
@@ -200,9 +200,11 @@ namespace DmacManager
 	void SetSourceAddress(uint8_t channel, const volatile void *const src);		// warning: call SetBtctrl, SetSourceAddress and SetDestinationAddress BEFORE SetDataLength!
 	void SetDestinationAddress(uint8_t channel, volatile void *const dst);		// warning: call SetBtctrl, SetSourceAddress and SetDestinationAddress BEFORE SetDataLength!
 	void SetDataLength(uint8_t channel, uint32_t amount);						// warning: call SetBtctrl, SetSourceAddress and SetDestinationAddress BEFORE SetDataLength!
+	void SetCircular(uint8_t channel);											// make the channel repeat the transfer indefinitely. Call this after SetDataLength.
 	void SetTriggerSource(uint8_t channel, DmaTrigSource source);
 	void SetTriggerSourceSercomTx(uint8_t channel, uint8_t sercomNumber);
 	void SetTriggerSourceSercomRx(uint8_t channel, uint8_t sercomNumber);
+	void SetEventTrigger(uint8_t channel);										// make the channel do one beat per event on its event input. Only channels 0-7 on the SAME5x have event inputs.
 	void SetArbitrationLevel(uint8_t channel, uint8_t level);
 	void EnableChannel(uint8_t channel, uint8_t priority);
 	void DisableChannel(uint8_t channel);
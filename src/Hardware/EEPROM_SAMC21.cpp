@@ -89,20 +89,20 @@ bool EEPROM::Write(const char *data, uint32_t offset, uint32_t length)
 		offset += thisLength;
 		uint32_t pageBuffer[FlashRowSize/4];											// buffer to hold the data we may need to erase
 		memcpy(static_cast<void*>(pageBuffer), reinterpret_cast<const void *>(RWWEEEaddess + rowStartOffset), FlashRowSize);
-		char *bufp = reinterpret_cast<char *>(pageBuffer) + thisOffset;
+		char * const rowBuffer = reinterpret_cast<char *>(pageBuffer);					// thisOffset indexes this
 		bool eraseNeeded = false;														// true if we are changing any bits from 0 to 1
 		uint32_t writesNeeded = 0;														// bitmap of pages in the row that need to be written
 		while (thisLength != 0)
 		{
-			if ((~bufp[thisOffset] & *data & 0xFF) != 0)
+			if ((~rowBuffer[thisOffset] & *data & 0xFF) != 0)
 			{
 				eraseNeeded = true;
 			}
-			else if (*bufp != *data)
+			else if (rowBuffer[thisOffset] != *data)
 			{
 				writesNeeded |= 1 << (thisOffset/FLASH_PAGE_SIZE);
 			}
-			bufp[thisOffset] = *data;
+			rowBuffer[thisOffset] = *data;
 			++thisOffset;
 			++data;
 			--thisLength;
@@ -118,8 +118,8 @@ bool EEPROM::Write(const char *data, uint32_t offset, uint32_t length)
 			/* Clear flags */
 			hri_nvmctrl_clear_STATUS_reg(NVMCTRL, NVMCTRL_STATUS_MASK);
 
-			/* Set address and command */
-			hri_nvmctrl_write_ADDR_reg(NVMCTRL, rowStartOffset / 2);
+			/* Set address and command. The NVM controller needs the address within the RWWEE section, not the offset from its start. */
+			hri_nvmctrl_write_ADDR_reg(NVMCTRL, (RWWEEEaddess + rowStartOffset) / 2);
 			hri_nvmctrl_write_CTRLA_reg(NVMCTRL, NVMCTRL_CTRLA_CMD_RWWEEER | NVMCTRL_CTRLA_CMDEX_KEY);
 		}
 
@@ -127,7 +127,7 @@ bool EEPROM::Write(const char *data, uint32_t offset, uint32_t length)
 		{
 			if (eraseNeeded || (writesNeeded & (1u << i)) != 0)
 			{
-				flash_program(rowStartOffset + i * NVMCTRL_PAGE_SIZE,
+				flash_program(RWWEEEaddess + rowStartOffset + i * NVMCTRL_PAGE_SIZE,
 								reinterpret_cast<const uint8_t*>(pageBuffer) + (i * NVMCTRL_PAGE_SIZE),
 								NVMCTRL_PAGE_SIZE,
 								NVMCTRL_CTRLA_CMD_RWWEEWP);
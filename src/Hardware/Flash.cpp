@@ -81,4 +81,27 @@ bool Flash::Write(uint32_t start, uint32_t length, uint8_t *data)
 	return ok;
 }
 
+#if SAME5x
+
+bool Flash::EraseOtherBank(uint32_t start, uint32_t length)
+{
+	if (start < OtherBankStart || length > FLASH_ADDR + FLASH_SIZE - start)
+	{
+		return false;
+	}
+	const uint32_t pageSize = flash_get_page_size(&flash);
+	return flash_erase(&flash, start, length/pageSize) == 0;
+}
+
+bool Flash::WriteOtherBank(uint32_t start, uint32_t length, const uint8_t *data)
+{
+	if (start < OtherBankStart || length > FLASH_ADDR + FLASH_SIZE - start)
+	{
+		return false;
+	}
+	return flash_append(&flash, start, const_cast<uint8_t*>(data), length) == 0;
+}
+
+#endif
+
 // End
@@ -26,6 +26,16 @@ namespace Flash
 	bool Erase(uint32_t start, uint32_t length);
 	bool Lock(uint32_t start, uint32_t length);
 	bool Write(uint32_t start, uint32_t length, uint8_t *data);
+
+#if SAME5x
+	// Versions of Erase and Write that leave interrupts enabled. Use these only on the flash bank that we are not executing from.
+	// WriteOtherBank doesn't erase anything, so the area must have been erased already.
+	constexpr uint32_t BankSize = FLASH_SIZE/2;
+	constexpr uint32_t OtherBankStart = FLASH_ADDR + BankSize;		// the bank we are not executing from is always mapped to the upper half
+
+	bool EraseOtherBank(uint32_t start, uint32_t length);
+	bool WriteOtherBank(uint32_t start, uint32_t length, const uint8_t *data);
+#endif
 }
 
 #endif /* SRC_HARDWARE_FLASH_H_ */
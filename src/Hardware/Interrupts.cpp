@@ -64,20 +64,9 @@ void InitialisePinChangeInterrupts()
 	hri_eic_set_CTRLA_ENABLE_bit(EIC);
 }
 
-// Attach an interrupt to the specified pin returning true if successful
-bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode mode, CallbackParameter param)
+// Set the sense mode of an EXINT and whether it generates events
+static void SetExintMode(unsigned int exintNumber, InterruptMode mode, bool eventOutput)
 {
-	if (pin >= ARRAY_SIZE(PinTable))
-	{
-		return false;			// pin number out of range
-	}
-
-	const unsigned int exintNumber = PinTable[pin].exintNumber;
-	if (exintNumber >= 16)
-	{
-		return false;			// no EXINT available on this pin (only occurs for PA8 which is NMI)
-	}
-
 	// Configure the interrupt mode
 	uint32_t modeWord;
 	switch (mode)
@@ -90,13 +79,6 @@ bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode m
 	default:						modeWord = EIC_CONFIG_SENSE0_NONE_Val; break;
 	}
 
-	const irqflags_t flags = cpu_irq_save();
-	exintCallbacks[exintNumber].func = callback;
-	exintCallbacks[exintNumber].param = param;
-
-	// Switch the pin into EIC mode
-	gpio_set_pin_function(pin, GPIO_PIN_FUNCTION_A);		// EIC is always on peripheral A
-
 	const unsigned int shift = (exintNumber & 7u) << 2u;
 	const uint32_t mask = ~(0x0000000F << shift);
 
@@ -112,7 +94,41 @@ bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode m
 		EIC->CONFIG[1].reg = (EIC->CONFIG[1].reg & mask) | (modeWord << shift);
 	}
 
+	// The event output bits are enable-protected, so we set them while the EIC is disabled
+	if (eventOutput)
+	{
+		EIC->EVCTRL.reg |= 1ul << exintNumber;
+	}
+	else
+	{
+		EIC->EVCTRL.reg &= ~(1ul << exintNumber);
+	}
+
 	hri_eic_set_CTRLA_ENABLE_bit(EIC);
+}
+
+// Attach an interrupt to the specified pin returning true if successful
+bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode mode, CallbackParameter param)
+{
+	if (pin >= ARRAY_SIZE(PinTable))
+	{
+		return false;			// pin number out of range
+	}
+
+	const unsigned int exintNumber = PinTable[pin].exintNumber;
+	if (exintNumber >= 16)
+	{
+		return false;			// no EXINT available on this pin (only occurs for PA8 which is NMI)
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	exintCallbacks[exintNumber].func = callback;
+	exintCallbacks[exintNumber].param = param;
+
+	// Switch the pin into EIC mode
+	gpio_set_pin_function(pin, GPIO_PIN_FUNCTION_A);		// EIC is always on peripheral A
+
+	SetExintMode(exintNumber, mode, false);
 
 	// Enable interrupt
 	hri_eic_set_INTEN_reg(EIC, 1ul << exintNumber);
@@ -129,6 +145,30 @@ bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode m
 	return true;
 }
 
+// Make the specified pin generate an event on the EIC event output instead of an interrupt, returning true if successful.
+// The EXINT number is returned in 'exintNumber' so that the caller can route the event to its user.
+bool AttachEvent(Pin pin, InterruptMode mode, unsigned int& exintNumber)
+{
+	if (pin >= ARRAY_SIZE(PinTable))
+	{
+		return false;			// pin number out of range
+	}
+
+	exintNumber = PinTable[pin].exintNumber;
+	if (exintNumber >= 16)
+	{
+		return false;			// no EXINT available on this pin
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	exintCallbacks[exintNumber].func = nullptr;
+	gpio_set_pin_function(pin, GPIO_PIN_FUNCTION_A);		// EIC is always on peripheral A
+	SetExintMode(exintNumber, mode, true);
+	hri_eic_clear_INTEN_reg(EIC, 1ul << exintNumber);
+	cpu_irq_restore(flags);
+	return true;
+}
+
 void DetachInterrupt(Pin pin)
 {
 	if (pin <= ARRAY_SIZE(PinTable))
@@ -136,22 +176,7 @@ void DetachInterrupt(Pin pin)
 		const unsigned int exintNumber = PinTable[pin].exintNumber;
 		if (exintNumber < 16)
 		{
-			const unsigned int shift = (exintNumber & 7u) << 2u;
-			const uint32_t mask = ~(0x0000000F << shift);
-
-			hri_eic_clear_CTRLA_ENABLE_bit(EIC);
-			hri_eic_wait_for_sync(EIC, EIC_SYNCBUSY_ENABLE);
-
-			if (exintNumber < 8)
-			{
-				EIC->CONFIG[0].reg &= mask;
-			}
-			else
-			{
-				EIC->CONFIG[1].reg &= mask;
-			}
-
-			hri_eic_set_CTRLA_ENABLE_bit(EIC);
+			SetExintMode(exintNumber, InterruptMode::none, false);
 
 			// Disable the interrupt
 			hri_eic_clear_INTEN_reg(EIC, 1ul << exintNumber);
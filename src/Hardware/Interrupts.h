@@ -39,6 +39,7 @@ typedef void (*StandardCallbackFunction)(CallbackParameter);
 
 void InitialisePinChangeInterrupts();
 bool AttachInterrupt(Pin pin, StandardCallbackFunction callback, InterruptMode mode, CallbackParameter param);
+bool AttachEvent(Pin pin, InterruptMode mode, unsigned int& exintNumber);		// generate EIC events instead of interrupts, detach using DetachInterrupt
 void DetachInterrupt(Pin pin);
 
 // Return true if we are in any interrupt service routine
@@ -146,6 +146,15 @@ bool IoPort::SetAnalogCallback(AnalogInCallbackFunction fn, CallbackParameter cb
 	return AnalogIn::SetCallback(pin, fn, cbp, ticksPerCall, false);
 }
 
+#if SAME5x
+
+bool IoPort::SetAnalogThresholdCallback(AnalogThresholdCallbackFunction fn, CallbackParameter cbp, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState)
+{
+	return AnalogIn::SetThresholdCallback(pin, fn, cbp, lowerThreshold, upperThreshold, initialState, false);
+}
+
+#endif
+
 // Try to assign ports, returning the number of ports successfully assigned
 /*static*/ size_t IoPort::AssignPorts(const char* pinNames, const StringRef& reply, PinUsedBy neededFor, size_t numPorts, IoPort* const ports[], const PinAccess access[])
 {
@@ -586,4 +595,9 @@ void PwmPort::WriteAnalog(float pwm) const
 	}
 }
 
+bool PwmPort::PrepareWrite(float pwm, PwmRegisterWrite& pw) const
+{
+	return pin != NoPin && AnalogOut::PrepareWrite(pin, ((totalInvert) ? 1.0 - pwm : pwm), frequency, pw);
+}
+
 // End
@@ -11,6 +11,7 @@
 #include "RepRapFirmware.h"
 #include "Interrupts.h"
 #include "AnalogIn.h"
+#include "PwmRegisterWrite.h"
 
 // Enumeration to describe what we want to do with a pin
 enum class PinAccess : int
@@ -76,6 +77,7 @@ public:
 	void AppendPinName(const StringRef& str) const;
 	bool IsValid() const { return pin != NoPin; }
 	bool GetInvert() const;
+	bool GetTotalInvert() const { return totalInvert; }		// true if the value read from the pin is inverted, including any inversion in the hardware
 	void SetInvert(bool pInvert);
 	void ToggleInvert(bool pInvert);
 	bool UseAlternateConfig() const { return alternateConfig; }
@@ -87,6 +89,9 @@ public:
 	bool AttachInterrupt(StandardCallbackFunction callback, InterruptMode mode, CallbackParameter param) const;
 	void DetachInterrupt() const;
 	bool SetAnalogCallback(AnalogInCallbackFunction fn, CallbackParameter cbp, uint32_t ticksPerCall);
+#if SAME5x
+	bool SetAnalogThresholdCallback(AnalogThresholdCallbackFunction fn, CallbackParameter cbp, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState);
+#endif
 
 	// Initialise static data
 	static void Init();
@@ -135,7 +140,9 @@ public:
 
 	void AppendDetails(const StringRef& str) const;			// hides the version in IoPort
 	void SetFrequency(PwmFrequency freq) { frequency = freq; }
+	PwmFrequency GetFrequency() const { return frequency; }
 	void WriteAnalog(float pwm) const;
+	bool PrepareWrite(float pwm, PwmRegisterWrite& pw) const;	// prepare a write that an interrupt can apply later
 
 private:
 	PwmFrequency frequency;
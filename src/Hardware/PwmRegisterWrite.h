@@ -0,0 +1,34 @@
+/*
+ * PwmRegisterWrite.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  A PWM or digital output write that has been worked out in task context, so that an interrupt can apply it with a single register store.
+ *  The register is a timer compare buffer register, or a PORT OUTSET or OUTCLR register.
+ */
+
+#ifndef SRC_HARDWARE_PWMREGISTERWRITE_H_
+#define SRC_HARDWARE_PWMREGISTERWRITE_H_
+
+#include <cstdint>
+
+struct PwmRegisterWrite
+{
+	volatile void *reg;								// the register to write
+	uint32_t value;									// the value to write to it
+	bool is16Bit;									// true if the register must be written as a halfword
+
+	void Apply() const
+	{
+		if (is16Bit)
+		{
+			*static_cast<volatile uint16_t*>(reg) = (uint16_t)value;
+		}
+		else
+		{
+			*static_cast<volatile uint32_t*>(reg) = value;
+		}
+	}
+};
+
+#endif /* SRC_HARDWARE_PWMREGISTERWRITE_H_ */
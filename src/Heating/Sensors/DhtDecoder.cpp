@@ -0,0 +1,94 @@
+/*
+ * DhtDecoder.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "DhtDecoder.h"
+
+// Timing limits in microseconds. The nominal periods are 80us for the response, 50us for the low period of each bit, 26 to 28us for the high period of a zero and 70us for a one.
+// The DHT11 and AM2302 datasheets both allow a few microseconds either way. There is a dead band between the zero and one limits so that we reject periods that we can't classify reliably.
+constexpr uint32_t MinResponseMicroseconds = 60, MaxResponseMicroseconds = 100;
+constexpr uint32_t MinBitLowMicroseconds = 35, MaxBitLowMicroseconds = 75;
+constexpr uint32_t MinZeroHighMicroseconds = 15, MaxZeroHighMicroseconds = 40;
+constexpr uint32_t MinOneHighMicroseconds = 55, MaxOneHighMicroseconds = 85;
+
+DhtDecoder::DhtDecoder(uint32_t clockRate)
+	: response(MakeLimits(clockRate, MinResponseMicroseconds, MaxResponseMicroseconds)),
+	  bitLow(MakeLimits(clockRate, MinBitLowMicroseconds, MaxBitLowMicroseconds)),
+	  zeroHigh(MakeLimits(clockRate, MinZeroHighMicroseconds, MaxZeroHighMicroseconds)),
+	  oneHigh(MakeLimits(clockRate, MinOneHighMicroseconds, MaxOneHighMicroseconds))
+{
+}
+
+/*static*/ DhtDecoder::Limits DhtDecoder::MakeLimits(uint32_t clockRate, uint32_t minMicroseconds, uint32_t maxMicroseconds)
+{
+	Limits lim;
+	lim.min = (uint16_t)(((uint64_t)clockRate * minMicroseconds)/1000000u);								// round the minimum down
+	lim.max = (uint16_t)(((uint64_t)clockRate * maxMicroseconds + 999999u)/1000000u);					// round the maximum up
+	return lim;
+}
+
+// Decode a frame. The first edge we recorded may be the end of the start signal instead of the start of the response, so if the response doesn't start at the first edge then try the second one.
+DhtDecodeResult DhtDecoder::Decode(const uint16_t *edgeTimes, size_t numEdges, uint8_t data[NumDataBytes]) const
+{
+	const DhtDecodeResult rslt = DecodeFrom(edgeTimes, numEdges, data);
+	return (rslt == DhtDecodeResult::noResponse && numEdges != 0)
+			? DecodeFrom(edgeTimes + 1, numEdges - 1, data)
+				: rslt;
+}
+
+DhtDecodeResult DhtDecoder::DecodeFrom(const uint16_t *edgeTimes, size_t numEdges, uint8_t data[NumDataBytes]) const
+{
+	if (numEdges < 3 || !response.Contains(Interval(edgeTimes, 0)) || !response.Contains(Interval(edgeTimes, 1)))
+	{
+		return DhtDecodeResult::noResponse;
+	}
+
+	if (numEdges < NumFrameEdges)
+	{
+		return DhtDecodeResult::tooFewEdges;
+	}
+
+	for (size_t i = 0; i < NumDataBytes; ++i)
+	{
+		data[i] = 0;
+	}
+
+	for (size_t bit = 0; bit < NumDataBits; ++bit)
+	{
+		const size_t index = 2 + 2 * bit;
+		if (!bitLow.Contains(Interval(edgeTimes, index)))
+		{
+			return DhtDecodeResult::badTiming;
+		}
+
+		const uint16_t high = Interval(edgeTimes, index + 1);
+		data[bit/8] <<= 1;
+		if (oneHigh.Contains(high))
+		{
+			data[bit/8] |= 1;
+		}
+		else if (!zeroHigh.Contains(high))
+		{
+			return DhtDecodeResult::badTiming;
+		}
+	}
+
+	return (((data[0] + data[1] + data[2] + data[3]) & 0xFF) == data[4]) ? DhtDecodeResult::ok : DhtDecodeResult::badChecksum;
+}
+
+/*static*/ const char *DhtDecoder::ResultText(DhtDecodeResult rslt)
+{
+	switch (rslt)
+	{
+	case DhtDecodeResult::ok:			return "ok";
+	case DhtDecodeResult::noResponse:	return "no response";
+	case DhtDecodeResult::tooFewEdges:	return "too few edges";
+	case DhtDecodeResult::badTiming:	return "bad timing";
+	case DhtDecodeResult::badChecksum:	return "bad checksum";
+	default:							return "unknown";
+	}
+}
+
+// End
@@ -0,0 +1,63 @@
+/*
+ * DhtDecoder.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Decodes a DHT11/21/22 frame from the times of the edges on the data line. The sensor responds to the start signal by pulling the line low
+ *  for 80us and releasing it for 80us. Then each of the 40 data bits is a low period of about 50us followed by a high period of about 27us for
+ *  a zero or 70us for a one. We check every period against limits that leave a margin either side of the zero/one decision, so that a frame
+ *  with a missing or extra edge is rejected even if its checksum happens to be correct.
+ *
+ *  This file doesn't depend on the hardware, so that the decoder can be exercised on a PC using recorded edge times.
+ */
+
+#ifndef SRC_HEATING_SENSORS_DHTDECODER_H_
+#define SRC_HEATING_SENSORS_DHTDECODER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// The result of decoding a frame
+enum class DhtDecodeResult : uint8_t
+{
+	ok = 0,
+	noResponse,									// the first edges didn't look like the response to the start signal
+	tooFewEdges,								// the frame was truncated
+	badTiming,									// a period was outside the limits for a zero or a one
+	badChecksum
+};
+
+class DhtDecoder
+{
+public:
+	static constexpr size_t NumDataBytes = 5;	// humidity high and low, temperature high and low, checksum
+	static constexpr size_t NumDataBits = 8 * NumDataBytes;
+	static constexpr size_t NumFrameEdges = 3 + 2 * NumDataBits;			// the response low and high periods, then a low and a high period for each bit
+	static constexpr size_t MaxEdges = NumFrameEdges + 2;					// allow for the end of the start signal and the sensor releasing the line at the end
+
+	explicit DhtDecoder(uint32_t clockRate);	// the rate in Hz of the clock used to time the edges
+
+	// Decode a frame from the times of successive edges, starting with the sensor pulling the line low. The times are modulo 65536.
+	DhtDecodeResult Decode(const uint16_t *edgeTimes, size_t numEdges, uint8_t data[NumDataBytes]) const;
+
+	static const char *ResultText(DhtDecodeResult rslt);
+
+private:
+	struct Limits
+	{
+		uint16_t min, max;
+		bool Contains(uint16_t ticks) const { return ticks >= min && ticks <= max; }
+	};
+
+	static Limits MakeLimits(uint32_t clockRate, uint32_t minMicroseconds, uint32_t maxMicroseconds);
+	DhtDecodeResult DecodeFrom(const uint16_t *edgeTimes, size_t numEdges, uint8_t data[NumDataBytes]) const;
+
+	static uint16_t Interval(const uint16_t *edgeTimes, size_t index) { return (uint16_t)(edgeTimes[index + 1] - edgeTimes[index]); }
+
+	Limits response;							// the response low and high periods
+	Limits bitLow;								// the low period at the start of each bit
+	Limits zeroHigh;							// the high period of a zero bit
+	Limits oneHigh;								// the high period of a one bit
+};
+
+#endif /* SRC_HEATING_SENSORS_DHTDECODER_H_ */
@@ -17,8 +17,8 @@
 
 constexpr uint32_t MinimumReadInterval = 2000;		// ms
 constexpr uint32_t MaximumReadTime = 20;			// ms
-constexpr uint32_t MinimumOneBitLength = 50;		// microseconds
-constexpr uint32_t MinimumOneBitStepClocks = (StepTimer::StepClockRate * MinimumOneBitLength)/1000000;
+
+static const DhtDecoder decoder(StepTimer::StepClockRate);
 
 # include "Tasks.h"
 
@@ -138,19 +138,14 @@ DhtSensorHardwareInterface *DhtSensorHardwareInterface::Create(unsigned int rela
 	return activeSensors[relativeChannel]->GetTemperatureOrHumidity(t, wantHumidity);
 }
 
+// Record the time of an edge on the data line. The frame is decoded by the task after it has been received.
 void DhtSensorHardwareInterface::Interrupt()
 {
-	if (numPulses < ARRAY_SIZE(pulses))
+	const size_t n = numEdges;
+	if (n < ARRAY_SIZE(edgeTimes))
 	{
-		const uint32_t now = StepTimer::GetInterruptClocks();
-		if (IoPort::ReadPin(sensorPin))
-		{
-			lastPulseTime = now;
-		}
-		else if (lastPulseTime != 0)
-		{
-			pulses[numPulses++] = now - lastPulseTime;
-		}
+		edgeTimes[n] = (uint16_t)StepTimer::GetInterruptClocks();
+		numEdges = n + 1;
 	}
 }
 
@@ -173,15 +168,14 @@ void DhtSensorHardwareInterface::TakeReading()
 			// Now start reading the data line to get the value from the DHT sensor
 			IoPort::SetPinMode(sensorPin, INPUT_PULLUP);
 
-			// It appears that switching the pin to an output disables the interrupt, so we need to call attachInterrupt here
-			// We are likely to get an immediate interrupt at this point corresponding to the low-to-high transition. We must ignore this.
-			numPulses = ARRAY_SIZE(pulses);		// tell the ISR not to collect data yet
+			// It appears that switching the pin to an output disables the interrupt, so we need to call attachInterrupt here.
+			// We may record the low-to-high transition at the end of the start signal as well as the response, but the decoder allows for that.
+			numEdges = ARRAY_SIZE(edgeTimes);	// tell the ISR not to collect data yet
 			AttachInterrupt(sensorPin, DhtDataTransition, InterruptMode::change, this);
-			lastPulseTime = 0;
-			numPulses = 0;						// tell the ISR to collect data
+			numEdges = 0;						// tell the ISR to collect data
 		}
 
-		// Wait for the incoming signal to be read by the ISR (1 start bit + 40 data bits), or until timeout.
+		// Wait for the incoming signal to be recorded (the response + 40 data bits), or until timeout.
 		// We don't have the ISR wake the process up, because that would require the priority of the pin change interrupt to be reduced.
 		// So we just delay for long enough for the data to have been sent. It takes typically 4 to 5ms.
 		delay(MaximumReadTime);
@@ -233,31 +227,11 @@ void DhtSensorHardwareInterface::TakeReading()
 // Else return the TemperatureError code but do not update the readings.
 TemperatureError DhtSensorHardwareInterface::ProcessReadings()
 {
-	// Check enough bits received and check start bit
-	if (numPulses != ARRAY_SIZE(pulses) || pulses[0] < MinimumOneBitStepClocks)
-	{
-//		debugPrintf("pulses %u p0 %u\n", numPulses, (unsigned int)pulses[0]);
-		return TemperatureError::ioError;
-	}
-
-	// Reset 40 bits of received data to zero
-	uint8_t data[5] = { 0, 0, 0, 0, 0 };
-
-	// Inspect each high pulse and determine which ones are 0 (less than 50us) or 1 (more than 50us). Ignore the start bit.
-	for (size_t i = 0; i < 40; ++i)
-	{
-		data[i / 8] <<= 1;
-		if (pulses[i + 1] >= MinimumOneBitStepClocks)
-		{
-			data[i / 8] |= 1;
-		}
-	}
-
-//	debugPrintf("Data: %02x %02x %02x %02x %02x\n", data[0], data[1], data[2], data[3], data[4]);
-	// Verify checksum
-	if (((data[0] + data[1] + data[2] + data[3]) & 0xFF) != data[4])
+	uint8_t data[DhtDecoder::NumDataBytes];
+	const DhtDecodeResult rslt = decoder.Decode(edgeTimes, numEdges, data);
+	if (rslt != DhtDecodeResult::ok)
 	{
-//		debugPrintf("Cks err\n");
+//		debugPrintf("DHT %s, %u edges\n", DhtDecoder::ResultText(rslt), numEdges);
 		return TemperatureError::ioError;
 	}
 
@@ -17,6 +17,7 @@
 #endif
 
 # include "TemperatureSensor.h"
+# include "DhtDecoder.h"
 # include "RTOSIface/RTOSIface.h"
 
 enum class DhtSensorType
@@ -58,9 +59,8 @@ private:
 	float lastTemperature, lastHumidity;
 	size_t badTemperatureCount;
 
-	volatile uint32_t lastPulseTime;
-	volatile size_t numPulses;
-	uint16_t pulses[41];			// 1 start bit + 40 data bits
+	volatile size_t numEdges;
+	uint16_t edgeTimes[DhtDecoder::MaxEdges];	// the times of the edges on the data line in step clocks, written by the ISR
 };
 
 // This class represents a DHT temperature sensor
@@ -0,0 +1,35 @@
+/*
+ * InputDebouncer.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "InputDebouncer.h"
+
+void InputDebouncer::Reset(uint32_t mask, uint32_t raw)
+{
+	state = (state & ~mask) | (raw & mask);
+	count0 &= ~mask;
+	count1 &= ~mask;
+}
+
+uint32_t InputDebouncer::Update(uint32_t raw)
+{
+	const uint32_t differs = raw ^ state;
+
+	// Count up where the sample differs from the state, else count down stopping at zero:
+	//  up:   bit 0 toggles, bit 1 toggles if bit 0 was set
+	//  down: 3->2, 2->1, 1->0, 0->0
+	const uint32_t newCount0 = ~count0 & (differs | count1);
+	const uint32_t newCount1 = (differs & (count1 ^ count0)) | (~differs & count1 & count0);
+
+	// Where the count has reached 3 the state changes and the count starts again
+	static_assert(SamplesToChange == 3, "the counters only have 2 bits");
+	const uint32_t changed = newCount0 & newCount1;
+	state ^= changed;
+	count0 = newCount0 & ~changed;
+	count1 = newCount1 & ~changed;
+	return changed;
+}
+
+// End
@@ -0,0 +1,38 @@
+/*
+ * InputDebouncer.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Debounces 32 digital inputs at once, typically the bits of a port input register sampled at regular intervals.
+ *  Each bit has a 2-bit integrating counter, held as two bit-slice words so that all 32 counters are updated with a few logical operations.
+ *  A sample that differs from the debounced state counts up and a sample that agrees counts down, stopping at zero.
+ *  The debounced state changes when the count reaches SamplesToChange, so a clean edge is reported after SamplesToChange samples
+ *  and an input that is bouncing is reported when it has spent SamplesToChange more samples in the new state than in the old one.
+ *
+ *  This file doesn't depend on the hardware, so that the debouncer can be exercised on a PC using synthetic bounce patterns.
+ */
+
+#ifndef SRC_INPUTMONITORS_INPUTDEBOUNCER_H_
+#define SRC_INPUTMONITORS_INPUTDEBOUNCER_H_
+
+#include <cstdint>
+
+class InputDebouncer
+{
+public:
+	static constexpr unsigned int SamplesToChange = 3;
+
+	InputDebouncer() : state(0), count0(0), count1(0) { }
+
+	void Reset(uint32_t mask, uint32_t raw);								// set the state of the bits in 'mask' to their values in 'raw' and clear their counters
+	uint32_t Update(uint32_t raw);											// process a sample, returning the bits whose debounced state changed
+
+	uint32_t GetState() const { return state; }
+
+private:
+	uint32_t state;															// the debounced state
+	uint32_t count0;														// bit 0 of each counter
+	uint32_t count1;														// bit 1 of each counter
+};
+
+#endif /* SRC_INPUTMONITORS_INPUTDEBOUNCER_H_ */
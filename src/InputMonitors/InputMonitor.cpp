@@ -10,10 +10,20 @@
 #include <CanMessageFormats.h>
 #include <Hardware/IoPorts.h>
 #include <CAN/CanInterface.h>
+#include <CAN/CanInputChangesMessages.h>
+#include <Movement/StepTimer.h>
 
 InputMonitor *InputMonitor::monitorsList = nullptr;
 InputMonitor *InputMonitor::freeList = nullptr;
 ReadWriteLock InputMonitor::listLock;
+bool InputMonitor::timedReportsRequested = false;
+
+#if SUPPORT_INPUT_SCANNER
+uint32_t InputMonitor::scanMasks[PORT_GROUPS] = { 0 };
+InputDebouncer InputMonitor::debouncers[PORT_GROUPS];
+volatile uint32_t InputMonitor::scannedChanges[PORT_GROUPS] = { 0 };
+volatile uint32_t InputMonitor::whenScannedChanged[PORT_GROUPS][32];
+#endif
 
 bool InputMonitor::Activate()
 {
@@ -22,17 +32,41 @@ bool InputMonitor::Activate()
 	{
 		if (threshold == 0)
 		{
-			// Digital input
-			const irqflags_t flags = cpu_irq_save();
-			ok = port.AttachInterrupt(CommonDigitalPortInterrupt, InterruptMode::change, CallbackParameter(this));
-			state = port.Read();
-			cpu_irq_restore(flags);
+#if SUPPORT_INPUT_SCANNER
+			if (debounced)
+			{
+				// Digital input that has asked to be debounced, so it is sampled by the input scanner. Start debouncing from the current state of the pin.
+				// This adds up to InputDebouncer::SamplesToChange + 1 milliseconds of latency, so endstops and probes keep using the pin change interrupt.
+				const Pin pin = port.GetPin();
+				const uint32_t bit = 1ul << (pin & 31);
+				AtomicCriticalSectionLocker lock;
+				const uint32_t inputs = PORT->Group[pin >> 5].IN.reg;
+				state = ((inputs & bit) != 0) != port.GetTotalInvert();
+				debouncers[pin >> 5].Reset(bit, inputs);
+				scannedChanges[pin >> 5] &= ~bit;
+				scanMasks[pin >> 5] |= bit;
+				scanned = true;
+			}
+			else
+#endif
+			{
+				// Digital input
+				const irqflags_t flags = cpu_irq_save();
+				ok = port.AttachInterrupt(CommonDigitalPortInterrupt, InterruptMode::change, CallbackParameter(this));
+				state = port.Read();
+				cpu_irq_restore(flags);
+			}
 		}
 		else
 		{
 			// Analog port
 			state = port.ReadAnalog() >= threshold;
+#if SAME5x
+			// The ADC DMA completion interrupt compares each reading with the thresholds and time stamps any crossing
+			ok = SetAnalogThresholds();
+#else
 			ok = port.SetAnalogCallback(CommonAnalogPortInterrupt, CallbackParameter(this), 1);
+#endif
 		}
 		active = true;
 		whenLastSent = millis();
@@ -43,10 +77,55 @@ bool InputMonitor::Activate()
 
 void InputMonitor::Deactivate()
 {
-	//TODO
+	if (active)
+	{
+		if (threshold == 0)
+		{
+#if SUPPORT_INPUT_SCANNER
+			if (scanned)
+			{
+				const Pin pin = port.GetPin();
+				const uint32_t bit = 1ul << (pin & 31);
+				AtomicCriticalSectionLocker lock;
+				scanMasks[pin >> 5] &= ~bit;
+				scannedChanges[pin >> 5] &= ~bit;
+				scanned = false;
+			}
+			else
+#endif
+			{
+				port.DetachInterrupt();
+			}
+		}
+		else
+		{
+			// Stop the ADC calling us, because this monitor may be deleted and its storage reused
+#if SAME5x
+			(void)port.SetAnalogThresholdCallback(nullptr, CallbackParameter(), 0, 0, false);
+#else
+			(void)port.SetAnalogCallback(nullptr, CallbackParameter(), 1);
+#endif
+		}
+	}
 	active = false;
 }
 
+// Record a change of state that is to be reported. Called with interrupts disabled or from an ISR.
+void InputMonitor::RecordChange(uint32_t when)
+{
+	if (numChanges == 0)
+	{
+		whenFirstChanged = when;
+	}
+	whenChanged = when;
+	++totalChanges;
+	if (numChanges < 255)
+	{
+		++numChanges;
+	}
+	sendDue = true;
+}
+
 void InputMonitor::DigitalInterrupt()
 {
 	const bool newState = port.Read();
@@ -55,7 +134,7 @@ void InputMonitor::DigitalInterrupt()
 		state = newState;
 		if (active)
 		{
-			sendDue = true;
+			RecordChange(StepTimer::GetTimerTicks());
 			CanInterface::WakeAsyncSenderFromIsr();
 		}
 	}
@@ -69,17 +148,106 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 		state = newState;
 		if (active)
 		{
-			sendDue = true;
+			RecordChange(StepTimer::GetTimerTicks());
+			CanInterface::WakeAsyncSenderFromIsr();
+		}
+	}
+}
+
+#if SAME5x
+
+// Called from the ADC DMA completion interrupt when the reading crosses one of the thresholds
+void InputMonitor::AnalogThresholdInterrupt(bool newState, uint32_t whenChanged)
+{
+	if (newState != state)
+	{
+		state = newState;
+		if (active)
+		{
+			RecordChange(whenChanged);
 			CanInterface::WakeAsyncSenderFromIsr();
 		}
 	}
 }
 
+// Set up the threshold detection in the ADC from our threshold and current state
+bool InputMonitor::SetAnalogThresholds()
+{
+	const uint16_t lowerThreshold = (threshold > AnalogHysteresis) ? threshold - AnalogHysteresis : 0;
+	return port.SetAnalogThresholdCallback(CommonAnalogThresholdInterrupt, CallbackParameter(this), lowerThreshold, threshold, state);
+}
+
+#endif
+
 /*static*/ void InputMonitor::Init()
 {
 	// Nothing needed here yet
 }
 
+#if SUPPORT_INPUT_SCANNER
+
+// Sample and debounce the monitored digital inputs. Called from the tick interrupt, so all the inputs are sampled every millisecond with no interrupt per pin.
+// We read each port group that has monitored inputs in one go and debounce all its bits together, then wake up the async sender if any monitored input has changed.
+/*static*/ void InputMonitor::ScanInputs()
+{
+	bool anyChanged = false;
+	for (size_t group = 0; group < PORT_GROUPS; ++group)
+	{
+		const uint32_t mask = scanMasks[group];
+		if (mask != 0)
+		{
+			const uint32_t changed = debouncers[group].Update(PORT->Group[group].IN.reg) & mask;
+			if (changed != 0)
+			{
+				scannedChanges[group] |= changed;
+				const uint32_t now = StepTimer::GetTimerTicks();
+				for (uint32_t bits = changed; bits != 0; bits &= bits - 1)
+				{
+					whenScannedChanged[group][LowestSetBit(bits)] = now;
+				}
+				anyChanged = true;
+			}
+		}
+	}
+
+	if (anyChanged)
+	{
+		CanInterface::WakeAsyncSenderFromIsr();
+	}
+}
+
+// Pass the changes found by the input scanner to the monitors that use it. Must own the read lock before calling this.
+// Each monitor takes its change, the debounced state and the time of the change together, so that a change found by the next scan is left for the next call.
+/*static*/ void InputMonitor::TransferScannedChanges()
+{
+	bool anyChanged = false;
+	for (size_t group = 0; group < PORT_GROUPS; ++group)
+	{
+		anyChanged = anyChanged || scannedChanges[group] != 0;
+	}
+
+	if (anyChanged)
+	{
+		for (InputMonitor *p = monitorsList; p != nullptr; p = p->next)
+		{
+			if (p->scanned && p->active)
+			{
+				const Pin pin = p->port.GetPin();
+				const uint32_t bit = 1ul << (pin & 31);
+				AtomicCriticalSectionLocker lock;
+				if ((scannedChanges[pin >> 5] & bit) != 0)
+				{
+					scannedChanges[pin >> 5] &= ~bit;
+					p->state = ((debouncers[pin >> 5].GetState() & bit) != 0) != p->port.GetTotalInvert();
+					p->RecordChange(whenScannedChanged[pin >> 5][pin & 31]);
+				}
+			}
+		}
+	}
+}
+
+#endif
+
 /*static*/ void InputMonitor::CommonDigitalPortInterrupt(CallbackParameter cbp)
 {
 	static_cast<InputMonitor*>(cbp.vp)->DigitalInterrupt();
@@ -90,6 +258,15 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 	static_cast<InputMonitor*>(cbp.vp)->AnalogInterrupt(reading);
 }
 
+#if SAME5x
+
+/*static*/ void InputMonitor::CommonAnalogThresholdInterrupt(CallbackParameter cbp, bool newState, uint32_t whenChanged)
+{
+	static_cast<InputMonitor*>(cbp.vp)->AnalogThresholdInterrupt(newState, whenChanged);
+}
+
+#endif
+
 /*static*/ ReadLockedPointer<InputMonitor> InputMonitor::Find(uint16_t handle)
 {
 	ReadLocker lock(listLock);
@@ -149,8 +326,13 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 
 	newMonitor->handle = msg.handle.u.all;
 	newMonitor->active = false;
+	newMonitor->scanned = false;
+	newMonitor->debounced = false;
 	newMonitor->state = false;
 	newMonitor->minInterval = msg.minInterval;
+	newMonitor->reportWindow = 0;
+	newMonitor->totalChanges = 0;
+	newMonitor->numChanges = 0;
 	newMonitor->threshold = msg.threshold;
 	newMonitor->sendDue = false;
 	String<StringLength50> pinName;
@@ -210,12 +392,20 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 
 	case CanMessageChangeInputMonitor::actionReturnPinName:
 		m->port.AppendPinName(reply);
-		reply.catf(", min interval %ums", m->minInterval);
+		reply.catf(", min interval %ums, report window %ums, %s, %" PRIu32 " changes",
+						m->minInterval, m->reportWindow, (m->scanned) ? "debounced" : "not debounced", m->totalChanges);
 		rslt = GCodeResult::ok;
 		break;
 
 	case CanMessageChangeInputMonitor::actionChangeThreshold:
 		m->threshold = msg.param;
+#if SAME5x
+		if (m->active && m->threshold != 0 && !m->SetAnalogThresholds())
+		{
+			rslt = GCodeResult::error;
+			break;
+		}
+#endif
 		rslt = GCodeResult::ok;
 		break;
 
@@ -224,6 +414,31 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 		rslt = GCodeResult::ok;
 		break;
 
+	case CanMessageChangeInputMonitor::actionChangeReportWindow:
+		m->reportWindow = msg.param;
+		if (msg.param != 0)
+		{
+			timedReportsRequested = true;				// older main board firmware doesn't send this action and can't parse the timed message
+		}
+		rslt = GCodeResult::ok;
+		break;
+
+	case CanMessageChangeInputMonitor::actionChangeDebounce:
+		// Digital inputs that don't need low latency, such as filament sensors, can ask to be debounced. Switch over straight away if we are monitoring the input.
+		if (m->debounced != (msg.param != 0))
+		{
+			const bool wasActive = m->active;
+			m->Deactivate();
+			m->debounced = (msg.param != 0);
+			if (wasActive && !m->Activate())
+			{
+				rslt = GCodeResult::error;
+				break;
+			}
+		}
+		rslt = GCodeResult::ok;
+		break;
+
 	default:
 		reply.printf("ChangeInputMonitor action #%u not implemented", msg.action);
 		rslt = GCodeResult::error;
@@ -234,13 +449,18 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 	return rslt;
 }
 
-// Check the input monitors and add any pending ones to the message
+// Check the input monitors and add any pending ones to the message, using the message format that older main board firmware understands.
+// The report windows are all zero until the main board opts in to the timed format, so we only apply the minimum intervals.
 // Return the number of ticks before we should be woken again, or TaskBase::TimeoutUnlimited if we shouldn't be work until an input changes state
 /*static*/ uint32_t InputMonitor::AddStateChanges(CanMessageInputChanged *msg)
 {
 	uint32_t timeToWait = TaskBase::TimeoutUnlimited;
 	ReadLocker lock(listLock);
 
+#if SUPPORT_INPUT_SCANNER
+	TransferScannedChanges();
+#endif
+
 	const uint32_t now = millis();
 	for (InputMonitor *p = monitorsList; p != nullptr; p = p->next)
 	{
@@ -254,6 +474,7 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 					InterruptCriticalSectionLocker lock;
 					p->sendDue = false;
 					state = p->state;
+					p->numChanges = 0;
 				}
 
 				if (msg->AddEntry(p->handle, state))
@@ -269,11 +490,95 @@ void InputMonitor::AnalogInterrupt(uint16_t reading)
 			else
 			{
 				// The state has changed but we've recently sent a state change for this input
-				const uint32_t timeLeft = p->minInterval - age;
-				if (timeLeft < timeToWait)
+				timeToWait = min<uint32_t>(timeToWait, p->minInterval - age);
+			}
+		}
+	}
+	return timeToWait;
+}
+
+// Check the input monitors and add any pending ones to the timed message.
+// An input is ready to be reported once its minimum interval since it was last reported has passed. We hold back the message until the earliest unreported
+// change of a ready input is older than that input's report window, so that further changes to it and to other inputs during the window go in the same message.
+// So the report window, plus less than a millisecond because the async sender waits in whole milliseconds, is the most that coalescing adds to the latency of reporting a change.
+// Return the number of ticks before we should be woken again, or TaskBase::TimeoutUnlimited if we shouldn't be work until an input changes state
+/*static*/ uint32_t InputMonitor::AddStateChanges(CanMessageInputChangesTimed *msg)
+{
+	constexpr uint32_t StepClocksPerMillisecond = StepTimer::StepClockRate/1000;
+
+	uint32_t timeToWait = TaskBase::TimeoutUnlimited;
+	ReadLocker lock(listLock);
+
+#if SUPPORT_INPUT_SCANNER
+	TransferScannedChanges();
+#endif
+
+	// See whether we should send a message yet
+	const uint32_t now = millis();
+	const uint32_t ticksNow = StepTimer::GetTimerTicks();
+	bool sendNow = false;
+	for (InputMonitor *p = monitorsList; p != nullptr; p = p->next)
+	{
+		if (p->sendDue)
+		{
+			const uint32_t age = now - p->whenLastSent;
+			if (age >= p->minInterval)
+			{
+				// Work in step clocks and round the time left up, so that we don't wake up just before the window ends and then wait another whole millisecond
+				const uint32_t windowTicks = p->reportWindow * StepClocksPerMillisecond;
+				const uint32_t waited = ticksNow - p->whenFirstChanged;
+				if (waited >= windowTicks)
+				{
+					sendNow = true;
+					break;
+				}
+				timeToWait = min<uint32_t>(timeToWait, (windowTicks - waited + StepClocksPerMillisecond - 1)/StepClocksPerMillisecond);
+			}
+			else
+			{
+				// The state has changed but we've recently sent a state change for this input
+				timeToWait = min<uint32_t>(timeToWait, p->minInterval - age);
+			}
+		}
+	}
+
+	if (!sendNow)
+	{
+		return timeToWait;
+	}
+
+	// Add all the inputs that are ready
+	timeToWait = TaskBase::TimeoutUnlimited;
+	for (InputMonitor *p = monitorsList; p != nullptr; p = p->next)
+	{
+		if (p->sendDue)
+		{
+			const uint32_t age = now - p->whenLastSent;
+			if (age >= p->minInterval)
+			{
+				if (msg->IsFull())
+				{
+					return 1;										// send this message and come back for the rest
+				}
+
+				bool state;
+				unsigned int changes;
+				uint32_t when;
 				{
-					timeToWait = timeLeft;
+					InterruptCriticalSectionLocker lock;
+					p->sendDue = false;
+					state = p->state;
+					changes = p->numChanges;
+					p->numChanges = 0;
+					when = p->whenChanged;
 				}
+
+				msg->AddEntry(p->handle, state, changes, StepTimer::ConvertToMasterTime(when));
+				p->whenLastSent = now;
+			}
+			else
+			{
+				timeToWait = min<uint32_t>(timeToWait, p->minInterval - age);
 			}
 		}
 	}
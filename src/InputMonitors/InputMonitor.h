@@ -13,9 +13,14 @@
 #include <GCodes/GCodeResult.h>
 #include <RTOSIface/RTOSIface.h>
 
+#if SUPPORT_INPUT_SCANNER
+# include "InputDebouncer.h"
+#endif
+
 struct CanMessageCreateInputMonitor;
 struct CanMessageChangeInputMonitor;
 struct CanMessageInputChanged;
+struct CanMessageInputChangesTimed;
 
 class InputMonitor
 {
@@ -27,27 +32,56 @@ public:
 	static GCodeResult Create(const CanMessageCreateInputMonitor& msg, size_t dataLength, const StringRef& reply, uint8_t& extra);
 	static GCodeResult Change(const CanMessageChangeInputMonitor& msg, const StringRef& reply, uint8_t& extra);
 
+	static bool UseTimedReports() { return timedReportsRequested; }
 	static uint32_t AddStateChanges(CanMessageInputChanged *msg);
+	static uint32_t AddStateChanges(CanMessageInputChangesTimed *msg);
 
 	static void CommonDigitalPortInterrupt(CallbackParameter cbp);
 	static void CommonAnalogPortInterrupt(CallbackParameter cbp, uint16_t reading);
+#if SAME5x
+	static void CommonAnalogThresholdInterrupt(CallbackParameter cbp, bool newState, uint32_t whenChanged);
+#endif
+
+#if SUPPORT_INPUT_SCANNER
+	static void ScanInputs();									// called from the tick interrupt to sample and debounce the digital inputs
+#endif
 
 private:
 	bool Activate();
 	void Deactivate();
 	void DigitalInterrupt();
 	void AnalogInterrupt(uint16_t reading);
+#if SAME5x
+	void AnalogThresholdInterrupt(bool newState, uint32_t whenChanged);
+	bool SetAnalogThresholds();
+#endif
+	void RecordChange(uint32_t when);
+
+#if SAME5x
+	static constexpr uint16_t AnalogHysteresis = 1u << (AnalogIn::AdcBits - 8);	// the reading must fall this far below the threshold before the state goes low again
+#endif
 
 	static bool Delete(uint16_t handle);
 	static ReadLockedPointer<InputMonitor> Find(uint16_t handle);
 
+#if SUPPORT_INPUT_SCANNER
+	static void TransferScannedChanges();
+#endif
+
 	InputMonitor *next;
 	IoPort port;
 	uint32_t whenLastSent;
 	uint16_t handle;
 	uint16_t minInterval;
 	uint16_t threshold;
+	uint16_t reportWindow;										// how long in milliseconds we may hold back a change so that other changes can be reported in the same message
+	volatile uint32_t whenChanged;								// the step clock time of the latest change that we haven't reported
+	volatile uint32_t whenFirstChanged;							// the step clock time of the earliest change that we haven't reported
+	volatile uint32_t totalChanges;								// the number of changes since the monitor was created, for diagnostics
+	volatile uint8_t numChanges;								// the number of changes since we last reported the state
 	bool active;
+	bool debounced;												// true if the main board asked for this digital input to be debounced
+	bool scanned;												// true if this is a digital input being sampled by the input scanner
 	volatile bool state;
 	volatile bool sendDue;
 
@@ -55,6 +89,15 @@ private:
 	static InputMonitor *freeList;
 
 	static ReadWriteLock listLock;
+	static bool timedReportsRequested;							// true once the main board has set a report window, which tells us it understands the timed format
+
+#if SUPPORT_INPUT_SCANNER
+	// Digital inputs that ask to be debounced are sampled a whole port group at a time every tick, instead of having an interrupt per pin
+	static uint32_t scanMasks[PORT_GROUPS];						// which bits of each port group are monitored
+	static InputDebouncer debouncers[PORT_GROUPS];
+	static volatile uint32_t scannedChanges[PORT_GROUPS];		// the monitored bits whose debounced state has changed since the async sender last looked
+	static volatile uint32_t whenScannedChanged[PORT_GROUPS][32];	// the step clock time of the latest change of each monitored bit
+#endif
 };
 
 #endif /* SRC_ENDSTOPS_INPUTMONITOR_H_ */
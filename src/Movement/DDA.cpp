@@ -11,6 +11,16 @@
 #include "Kinematics/LinearDeltaKinematics.h"		// for DELTA_AXES
 #include "CanMessageFormats.h"
 #include <CAN/CanInterface.h>
+#include "HardwareStepGenerator.h"
+#include <RTOSIface/RTOSIface.h>
+
+#if SUPPORT_SLOW_DRIVERS
+# include "SlowDriverTiming.h"
+#endif
+
+#if SUPPORT_STEP_TIME_BUFFER && (SINGLE_DRIVER || !SAME5x)
+# error The step time buffer is only supported on SAME5x boards with multiple drivers
+#endif
 
 #ifdef DUET_NG
 # define DDA_MOVE_DEBUG	(0)
@@ -116,7 +126,7 @@ pre(state == executing || state == frozen || state == completed)
 inline void DDA::InsertDM(DriveMovement *dm)
 {
 	DriveMovement **dmp = &activeDMs;
-	while (*dmp != nullptr && (*dmp)->nextStepTime < dm->nextStepTime)
+	while (*dmp != nullptr && (*dmp)->GetDueTime() < dm->GetDueTime())
 	{
 		dmp = &((*dmp)->nextDM);
 	}
@@ -160,6 +170,12 @@ void DDA::DebugPrint() const
 				"cks=%" PRIu32 " sstcda=%" PRIu32 " tstcddpdsc=%" PRIu32 " exac=%" PRIi32 "\n",
 				(double)acceleration, (double)deceleration, (double)startSpeed, (double)topSpeed, (double)endSpeed, (double)accelDistance, (double)decelDistance,
 				clocksNeeded, afterPrepare.startSpeedTimesCdivA, afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks, afterPrepare.extraAccelerationClocks);
+#if SUPPORT_FIXED_POINT_PREPARE
+	if (flags.fixedPointPrepare)
+	{
+		debugPrintf("prepared using fixed point, float values not calculated\n");
+	}
+#endif
 }
 
 // Print the DDA and active DMs
@@ -188,9 +204,27 @@ bool DDA::Init(const CanMessageMovement& msg)
 	// 0. Update the endpoints (do we even need them?)
 	bool realMove = false;
 
+	int32_t steps[NumDrivers];
+	for (size_t drive = 0; drive < NumDrivers; drive++)
+	{
+		steps[drive] = msg.perDrive[drive].steps;
+	}
+
+	// If we are not using delta kinematics then the drivers flagged in deltaDrives have their steps calculated from the Cartesian coordinates
+	if (msg.deltaDrives != 0 && !moveInstance->IsDeltaMode())
+	{
+		moveInstance->GetKinematicMotorSteps(msg, steps);
+	}
+
+	flags.babystepped = moveInstance->IsBabysteppingPending();
+	if (flags.babystepped)
+	{
+		moveInstance->AddBabySteps(msg, steps, INT32_MAX, 0);
+	}
+
 	for (size_t drive = 0; drive < NumDrivers; drive++)
 	{
-		int32_t delta = msg.perDrive[drive].steps;
+		const int32_t delta = steps[drive];
 
 		if (delta != 0)
 		{
@@ -211,21 +245,17 @@ bool DDA::Init(const CanMessageMovement& msg)
 	// 3. Store some values
 	afterPrepare.moveStartTime = msg.whenToExecute;
 	clocksNeeded = msg.accelerationClocks + msg.steadyClocks + msg.decelClocks;
+	accelerationClocks = msg.accelerationClocks;
+	decelClocks = msg.decelClocks;
+	initialSpeedFraction = msg.initialSpeedFraction;
+	finalSpeedFraction = msg.finalSpeedFraction;
+	deltaDrives = (uint8_t)msg.deltaDrives;
+	pressureAdvanceDrives = (uint8_t)msg.pressureAdvanceDrives;
 	flags.stopAllDrivesOnEndstopHit = msg.stopAllDrivesOnEndstopHit;
 
 	flags.hadHiccup = false;
 	flags.goingSlow = false;
 
-	topSpeed = 2.0/(2 * msg.steadyClocks + (msg.initialSpeedFraction + 1.0) * msg.accelerationClocks + (msg.finalSpeedFraction + 1.0) * msg.decelClocks);
-	startSpeed = topSpeed * msg.initialSpeedFraction;
-	endSpeed = topSpeed * msg.finalSpeedFraction;
-
-	acceleration = (msg.accelerationClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.initialSpeedFraction))/msg.accelerationClocks;
-	deceleration = (msg.decelClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.finalSpeedFraction))/msg.decelClocks;
-
-	accelDistance = topSpeed * (1.0 + msg.initialSpeedFraction) * msg.accelerationClocks * 0.5;
-	decelDistance = topSpeed * (1.0 + msg.finalSpeedFraction) * msg.decelClocks * 0.5;
-
 	state = provisional;
 	Prepare(msg);
 	return true;
@@ -236,25 +266,103 @@ bool DDA::Init(const CanMessageMovement& msg)
 void DDA::Prepare(const CanMessageMovement& msg)
 {
 	PrepParams params;
-	params.decelStartDistance = 1.0 - decelDistance;
+	const uint32_t deltaDrives = (moveInstance->IsDeltaMode()) ? msg.deltaDrives : 0;
+
+#if SUPPORT_FIXED_POINT_PREPARE
+	// Floating point arithmetic is slow on processors without an FPU, so use fixed point arithmetic if the move allows it.
+	// The fixed point path doesn't set up the float speeds and distances, because nothing else uses them.
+	const uint32_t prepareStartTime = StepTimer::GetTimerTicks();
+	flags.fixedPointPrepare = (deltaDrives == 0 && SetFixedPointParameters(msg, params));
+	if (flags.fixedPointPrepare)
+	{
+		++numFixedPointPrepares;
+	}
+	else
+#endif
+	{
+		topSpeed = 2.0/(2 * msg.steadyClocks + (msg.initialSpeedFraction + 1.0) * msg.accelerationClocks + (msg.finalSpeedFraction + 1.0) * msg.decelClocks);
+		startSpeed = topSpeed * msg.initialSpeedFraction;
+		endSpeed = topSpeed * msg.finalSpeedFraction;
+
+		acceleration = (msg.accelerationClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.initialSpeedFraction))/msg.accelerationClocks;
+		deceleration = (msg.decelClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.finalSpeedFraction))/msg.decelClocks;
+
+		accelDistance = topSpeed * (1.0 + msg.initialSpeedFraction) * msg.accelerationClocks * 0.5;
+		decelDistance = topSpeed * (1.0 + msg.finalSpeedFraction) * msg.decelClocks * 0.5;
+
+		params.decelStartDistance = 1.0 - decelDistance;
+
+		if (deltaDrives != 0)
+		{
+			afterPrepare.cKc = roundS32(msg.zMovement * DriveMovement::Kc);
+			params.dvecX = msg.finalX - msg.initialX;
+			params.dvecY = msg.finalY - msg.initialY;
+			params.dvecZ = msg.zMovement;
+			params.a2plusb2 = fsquare(params.dvecX) + fsquare(params.dvecY);
+			params.initialX = msg.initialX;
+			params.initialY = msg.initialY;
+			params.dparams = static_cast<const LinearDeltaKinematics*>(&(moveInstance->GetKinematics()));
+		}
+
+		afterPrepare.startSpeedTimesCdivA = (uint32_t)roundU32(startSpeed/acceleration);
+		params.topSpeedTimesCdivD = (uint32_t)roundU32(topSpeed/deceleration);
+		afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks = params.topSpeedTimesCdivD + msg.accelerationClocks + msg.steadyClocks;
+		afterPrepare.extraAccelerationClocks = msg.accelerationClocks - roundS32(accelDistance/topSpeed);
+		params.compFactor = (topSpeed - startSpeed)/topSpeed;
+#if SUPPORT_FIXED_POINT_PREPARE
+		++numFloatPrepares;
+#endif
+	}
 
-	if (msg.deltaDrives != 0)
+#if SUPPORT_INPUT_SHAPING
+	// All local drives except delta towers and extruders using pressure advance follow the same shaped profile, so that the part of the path
+	// driven by this board stays straight. Drives on other boards are shaped by those boards, so the whole path only stays straight if they
+	// use the same shaper. ProcessM593 ensures that all the enabled shapers on this board are the same, so use the first one we find.
+	flags.accelShaped = flags.decelShaped = false;
+	const InputShaper *shaper = nullptr;
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
 	{
-		afterPrepare.cKc = roundS32(msg.zMovement * DriveMovement::Kc);
-		params.dvecX = msg.finalX - msg.initialX;
-		params.dvecY = msg.finalY - msg.initialY;
-		params.dvecZ = msg.zMovement;
-		params.a2plusb2 = fsquare(params.dvecX) + fsquare(params.dvecY);
-		params.initialX = msg.initialX;
-		params.initialY = msg.initialY;
-		params.dparams = static_cast<const LinearDeltaKinematics*>(&(moveInstance->GetKinematics()));
+		if (pddm[drive] != nullptr && ((deltaDrives | msg.pressureAdvanceDrives) & (1u << drive)) == 0 && moveInstance->GetInputShaper(drive).IsEnabled())
+		{
+			shaper = &moveInstance->GetInputShaper(drive);
+			break;
+		}
 	}
 
-	afterPrepare.startSpeedTimesCdivA = (uint32_t)roundU32(startSpeed/acceleration);
-	params.topSpeedTimesCdivD = (uint32_t)roundU32(topSpeed/deceleration);
-	afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks = params.topSpeedTimesCdivD + msg.accelerationClocks + msg.steadyClocks;
-	afterPrepare.extraAccelerationClocks = msg.accelerationClocks - roundS32(accelDistance/topSpeed);
-	params.compFactor = (topSpeed - startSpeed)/topSpeed;
+	if (shaper != nullptr)
+	{
+		const uint32_t startTime = StepTimer::GetTimerTicks();
+		if (msg.accelerationClocks != 0)
+		{
+			flags.accelShaped = shapedAccel.Build(*shaper, 0.0, 0.0, startSpeed, topSpeed - startSpeed, (float)msg.accelerationClocks);
+			if (flags.accelShaped)
+			{
+				++numShapedPhases;
+			}
+			else
+			{
+				++numPhasesTooShort;
+			}
+		}
+		if (msg.decelClocks != 0)
+		{
+			flags.decelShaped = shapedDecel.Build(*shaper, (float)(msg.accelerationClocks + msg.steadyClocks), 1.0 - decelDistance, topSpeed, endSpeed - topSpeed, (float)msg.decelClocks);
+			if (flags.decelShaped)
+			{
+				++numShapedPhases;
+			}
+			else
+			{
+				++numPhasesTooShort;
+			}
+		}
+		const uint32_t timeTaken = StepTimer::GetTimerTicks() - startTime;
+		if (timeTaken > maxShapingClocks)
+		{
+			maxShapingClocks = timeTaken;
+		}
+	}
+#endif
 
 	activeDMs = nullptr;
 
@@ -263,79 +371,351 @@ void DDA::Prepare(const CanMessageMovement& msg)
 		DriveMovement* const pdm = FindDM(drive);
 		if (pdm != nullptr && pdm->state == DMState::moving)
 		{
-			Platform::EnableDrive(drive);
-			if ((msg.deltaDrives & (1u << drive)) != 0)			// for now, additional axes are assumed to be not part of the delta mechanism
-			{
-				pdm->PrepareDeltaAxis(*this, params);
+			PrepareDM(pdm, params, deltaDrives, msg.pressureAdvanceDrives);
+		}
+	}
 
-				// Check for sensible values, print them if they look dubious
-				if (Platform::Debug(moduleDda) && pdm->totalSteps > 1000000)
-				{
-					DebugPrintAll();
-				}
-			}
-			else if ((msg.pressureAdvanceDrives & (1u << drive)) != 0)
-			{
-				// If there is any extruder jerk in this move, in theory that means we need to instantly extrude or retract some amount of filament.
-				// Pass the speed change to PrepareExtruder
-				// But PrepareExtruder doesn't use it currently, so don't bother
-				pdm->PrepareExtruder(*this, params, 0.0);
-
-				// Check for sensible values, print them if they look dubious
-				if (Platform::Debug(moduleDda)
-					&& (   pdm->totalSteps > 1000000
-						|| pdm->reverseStartStep < pdm->mp.cart.decelStartStep
-						|| (pdm->reverseStartStep <= pdm->totalSteps
-							&& pdm->mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD > (int64_t)(pdm->mp.cart.twoCsquaredTimesMmPerStepDivD * pdm->reverseStartStep)
-						   )
-					   )
+#if SUPPORT_FIXED_POINT_PREPARE
+	const uint32_t prepareClocks = StepTimer::GetTimerTicks() - prepareStartTime;
+	if (prepareClocks > maxPrepareClocks)
+	{
+		maxPrepareClocks = prepareClocks;
+	}
+#endif
+
+	if (Platform::Debug(moduleDda) && Platform::Debug(moduleMove))		// temp show the prepared DDA if debug enabled for both modules
+	{
+		DebugPrintAll();
+	}
+
+	state = frozen;					// must do this last so that the ISR doesn't start executing it before we have finished setting it up
+}
+
+// Prepare a DM for its first step and add it to the list of DMs that need steps, if it has any steps to do
+void DDA::PrepareDM(DriveMovement *pdm, const PrepParams& params, uint32_t deltaDrives, uint32_t pressureAdvanceDrives)
+{
+	const size_t drive = pdm->drive;
+	Platform::EnableDrive(drive);
+	if ((deltaDrives & (1u << drive)) != 0)				// for now, additional axes are assumed to be not part of the delta mechanism
+	{
+		pdm->PrepareDeltaAxis(*this, params);
+
+		// Check for sensible values, print them if they look dubious
+		if (Platform::Debug(moduleDda) && pdm->totalSteps > 1000000)
+		{
+			DebugPrintAll();
+		}
+	}
+	else if ((pressureAdvanceDrives & (1u << drive)) != 0)
+	{
+		// If there is any extruder jerk in this move, in theory that means we need to instantly extrude or retract some amount of filament.
+		// Pass the speed change to PrepareExtruder
+		// But PrepareExtruder doesn't use it currently, so don't bother
+#if SUPPORT_FIXED_POINT_PREPARE
+		if (flags.fixedPointPrepare)
+		{
+			pdm->PrepareExtruderFixedPoint(params);
+		}
+		else
+#endif
+		{
+			pdm->PrepareExtruder(*this, params, 0.0);
+		}
+
+		// Check for sensible values, print them if they look dubious
+		if (Platform::Debug(moduleDda)
+			&& (   pdm->totalSteps > 1000000
+				|| pdm->reverseStartStep < pdm->mp.cart.decelStartStep
+				|| (pdm->reverseStartStep <= pdm->totalSteps
+					&& pdm->mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD > (int64_t)(pdm->mp.cart.twoCsquaredTimesMmPerStepDivD * pdm->reverseStartStep)
 				   )
-				{
-					DebugPrintAll();
-				}
+			   )
+		   )
+		{
+			DebugPrintAll();
+		}
+	}
+	else
+	{
+#if SUPPORT_FIXED_POINT_PREPARE
+		if (flags.fixedPointPrepare)
+		{
+			pdm->PrepareCartesianAxisFixedPoint(params);
+		}
+		else
+#endif
+		{
+			pdm->PrepareCartesianAxis(*this, params);
+		}
+
+		// Check for sensible values, print them if they look dubious
+		if (Platform::Debug(moduleDda) && pdm->totalSteps > 1000000)
+		{
+			DebugPrintAll();
+		}
+	}
+
+#if SUPPORT_INPUT_SHAPING
+	pdm->isShaped = !pdm->isDeltaMovement && (pressureAdvanceDrives & (1u << drive)) == 0;
+	pdm->accelSegment = pdm->decelSegment = 0;
+#endif
+
+	// Prepare for the first step
+	pdm->nextStep = 0;
+	pdm->nextStepTime = 0;
+	pdm->stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
+	pdm->stepsTillRecalc = 0;							// so that we don't skip the calculation
+#if SUPPORT_STEP_TIME_BUFFER
+	// Fill the step time buffer, then take the time of the first step from it
+	pdm->stepTimes.Clear();
+	pdm->startDirection = pdm->direction;
+	pdm->netStepsOutput = 0;
+	pdm->stepsOutput = 0;
+	pdm->lastOutputStepTime = pdm->outputStepInterval = 0;
+	while (pdm->NeedsPrecomputedSteps())
+	{
+		pdm->PrecomputeStep(*this);
+	}
+	const bool stepsToDo = pdm->PopStepTime(*this, false);
+#elif SUPPORT_DELTA_MOVEMENT
+	const bool stepsToDo = (pdm->IsDeltaMovement())
+							? pdm->CalcNextStepTimeDelta(*this, false)
+							: pdm->CalcNextStepTimeCartesian(*this, false);
+#else
+	const bool stepsToDo = pdm->CalcNextStepTimeCartesian(*this, false);
+#endif
+	if (stepsToDo)
+	{
+		InsertDM(pdm);
+	}
+	else
+	{
+		pdm->state = DMState::idle;
+	}
+}
+
+// Superimpose pending babysteps on this move, which has been prepared but not started, returning true if we added any. Called by the Move task.
+// We take the move out of the frozen state while we change it, so that if the step ISR gets to it first then it leaves it for Move::Spin to start.
+// Only the DMs of the drives that get babysteps are prepared again. The speed profile is unchanged, so the move still takes the same time.
+bool DDA::AddBabySteps()
+{
+	{
+		AtomicCriticalSectionLocker lock;
+		if (state != frozen)
+		{
+			return false;
+		}
+		state = provisional;
+	}
+
+	CanMessageMovement msg;
+	GetProfile(msg);
+	int32_t steps[NumDrivers], oldSteps[NumDrivers];
+	uint32_t drivesWithoutDms = 0;
+	int numDrivesWithoutDms = 0;
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
+	{
+		steps[drive] = oldSteps[drive] = GetNetSteps(drive);
+		if (pddm[drive] == nullptr)
+		{
+			drivesWithoutDms |= 1u << drive;
+			++numDrivesWithoutDms;
+		}
+	}
+
+	// A drive that isn't in this move needs a DM to take babysteps. Move::Spin doesn't keep any spare for queued moves, so we can only use those that are free.
+	const uint32_t excludedDrives = (DriveMovement::NumFree() >= numDrivesWithoutDms) ? 0 : drivesWithoutDms;
+#if SUPPORT_FIXED_POINT_PREPARE
+	moveInstance->AddBabySteps(msg, steps, (flags.fixedPointPrepare) ? (int32_t)MaxFixedPointSteps - 1 : INT32_MAX, excludedDrives);
+#else
+	moveInstance->AddBabySteps(msg, steps, INT32_MAX, excludedDrives);
+#endif
+	flags.babystepped = true;
+
+	bool changed = false;
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
+	{
+		if (steps[drive] != oldSteps[drive])
+		{
+			changed = true;
+			DriveMovement*& pdm = pddm[drive];
+			if (pdm == nullptr)
+			{
+				pdm = DriveMovement::Allocate(drive, DMState::moving);	// we checked that there are enough free DMs
 			}
 			else
 			{
-				pdm->PrepareCartesianAxis(*this, params);
-
-				// Check for sensible values, print them if they look dubious
-				if (Platform::Debug(moduleDda) && pdm->totalSteps > 1000000)
+				RemoveDM(drive);
+				if (steps[drive] == 0)
 				{
-					DebugPrintAll();
+					DriveMovement::Release(pdm);
+					pdm = nullptr;
+					continue;
 				}
+				pdm->state = DMState::moving;
 			}
+			pdm->totalSteps = labs(steps[drive]);
+			pdm->direction = (steps[drive] >= 0);
+		}
+	}
 
-			// Prepare for the first step
-			pdm->nextStep = 0;
-			pdm->nextStepTime = 0;
-			pdm->stepInterval = 999999;							// initialise to a large value so that we will calculate the time for just one step
-			pdm->stepsTillRecalc = 0;							// so that we don't skip the calculation
-#if SUPPORT_DELTA_MOVEMENT
-			const bool stepsToDo = (pdm->IsDeltaMovement())
-									? pdm->CalcNextStepTimeDelta(*this, false)
-									: pdm->CalcNextStepTimeCartesian(*this, false);
-#else
-			const bool stepsToDo = pdm->CalcNextStepTimeCartesian(*this, false);
+	if (changed)
+	{
+		PrepParams params;
+#if SUPPORT_FIXED_POINT_PREPARE
+		if (flags.fixedPointPrepare)
+		{
+			(void)SetFixedPointParameters(msg, params);				// this can't fail, because Move::AddBabySteps kept the step counts in range
+		}
+		else
 #endif
-			if (stepsToDo)
+		{
+			params.decelStartDistance = 1.0 - decelDistance;
+			params.topSpeedTimesCdivD = (uint32_t)roundU32(topSpeed/deceleration);
+		}
+
+		// Drives that get babysteps are never delta towers or extruders using pressure advance
+		for (size_t drive = 0; drive < NumDrivers; ++drive)
+		{
+			if (steps[drive] != oldSteps[drive] && pddm[drive] != nullptr)
 			{
-				InsertDM(pdm);
+				PrepareDM(pddm[drive], params, 0, 0);
 			}
-			else
+		}
+	}
+
+	state = frozen;
+	return changed;
+}
+
+// Recreate the parts of the movement message that describe the speed profile of this move
+void DDA::GetProfile(CanMessageMovement& msg) const
+{
+	memset(&msg, 0, sizeof(msg));
+	msg.whenToExecute = afterPrepare.moveStartTime;
+	msg.accelerationClocks = accelerationClocks;
+	msg.steadyClocks = clocksNeeded - accelerationClocks - decelClocks;
+	msg.decelClocks = decelClocks;
+	msg.initialSpeedFraction = initialSpeedFraction;
+	msg.finalSpeedFraction = finalSpeedFraction;
+	msg.deltaDrives = deltaDrives;
+	msg.pressureAdvanceDrives = pressureAdvanceDrives;
+}
+
+#if SUPPORT_FIXED_POINT_PREPARE
+
+unsigned int DDA::numFixedPointPrepares = 0;
+unsigned int DDA::numFloatPrepares = 0;
+uint32_t DDA::maxPrepareClocks = 0;
+
+// Convert a speed fraction in the range 0.0 to 1.0 to Q16 format by unpacking the float, because a floating point multiplication is slow without an FPU.
+// Values outside the range are clamped. Rounding is to nearest.
+/*static*/ uint32_t DDA::SpeedFractionToFixed(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	if ((int32_t)bits <= 0)
+	{
+		return 0;													// zero, negative or negative zero
+	}
+
+	// The value is mantissa * 2^(exponent - 23) where mantissa has 24 bits including the implied leading 1, so the Q16 value is mantissa >> (7 - exponent)
+	const int32_t exponent = (int32_t)(bits >> 23) - 127;
+	if (exponent >= 0)
+	{
+		return SpeedFractionScale;									// 1.0 or greater, or infinity or NaN
+	}
+	const unsigned int shift = 7 - exponent;						// at least 8
+	const uint32_t mantissa = (bits & 0x007FFFFF) | 0x00800000;
+	return (shift >= 32) ? 0 : (mantissa + (1u << (shift - 1))) >> shift;
+}
+
+// Calculate the fixed point move parameters if the move is within the ranges that we can handle, returning true if successful.
+// With the speed fractions in Q16 format and durations, step counts and pressure advance times all less than 2^22 step clocks or steps:
+//  twoClocksAtTopSpeed = (2 * steady + (1 + initialFraction) * accel + (1 + finalFraction) * decel) * 2^16 <= 2 * 2^22 * 2^16 = 2^39
+//  the distance numerators are no greater than twoClocksAtTopSpeed, and the compensation distance numerator in PrepareExtruderFixedPoint is less than 2^39
+//  so the products of a distance numerator (or the sum of two of them) with a step count or phase duration are less than 2^40 * 2^22 = 2^62
+//  topSpeedTimesCdivD is checked to be less than 2^31 so that its square plus twoDecelStartDistanceDivD still fits in an int64_t
+bool DDA::SetFixedPointParameters(const CanMessageMovement& msg, PrepParams& params)
+{
+	constexpr float MaxFixedPointPressureAdvance = (float)MaxFixedPointClocks/(float)StepTimer::StepClockRate;
+
+	if (clocksNeeded >= MaxFixedPointClocks)
+	{
+		return false;
+	}
+
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
+	{
+		const DriveMovement * const pdm = FindDM(drive);
+		if (pdm != nullptr && pdm->state == DMState::moving)
+		{
+			if (   pdm->totalSteps >= MaxFixedPointSteps
+				|| ((msg.pressureAdvanceDrives & (1u << drive)) != 0 && Platform::GetPressureAdvance(drive) >= MaxFixedPointPressureAdvance)
+			   )
 			{
-				pdm->state = DMState::idle;
+				return false;
 			}
 		}
 	}
 
-	if (Platform::Debug(moduleDda) && Platform::Debug(moduleMove))		// temp show the prepared DDA if debug enabled for both modules
+	const uint32_t accelClocks = msg.accelerationClocks;
+	const uint32_t decelClocks = msg.decelClocks;
+	const uint32_t initialFraction = SpeedFractionToFixed(msg.initialSpeedFraction);
+	const uint32_t finalFraction = SpeedFractionToFixed(msg.finalSpeedFraction);
+
+	// If there is an acceleration or deceleration phase then its speed change must not be zero, else we would divide by zero
+	uint32_t accelSpeedChange = SpeedFractionScale - initialFraction;
+	if (accelClocks != 0 && accelSpeedChange == 0)
 	{
-		DebugPrintAll();
+		accelSpeedChange = 1;
+	}
+	uint32_t decelSpeedChange = SpeedFractionScale - finalFraction;
+	if (decelClocks != 0 && decelSpeedChange == 0)
+	{
+		decelSpeedChange = 1;
 	}
 
-	state = frozen;					// must do this last so that the ISR doesn't start executing it before we have finished setting it up
+	const uint64_t topSpeedTimesCdivD = (decelClocks == 0) ? 0 : roundDivU64((uint64_t)decelClocks << SpeedFractionBits, decelSpeedChange);
+	const uint64_t startSpeedTimesCdivA = (accelClocks == 0) ? 0 : roundDivU64((uint64_t)initialFraction * accelClocks, accelSpeedChange);
+	if (topSpeedTimesCdivD >= (1u << 31) || startSpeedTimesCdivA >= (1u << 31))
+	{
+		return false;
+	}
+
+	const uint64_t accelDistanceNumerator = (uint64_t)(SpeedFractionScale + initialFraction) * accelClocks;
+	const uint64_t decelDistanceNumerator = (uint64_t)(SpeedFractionScale + finalFraction) * decelClocks;
+	const uint64_t twoSteadyDistanceNumerator = (uint64_t)msg.steadyClocks << (SpeedFractionBits + 1);
+	const uint64_t twoClocksAtTopSpeed = accelDistanceNumerator + twoSteadyDistanceNumerator + decelDistanceNumerator;
+
+	params.fixed.twoClocksAtTopSpeed = twoClocksAtTopSpeed;
+	params.fixed.accelDistanceNumerator = accelDistanceNumerator;
+	params.fixed.decelDistanceNumerator = decelDistanceNumerator;
+	params.fixed.decelStartNumerator = accelDistanceNumerator + twoSteadyDistanceNumerator;
+	params.fixed.twoDivANumerator = (uint64_t)accelClocks * twoClocksAtTopSpeed;
+	params.fixed.twoDivDNumerator = (uint64_t)decelClocks * twoClocksAtTopSpeed;
+	params.fixed.twoDecelStartDistanceDivD = (decelClocks == 0) ? 0 : roundDivU64(params.fixed.decelStartNumerator * decelClocks, decelSpeedChange);
+	params.fixed.accelSpeedChange = accelSpeedChange;
+	params.fixed.decelSpeedChange = decelSpeedChange;
+	params.fixed.decelClocks = decelClocks;
+
+	afterPrepare.startSpeedTimesCdivA = (uint32_t)startSpeedTimesCdivA;
+	params.topSpeedTimesCdivD = (uint32_t)topSpeedTimesCdivD;
+	afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks = params.topSpeedTimesCdivD + accelClocks + msg.steadyClocks;
+	afterPrepare.extraAccelerationClocks = (int32_t)accelClocks - (int32_t)(accelDistanceNumerator >> (SpeedFractionBits + 1));
+	return true;
+}
+
+/*static*/ void DDA::PrepareDiagnostics(const StringRef& reply)
+{
+	reply.catf("Moves prepared using fixed point %u, floating point %u, max prepare time %" PRIu32 "us\n",
+				numFixedPointPrepares, numFloatPrepares, (maxPrepareClocks * 1000000u)/StepTimer::StepClockRate);
+	numFixedPointPrepares = numFloatPrepares = 0;
+	maxPrepareClocks = 0;
 }
 
+#endif
+
 // The remaining functions are speed-critical, so use full optimisation
 // The GCC optimize pragma appears to be broken, if we try to force O3 optimisation here then functions are never inlined
 
@@ -357,7 +737,25 @@ pre(state == frozen)
 			if (pdm != nullptr && pdm->state == DMState::moving)
 			{
 				const size_t drive = pdm->drive;
+#if SUPPORT_HARDWARE_STEP_GENERATION
+				if (HardwareStepGenerator::IsHardwareStepped(drive))
+				{
+					// The generator sets the direction when it has finished the steps of the previous move. Queue as many steps as it will take.
+					RemoveDM(drive);
+					pdm->hardwareStepTime = pdm->dueStepTime;
+					if (pdm->FeedHardwareStepGenerator(*this))
+					{
+						InsertDM(pdm);
+					}
+					continue;
+				}
+#endif
+#if SUPPORT_STEP_TIME_BUFFER
+				Platform::SetDirection(drive, pdm->startDirection);
+				pdm->outputDirection = pdm->startDirection;
+#else
 				Platform::SetDirection(drive, pdm->direction);
+#endif
 			}
 		}
 	}
@@ -366,6 +764,106 @@ pre(state == frozen)
 uint32_t DDA::lastStepLowTime = 0;
 uint32_t DDA::lastDirChangeTime = 0;
 
+#if SUPPORT_SLOW_DRIVERS
+
+uint32_t DDA::lastStepHighTime = 0;
+uint32_t DDA::stepHoldoffTime = 0;
+bool DDA::slowDriverStepPulseActive = false;
+bool DDA::stepHoldoffPending = false;
+unsigned int DDA::numStepHoldoffs = 0;
+unsigned int DDA::numShortWaits = 0;
+unsigned int DDA::numDirectionChangesDeferred = 0;
+
+// Check whether the step low time and direction setup time of the slow drivers allow us to generate a step now.
+// If the wait is shorter than we can schedule an interrupt for, wait here. Otherwise return false after arranging for the next step interrupt to be when the wait will be over,
+// so that the time isn't taken from other interrupts.
+/*static*/ bool DDA::SlowDriverTimingAllowsStep(uint32_t now)
+{
+	const uint32_t wait = SlowDriverTiming::GetStepWait(now, lastStepLowTime, lastDirChangeTime,
+															Platform::GetSlowDriverStepLowClocks(), Platform::GetSlowDriverDirSetupClocks());
+	if (wait == 0)
+	{
+		return true;
+	}
+
+	if (SlowDriverTiming::ShouldHoldOff(wait, StepTimer::MinInterruptInterval))
+	{
+		stepHoldoffTime = now + wait;
+		stepHoldoffPending = true;
+		++numStepHoldoffs;
+		return false;
+	}
+
+	++numShortWaits;
+	while (StepTimer::GetTimerTicks() - now < wait) { }
+	return true;
+}
+
+// Platform::SetDirection calls this when it has deferred a direction change, so that the step interrupt happens when the change can be made
+/*static*/ void DDA::DeferSlowDriverDirectionChange(uint32_t whenAllowed)
+{
+	stepHoldoffTime = whenAllowed;
+	stepHoldoffPending = true;
+	++numDirectionChangesDeferred;
+}
+
+// Make any direction changes that SetDirection deferred, updating 'now' if we do. If the direction hold time is still long enough away
+// to schedule an interrupt for, return false after arranging for the next step interrupt to be then.
+// We are called before generating steps, in case this is the interrupt that we scheduled for the change, and after calculating the step times.
+/*static*/ bool DDA::SlowDriverDirectionChangesDone(uint32_t& now)
+{
+	const uint32_t wait = SlowDriverTiming::GetRemainingTime(now, lastStepLowTime, Platform::GetSlowDriverDirHoldClocks());
+	if (SlowDriverTiming::ShouldHoldOff(wait, StepTimer::MinInterruptInterval))
+	{
+		stepHoldoffTime = now + wait;
+		stepHoldoffPending = true;
+		return false;
+	}
+
+	while (SlowDriverTiming::GetRemainingTime(StepTimer::GetTimerTicks(), lastStepLowTime, Platform::GetSlowDriverDirHoldClocks()) != 0) { }
+	Platform::ApplyPendingDirectionChanges();
+	stepHoldoffPending = false;										// we no longer need the interrupt that SetDirection asked for
+	now = StepTimer::GetTimerTicks();
+	return true;
+}
+
+// End the step pulse to slow drivers. We generate the step pulse before calculating the next step times, so usually it has been high for long enough already.
+/*static*/ void DDA::EndSlowDriverStepPulse()
+{
+	while (SlowDriverTiming::GetRemainingTime(StepTimer::GetTimerTicks(), lastStepHighTime, Platform::GetSlowDriverStepHighClocks()) != 0) { }
+#if SINGLE_DRIVER
+	Platform::StepDriverLow();
+#else
+	Platform::StepDriversLow();
+#endif
+	lastStepLowTime = StepTimer::GetTimerTicks();
+	slowDriverStepPulseActive = false;
+}
+
+/*static*/ void DDA::SlowDriverDiagnostics(const StringRef& reply)
+{
+	reply.catf("Slow driver steps held off %u, short waits %u, direction changes deferred %u\n", numStepHoldoffs, numShortWaits, numDirectionChangesDeferred);
+	numStepHoldoffs = numShortWaits = numDirectionChangesDeferred = 0;
+}
+
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+
+unsigned int DDA::numShapedPhases = 0;
+unsigned int DDA::numPhasesTooShort = 0;
+uint32_t DDA::maxShapingClocks = 0;
+
+/*static*/ void DDA::ShapingDiagnostics(const StringRef& reply)
+{
+	reply.catf("Input shaping: phases shaped %u, too short %u, max calc time %" PRIu32 "us\n",
+				numShapedPhases, numPhasesTooShort, (maxShapingClocks * 1000000u)/StepTimer::StepClockRate);
+	numShapedPhases = numPhasesTooShort = 0;
+	maxShapingClocks = 0;
+}
+
+#endif
+
 #if SINGLE_DRIVER
 
 // This is called by the interrupt service routine to execute steps.
@@ -374,6 +872,13 @@ uint32_t DDA::lastDirChangeTime = 0;
 // This may occasionally get called prematurely, so it must check that a step is actually due before generating one.
 void DDA::StepDrivers(uint32_t now)
 {
+#if SUPPORT_SLOW_DRIVERS
+	if (Platform::HasPendingDirectionChanges() && !SlowDriverDirectionChangesDone(now))
+	{
+		return;														// the step interrupt will be scheduled for when we can change the direction
+	}
+#endif
+
 	// Determine whether the driver is due for stepping, overdue, or will be due very shortly
 	DriveMovement* const dm = activeDMs;
 	if (dm != nullptr && (now - afterPrepare.moveStartTime) + StepTimer::MinInterruptInterval >= dm->nextStepTime)	// if the next step is due
@@ -382,18 +887,13 @@ void DDA::StepDrivers(uint32_t now)
 #if SUPPORT_SLOW_DRIVERS
 		if (Platform::IsSlowDriver())									// if using a slow driver
 		{
-			uint32_t lastStepPulseTime = lastStepLowTime;
-			while (now - lastStepPulseTime < Platform::GetSlowDriverStepLowClocks() || now - lastDirChangeTime < Platform::GetSlowDriverDirSetupClocks())
+			if (!SlowDriverTimingAllowsStep(now))
 			{
-				now = StepTimer::GetTimerTicks();
+				return;													// the step interrupt will be scheduled for when we can generate the step
 			}
 			Platform::StepDriverHigh();									// generate the step
-			lastStepPulseTime = StepTimer::GetTimerTicks();
-
-			// 3a. Reset all step pins low. Do this now because some external drivers don't like the direction pins being changed before the end of the step pulse.
-			while (StepTimer::GetTimerTicks() - lastStepPulseTime < Platform::GetSlowDriverStepHighClocks()) {}
-			Platform::StepDriverLow();									// set all step pins low
-			lastStepLowTime = StepTimer::GetTimerTicks();
+			lastStepHighTime = StepTimer::GetTimerTicks();
+			slowDriverStepPulseActive = true;							// we end the pulse after calculating the next step time, or before changing direction
 		}
 		else
 		{
@@ -415,8 +915,25 @@ void DDA::StepDrivers(uint32_t now)
 			activeDMs = nullptr;
 		}
 
-		// Reset the step pin low. We already did this if we are using any external drivers, but doing it again does no harm.
-		Platform::StepDriverLow();										// set the step pin low
+		// Reset the step pin low
+#if SUPPORT_SLOW_DRIVERS
+		if (slowDriverStepPulseActive)
+		{
+			EndSlowDriverStepPulse();
+		}
+		else
+#endif
+		{
+			Platform::StepDriverLow();									// set the step pin low
+		}
+
+#if SUPPORT_SLOW_DRIVERS
+		if (Platform::HasPendingDirectionChanges())
+		{
+			now = StepTimer::GetTimerTicks();
+			(void)SlowDriverDirectionChangesDone(now);					// usually the hold time has passed while we calculated the step time
+		}
+#endif
 	}
 
 	// If there are no more steps to do and the time for the move has nearly expired, flag the move as complete
@@ -434,14 +951,26 @@ void DDA::StepDrivers(uint32_t now)
 // This may occasionally get called prematurely, so it must check that a step is actually due before generating one.
 void DDA::StepDrivers(uint32_t now)
 {
-	// 1. There is no step 1.
+	// 1. Make any direction changes to slow drivers that we deferred
+#if SUPPORT_SLOW_DRIVERS
+	if (Platform::HasPendingDirectionChanges() && !SlowDriverDirectionChangesDone(now))
+	{
+		return;														// the step interrupt will be scheduled for when we can change the direction
+	}
+#endif
+
 	// 2. Determine which drivers are due for stepping, overdue, or will be due very shortly
 	uint32_t driversStepping = 0;
 	DriveMovement* dm = activeDMs;
 	const uint32_t elapsedTime = (now - afterPrepare.moveStartTime) + StepTimer::MinInterruptInterval;
-	while (dm != nullptr && elapsedTime >= dm->nextStepTime)		// if the next step is due
+	while (dm != nullptr && elapsedTime >= dm->GetDueTime())		// if the next step is due
 	{
-		driversStepping |= Platform::GetDriversBitmap(dm->drive);
+#if SUPPORT_STEP_TIME_BUFFER
+		if (dm->HasStepDue())										// if the step time buffer was empty then the due time is when to look at it again
+#endif
+		{
+			driversStepping |= Platform::GetDriversBitmap(dm->drive);
+		}
 		dm = dm->nextDM;
 	}
 
@@ -453,18 +982,13 @@ void DDA::StepDrivers(uint32_t now)
 	}
 	else
 	{
-		uint32_t lastStepPulseTime = lastStepLowTime;
-		while (now - lastStepPulseTime < Platform::GetSlowDriverStepLowClocks() || now - lastDirChangeTime < Platform::GetSlowDriverDirSetupClocks())
+		if (!SlowDriverTimingAllowsStep(now))
 		{
-			now = StepTimer::GetTimerTicks();
+			return;													// the step interrupt will be scheduled for when we can generate the steps
 		}
 		Platform::StepDriversHigh(driversStepping);					// generate the steps
-		lastStepPulseTime = StepTimer::GetTimerTicks();
-
-		// 3a. Reset all step pins low. Do this now because some external drivers don't like the direction pins being changed before the end of the step pulse.
-		while (StepTimer::GetTimerTicks() - lastStepPulseTime < Platform::GetSlowDriverStepHighClocks()) {}
-		Platform::StepDriversLow();									// set all step pins low
-		lastStepLowTime = StepTimer::GetTimerTicks();
+		lastStepHighTime = StepTimer::GetTimerTicks();
+		slowDriverStepPulseActive = true;							// we end the pulse after calculating the next step times, or before changing direction
 	}
 #else
 	Platform::StepDriversHigh(driversStepping);						// generate the steps
@@ -475,9 +999,24 @@ void DDA::StepDrivers(uint32_t now)
 	//    Note that the call to CalcNextStepTime may change the state of Direction pin.
 	DriveMovement *dmToInsert = activeDMs;							// head of the chain we need to re-insert
 	activeDMs = dm;													// remove the chain from the list
+#if SUPPORT_STEP_TIME_BUFFER
+	bool wakeStepCalculator = false;
+#endif
 	while (dmToInsert != dm)										// note that both of these may be nullptr
 	{
-#if SUPPORT_DELTA_MOVEMENT
+#if SUPPORT_STEP_TIME_BUFFER
+# if SUPPORT_HARDWARE_STEP_GENERATION
+		const bool hasMoreSteps = (HardwareStepGenerator::IsHardwareStepped(dmToInsert->drive))
+									? dmToInsert->FeedHardwareStepGenerator(*this)
+									: dmToInsert->PopStepTime(*this, true);
+# else
+		const bool hasMoreSteps = dmToInsert->PopStepTime(*this, true);
+# endif
+		if (dmToInsert->NumBufferedStepTimes() <= DriveMovement::StepTimeBufferLength/2 && dmToInsert->NeedsPrecomputedSteps())
+		{
+			wakeStepCalculator = true;
+		}
+#elif SUPPORT_DELTA_MOVEMENT
 		const bool hasMoreSteps = (dmToInsert->IsDeltaMovement())
 				? dmToInsert->CalcNextStepTimeDelta(*this, true)
 				: dmToInsert->CalcNextStepTimeCartesian(*this, true);
@@ -492,8 +1031,32 @@ void DDA::StepDrivers(uint32_t now)
 		dmToInsert = nextToInsert;
 	}
 
-	// 5. Reset all step pins low. We already did this if we are using any external drivers, but doing it again does no harm.
-	Platform::StepDriversLow();										// set all step pins low
+	// 5. Reset all step pins low
+#if SUPPORT_SLOW_DRIVERS
+	if (slowDriverStepPulseActive)
+	{
+		EndSlowDriverStepPulse();									// usually the step calculations took longer than the step high time, so this doesn't wait
+	}
+	else
+#endif
+	{
+		Platform::StepDriversLow();									// set all step pins low
+	}
+
+#if SUPPORT_SLOW_DRIVERS
+	if (Platform::HasPendingDirectionChanges())
+	{
+		now = StepTimer::GetTimerTicks();
+		(void)SlowDriverDirectionChangesDone(now);					// usually the hold time has passed while we calculated the step times
+	}
+#endif
+
+#if SUPPORT_STEP_TIME_BUFFER
+	if (wakeStepCalculator)
+	{
+		Move::WakeStepCalculator();
+	}
+#endif
 
 	// 6. If there are no more steps to do and the time for the move has nearly expired, flag the move as complete
 	if (activeDMs == nullptr && StepTimer::GetTimerTicks() - afterPrepare.moveStartTime + WakeupTime >= clocksNeeded)
@@ -504,10 +1067,40 @@ void DDA::StepDrivers(uint32_t now)
 
 #endif
 
+#if SUPPORT_STEP_TIME_BUFFER
+
+// Top up the step time buffers of this move. Called by the step calculation task while the move is executing.
+// The step ISR only takes entries from the buffers and never calculates steps, so we don't need to disable it.
+// The DMs can't be released while we are using them, because that is done by the main task, which has a lower priority than this one.
+void DDA::PrecomputeSteps()
+{
+	bool moreNeeded;
+	do
+	{
+		moreNeeded = false;
+		for (DriveMovement *pdm : pddm)
+		{
+			if (pdm != nullptr && state == executing && pdm->NeedsPrecomputedSteps())
+			{
+				pdm->PrecomputeStep(*this);
+				moreNeeded = moreNeeded || pdm->NeedsPrecomputedSteps();
+			}
+		}
+	} while (moreNeeded);
+}
+
+#endif
+
 // Stop a drive and re-calculate the corresponding endpoint.
 // For extruder drivers, we need to be able to calculate how much of the extrusion was completed after calling this.
 void DDA::StopDrive(size_t drive)
 {
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	if (HardwareStepGenerator::IsHardwareStepped(drive))
+	{
+		HardwareStepGenerator::Cancel();							// the generator may have steps queued even if the DM has passed it all its steps
+	}
+#endif
 	DriveMovement* const pdm = FindDM(drive);
 	if (pdm != nullptr && pdm->state == DMState::moving)
 	{
@@ -584,4 +1177,11 @@ int32_t DDA::GetStepsTaken(size_t drive) const
 	return (dmp != nullptr) ? dmp->GetNetStepsTaken() : 0;
 }
 
+// Return the number of net steps that a particular drive takes in the whole of this move
+int32_t DDA::GetNetSteps(size_t drive) const
+{
+	const DriveMovement * const dmp = FindDM(drive);
+	return (dmp != nullptr && dmp->state == DMState::moving) ? dmp->GetNetSteps() : 0;
+}
+
 // End
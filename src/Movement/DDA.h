@@ -12,6 +12,7 @@
 #include "DriveMovement.h"
 #include "GCodes/GCodes.h"			// for class RawMove, HomeAxes
 #include "StepTimer.h"
+#include "InputShaper.h"
 
 struct CanMessageMovement;
 
@@ -44,6 +45,10 @@ public:
 	void Complete() { state = completed; }
 	bool Free();
 	void Prepare(const CanMessageMovement& msg) __attribute__ ((hot));	// Calculate all the values and freeze this DDA
+	bool AddBabySteps();											// Superimpose pending babysteps on this move before it starts
+#if SUPPORT_STEP_TIME_BUFFER
+	void PrecomputeSteps();											// Top up the step time buffers, called by the step calculation task
+#endif
 	bool HasStepError() const;
 
 	DDAState GetState() const { return state; }
@@ -55,10 +60,16 @@ public:
 	// Filament monitor support
 	int32_t GetStepsTaken(size_t drive) const;
 
+	// Babystepping support
+	int32_t GetNetSteps(size_t drive) const;
+	bool HasBabySteps() const { return flags.babystepped; }
+	void SetHasBabySteps() { flags.babystepped = true; }
+
 	void MoveAborted();
 	void StopDrivers(uint16_t whichDrivers);
 
 	uint32_t GetClocksNeeded() const { return clocksNeeded; }
+	uint32_t GetMoveStartTime() const { return afterPrepare.moveStartTime; }
 	uint32_t GetMoveFinishTime() const { return afterPrepare.moveStartTime + clocksNeeded; }
 
 #if HAS_SMART_DRIVERS
@@ -93,12 +104,29 @@ public:
 	static uint32_t lastStepLowTime;								// when we last completed a step pulse to a slow driver
 	static uint32_t lastDirChangeTime;								// when we last change the DIR signal to a slow driver
 
+#if SUPPORT_SLOW_DRIVERS
+	static void EndSlowDriverStepPulse();							// end a step pulse to slow drivers once it has been high for long enough
+	static bool IsSlowDriverStepPulseActive() { return slowDriverStepPulseActive; }
+	static void SlowDriverDiagnostics(const StringRef& reply);
+	static void DeferSlowDriverDirectionChange(uint32_t whenAllowed);	// have the step interrupt make a deferred direction change when the hold time has passed
+#endif
+
+#if SUPPORT_INPUT_SHAPING
+	static void ShapingDiagnostics(const StringRef& reply);
+#endif
+
+#if SUPPORT_FIXED_POINT_PREPARE
+	static void PrepareDiagnostics(const StringRef& reply);
+#endif
+
 private:
 	DriveMovement *FindDM(size_t drive) const;
 	void StopDrive(size_t drive);									// stop movement of a drive and recalculate the endpoint
 	void InsertDM(DriveMovement *dm) __attribute__ ((hot));
 	void RemoveDM(size_t drive);
 	void ReleaseDMs();
+	void PrepareDM(DriveMovement *pdm, const PrepParams& params, uint32_t deltaDrives, uint32_t pressureAdvanceDrives) __attribute__ ((hot));
+	void GetProfile(CanMessageMovement& msg) const;
 	void DebugPrintVector(const char *name, const float *vec, size_t len) const;
 
     DDA *next;								// The next one in the ring
@@ -112,7 +140,11 @@ private:
 		{
 			uint16_t goingSlow : 1,					// True if we have slowed the movement because the Z probe is approaching its threshold
 					 hadHiccup : 1,					// True if we had a hiccup while executing this move
-					 stopAllDrivesOnEndstopHit : 1;	// True if hitting an endstop stops the entire move
+					 stopAllDrivesOnEndstopHit : 1,	// True if hitting an endstop stops the entire move
+					 accelShaped : 1,				// True if the acceleration phase has been input shaped
+					 decelShaped : 1,				// True if the deceleration phase has been input shaped
+					 fixedPointPrepare : 1,			// True if the move was prepared using fixed point arithmetic, so the float speeds and distances are not valid
+					 babystepped : 1;				// True if the pending babysteps have been added to the move as far as its limits allow, or it is a move to do babysteps
 		} flags;
 		uint16_t all;								// so that we can print all the flags at once for debugging
 	};
@@ -129,6 +161,14 @@ private:
 
 	uint32_t clocksNeeded;
 
+	// The speed profile of the move as received, kept so that babysteps can be added after the move has been prepared
+	uint32_t accelerationClocks;
+	uint32_t decelClocks;
+	float initialSpeedFraction;
+	float finalSpeedFraction;
+	uint8_t deltaDrives;
+	uint8_t pressureAdvanceDrives;
+
 	// Values that are not set or accessed before Prepare is called
 	struct
 	{
@@ -144,6 +184,37 @@ private:
 
     DriveMovement* activeDMs;				// list of contained DMs that need steps, in step time order
 	DriveMovement *pddm[NumDrivers];		// These describe the state of each drive movement
+
+#if SUPPORT_INPUT_SHAPING
+	ShapedPhase shapedAccel;				// the shaped acceleration phase, valid if flags.accelShaped is set
+	ShapedPhase shapedDecel;				// the shaped deceleration phase, valid if flags.decelShaped is set
+
+	static unsigned int numShapedPhases;	// counters for diagnostics
+	static unsigned int numPhasesTooShort;
+	static uint32_t maxShapingClocks;
+#endif
+
+#if SUPPORT_FIXED_POINT_PREPARE
+	bool SetFixedPointParameters(const CanMessageMovement& msg, PrepParams& params);
+	static uint32_t SpeedFractionToFixed(float f);
+
+	static unsigned int numFixedPointPrepares;	// counters for diagnostics
+	static unsigned int numFloatPrepares;
+	static uint32_t maxPrepareClocks;
+#endif
+
+#if SUPPORT_SLOW_DRIVERS
+	static bool SlowDriverTimingAllowsStep(uint32_t now);
+	static bool SlowDriverDirectionChangesDone(uint32_t& now);
+
+	static uint32_t lastStepHighTime;		// when we started the current step pulse to slow drivers
+	static uint32_t stepHoldoffTime;		// when the step that we held off to meet the slow driver timing can be generated
+	static bool slowDriverStepPulseActive;	// true if the step pins are high and we haven't yet ended the pulse
+	static bool stepHoldoffPending;			// true if we held off a step and the next step interrupt must not be scheduled before stepHoldoffTime
+	static unsigned int numStepHoldoffs;	// counters for diagnostics
+	static unsigned int numShortWaits;
+	static unsigned int numDirectionChangesDeferred;
+#endif
 };
 
 // Find the DriveMovement record for a given drive, or return nullptr if there isn't one
@@ -158,7 +229,15 @@ inline bool DDA::ScheduleNextStepInterrupt(StepTimer& timer) const
 {
 	if (state == executing)
 	{
-		const uint32_t whenDue = ((activeDMs != nullptr) ? activeDMs->nextStepTime
+#if SUPPORT_SLOW_DRIVERS
+		if (stepHoldoffPending)
+		{
+			// StepDrivers held off a step that was due, or SetDirection deferred a direction change, because the slow driver timing didn't allow it yet
+			stepHoldoffPending = false;
+			return timer.ScheduleCallbackFromIsr(stepHoldoffTime);
+		}
+#endif
+		const uint32_t whenDue = ((activeDMs != nullptr) ? activeDMs->GetDueTime()
 									: (clocksNeeded > DDA::WakeupTime) ? clocksNeeded - DDA::WakeupTime
 										: 0)
 								+ afterPrepare.moveStartTime;
@@ -170,7 +249,7 @@ inline bool DDA::ScheduleNextStepInterrupt(StepTimer& timer) const
 // Insert a hiccup long enough to guarantee that we will exit the ISR
 inline void DDA::InsertHiccup(uint32_t now)
 {
-	const uint32_t ticksDueAfterStart = (activeDMs != nullptr) ? activeDMs->nextStepTime
+	const uint32_t ticksDueAfterStart = (activeDMs != nullptr) ? activeDMs->GetDueTime()
 										: (clocksNeeded > DDA::WakeupTime) ? clocksNeeded - DDA::WakeupTime
 											: 0;
 	afterPrepare.moveStartTime = now + DDA::HiccupTime - ticksDueAfterStart;
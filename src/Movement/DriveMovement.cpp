@@ -9,9 +9,11 @@
 #include "DDA.h"
 #include "Move.h"
 #include "Math/Isqrt.h"
+#include "StepMath.h"
 #include "Kinematics/LinearDeltaKinematics.h"
 #include "StepTimer.h"
 #include "Platform.h"
+#include "HardwareStepGenerator.h"
 
 // Static members
 
@@ -19,6 +21,10 @@ DriveMovement *DriveMovement::freeList = nullptr;
 int DriveMovement::numFree = 0;
 int DriveMovement::minFree = 0;
 
+#if SUPPORT_STEP_TIME_BUFFER
+unsigned int DriveMovement::numUnderruns = 0;
+#endif
+
 void DriveMovement::InitialAllocate(unsigned int num)
 {
 	while (num != 0)
@@ -239,6 +245,123 @@ void DriveMovement::PrepareExtruder(const DDA& dda, const PrepParams& params, fl
 	}
 }
 
+#if SUPPORT_FIXED_POINT_PREPARE
+
+// Prepare this DM for a Cartesian axis move using fixed point arithmetic. This calculates the same values as PrepareCartesianAxis.
+// The DDA has checked that totalSteps is less than MaxFixedPointSteps, so none of the products below overflows 64 bits.
+void DriveMovement::PrepareCartesianAxisFixedPoint(const PrepParams& params)
+{
+	isDeltaMovement = false;
+	const uint64_t twoClocksAtTopSpeed = params.fixed.twoClocksAtTopSpeed;
+	mp.cart.twoCsquaredTimesMmPerStepDivA = (params.fixed.twoDivANumerator == 0) ? 0
+												: roundDivU64(params.fixed.twoDivANumerator, (uint64_t)params.fixed.accelSpeedChange * totalSteps);
+	mp.cart.twoCsquaredTimesMmPerStepDivD = (params.fixed.twoDivDNumerator == 0) ? 0
+												: roundDivU64(params.fixed.twoDivDNumerator, (uint64_t)params.fixed.decelSpeedChange * totalSteps);
+
+	// Acceleration phase parameters
+	mp.cart.accelStopStep = (uint32_t)((params.fixed.accelDistanceNumerator * totalSteps)/twoClocksAtTopSpeed) + 1;
+	mp.cart.compensationClocks = mp.cart.accelCompensationClocks = 0;
+
+	// Constant speed phase parameters
+	mp.cart.mmPerStepTimesCKdivtopSpeed = (uint32_t)roundDivU64(twoClocksAtTopSpeed * (K1/2), (uint64_t)totalSteps << SpeedFractionBits);
+
+	// Deceleration phase parameters
+	// First check whether there is any deceleration at all, otherwise we may get strange results because of rounding errors
+	if (2 * params.fixed.decelDistanceNumerator * totalSteps < twoClocksAtTopSpeed)
+	{
+		mp.cart.decelStartStep = totalSteps + 1;
+		twoDistanceToStopTimesCsquaredDivD = 0;
+	}
+	else
+	{
+		mp.cart.decelStartStep = (uint32_t)((params.fixed.decelStartNumerator * totalSteps)/twoClocksAtTopSpeed) + 1;
+		twoDistanceToStopTimesCsquaredDivD = isquare64(params.topSpeedTimesCdivD) + params.fixed.twoDecelStartDistanceDivD;
+	}
+
+	// No reverse phase
+	reverseStartStep = totalSteps + 1;
+	mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD = 0;
+}
+
+// Prepare this DM for an extruder move using fixed point arithmetic. This calculates the same values as PrepareExtruder.
+// The DDA has checked that totalSteps and the pressure advance in step clocks are both less than 2^22, so none of the products below overflows 64 bits.
+void DriveMovement::PrepareExtruderFixedPoint(const PrepParams& params)
+{
+	isDeltaMovement = false;
+	const uint64_t twoClocksAtTopSpeed = params.fixed.twoClocksAtTopSpeed;
+
+	// Calculate the pressure advance parameters
+	const uint32_t compensationClocks = roundU32(Platform::GetPressureAdvance(drive) * (float)StepTimer::StepClockRate);
+	mp.cart.compensationClocks = compensationClocks;
+	mp.cart.accelCompensationClocks = (uint32_t)(((uint64_t)compensationClocks * params.fixed.accelSpeedChange) >> SpeedFractionBits);
+
+	// Recalculate the net total step count to allow for compensation. It may be negative.
+	// The compensation distance is (endSpeed - startSpeed) * compensationClocks, i.e. 2 * (accelSpeedChange - decelSpeedChange) * compensationClocks/twoClocksAtTopSpeed.
+	const int64_t compensationStepsNumerator = (int64_t)(2 * ((int32_t)params.fixed.accelSpeedChange - (int32_t)params.fixed.decelSpeedChange)) * compensationClocks * totalSteps;
+	const int64_t halfDenominator = (int64_t)(twoClocksAtTopSpeed/2);
+	int32_t netSteps = (int32_t)totalSteps
+						+ (int32_t)((compensationStepsNumerator >= 0)
+									? (compensationStepsNumerator + halfDenominator)/(int64_t)twoClocksAtTopSpeed
+									: (compensationStepsNumerator - halfDenominator)/(int64_t)twoClocksAtTopSpeed);
+
+	// Calculate the acceleration phase parameters
+	const uint64_t accelCompensationDistanceNumerator = (uint64_t)(2 * compensationClocks) * params.fixed.accelSpeedChange;		// less than 2^39
+	mp.cart.accelStopStep = (uint32_t)(((params.fixed.accelDistanceNumerator + accelCompensationDistanceNumerator) * totalSteps)/twoClocksAtTopSpeed) + 1;
+
+	mp.cart.twoCsquaredTimesMmPerStepDivA = (params.fixed.twoDivANumerator == 0) ? 0
+												: roundDivU64(params.fixed.twoDivANumerator, (uint64_t)params.fixed.accelSpeedChange * totalSteps);
+	mp.cart.twoCsquaredTimesMmPerStepDivD = (params.fixed.twoDivDNumerator == 0) ? 0
+												: roundDivU64(params.fixed.twoDivDNumerator, (uint64_t)params.fixed.decelSpeedChange * totalSteps);
+
+	// Constant speed phase parameters
+	mp.cart.mmPerStepTimesCKdivtopSpeed = (uint32_t)((twoClocksAtTopSpeed * (K1/2))/((uint64_t)totalSteps << SpeedFractionBits));
+
+	// Calculate the deceleration and reverse phase parameters and update totalSteps
+	// First check whether there is any deceleration at all, otherwise we may get strange results because of rounding errors
+	if (2 * params.fixed.decelDistanceNumerator * totalSteps < twoClocksAtTopSpeed)		// if less than 1 deceleration step
+	{
+		totalSteps = (uint32_t)max<int32_t>(netSteps, 0);
+		mp.cart.decelStartStep = reverseStartStep = netSteps + 1;
+		mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD = 0;
+		twoDistanceToStopTimesCsquaredDivD = 0;
+	}
+	else
+	{
+		const uint64_t decelStartNumerator = params.fixed.decelStartNumerator + accelCompensationDistanceNumerator;		// less than 2^40
+		mp.cart.decelStartStep = (uint32_t)((decelStartNumerator * totalSteps)/twoClocksAtTopSpeed) + 1;
+		const int32_t initialDecelSpeedTimesCdivD = (int32_t)params.topSpeedTimesCdivD - (int32_t)mp.cart.compensationClocks;	// signed because it may be negative and we square it
+		const uint64_t initialDecelSpeedTimesCdivDSquared = isquare64(initialDecelSpeedTimesCdivD);
+		twoDistanceToStopTimesCsquaredDivD =
+			initialDecelSpeedTimesCdivDSquared + roundDivU64(decelStartNumerator * params.fixed.decelClocks, params.fixed.decelSpeedChange);
+
+		// See whether there is a reverse phase. Compared with PrepareExtruder, the speed comparisons have been multiplied through by decelClocks/topSpeed.
+		const uint32_t endSpeedFraction = SpeedFractionScale - params.fixed.decelSpeedChange;
+		const uint32_t stepsBeforeReverse = ((uint64_t)compensationClocks * params.fixed.decelSpeedChange > (uint64_t)params.fixed.decelClocks << SpeedFractionBits)
+											? mp.cart.decelStartStep - 1
+											: twoDistanceToStopTimesCsquaredDivD/mp.cart.twoCsquaredTimesMmPerStepDivD;
+		if ((uint64_t)endSpeedFraction * params.fixed.decelClocks < (uint64_t)params.fixed.decelSpeedChange * compensationClocks && (int32_t)stepsBeforeReverse > netSteps)
+		{
+			reverseStartStep = stepsBeforeReverse + 1;
+			totalSteps = (uint32_t)((int32_t)(2 * stepsBeforeReverse) - netSteps);
+			mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD =
+					(int64_t)((2 * stepsBeforeReverse) * mp.cart.twoCsquaredTimesMmPerStepDivD) - (int64_t)twoDistanceToStopTimesCsquaredDivD;
+		}
+		else
+		{
+			// There is no reverse phase. Check that we can actually do the last step requested.
+			if (netSteps > (int32_t)stepsBeforeReverse)
+			{
+				netSteps = (int32_t)stepsBeforeReverse;
+			}
+			reverseStartStep = netSteps + 1;
+			totalSteps = (uint32_t)max<int32_t>(netSteps, 0);
+			mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD = 0;
+		}
+	}
+}
+
+#endif
+
 void DriveMovement::DebugPrint(char c) const
 {
 	if (state != DMState::idle)
@@ -307,8 +430,17 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	if (nextCalcStep < mp.cart.accelStopStep)
 	{
 		// acceleration phase
-		const uint32_t adjustedStartSpeedTimesCdivA = dda.afterPrepare.startSpeedTimesCdivA + mp.cart.compensationClocks;
-		nextCalcStepTime = isqrt64(isquare64(adjustedStartSpeedTimesCdivA) + (mp.cart.twoCsquaredTimesMmPerStepDivA * nextCalcStep)) - adjustedStartSpeedTimesCdivA;
+#if SUPPORT_INPUT_SHAPING
+		if (isShaped && dda.flags.accelShaped)
+		{
+			nextCalcStepTime = (uint32_t)dda.shapedAccel.GetTimeAtDistance((float)nextCalcStep/(float)totalSteps, accelSegment);
+		}
+		else
+#endif
+		{
+			const uint32_t adjustedStartSpeedTimesCdivA = dda.afterPrepare.startSpeedTimesCdivA + mp.cart.compensationClocks;
+			nextCalcStepTime = StepMath::Isqrt64(isquare64(adjustedStartSpeedTimesCdivA) + (mp.cart.twoCsquaredTimesMmPerStepDivA * nextCalcStep)) - adjustedStartSpeedTimesCdivA;
+		}
 	}
 	else if (nextCalcStep < mp.cart.decelStartStep)
 	{
@@ -318,6 +450,13 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 								  - (int32_t)mp.cart.accelCompensationClocks
 								 );
 	}
+#if SUPPORT_INPUT_SHAPING
+	else if (isShaped && dda.flags.decelShaped)
+	{
+		// shaped deceleration phase. Shaped drives never have a reverse phase.
+		nextCalcStepTime = (uint32_t)dda.shapedDecel.GetTimeAtDistance((float)nextCalcStep/(float)totalSteps, decelSegment);
+	}
+#endif
 	else if (nextCalcStep < reverseStartStep)
 	{
 		// deceleration phase, not reversed yet
@@ -325,7 +464,7 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 		const uint32_t adjustedTopSpeedTimesCdivDPlusDecelStartClocks = dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - mp.cart.compensationClocks;
 		// Allow for possible rounding error when the end speed is zero or very small
 		nextCalcStepTime = (temp < twoDistanceToStopTimesCsquaredDivD)
-						? adjustedTopSpeedTimesCdivDPlusDecelStartClocks - isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
+						? adjustedTopSpeedTimesCdivDPlusDecelStartClocks - StepMath::Isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
 						: adjustedTopSpeedTimesCdivDPlusDecelStartClocks;
 	}
 	else
@@ -341,7 +480,7 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 		}
 		const uint32_t adjustedTopSpeedTimesCdivDPlusDecelStartClocks = dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - mp.cart.compensationClocks;
 		nextCalcStepTime = adjustedTopSpeedTimesCdivDPlusDecelStartClocks
-							+ isqrt64((int64_t)(mp.cart.twoCsquaredTimesMmPerStepDivD * nextCalcStep) - mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD);
+							+ StepMath::Isqrt64((int64_t)(mp.cart.twoCsquaredTimesMmPerStepDivD * nextCalcStep) - mp.cart.fourMaxStepDistanceMinusTwoDistanceToStopTimesCsquaredDivD);
 	}
 
 	// When crossing between movement phases with high microstepping, due to rounding errors the next step may appear to be due before the last one
@@ -435,7 +574,7 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	const int32_t t1 = mp.delta.minusAaPlusBbTimesKs + hmz0scK;
 	// Due to rounding error we can end up trying to take the square root of a negative number if we do not take precautions here
 	const int64_t t2a = mp.delta.dSquaredMinusAsquaredMinusBsquaredTimesKsquaredSsquared - (int64_t)isquare64(mp.delta.hmz0sK) + (int64_t)isquare64(t1);
-	const int32_t t2 = (t2a > 0) ? isqrt64(t2a) : 0;
+	const int32_t t2 = (t2a > 0) ? StepMath::Isqrt64(t2a) : 0;
 	const int32_t dsK = (direction) ? t1 - t2 : t1 + t2;
 
 	// Now feed dsK into a modified version of the step algorithm for Cartesian motion without elasticity compensation
@@ -450,7 +589,7 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 	if ((uint32_t)dsK < mp.delta.accelStopDsK)
 	{
 		// Acceleration phase
-		nextCalcStepTime = isqrt64(isquare64(dda.afterPrepare.startSpeedTimesCdivA) + (mp.delta.twoCsquaredTimesMmPerStepDivA * (uint32_t)dsK)/K2) - dda.afterPrepare.startSpeedTimesCdivA;
+		nextCalcStepTime = StepMath::Isqrt64(isquare64(dda.afterPrepare.startSpeedTimesCdivA) + (mp.delta.twoCsquaredTimesMmPerStepDivA * (uint32_t)dsK)/K2) - dda.afterPrepare.startSpeedTimesCdivA;
 	}
 	else if ((uint32_t)dsK < mp.delta.decelStartDsK)
 	{
@@ -464,7 +603,7 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 		const uint64_t temp = (mp.delta.twoCsquaredTimesMmPerStepDivD * (uint32_t)dsK)/K2;
 		// Because of possible rounding error when the end speed is zero or very small, we need to check that the square root will work OK
 		nextCalcStepTime = (temp < twoDistanceToStopTimesCsquaredDivD)
-						? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
+						? dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks - StepMath::Isqrt64(twoDistanceToStopTimesCsquaredDivD - temp)
 						: dda.afterPrepare.topSpeedTimesCdivDPlusDecelStartClocks;
 	}
 
@@ -501,6 +640,164 @@ pre(nextStep < totalSteps; stepsTillRecalc == 0)
 
 #endif
 
+#if SUPPORT_STEP_TIME_BUFFER
+
+// Calculate the time of the next step and append it to the buffer. Called only by the step calculation task, or by DDA::Prepare before the move starts.
+// The step ISR may be taking entries from the buffer at the same time, but it never calculates steps, so it never touches the fields used here.
+void DriveMovement::PrecomputeStep(const DDA& dda)
+{
+	if (stepTimes.IsFull() || stepTimes.IsFinished())
+	{
+		return;
+	}
+
+	// Check for the end of the move here instead of letting the step calculation find it, because that would set the state to idle
+	// while the step ISR may still be taking the buffered steps
+	if (nextStep >= totalSteps)
+	{
+		stepTimes.SetFinished();
+		return;
+	}
+
+	const bool oldDirection = direction;
+#if SUPPORT_DELTA_MOVEMENT
+	const bool moreSteps = (isDeltaMovement) ? CalcNextStepTimeDelta(dda, false) : CalcNextStepTimeCartesian(dda, false);
+#else
+	const bool moreSteps = CalcNextStepTimeCartesian(dda, false);
+#endif
+	if (moreSteps)
+	{
+		uint32_t entry = nextStepTime & StepTimeMask;
+		if (direction != oldDirection)
+		{
+			entry |= (direction) ? DirectionChangeFlag | NewDirectionForwardsFlag : DirectionChangeFlag;
+		}
+		(void)stepTimes.Push(entry);					// can't fail because we checked that the buffer isn't full and only we add to it
+	}
+	else
+	{
+		stepTimes.SetFinished();						// the step calculation failed and has set the state to stepError
+	}
+}
+
+// Record that a step has been output. Called from the step ISR.
+inline void DriveMovement::CountOutputStep(uint32_t stepTime, bool forwards)
+{
+	netStepsOutput += (forwards) ? 1 : -1;
+	++stepsOutput;
+	outputStepInterval = stepTime - lastOutputStepTime;
+	lastOutputStepTime = stepTime;
+}
+
+// Take the next step time from the buffer, setting the direction pin first if 'live' is true and the direction changes.
+// If 'live' is true and there was a step due at dueStepTime then the step ISR has just output it, so count it first.
+// If the buffer is empty because the step calculation task hasn't kept up, set dueStepTime to a short time ahead so that the ISR looks again then.
+// We don't calculate the step here, because that would need the task to disable the step interrupt around its own calculations.
+// Return true if there is another step to do or we are waiting for one.
+bool DriveMovement::PopStepTime(const DDA& dda, bool live)
+{
+	if (live && haveDueStep)
+	{
+		CountOutputStep(dueStepTime, outputDirection);
+	}
+
+	uint32_t entry;
+	if (!stepTimes.Pop(entry))
+	{
+		// The producer sets the finished flag after adding the last entry, so if it is set we must look at the buffer again before concluding that it is empty
+		if (!stepTimes.IsFinished())
+		{
+			if (live)
+			{
+				++numUnderruns;
+			}
+			haveDueStep = false;
+			dueStepTime = (StepTimer::GetTimerTicks() - dda.afterPrepare.moveStartTime) + UnderrunRetryClocks;
+			return true;
+		}
+		if (!stepTimes.Pop(entry))
+		{
+			haveDueStep = false;
+			if (state == DMState::moving)
+			{
+				state = DMState::idle;
+			}
+			return false;
+		}
+	}
+
+	if ((entry & DirectionChangeFlag) != 0)
+	{
+		const bool newDirection = (entry & NewDirectionForwardsFlag) != 0;
+		if (live)
+		{
+			Platform::SetDirection(drive, newDirection);
+			outputDirection = newDirection;
+		}
+		else
+		{
+			startDirection = newDirection;
+		}
+	}
+	haveDueStep = true;
+	dueStepTime = entry & StepTimeMask;
+	return true;
+}
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+
+// Pass steps to the hardware step generator until it can't take any more, then set dueStepTime to when the step ISR needs to call us again.
+// The direction of each step is in startDirection, because we take the step times from the buffer without setting the direction pin.
+// We count the steps as output when we pass them to the generator.
+// Return true if there are more steps to pass to the generator.
+bool DriveMovement::FeedHardwareStepGenerator(const DDA& dda)
+{
+	if (!haveDueStep)
+	{
+		// The buffer was empty last time, so see whether the step calculation task has caught up
+		if (!PopStepTime(dda, false))
+		{
+			return false;
+		}
+		if (!haveDueStep)
+		{
+			return true;
+		}
+		hardwareStepTime = dueStepTime;
+	}
+
+	uint32_t retryTime;
+	while (HardwareStepGenerator::QueueStep(dda.afterPrepare.moveStartTime + hardwareStepTime, startDirection, retryTime))
+	{
+		CountOutputStep(hardwareStepTime, startDirection);
+		if (!PopStepTime(dda, false))
+		{
+			return false;
+		}
+		if (!haveDueStep)
+		{
+			++numUnderruns;
+			return true;								// PopStepTime has set dueStepTime to when to look again
+		}
+		hardwareStepTime = dueStepTime;
+	}
+
+	const int32_t retryAfterStart = (int32_t)(retryTime - dda.afterPrepare.moveStartTime);
+	dueStepTime = (retryAfterStart > 0) ? (uint32_t)retryAfterStart : 0;		// the retry time may be before the start of this move if it is for a step of the previous move
+	return true;
+}
+
+#endif
+
+/*static*/ unsigned int DriveMovement::GetAndClearUnderruns()
+{
+	const unsigned int ret = numUnderruns;
+	numUnderruns = 0;
+	return ret;
+}
+
+#endif
+
 // Reduce the speed of this movement. Called to reduce the homing speed when we detect we are near the endstop for a drive.
 void DriveMovement::ReduceSpeed(const DDA& dda, uint32_t inverseSpeedFactor)
 {
@@ -10,6 +10,11 @@
 
 #include "RepRapFirmware.h"
 
+#if SUPPORT_STEP_TIME_BUFFER
+# include "StepTimeRing.h"
+# include "StepTimer.h"
+#endif
+
 class LinearDeltaKinematics;
 class DDA;
 
@@ -88,6 +93,27 @@ inline int64_t roundS64(double d)
 #endif
 }
 
+#if SUPPORT_FIXED_POINT_PREPARE
+
+// Scaling and limits for preparing moves using fixed point arithmetic. Speeds are held as fractions of the top speed in Q16 format.
+// Moves that exceed these limits are prepared using floating point arithmetic instead. See DDA::SetFixedPointParameters for the range analysis.
+constexpr unsigned int SpeedFractionBits = 16;
+constexpr uint32_t SpeedFractionScale = 1u << SpeedFractionBits;
+constexpr uint32_t MaxFixedPointClocks = 1u << 22;		// the maximum move duration and pressure advance time in step clocks, about 5.6 seconds
+constexpr uint32_t MaxFixedPointSteps = 1u << 22;		// the maximum number of steps that any drive may take in one move
+
+// Integer division that rounds in the same way as the functions above
+inline uint64_t roundDivU64(uint64_t num, uint64_t den)
+{
+#if ROUND_TO_NEAREST
+	return (num + den/2)/den;
+#else
+	return num/den;
+#endif
+}
+
+#endif
+
 // Struct for passing parameters to the DriveMovement Prepare methods
 struct PrepParams
 {
@@ -107,6 +133,24 @@ struct PrepParams
 	const LinearDeltaKinematics *dparams;
 	float a2plusb2;								// sum of the squares of the X and Y movement fractions
 	float dvecX, dvecY, dvecZ;
+
+#if SUPPORT_FIXED_POINT_PREPARE
+	// Parameters used instead of the float ones when the move is prepared using fixed point arithmetic.
+	// Distances are fractions of the move held as numerators, the denominator being twoClocksAtTopSpeed.
+	struct
+	{
+		uint64_t twoClocksAtTopSpeed;			// 2/topSpeed in step clocks, Q16, less than 2^39
+		uint64_t accelDistanceNumerator;		// less than 2^39
+		uint64_t decelDistanceNumerator;		// less than 2^39
+		uint64_t decelStartNumerator;			// less than 2^39
+		uint64_t twoDivANumerator;				// 2/acceleration in step clocks squared, multiplied by accelSpeedChange. Less than 2^61.
+		uint64_t twoDivDNumerator;				// 2/deceleration in step clocks squared, multiplied by decelSpeedChange. Less than 2^61.
+		uint64_t twoDecelStartDistanceDivD;		// 2 * decelStartDistance/deceleration in step clocks squared, less than 2^61
+		uint32_t accelSpeedChange;				// (topSpeed - startSpeed)/topSpeed, Q16, at least 1 if there is an acceleration phase
+		uint32_t decelSpeedChange;				// (topSpeed - endSpeed)/topSpeed, Q16, at least 1 if there is a deceleration phase
+		uint32_t decelClocks;
+	} fixed;
+#endif
 };
 
 enum class DMState : uint8_t
@@ -131,16 +175,38 @@ public:
 	void PrepareCartesianAxis(const DDA& dda, const PrepParams& params) __attribute__ ((hot));
 	void PrepareDeltaAxis(const DDA& dda, const PrepParams& params) __attribute__ ((hot));
 	void PrepareExtruder(const DDA& dda, const PrepParams& params, float speedChange) __attribute__ ((hot));
+#if SUPPORT_FIXED_POINT_PREPARE
+	void PrepareCartesianAxisFixedPoint(const PrepParams& params) __attribute__ ((hot));
+	void PrepareExtruderFixedPoint(const PrepParams& params) __attribute__ ((hot));
+#endif
 	void ReduceSpeed(const DDA& dda, uint32_t inverseSpeedFactor);
 	void DebugPrint(char c) const;
 	int32_t GetNetStepsLeft() const;
 	int32_t GetNetStepsTaken() const;
+	int32_t GetNetSteps() const;
 	bool IsDeltaMovement() const { return isDeltaMovement; }
 
 #if HAS_SMART_DRIVERS
 	uint32_t GetStepInterval(uint32_t microstepShift) const;	// Get the current full step interval for this axis or extruder
 #endif
 
+#if SUPPORT_STEP_TIME_BUFFER
+	void PrecomputeStep(const DDA& dda) __attribute__ ((hot));
+	bool NeedsPrecomputedSteps() const { return state == DMState::moving && !stepTimes.IsFinished() && !stepTimes.IsFull(); }
+	bool PopStepTime(const DDA& dda, bool live) __attribute__ ((hot));
+	size_t NumBufferedStepTimes() const { return stepTimes.NumEntries(); }
+	uint32_t GetDueTime() const { return dueStepTime; }
+	bool HasStepDue() const { return haveDueStep; }
+
+	static unsigned int GetAndClearUnderruns();
+#else
+	uint32_t GetDueTime() const { return nextStepTime; }
+#endif
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	bool FeedHardwareStepGenerator(const DDA& dda) __attribute__ ((hot));
+#endif
+
 	static void InitialAllocate(unsigned int num);
 	static int NumFree() { return numFree; }
 	static int MinFree() { return minFree; }
@@ -149,6 +215,9 @@ public:
 	static void Release(DriveMovement *item);
 
 private:
+#if SUPPORT_STEP_TIME_BUFFER
+	void CountOutputStep(uint32_t stepTime, bool forwards) __attribute__ ((hot));
+#endif
 	bool CalcNextStepTimeCartesianFull(const DDA &dda, bool live) __attribute__ ((hot));
 #if SUPPORT_DELTA_MOVEMENT
 	bool CalcNextStepTimeDeltaFull(const DDA &dda, bool live) __attribute__ ((hot));
@@ -167,8 +236,13 @@ private:
 	uint8_t microstepShift : 4,							// log2 of the microstepping factor (for when we use dynamic microstepping adjustment)
 			direction : 1,								// true=forwards, false=backwards
 			fullCurrent : 1,							// true if the drivers are set to the full current, false if they are set to the standstill current
-			isDeltaMovement : 1;						// true if this motor is executing a delta tower move
+			isDeltaMovement : 1,						// true if this motor is executing a delta tower move
+			isShaped : 1;								// true if this motor follows the input shaped acceleration and deceleration phases
 	uint8_t stepsTillRecalc;							// how soon we need to recalculate
+#if SUPPORT_INPUT_SHAPING
+	uint8_t accelSegment;								// the segment of the shaped acceleration phase that we reached
+	uint8_t decelSegment;								// the segment of the shaped deceleration phase that we reached
+#endif
 
 	uint32_t totalSteps;								// total number of steps for this move
 
@@ -178,6 +252,34 @@ private:
 	uint32_t nextStepTime;								// how many clocks after the start of this move the next step is due
 	uint32_t stepInterval;								// how many clocks between steps
 
+#if SUPPORT_STEP_TIME_BUFFER
+	// Step times calculated in advance by the step calculation task and taken by the step ISR. The task is the only writer and the ISR the only reader,
+	// so neither needs to disable interrupts. The entries are in step clocks from the start of the move, with flags in the top bits to indicate a change
+	// of direction before the step. The fields above that are used to calculate the step times belong to the task once the move has started.
+	static constexpr size_t StepTimeBufferLength = StepTimeRing::Length;
+	static constexpr uint32_t DirectionChangeFlag = 1u << 31;
+	static constexpr uint32_t NewDirectionForwardsFlag = 1u << 30;
+	static constexpr uint32_t StepTimeMask = NewDirectionForwardsFlag - 1;
+	static constexpr uint32_t UnderrunRetryClocks = StepTimer::StepClockRate/50000;	// how long the step ISR waits before looking at an empty buffer again, about 20us
+
+	StepTimeRing stepTimes;
+	bool haveDueStep;									// false if the ring was empty when the ISR needed the next step, so dueStepTime is when to look again
+	bool startDirection;								// the direction to set when the move starts
+	bool outputDirection;								// the direction of the step at dueStepTime, i.e. the direction the pin is set to
+	uint32_t dueStepTime;								// when the step that the ISR is waiting for is due, in clocks after the start of the move
+
+	// The following record the steps that the step ISR has actually output, as distinct from the steps that the producer has calculated
+	int32_t netStepsOutput;								// net steps output in the forwards direction
+	uint32_t stepsOutput;								// total steps output
+	uint32_t lastOutputStepTime;						// when the last step was output, in clocks after the start of the move
+	uint32_t outputStepInterval;						// the interval between the last two steps output
+# if SUPPORT_HARDWARE_STEP_GENERATION
+	uint32_t hardwareStepTime;							// the time of the next step to pass to the hardware step generator, in clocks after the start of the move
+# endif
+
+	static unsigned int numUnderruns;					// how many times the step ISR found an empty buffer and had to wait for the next step time
+#endif
+
 	// The following only needs to be stored per-drive if we are supporting pressure advance
 	uint64_t twoDistanceToStopTimesCsquaredDivD;
 
@@ -296,7 +398,25 @@ inline int32_t DriveMovement::GetNetStepsLeft() const
 	return (direction) ? netStepsLeft : -netStepsLeft;
 }
 
+// Return the number of net steps for the whole move in the forwards direction
+inline int32_t DriveMovement::GetNetSteps() const
+{
+	const int32_t netSteps = (reverseStartStep > totalSteps) ? (int32_t)totalSteps : (int32_t)(2 * reverseStartStep) - (int32_t)totalSteps - 2;
+#if SUPPORT_STEP_TIME_BUFFER
+	return (startDirection) ? netSteps : -netSteps;			// the step calculation task changes 'direction' when it reaches the reverse phase
+#else
+	return (direction) ? netSteps : -netSteps;
+#endif
+}
+
 // Return the number of net steps already taken for the move in the forwards direction.
+#if SUPPORT_STEP_TIME_BUFFER
+// The producer calculates steps ahead of the step ISR, so we can't use nextStep. Use the count of the steps actually output instead.
+inline int32_t DriveMovement::GetNetStepsTaken() const
+{
+	return netStepsOutput;
+}
+#else
 // We have already taken nextSteps - 1 steps, unless nextStep is zero.
 inline int32_t DriveMovement::GetNetStepsTaken() const
 {
@@ -311,6 +431,7 @@ inline int32_t DriveMovement::GetNetStepsTaken() const
 	}
 	return (direction) ? netStepsTaken : -netStepsTaken;
 }
+#endif
 
 // This is inlined because it is only called from one place
 inline void DriveMovement::Release(DriveMovement *item)
@@ -325,9 +446,15 @@ inline void DriveMovement::Release(DriveMovement *item)
 // Get the current full step interval for this axis or extruder
 inline uint32_t DriveMovement::GetStepInterval(uint32_t microstepShift) const
 {
+#if SUPPORT_STEP_TIME_BUFFER
+	return ((stepsOutput >> microstepShift) != 0)	// if at least 1 full step done
+		? outputStepInterval << microstepShift		// return the interval between steps converted to full steps
+			: 0;
+#else
 	return ((nextStep >> microstepShift) != 0)		// if at least 1 full step done
 		? stepInterval << microstepShift			// return the interval between steps converted to full steps
 			: 0;
+#endif
 }
 
 #endif
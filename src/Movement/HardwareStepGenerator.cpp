@@ -0,0 +1,226 @@
+/*
+ * HardwareStepGenerator.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "HardwareStepGenerator.h"
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+
+#if !SAME5x
+# error Hardware step generation is only supported on the SAME5x
+#endif
+
+#if !SUPPORT_STEP_TIME_BUFFER
+# error Hardware step generation needs the step time buffer
+#endif
+
+#include "StepTimer.h"
+#include <Platform.h>
+#include <Hardware/DmacManager.h>
+#include <RTOSIface/RTOSIface.h>
+
+// How it works:
+// The DMA channel reads the step time queue circularly. Each compare match of CC1 toggles the step pin and triggers the DMA to load the next entry into CC1.
+// The entry after the last step we queued always holds a parking value a long way in the future, so that when we run out of steps the compare register doesn't match again.
+// When the generator is idle the DMA has already read the parking value, so we load the time of the next step into CC1 directly and the DMA carries on from the following entry.
+// We keep a copy of the times of the queued steps so that we can tell how many are still pending, without having to read the DMA status.
+namespace HardwareStepGenerator
+{
+	constexpr size_t QueueLength = 32;									// must be a power of 2
+	constexpr uint32_t MinStepSeparation = 2;							// the minimum interval between steps in step clocks, to allow for the DMA latency
+	constexpr uint32_t SafetyMargin = 3;								// if the last queued step is closer than this then we wait for it before adding to the queue
+	constexpr uint32_t ParkingOffset = 1u << 31;						// how far ahead of the last step we put the parking value
+	constexpr uint32_t IdleRefreshInterval = 1u << 30;					// how often we move the parking value when idle, in step clocks
+
+	static volatile uint32_t dmaQueue[QueueLength];						// the circular buffer that the DMA reads from
+	static uint32_t queuedTimes[QueueLength];							// the times of the pending steps, oldest first
+	static size_t writeIndex;											// the DMA queue entry that holds the parking value
+	static size_t pendingTail;											// the index of the oldest pending step in queuedTimes
+	static size_t numPending;											// how many steps are waiting to be generated
+	static uint32_t lastStepTime;										// the time of the last step we queued
+	static bool currentDirection;
+
+	static int32_t netStepsCancelled = 0;								// the net forwards steps that we discarded since we started up
+
+	static uint32_t numStepsQueued = 0, numLateSteps = 0, numDirectionWaits = 0, numQueueFull = 0, numMarginWaits = 0, numCancelled = 0;
+
+	static inline void SetCompareRegister(uint32_t val)
+	{
+		StepTc->CC[1].reg = val;
+		while ((StepTc->SYNCBUSY.reg & TC_SYNCBUSY_CC1) != 0) { }
+	}
+
+	// Forget about the steps we have generated. A step counts as generated once its time is at least one clock in the past, so that the DMA has reloaded CC1.
+	static inline void RetireSteps(uint32_t now)
+	{
+		while (numPending != 0 && (int32_t)(now - queuedTimes[pendingTail]) >= 1)
+		{
+			pendingTail = (pendingTail + 1) & (QueueLength - 1);
+			--numPending;
+		}
+	}
+
+	// Set up an empty queue with CC1 already holding the parking value, so that the next DMA read is of the entry after writeIndex
+	static void ResetQueue(uint32_t now)
+	{
+		SetCompareRegister(now + ParkingOffset);
+		writeIndex = QueueLength - 1;
+		pendingTail = numPending = 0;
+		lastStepTime = now;
+		for (volatile uint32_t& entry : dmaQueue)
+		{
+			entry = now + ParkingOffset;
+		}
+	}
+
+	static void StartDma()
+	{
+		DmacManager::SetBtctrl(DmacChanStepGen, DMAC_BTCTRL_VALID | DMAC_BTCTRL_EVOSEL_DISABLE | DMAC_BTCTRL_BLOCKACT_NOACT | DMAC_BTCTRL_BEATSIZE_WORD
+										| DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_STEPSEL_SRC | DMAC_BTCTRL_STEPSIZE_X1);
+		DmacManager::SetSourceAddress(DmacChanStepGen, dmaQueue);
+		DmacManager::SetDestinationAddress(DmacChanStepGen, &StepTc->CC[1].reg);
+		DmacManager::SetDataLength(DmacChanStepGen, QueueLength);
+		DmacManager::SetCircular(DmacChanStepGen);
+		DmacManager::SetTriggerSource(DmacChanStepGen, (DmaTrigSource)StepTcMc1DmacId);
+		DmacManager::EnableChannel(DmacChanStepGen, DmacPrioStepGen);
+	}
+}
+
+// Set up the event system, the PORT event input and the DMA channel. The step timer must already have been initialised with the CC1 event output enabled.
+void HardwareStepGenerator::Init()
+{
+	const Pin stepPin = StepPins[HardwareStepDriver];
+
+	// Route the CC1 compare match event to the PORT event input that toggles the step pin
+	MCLK->APBBMASK.reg |= MCLK_APBBMASK_EVSYS;
+	EVSYS->Channel[HardwareStepEventChannel].CHANNEL.reg = EVSYS_CHANNEL_EVGEN(StepTcMc1EventGenerator) | EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+	EVSYS->USER[EVSYS_ID_USER_PORT_EV_0 + HardwarePortEventInput].reg = EVSYS_USER_CHANNEL(HardwareStepEventChannel + 1);
+	PORT->Group[stepPin >> 5].EVCTRL.reg |= (PORT_EVCTRL_PID0(stepPin & 31) | PORT_EVCTRL_EVACT0(PORT_EVCTRL_EVACT0_TGL_Val) | PORT_EVCTRL_PORTEI0)
+												<< (8 * HardwarePortEventInput);
+
+	currentDirection = true;
+	Platform::SetDirection(HardwareStepDriver, currentDirection);
+	ResetQueue(StepTimer::GetTimerTicks());
+	StartDma();
+}
+
+// Queue a step at the specified time. If we can't queue it yet, return false and set the time at which it is worth trying again.
+bool HardwareStepGenerator::QueueStep(uint32_t when, bool forwards, uint32_t& retryTime)
+{
+	RetireSteps(StepTimer::GetTimerTicks());
+	if (numPending != 0)
+	{
+		if (forwards != currentDirection)
+		{
+			// We can't change direction until the steps we have already queued have been generated
+			retryTime = lastStepTime + 1;
+			++numDirectionWaits;
+			return false;
+		}
+
+		if (numPending >= QueueLength - 1)
+		{
+			// Try again when half the queue has been emptied
+			retryTime = queuedTimes[(pendingTail + numPending/2) & (QueueLength - 1)] + 1;
+			++numQueueFull;
+			return false;
+		}
+	}
+	else if (forwards != currentDirection)
+	{
+		Platform::SetDirection(HardwareStepDriver, forwards);
+		currentDirection = forwards;
+	}
+
+	AtomicCriticalSectionLocker lock;									// we mustn't be delayed between checking the time and writing the queue or CC1
+
+	const uint32_t now = StepTimer::GetTimerTicks();
+	RetireSteps(now);
+	if (numPending != 0 && (int32_t)(lastStepTime - now) < (int32_t)SafetyMargin)
+	{
+		// The DMA will soon read the entry we are about to write. Try again when the last step has been generated and the generator is idle.
+		retryTime = lastStepTime + 1;
+		++numMarginWaits;
+		return false;
+	}
+
+	// Make sure that the step isn't in the past or too close to the previous one
+	const uint32_t earliest = ((numPending != 0) ? lastStepTime : now) + MinStepSeparation;
+	if ((int32_t)(when - earliest) < 0)
+	{
+		when = earliest;
+		++numLateSteps;
+	}
+
+	dmaQueue[(writeIndex + 1) & (QueueLength - 1)] = when + ParkingOffset;
+	if (numPending == 0)
+	{
+		SetCompareRegister(when);										// the DMA has already read the parking value, so set the compare register directly
+	}
+	else
+	{
+		dmaQueue[writeIndex] = when;									// replace the parking value
+	}
+	writeIndex = (writeIndex + 1) & (QueueLength - 1);
+
+	queuedTimes[(pendingTail + numPending) & (QueueLength - 1)] = when;
+	++numPending;
+	lastStepTime = when;
+	++numStepsQueued;
+	return true;
+}
+
+// Discard the steps that have not been generated yet. Called when a move is aborted.
+void HardwareStepGenerator::Cancel()
+{
+	AtomicCriticalSectionLocker lock;
+	DmacManager::DisableChannel(DmacChanStepGen);
+	const uint32_t now = StepTimer::GetTimerTicks();
+	RetireSteps(now);
+	numCancelled += numPending;
+	netStepsCancelled += (currentDirection) ? (int32_t)numPending : -(int32_t)numPending;
+	ResetQueue(now);
+	StartDma();
+}
+
+// Return true if all the steps queued have been generated
+bool HardwareStepGenerator::IsIdle()
+{
+	RetireSteps(StepTimer::GetTimerTicks());
+	return numPending == 0;
+}
+
+// Return the net forwards steps that were queued but have not been generated, either because they are still pending or because we discarded them.
+// The caller subtracts this from the steps passed to the generator to get the steps actually generated.
+int32_t HardwareStepGenerator::GetNetStepsNotGenerated()
+{
+	RetireSteps(StepTimer::GetTimerTicks());
+	return netStepsCancelled + ((currentDirection) ? (int32_t)numPending : -(int32_t)numPending);
+}
+
+// The compare register holds the parking value when we are idle. Stop it matching by moving it further away from time to time.
+void HardwareStepGenerator::Spin()
+{
+	const uint32_t oldPrio = ChangeBasePriority(NvicPriorityStep);
+	const uint32_t now = StepTimer::GetTimerTicks();
+	RetireSteps(now);
+	if (numPending == 0 && now - lastStepTime >= IdleRefreshInterval)
+	{
+		SetCompareRegister(now + ParkingOffset);
+		lastStepTime = now;
+	}
+	RestoreBasePriority(oldPrio);
+}
+
+void HardwareStepGenerator::Diagnostics(const StringRef& reply)
+{
+	reply.catf("Hardware steps %" PRIu32 ", late %" PRIu32 ", direction waits %" PRIu32 ", queue full %" PRIu32 ", margin waits %" PRIu32 ", cancelled %" PRIu32 "\n",
+				numStepsQueued, numLateSteps, numDirectionWaits, numQueueFull, numMarginWaits, numCancelled);
+	numStepsQueued = numLateSteps = numDirectionWaits = numQueueFull = numMarginWaits = numCancelled = 0;
+}
+
+#endif
+
+// End
@@ -0,0 +1,36 @@
+/*
+ * HardwareStepGenerator.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Generates the steps for one driver without a CPU interrupt per step. The step timer's second compare channel generates an event at each step time,
+ *  which toggles the step pin via the PORT event input. A circular DMA transfer triggered by the same compare match loads the next step time.
+ *  The driver must be configured to step on both edges of the step signal.
+ *  The step ISR only needs to run when the queue of step times needs topping up or the direction needs to change.
+ */
+
+#ifndef SRC_MOVEMENT_HARDWARESTEPGENERATOR_H_
+#define SRC_MOVEMENT_HARDWARESTEPGENERATOR_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+
+namespace HardwareStepGenerator
+{
+	void Init();
+	void Spin();																// called from the main task to keep the idle compare value well away from the timer count
+	inline bool IsHardwareStepped(size_t driver) { return driver == HardwareStepDriver; }
+
+	// The following must be called from the step ISR or with the step interrupt disabled
+	bool QueueStep(uint32_t when, bool forwards, uint32_t& retryTime);			// queue a step, or return false and set the time to try again
+	void Cancel();																// discard the steps that have not been generated yet
+	bool IsIdle();																// return true if all the steps queued have been generated
+	int32_t GetNetStepsNotGenerated();											// get the net steps that were queued but are still pending or were discarded
+
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif
+
+#endif /* SRC_MOVEMENT_HARDWARESTEPGENERATOR_H_ */
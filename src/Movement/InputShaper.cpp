@@ -0,0 +1,228 @@
+/*
+ * InputShaper.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "InputShaper.h"
+
+#if SUPPORT_INPUT_SHAPING
+
+#include "StepTimer.h"
+
+// The following must be kept in line with enum class InputShaperType
+static const char *const InputShaperTypeNames[] =
+{
+	"none",
+	"ZV",
+	"ZVD",
+	"EI",
+	"2-hump EI"
+};
+
+static_assert(ARRAY_SIZE(InputShaperTypeNames) == (size_t)InputShaperType::numTypes, "InputShaperTypeNames is the wrong length");
+
+constexpr float MinFrequency = 4.0;						// below this the shaper duration gets too long to be useful
+constexpr float MaxFrequency = 1000.0;
+constexpr float MaxDamping = 0.99;
+constexpr float VibrationTolerance = 0.05;				// the residual vibration tolerance used by the EI shapers
+
+/*static*/ const char *InputShaper::GetTypeName(InputShaperType t)
+{
+	return ((size_t)t < ARRAY_SIZE(InputShaperTypeNames)) ? InputShaperTypeNames[(size_t)t] : "unknown";
+}
+
+// Set up the impulses for the requested shaper. Return false if the parameters are out of range, leaving the existing configuration alone.
+bool InputShaper::Configure(InputShaperType t, float freq, float zeta)
+{
+	if (t >= InputShaperType::numTypes)
+	{
+		return false;
+	}
+
+	if (t == InputShaperType::none)
+	{
+		type = t;
+		numImpulses = 0;
+		duration = centroid = 0.0;
+		return true;
+	}
+
+	if (freq < MinFrequency || freq > MaxFrequency || zeta < 0.0 || zeta > MaxDamping)
+	{
+		return false;
+	}
+
+	const float sqrtOneMinusZetaSquared = sqrtf(1.0 - fsquare(zeta));
+	const float k = expf(-zeta * Pi/sqrtOneMinusZetaSquared);
+	const float halfPeriod = 0.5/(freq * sqrtOneMinusZetaSquared);		// half the damped period in seconds
+
+	float amplitudes[MaxImpulses];
+	size_t num;
+	switch (t)
+	{
+	case InputShaperType::zv:
+		amplitudes[0] = 1.0;
+		amplitudes[1] = k;
+		num = 2;
+		break;
+
+	case InputShaperType::zvd:
+		amplitudes[0] = 1.0;
+		amplitudes[1] = 2.0 * k;
+		amplitudes[2] = fsquare(k);
+		num = 3;
+		break;
+
+	case InputShaperType::ei:
+		amplitudes[0] = 0.25 * (1.0 + VibrationTolerance);
+		amplitudes[1] = 0.5 * (1.0 - VibrationTolerance) * k;
+		amplitudes[2] = amplitudes[0] * fsquare(k);
+		num = 3;
+		break;
+
+	case InputShaperType::ei2:
+		{
+			const float v2 = fsquare(VibrationTolerance);
+			const float x = powf(v2 * (sqrtf(1.0 - v2) + 1.0), 1.0/3.0);
+			amplitudes[0] = (3.0 * fsquare(x) + 2.0 * x + 3.0 * v2)/(16.0 * x);
+			amplitudes[1] = (0.5 - amplitudes[0]) * k;
+			amplitudes[2] = amplitudes[1] * k;
+			amplitudes[3] = amplitudes[0] * k * k * k;
+			num = 4;
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	float sum = 0.0;
+	for (size_t i = 0; i < num; ++i)
+	{
+		sum += amplitudes[i];
+	}
+
+	type = t;
+	frequency = freq;
+	damping = zeta;
+	numImpulses = num;
+	centroid = 0.0;
+	for (size_t i = 0; i < num; ++i)
+	{
+		coefficients[i] = amplitudes[i]/sum;
+		delays[i] = i * halfPeriod * (float)StepTimer::StepClockRate;
+		centroid += coefficients[i] * delays[i];
+	}
+	duration = delays[num - 1];
+	return true;
+}
+
+void InputShaper::AppendDetails(const StringRef& reply) const
+{
+	if (IsEnabled())
+	{
+		reply.catf("%s %.1fHz damping %.2f duration %.1fms",
+					GetTypeName(type), (double)frequency, (double)damping, (double)(duration * StepTimer::StepClocksToMillis));
+	}
+	else
+	{
+		reply.cat("none");
+	}
+}
+
+// Build the shaped version of an acceleration or deceleration phase.
+// We convolve the shaper with a shortened pulse of constant acceleration, positioned within the phase so that the centroid of the shaped acceleration
+// is in the middle of the phase. The shaped phase then has the same duration, speed change and distance as the original.
+bool ShapedPhase::Build(const InputShaper& shaper, float startTime, float startDistance, float startSpeed, float speedChange, float phaseClocks)
+{
+	numSegments = 0;
+	if (!shaper.IsEnabled() || speedChange == 0.0 || phaseClocks <= 0.0)
+	{
+		return false;
+	}
+
+	const float asymmetry = fabsf(0.5 * shaper.GetDuration() - shaper.GetCentroid());
+	const float pulseClocks = phaseClocks - shaper.GetDuration() - 2.0 * asymmetry;
+	if (pulseClocks * MaxAccelerationIncrease < phaseClocks)
+	{
+		return false;
+	}
+	const float pulseStart = 0.5 * (phaseClocks - pulseClocks) - shaper.GetCentroid();
+	const float pulseAcceleration = speedChange/pulseClocks;
+
+	// Collect the times at which the acceleration changes and sort them
+	const size_t numImpulses = shaper.GetNumImpulses();
+	float times[2 * InputShaper::MaxImpulses + 2];
+	size_t numTimes = 0;
+	times[numTimes++] = 0.0;
+	times[numTimes++] = phaseClocks;
+	for (size_t i = 0; i < numImpulses; ++i)
+	{
+		times[numTimes++] = pulseStart + shaper.GetDelay(i);
+		times[numTimes++] = pulseStart + shaper.GetDelay(i) + pulseClocks;
+	}
+	for (size_t i = 1; i < numTimes; ++i)
+	{
+		const float t = times[i];
+		size_t j = i;
+		while (j != 0 && times[j - 1] > t)
+		{
+			times[j] = times[j - 1];
+			--j;
+		}
+		times[j] = t;
+	}
+
+	// Integrate the acceleration over each interval to get the segments
+	float distance = startDistance;
+	float speed = startSpeed;
+	for (size_t i = 0; i + 1 < numTimes; ++i)
+	{
+		const float segStart = times[i];
+		const float segClocks = times[i + 1] - segStart;
+		if (segClocks < 1.0 && numSegments != 0)
+		{
+			continue;										// ignore very short intervals caused by coincident impulses
+		}
+
+		const float midTime = segStart + 0.5 * segClocks;
+		float coefficient = 0.0;
+		for (size_t j = 0; j < numImpulses; ++j)
+		{
+			const float impulseTime = pulseStart + shaper.GetDelay(j);
+			if (midTime >= impulseTime && midTime < impulseTime + pulseClocks)
+			{
+				coefficient += shaper.GetCoefficient(j);
+			}
+		}
+
+		ShapedSegment& seg = segments[numSegments++];
+		seg.startTime = startTime + segStart;
+		seg.startDistance = distance;
+		seg.startSpeed = speed;
+		seg.acceleration = pulseAcceleration * coefficient;
+		distance += (speed + 0.5 * seg.acceleration * segClocks) * segClocks;
+		speed += seg.acceleration * segClocks;
+	}
+	return true;
+}
+
+float ShapedPhase::GetTimeAtDistance(float distance, uint8_t& segIndex) const
+{
+	while (segIndex + 1u < numSegments && distance >= segments[segIndex + 1].startDistance)
+	{
+		++segIndex;
+	}
+
+	// Solve distance = u*t + a*t^2/2 for t, in a form that works for positive, negative and zero acceleration
+	const ShapedSegment& seg = segments[segIndex];
+	const float segDistance = distance - seg.startDistance;
+	const float discriminant = fsquare(seg.startSpeed) + 2.0 * seg.acceleration * segDistance;
+	const float denominator = seg.startSpeed + ((discriminant > 0.0) ? sqrtf(discriminant) : 0.0);
+	return (denominator > 0.0) ? seg.startTime + (2.0 * segDistance)/denominator : seg.startTime;
+}
+
+#endif
+
+// End
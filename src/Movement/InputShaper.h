@@ -0,0 +1,96 @@
+/*
+ * InputShaper.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Input shaping reduces ringing by convolving the acceleration profile with a short sequence of impulses whose responses at the ringing frequency cancel.
+ *  The main board plans moves with trapezoidal speed profiles, so we shape each acceleration and deceleration phase within its own move.
+ *  The shaped acceleration pulse is shortened so that the phase keeps its duration, distance and speed change. The move stays in step with
+ *  its neighbours and with the main board, at the cost of a higher peak acceleration.
+ */
+
+#ifndef SRC_MOVEMENT_INPUTSHAPER_H_
+#define SRC_MOVEMENT_INPUTSHAPER_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_INPUT_SHAPING
+
+// Types of input shaper. These must have the same numeric values as the T parameter of the M593 CAN message.
+enum class InputShaperType : uint8_t
+{
+	none = 0,
+	zv,
+	zvd,
+	ei,
+	ei2,				// 2-hump extra insensitive
+	numTypes
+};
+
+class InputShaper
+{
+public:
+	static constexpr size_t MaxImpulses = 4;
+
+	InputShaper() : type(InputShaperType::none), numImpulses(0), frequency(0.0), damping(0.0), duration(0.0), centroid(0.0) { }
+
+	bool Configure(InputShaperType t, float freq, float zeta);
+	bool IsEnabled() const { return numImpulses > 1; }
+	bool Matches(const InputShaper& other) const { return type == other.type && frequency == other.frequency && damping == other.damping; }
+
+	InputShaperType GetType() const { return type; }
+	float GetFrequency() const { return frequency; }
+	float GetDamping() const { return damping; }
+	float GetDuration() const { return duration; }		// in step clocks
+	float GetCentroid() const { return centroid; }		// the amplitude-weighted mean impulse delay, in step clocks
+	size_t GetNumImpulses() const { return numImpulses; }
+	float GetCoefficient(size_t n) const { return coefficients[n]; }
+	float GetDelay(size_t n) const { return delays[n]; }
+
+	void AppendDetails(const StringRef& reply) const;
+
+	static const char *GetTypeName(InputShaperType t);
+
+private:
+	InputShaperType type;
+	uint8_t numImpulses;
+	float frequency;									// the undamped ringing frequency in Hz
+	float damping;										// the damping ratio
+	float duration;
+	float centroid;
+	float coefficients[MaxImpulses];					// impulse amplitudes, which sum to 1
+	float delays[MaxImpulses];							// impulse delays in step clocks, in increasing order with the first one zero
+};
+
+// One segment of constant acceleration within a shaped phase. Distances are fractions of the total move and times are step clocks from the start of the move.
+struct ShapedSegment
+{
+	float startTime;
+	float startDistance;
+	float startSpeed;
+	float acceleration;
+};
+
+// The shaped version of one acceleration or deceleration phase of a move
+class ShapedPhase
+{
+public:
+	static constexpr size_t MaxSegments = 2 * InputShaper::MaxImpulses + 1;
+
+	// Build the segments, returning false if the phase is too short to shape without exceeding the maximum acceleration increase
+	bool Build(const InputShaper& shaper, float startTime, float startDistance, float startSpeed, float speedChange, float phaseClocks);
+
+	// Return the time in step clocks from the start of the move at which the specified distance is reached.
+	// 'segIndex' is used to remember where we got to, so it should be zero at the start of the phase.
+	float GetTimeAtDistance(float distance, uint8_t& segIndex) const __attribute__ ((hot));
+
+private:
+	static constexpr float MaxAccelerationIncrease = 2.0;	// the most we allow shaping to increase the peak acceleration by
+
+	uint8_t numSegments;
+	ShapedSegment segments[MaxSegments];
+};
+
+#endif
+
+#endif /* SRC_MOVEMENT_INPUTSHAPER_H_ */
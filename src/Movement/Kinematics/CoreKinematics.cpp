@@ -0,0 +1,110 @@
+/*
+ * CoreKinematics.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "CoreKinematics.h"
+
+// The motor position for each of the X, Y and Z motors is the dot product of the corresponding row of the forward matrix with the XYZ coordinates,
+// using the same conventions as the main board so that both agree on the motor positions.
+CoreKinematics::CoreKinematics(KinematicsType k) : ZLeadscrewKinematics(k)
+{
+	for (size_t i = 0; i < XYZ_AXES; ++i)
+	{
+		for (size_t j = 0; j < XYZ_AXES; ++j)
+		{
+			forwardMatrix[i][j] = inverseMatrix[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+
+	switch (k)
+	{
+	case KinematicsType::coreXY:
+		// A = X + Y, B = X - Y
+		forwardMatrix[X_AXIS][Y_AXIS] = 1.0;
+		forwardMatrix[Y_AXIS][X_AXIS] = 1.0;
+		forwardMatrix[Y_AXIS][Y_AXIS] = -1.0;
+		inverseMatrix[X_AXIS][X_AXIS] = inverseMatrix[X_AXIS][Y_AXIS] = inverseMatrix[Y_AXIS][X_AXIS] = 0.5;
+		inverseMatrix[Y_AXIS][Y_AXIS] = -0.5;
+		break;
+
+	case KinematicsType::coreXZ:
+		// A = X + Z, C = X - Z
+		forwardMatrix[X_AXIS][Z_AXIS] = 1.0;
+		forwardMatrix[Z_AXIS][X_AXIS] = 1.0;
+		forwardMatrix[Z_AXIS][Z_AXIS] = -1.0;
+		inverseMatrix[X_AXIS][X_AXIS] = inverseMatrix[X_AXIS][Z_AXIS] = inverseMatrix[Z_AXIS][X_AXIS] = 0.5;
+		inverseMatrix[Z_AXIS][Z_AXIS] = -0.5;
+		break;
+
+	case KinematicsType::markForged:
+		// A = X + Y, B = Y
+		forwardMatrix[X_AXIS][Y_AXIS] = 1.0;
+		inverseMatrix[X_AXIS][Y_AXIS] = -1.0;
+		break;
+
+	default:
+		break;
+	}
+}
+
+// Return the name of the current kinematics
+const char *CoreKinematics::GetName(bool forStatusReport) const
+{
+	switch (GetKinematicsType())
+	{
+	case KinematicsType::coreXY:		return (forStatusReport) ? "coreXY" : "CoreXY";
+	case KinematicsType::coreXZ:		return (forStatusReport) ? "coreXZ" : "CoreXZ";
+	case KinematicsType::markForged:	return (forStatusReport) ? "markForged" : "MarkForged";
+	default:							return "unknown";
+	}
+}
+
+// Convert Cartesian coordinates to motor coordinates
+bool CoreKinematics::CartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, int32_t motorPos[], bool isCoordinated) const
+{
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		float motorMm = 0.0;
+		for (size_t j = 0; j < XYZ_AXES; ++j)
+		{
+			motorMm += forwardMatrix[axis][j] * machinePos[j];
+		}
+		motorPos[axis] = lrintf(motorMm * stepsPerMm[axis]);
+	}
+
+	// Any additional axes are linear
+	for (size_t axis = XYZ_AXES; axis < numVisibleAxes; ++axis)
+	{
+		motorPos[axis] = lrintf(machinePos[axis] * stepsPerMm[axis]);
+	}
+	return true;
+}
+
+// Convert motor coordinates to machine coordinates. Used after homing and after individual motor moves.
+void CoreKinematics::MotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const
+{
+	float motorMm[XYZ_AXES];
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		motorMm[axis] = motorPos[axis]/stepsPerMm[axis];
+	}
+
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		float pos = 0.0;
+		for (size_t j = 0; j < XYZ_AXES; ++j)
+		{
+			pos += inverseMatrix[axis][j] * motorMm[j];
+		}
+		machinePos[axis] = pos;
+	}
+
+	for (size_t axis = XYZ_AXES; axis < numVisibleAxes; ++axis)
+	{
+		machinePos[axis] = motorPos[axis]/stepsPerMm[axis];
+	}
+}
+
+// End
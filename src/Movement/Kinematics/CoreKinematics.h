@@ -0,0 +1,30 @@
+/*
+ * CoreKinematics.h
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#ifndef SRC_MOVEMENT_KINEMATICS_COREKINEMATICS_H_
+#define SRC_MOVEMENT_KINEMATICS_COREKINEMATICS_H_
+
+#include "ZLeadscrewKinematics.h"
+
+// This class implements CoreXY, CoreXZ and Markforged kinematics.
+// In each of these the motor positions are a linear combination of the X, Y and Z positions, so a straight line move in Cartesian space
+// is also a straight line move in motor space and the normal Cartesian step generation code can be used for all the motors.
+class CoreKinematics : public ZLeadscrewKinematics
+{
+public:
+	CoreKinematics(KinematicsType k);
+
+	// Overridden base class functions. See Kinematics.h for descriptions.
+	const char *GetName(bool forStatusReport) const override;
+	bool CartesianToMotorSteps(const float machinePos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, int32_t motorPos[], bool isCoordinated) const override;
+	void MotorStepsToCartesian(const int32_t motorPos[], const float stepsPerMm[], size_t numVisibleAxes, size_t numTotalAxes, float machinePos[]) const override;
+
+private:
+	float forwardMatrix[XYZ_AXES][XYZ_AXES];			// maps Cartesian positions to motor positions
+	float inverseMatrix[XYZ_AXES][XYZ_AXES];			// maps motor positions to Cartesian positions
+};
+
+#endif /* SRC_MOVEMENT_KINEMATICS_COREKINEMATICS_H_ */
@@ -8,6 +8,7 @@
 #include "LinearDeltaKinematics.h"
 #include "Kinematics.h"
 #include "CartesianKinematics.h"
+#include "CoreKinematics.h"
 #include "Platform.h"
 #include "GCodes/GCodes.h"
 
@@ -29,11 +30,11 @@ Kinematics::Kinematics(KinematicsType t, float segsPerSecond, float minSegLength
 		return new CartesianKinematics();
 	case KinematicsType::linearDelta:
 		return new LinearDeltaKinematics();
-#if 0
 	case KinematicsType::coreXY:
-		return new CoreXYKinematics();
 	case KinematicsType::coreXZ:
-		return new CoreXZKinematics();
+	case KinematicsType::markForged:
+		return new CoreKinematics(k);
+#if 0
 	case KinematicsType::scara:
 		return new ScaraKinematics();
 	case KinematicsType::coreXYU:
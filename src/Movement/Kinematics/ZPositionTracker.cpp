@@ -0,0 +1,53 @@
+/*
+ * ZPositionTracker.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "ZPositionTracker.h"
+#include <cmath>
+
+// Change the Z steps/mm. This is only done when M669 or M92 is processed, so we can afford double precision to keep the full fixed point range.
+void ZPositionTracker::SetStepsPerMm(float newStepsPerMm)
+{
+	position = llrint((double)position * (double)newStepsPerMm/(double)stepsPerMm);
+	stepsPerMm = newStepsPerMm;
+}
+
+// Record a new Z coordinate from the main board. It takes effect at the move boundary where the main board sent it, which is after the
+// moves that we had received when the request arrived, so that moves still in the queue are not calculated from the new coordinate.
+void ZPositionTracker::ScheduleReset(float z, uint32_t movesBeforeReset)
+{
+	resetZ = z;
+	resetAfterMoves = movesBeforeReset;
+	resetPending = true;
+}
+
+// Apply a pending reset if all the moves that preceded it have been taken. The move counts wrap round, so compare the difference.
+void ZPositionTracker::ApplyPendingReset(uint32_t movesTaken)
+{
+	if (resetPending && (int32_t)(movesTaken - resetAfterMoves) >= 0)
+	{
+		position = llrintf(resetZ * stepsPerMm * Scale);
+		resetPending = false;
+	}
+}
+
+// Add the Z movement of a move. The start and end coordinates are both derived from the fixed point position, so each move starts exactly
+// where the previous one ended and the kinematics rounds only the total position to whole motor steps.
+void ZPositionTracker::AddMove(float zMovement, float& initialZ, float& finalZ)
+{
+	initialZ = GetZ();
+	position += llrintf(zMovement * stepsPerMm * Scale);
+	finalZ = GetZ();
+}
+
+// Convert the position to mm. Convert the whole steps and the fraction separately so that no precision is lost in the conversion to float.
+float ZPositionTracker::GetZ() const
+{
+	const int64_t wholeSteps = position >> FractionBits;
+	const float fraction = (float)(uint32_t)(position & ((1u << FractionBits) - 1))/Scale;
+	return ((float)wholeSteps + fraction)/stepsPerMm;
+}
+
+// End
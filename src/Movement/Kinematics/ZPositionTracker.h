@@ -0,0 +1,42 @@
+/*
+ * ZPositionTracker.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Tracks the absolute Z coordinate of the moves we receive from the main board, which we need to calculate local kinematic motor steps
+ *  because the movement message only carries the Z movement. The position is held in fixed point units of 1/65536 of a Z motor step,
+ *  so that a run of moves each shorter than half a step still moves Z, and only the total position is rounded to whole steps.
+ *  This class doesn't depend on the hardware, so it can be tested on a PC.
+ */
+
+#ifndef SRC_MOVEMENT_KINEMATICS_ZPOSITIONTRACKER_H_
+#define SRC_MOVEMENT_KINEMATICS_ZPOSITIONTRACKER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+class ZPositionTracker
+{
+public:
+	ZPositionTracker() : position(0), stepsPerMm(1.0), resetZ(0.0), resetAfterMoves(0), resetPending(false) { }
+
+	void SetStepsPerMm(float newStepsPerMm);										// change the Z steps/mm, keeping the Z coordinate the same
+	void ScheduleReset(float z, uint32_t movesBeforeReset);							// set the Z coordinate once the specified number of moves have been taken
+	void ApplyPendingReset(uint32_t movesTaken);									// called before taking each move, passing the number of moves taken so far
+	void AddMove(float zMovement, float& initialZ, float& finalZ);					// add the Z movement of a move and return its initial and final Z coordinates
+
+	float GetZ() const;
+	bool IsResetPending() const { return resetPending; }
+
+private:
+	static constexpr unsigned int FractionBits = 16;
+	static constexpr float Scale = (float)(1u << FractionBits);
+
+	int64_t position;								// the Z coordinate at the end of the last move, in units of 1/(stepsPerMm * Scale) mm
+	float stepsPerMm;
+	float resetZ;									// the Z coordinate to set when the reset is applied
+	uint32_t resetAfterMoves;						// the number of moves to take before applying the reset
+	bool resetPending;
+};
+
+#endif /* SRC_MOVEMENT_KINEMATICS_ZPOSITIONTRACKER_H_ */
@@ -38,11 +38,63 @@
 #include "Platform.h"
 #include <CAN/CanInterface.h>
 #include "Hardware/Interrupts.h"
+#include "HardwareStepGenerator.h"
+#include "StepMath.h"
 #include "CanMessageFormats.h"
+#include "CanMessageGenericParser.h"
+#include <RTOSIface/RTOSIface.h>
+
+constexpr float DefaultBabystepSpeed = 1000.0;						// steps per second
+constexpr float DefaultBabystepAcceleration = 20000.0;				// steps per second squared
+constexpr uint32_t BabystepPrepareMargin = StepTimer::StepClockRate/500;	// how long before a queued move is due to start we can add babysteps to it, 2ms
+
+#if SUPPORT_STEP_TIME_BUFFER
+
+constexpr size_t StepCalcTaskStackWords = 150;
+static Task<StepCalcTaskStackWords> stepCalcTask;
+
+// Task that calculates step times ahead of the step ISR. It runs at a higher priority than all other tasks, but the step ISR can preempt it.
+extern "C" [[noreturn]] void StepCalcLoop(void *)
+{
+	for (;;)
+	{
+		TaskBase::Take();
+		moveInstance->PrecomputeSteps();
+	}
+}
+
+#endif
 
 Move::Move() : currentDda(nullptr), scheduledMoves(0), completedMoves(0), numHiccups(0), active(false)
+#if SUPPORT_POWER_FAIL_DETECTION
+	, stepsFrozen(false)
+#endif
 {
 	kinematics = Kinematics::Create(KinematicsType::cartesian);			// default to Cartesian
+	for (uint8_t& motor : driverMotors)
+	{
+		motor = NoMotor;
+	}
+	for (float& spm : motorStepsPerMm)
+	{
+		spm = Platform::DefaultStepsPerMm;
+	}
+	kinematicZ.SetStepsPerMm(Platform::DefaultStepsPerMm);
+	canMovesTaken = 0;
+	for (size_t driver = 0; driver < NumDrivers; ++driver)
+	{
+		pendingBabySteps[driver] = babyStepOffsets[driver] = 0;
+		babystepMaxSpeeds[driver] = DefaultBabystepSpeed/(float)StepTimer::StepClockRate;
+		babystepMaxAccelerations[driver] = DefaultBabystepAcceleration/fsquare((float)StepTimer::StepClockRate);
+	}
+	babysteppingPending = false;
+	babystepDda = nullptr;
+#if SUPPORT_DRIVER_TELEMETRY
+	for (int32_t& steps : completedDriverSteps)
+	{
+		steps = 0;
+	}
+#endif
 
 	// Build the DDA ring
 	DDA *dda = new DDA(nullptr);
@@ -72,10 +124,23 @@ void Move::Init()
 	} while (dda != ddaRingAddPointer);
 
 	currentDda = nullptr;
+	babystepDda = nullptr;
 	stepErrors = 0;
+	ddasInUse = maxDdasInUse = 0;
+	numStarvedMoves = 0;
 
 	idleCount = 0;
 
+#if SUPPORT_STEP_TIME_BUFFER
+	// Enable the cycle counter so that we can time the step ISR
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	numStepInterrupts = maxStepInterruptCycles = 0;
+	totalStepInterruptCycles = 0;
+
+	stepCalcTask.Create(StepCalcLoop, "StepCalc", nullptr, TaskPriority::StepCalcPriority);
+#endif
+
 	active = true;
 }
 
@@ -85,6 +150,7 @@ void Move::Exit()
 
 	// Clear the DDA ring so that we don't report any moves as pending
 	currentDda = nullptr;
+	babystepDda = nullptr;
 	while (ddaRingGetPointer != ddaRingAddPointer)
 	{
 		ddaRingGetPointer->Complete();
@@ -95,6 +161,7 @@ void Move::Exit()
 	{
 		(void)ddaRingCheckPointer->Free();
 		ddaRingCheckPointer = ddaRingCheckPointer->GetNext();
+		--ddasInUse;
 	}
 	active = false;												// don't accept any more moves
 }
@@ -126,8 +193,13 @@ void Move::Spin()
 		}
 
 		// Now release the DMs and check for underrun
+		if (ddaRingCheckPointer == babystepDda)
+		{
+			babystepDda = nullptr;
+		}
 		(void)ddaRingCheckPointer->Free();
 		ddaRingCheckPointer = ddaRingCheckPointer->GetNext();
+		--ddasInUse;
 	}
 
 	// See if we can add another move to the ring
@@ -160,19 +232,58 @@ void Move::Spin()
 	{
 		// OK to add another move
 		CanMessageMovement move;
-		if (CanInterface::GetCanMove(move))
+		kinematicZ.ApplyPendingReset(canMovesTaken);					// M669 is processed by the same task, so this can't race with it
+		bool haveMove = CanInterface::GetCanMove(move);
+		bool isBabystepMove = false;
+		if (haveMove)
+		{
+			++canMovesTaken;
+			if (babystepDda != nullptr)
+			{
+				StopBabystepMove(move.whenToExecute);
+			}
+		}
+		else
+		{
+			haveMove = isBabystepMove = MakeBabystepMove(move);
+		}
+		if (haveMove)
 		{
 			if (ddaRingAddPointer->Init(move))
 			{
+				if (isBabystepMove)
+				{
+					// Record the steps in the move, which include any babysteps that were requested after MakeBabystepMove took the pending ones
+					babystepDda = ddaRingAddPointer;
+					babystepDda->SetHasBabySteps();
+					for (size_t drive = 0; drive < NumDrivers; ++drive)
+					{
+						babystepMoveSteps[drive] = babystepDda->GetNetSteps(drive);
+					}
+				}
 				ddaRingAddPointer = ddaRingAddPointer->GetNext();
 				idleCount = 0;
 				scheduledMoves++;
+				++ddasInUse;
+				if (ddasInUse > maxDdasInUse)
+				{
+					maxDdasInUse = ddasInUse;
+				}
 			}
 		}
 	}
 
+	if (babysteppingPending)
+	{
+		AddBabyStepsToQueuedMove();
+	}
+
 	// See whether we need to kick off a move
+#if SUPPORT_POWER_FAIL_DETECTION
+	if (currentDda == nullptr && !stepsFrozen)
+#else
 	if (currentDda == nullptr)
+#endif
 	{
 		// No DDA is executing, so start executing a new one if possible
 		if (!canAddMove || idleCount > 10)							// better to have a few moves in the queue so that we can do lookahead
@@ -183,8 +294,14 @@ void Move::Spin()
 			{
 				AtomicCriticalSectionLocker();
 
+				// If the move should already have started then the queue ran dry, or we received or prepared the move too late
+				const uint32_t now = StepTimer::GetTimerTicks();
+				if ((int32_t)(cdda->GetMoveStartTime() - now) < 0)
+				{
+					++numStarvedMoves;
+				}
 				currentDda = cdda;
-				cdda->Start(StepTimer::GetTimerTicks());
+				cdda->Start(now);
 				if (cdda->ScheduleNextStepInterrupt(timer))
 				{
 					Interrupt();
@@ -194,13 +311,243 @@ void Move::Spin()
 	}
 }
 
-#if 0
-// Try to push some babystepping through the lookahead queue
-float Move::PushBabyStepping(float amount)
+// Handle a babystepping request from the main board. P is the driver number and S is the number of microsteps to add to its position.
+// V is the maximum speed of the babystepping motion in steps/sec, which is also the largest sudden speed change it may cause at the start or end of a move.
+// A is the maximum acceleration of the babystepping motion in steps/sec^2. V and A are remembered for future babystepping of that driver.
+// While moves are arriving, the babysteps are superimposed on the first queued move that isn't about to start, or on the next move we receive.
+// If we are idle then Spin generates a move of our own to do them.
+GCodeResult Move::ProcessBabystep(const CanMessageGeneric& msg, const StringRef& reply)
 {
-	return ddaRingAddPointer->AdvanceBabyStepping(amount);
+	CanMessageGenericParser parser(msg, BabystepParams);
+	uint8_t drive;
+	if (!parser.GetUintParam('P', drive))
+	{
+		reply.copy("Missing P parameter in CAN message");
+		return GCodeResult::error;
+	}
+
+	if (drive >= NumDrivers)
+	{
+		reply.printf("Driver number %u.%u out of range", CanInterface::GetCanAddress(), drive);
+		return GCodeResult::error;
+	}
+
+	float speed, acceleration;
+	if (parser.GetFloatParam('V', speed))
+	{
+		if (speed <= 0.0)
+		{
+			reply.copy("Babystep speed must be greater than zero");
+			return GCodeResult::error;
+		}
+		babystepMaxSpeeds[drive] = speed/(float)StepTimer::StepClockRate;
+	}
+	if (parser.GetFloatParam('A', acceleration))
+	{
+		if (acceleration <= 0.0)
+		{
+			reply.copy("Babystep acceleration must be greater than zero");
+			return GCodeResult::error;
+		}
+		babystepMaxAccelerations[drive] = acceleration/fsquare((float)StepTimer::StepClockRate);
+	}
+
+	int32_t amount;
+	if (parser.GetIntParam('S', amount) && amount != 0)
+	{
+		TaskCriticalSectionLocker lock;						// the Move task updates the pending babysteps when it adds a move
+		pendingBabySteps[drive] += amount;
+		babysteppingPending = true;
+	}
+
+	reply.printf("Driver %u.%u babystep offset %" PRIi32 " steps, %" PRIi32 " pending, max speed %.1f steps/sec, max acceleration %.1f steps/sec^2",
+					CanInterface::GetCanAddress(), drive, babyStepOffsets[drive], pendingBabySteps[drive],
+					(double)(babystepMaxSpeeds[drive] * (float)StepTimer::StepClockRate),
+					(double)(babystepMaxAccelerations[drive] * fsquare((float)StepTimer::StepClockRate)));
+	return GCodeResult::ok;
 }
+
+// Superimpose pending babysteps on the steps of a move. Called by DDA::Init for a new move and by DDA::AddBabySteps for a queued one.
+// The extra steps follow the speed profile of the move, so their peak speed and acceleration are the number of extra steps multiplied by the peak speed
+// and acceleration of the move expressed as fractions of its length. We add as many as the limits for each driver allow and leave the rest for later moves.
+// We also keep the net steps of each driver within maxNetSteps, which a queued move that was prepared using fixed point arithmetic needs,
+// and we don't add any to the drives in excludedDrives.
+// The extra steps become part of the move, so the step counts used for position reporting include them.
+// Extruders using pressure advance and delta towers don't follow the speed profile of the move, so we don't add babysteps to them in those moves.
+void Move::AddBabySteps(const CanMessageMovement& msg, int32_t steps[NumDrivers], int32_t maxNetSteps, uint32_t excludedDrives)
+{
+	const float topSpeed = 2.0/(2 * msg.steadyClocks + (msg.initialSpeedFraction + 1.0) * msg.accelerationClocks + (msg.finalSpeedFraction + 1.0) * msg.decelClocks);
+	const float acceleration = (msg.accelerationClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.initialSpeedFraction))/msg.accelerationClocks;
+	const float deceleration = (msg.decelClocks == 0) ? 0.0 : (topSpeed * (1.0 - msg.finalSpeedFraction))/msg.decelClocks;
+	const float peakAcceleration = max<float>(acceleration, deceleration);
+	excludedDrives |= msg.pressureAdvanceDrives | ((IsDeltaMode()) ? msg.deltaDrives : 0);
+
+	TaskCriticalSectionLocker lock;							// stop a babystep request being processed while we update the pending babysteps
+	bool stillPending = false;
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
+	{
+		const int32_t pending = pendingBabySteps[drive];
+		if (pending != 0)
+		{
+			if ((excludedDrives & (1u << drive)) == 0)
+			{
+				float limit = babystepMaxSpeeds[drive]/topSpeed;
+				if (peakAcceleration > 0.0)
+				{
+					limit = min<float>(limit, babystepMaxAccelerations[drive]/peakAcceleration);
+				}
+				const int32_t maxSteps = (limit < (float)INT32_MAX) ? (int32_t)limit : INT32_MAX;		// round down so that we stay within the limits
+				int32_t amount = constrain<int32_t>(pending, -maxSteps, maxSteps);
+				amount = constrain<int32_t>(steps[drive] + amount, -maxNetSteps, maxNetSteps) - steps[drive];
+				steps[drive] += amount;
+				pendingBabySteps[drive] = pending - amount;
+				babyStepOffsets[drive] += amount;
+			}
+			if (pendingBabySteps[drive] != 0)
+			{
+				stillPending = true;
+			}
+		}
+	}
+	babysteppingPending = stillPending;
+}
+
+// If we have pending babysteps and no moves queued or arriving, set up a move that does just the babysteps and return true.
+// We only do this when we have been idle for a while, because a move from the main board is probably not about to arrive. If one does arrive then
+// StopBabystepMove makes sure that this move doesn't delay it.
+// All the babystepped drivers share the same trapezoidal speed profile, chosen so that each stays within its own speed and acceleration limits.
+bool Move::MakeBabystepMove(CanMessageMovement& msg)
+{
+	if (!babysteppingPending || idleCount <= 10 || currentDda != nullptr || ddaRingGetPointer->GetState() != DDA::empty)
+	{
+		return false;
+	}
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	{
+		// If the move is stopped then we work out how many of its steps the hardware step generator discarded, which is only possible if it has no other steps
+		const uint32_t oldPrio = ChangeBasePriority(NvicPriorityStep);
+		const bool generatorIdle = HardwareStepGenerator::IsIdle();
+		babystepMoveNotGenerated = HardwareStepGenerator::GetNetStepsNotGenerated();
+		RestoreBasePriority(oldPrio);
+		if (!generatorIdle)
+		{
+			return false;
+		}
+	}
+#endif
+
+	memset(&msg, 0, sizeof(msg));
+	float accelClocks = 0.0, totalAccelSteadyClocks = 0.0;					// the acceleration time and the acceleration plus steady time
+	{
+		TaskCriticalSectionLocker lock;										// stop a babystep request being processed while we take the pending babysteps
+		for (size_t drive = 0; drive < NumDrivers; ++drive)
+		{
+			const int32_t amount = pendingBabySteps[drive];
+			if (amount != 0)
+			{
+				// Find the shortest profile that moves this driver by 'amount' within its limits
+				const float steps = (float)labs(amount);
+				const float speed = babystepMaxSpeeds[drive];
+				const float acceleration = babystepMaxAccelerations[drive];
+				const float timeToTopSpeed = speed/acceleration;
+				const float driveAccelClocks = (steps * acceleration >= fsquare(speed)) ? timeToTopSpeed : sqrtf(steps/acceleration);
+				accelClocks = max<float>(accelClocks, driveAccelClocks);
+				totalAccelSteadyClocks = max<float>(totalAccelSteadyClocks, max<float>(steps/speed, driveAccelClocks));
+				msg.perDrive[drive].steps = amount;
+				babyStepOffsets[drive] += amount;
+				pendingBabySteps[drive] = 0;
+			}
+		}
+		babysteppingPending = false;
+	}
+
+	msg.accelerationClocks = msg.decelClocks = (uint32_t)ceilf(accelClocks);
+	msg.steadyClocks = (uint32_t)ceilf(max<float>(totalAccelSteadyClocks, accelClocks)) - msg.accelerationClocks;
+	msg.initialSpeedFraction = msg.finalSpeedFraction = 0.0;
+	msg.whenToExecute = StepTimer::GetTimerTicks() + StepTimer::StepClockRate/1000;	// allow time to prepare it
+	return true;
+}
+
+// A move has arrived from the main board while the move that MakeBabystepMove set up is queued or executing. If the babystep move hasn't started
+// then withdraw it, and if it would finish after the new move is due to start then stop it where it is, so that the new move isn't delayed.
+// Stopping it is a sudden change of speed, but no larger than the babystep speed limits allow.
+// The babysteps that it didn't do become pending again, so they are added to the new move and the moves after it.
+void Move::StopBabystepMove(uint32_t whenNextMoveDue)
+{
+	DDA * const bdda = babystepDda;
+	babystepDda = nullptr;
+	int32_t stepsDone[NumDrivers];
+	{
+		AtomicCriticalSectionLocker lock;								// stop the step ISR starting or completing the move while we look at it
+		if (bdda->GetState() == DDA::frozen)
+		{
+			// Nothing else was queued when we set it up, so it is first in the queue
+			bdda->Complete();
+			ddaRingGetPointer = bdda->GetNext();
+			--scheduledMoves;
+			for (int32_t& steps : stepsDone)
+			{
+				steps = 0;
+			}
+		}
+		else if (bdda == currentDda && (int32_t)(bdda->GetMoveFinishTime() - whenNextMoveDue) > 0)
+		{
+			bdda->MoveAborted();
+			for (size_t drive = 0; drive < NumDrivers; ++drive)
+			{
+				stepsDone[drive] = bdda->GetStepsTaken(drive);
+			}
+#if SUPPORT_HARDWARE_STEP_GENERATION
+			// The move counts the steps when it queues them, so allow for the steps that the generator discarded when we stopped the move
+			stepsDone[HardwareStepDriver] -= HardwareStepGenerator::GetNetStepsNotGenerated() - babystepMoveNotGenerated;
 #endif
+			CurrentMoveCompleted();
+		}
+		else
+		{
+			return;														// it has finished or will finish in time
+		}
+	}
+
+	TaskCriticalSectionLocker lock;										// stop a babystep request being processed while we update the pending babysteps
+	for (size_t drive = 0; drive < NumDrivers; ++drive)
+	{
+		const int32_t notDone = babystepMoveSteps[drive] - stepsDone[drive];
+		if (notDone != 0)
+		{
+			pendingBabySteps[drive] += notDone;
+			babyStepOffsets[drive] -= notDone;
+			babysteppingPending = true;
+		}
+	}
+}
+
+// Superimpose pending babysteps on the first queued move that won't start for a while and hasn't been given them already,
+// so that they take effect without waiting for the queued moves to be executed. We do at most one move each time we are called.
+// We don't change the executing move, because the step ISR is using its DMs and the step times already calculated depend on them.
+void Move::AddBabyStepsToQueuedMove()
+{
+	DDA *dda = ddaRingGetPointer;
+	if (dda->GetState() == DDA::empty)
+	{
+		return;																// nothing is queued
+	}
+
+	const uint32_t now = StepTimer::GetTimerTicks();
+	do
+	{
+		if (   dda->GetState() == DDA::frozen
+			&& !dda->HasBabySteps()
+			&& (int32_t)(dda->GetMoveStartTime() - now) >= (int32_t)BabystepPrepareMargin
+		   )
+		{
+			(void)dda->AddBabySteps();
+			return;
+		}
+		dda = dda->GetNext();
+	} while (dda != ddaRingAddPointer);										// when the ring is full the add pointer is the same as the get pointer
+}
 
 // Change the kinematics to the specified type if it isn't already
 // If it is already correct leave its parameters alone.
@@ -221,6 +568,160 @@ bool Move::SetKinematics(KinematicsType k)
 	return true;
 }
 
+// Handle the kinematics configuration sent by the main board when it processes M669, M92 or M584.
+// K is the kinematics type, A is the kinematic motor number (0 = X, 1 = Y, 2 = Z) for each local driver, 255 if none.
+// S is the steps/mm for each of the kinematic motors. Z is the current Z coordinate, which the main board sends after homing or G92 and whenever a move may have been stopped early.
+// Drivers that have a kinematic motor number have their steps calculated locally from the Cartesian coordinates in movement messages.
+GCodeResult Move::ProcessM669(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, M669Params);
+	uint8_t kType;
+	if (parser.GetUintParam('K', kType))
+	{
+		if (kType >= (uint8_t)KinematicsType::unknown || !SetKinematics((KinematicsType)kType))
+		{
+			reply.printf("Board %u does not support kinematics type %u", CanInterface::GetCanAddress(), kType);
+			return GCodeResult::error;
+		}
+	}
+
+	size_t numMotors;
+	const uint8_t *motors;
+	if (parser.GetUint8ArrayParam('A', numMotors, motors))
+	{
+		if (numMotors > NumDrivers)
+		{
+			reply.copy("Too many drivers in A parameter");
+			return GCodeResult::error;
+		}
+		for (size_t driver = 0; driver < NumDrivers; ++driver)
+		{
+			driverMotors[driver] = (driver < numMotors && motors[driver] < XYZ_AXES) ? motors[driver] : NoMotor;
+		}
+	}
+
+	float stepsPerMm[XYZ_AXES];
+	size_t numStepsPerMm = XYZ_AXES;
+	if (parser.GetFloatArrayParam('S', numStepsPerMm, stepsPerMm))
+	{
+		for (size_t i = 0; i < numStepsPerMm; ++i)
+		{
+			if (stepsPerMm[i] <= 0.0)
+			{
+				reply.copy("Steps/mm must be greater than zero");
+				return GCodeResult::error;
+			}
+			motorStepsPerMm[i] = stepsPerMm[i];
+		}
+	}
+
+	float zPosition;
+	kinematicZ.SetStepsPerMm(motorStepsPerMm[Z_AXIS]);
+	if (parser.GetFloatParam('Z', zPosition))
+	{
+		// Moves received before this request may still be queued, so the reset takes effect after them
+		kinematicZ.ScheduleReset(zPosition, CanInterface::GetMovesReceivedBeforeM669());
+	}
+
+	reply.printf("Kinematics is %s", kinematics->GetName(false));
+	return GCodeResult::ok;
+}
+
+// Calculate the net steps for drivers whose steps are derived locally from the Cartesian coordinates in the movement message.
+// The main board flags these drivers in msg.deltaDrives. We convert the absolute start and end positions rather than the difference between them,
+// so that rounding errors don't accumulate from one move to the next. The message doesn't carry the absolute Z coordinate, so we track it in fixed point
+// so that only the total is rounded to whole steps, and the main board resets it using M669 when it changes for other reasons.
+void Move::GetKinematicMotorSteps(const CanMessageMovement& msg, int32_t motorSteps[NumDrivers])
+{
+	float initialZ, finalZ;
+	kinematicZ.AddMove(msg.zMovement, initialZ, finalZ);
+	const float initialCoords[XYZ_AXES] = { msg.initialX, msg.initialY, initialZ };
+	const float finalCoords[XYZ_AXES] = { msg.finalX, msg.finalY, finalZ };
+
+	int32_t initialMotorPos[XYZ_AXES], finalMotorPos[XYZ_AXES];
+	(void)kinematics->CartesianToMotorSteps(initialCoords, motorStepsPerMm, XYZ_AXES, XYZ_AXES, initialMotorPos, true);
+	(void)kinematics->CartesianToMotorSteps(finalCoords, motorStepsPerMm, XYZ_AXES, XYZ_AXES, finalMotorPos, true);
+
+	for (size_t driver = 0; driver < NumDrivers; ++driver)
+	{
+		const uint8_t motor = driverMotors[driver];
+		if ((msg.deltaDrives & (1u << driver)) != 0 && motor != NoMotor)
+		{
+			motorSteps[driver] = finalMotorPos[motor] - initialMotorPos[motor];
+		}
+	}
+}
+
+#if SUPPORT_INPUT_SHAPING
+
+// Handle the input shaping configuration sent by the main board when it processes M593.
+// P is the driver number, T is the shaper type, F is the frequency in Hz and S is the damping ratio.
+// We reject a shaper that differs from one already enabled on another driver, because DDA::Prepare uses one shaper for all the drives in a move.
+GCodeResult Move::ProcessM593(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	constexpr float DefaultShaperFrequency = 40.0;
+	constexpr float DefaultShaperDamping = 0.1;
+
+	CanMessageGenericParser parser(msg, M593Params);
+	uint8_t drive;
+	if (!parser.GetUintParam('P', drive))
+	{
+		reply.copy("Missing P parameter in CAN message");
+		return GCodeResult::error;
+	}
+
+	if (drive >= NumDrivers)
+	{
+		reply.printf("Driver number %u.%u out of range", CanInterface::GetCanAddress(), drive);
+		return GCodeResult::error;
+	}
+
+	InputShaper& shaper = shapers[drive];
+	uint8_t type = (uint8_t)shaper.GetType();
+	float frequency = (shaper.IsEnabled()) ? shaper.GetFrequency() : DefaultShaperFrequency;
+	float damping = (shaper.IsEnabled()) ? shaper.GetDamping() : DefaultShaperDamping;
+	bool seen = parser.GetUintParam('T', type);
+	if (parser.GetFloatParam('F', frequency))
+	{
+		seen = true;
+	}
+	if (parser.GetFloatParam('S', damping))
+	{
+		seen = true;
+	}
+
+	if (seen)
+	{
+		InputShaper newShaper = shaper;
+		if (type >= (uint8_t)InputShaperType::numTypes || !newShaper.Configure((InputShaperType)type, frequency, damping))
+		{
+			reply.printf("Bad input shaping parameters for driver %u.%u", CanInterface::GetCanAddress(), drive);
+			return GCodeResult::error;
+		}
+
+		// Each move is shaped using one shaper for all its drives, so the drivers on this board must all use the same one
+		if (newShaper.IsEnabled())
+		{
+			for (size_t otherDrive = 0; otherDrive < NumDrivers; ++otherDrive)
+			{
+				if (otherDrive != drive && shapers[otherDrive].IsEnabled() && !shapers[otherDrive].Matches(newShaper))
+				{
+					reply.printf("Driver %u.%u uses different input shaping. All drivers on a board must use the same input shaping, so disable it on that driver first",
+									CanInterface::GetCanAddress(), otherDrive);
+					return GCodeResult::error;
+				}
+			}
+		}
+		shaper = newShaper;
+	}
+
+	reply.printf("Driver %u.%u input shaping: ", CanInterface::GetCanAddress(), drive);
+	shaper.AppendDetails(reply);
+	return GCodeResult::ok;
+}
+
+#endif
+
 // Return true if this is a raw motor move
 bool Move::IsRawMotorMove(uint8_t moveType) const
 {
@@ -411,17 +912,161 @@ void Move::Diagnostics(const StringRef& reply)
 	reply.catf("Moves scheduled %" PRIu32 ", completed %" PRIu32 ", in progress %d, hiccups %" PRIu32 "\n",
 					scheduledMoves, completedMoves, (int)(currentDda != nullptr), numHiccups);
 	numHiccups = 0;
+	reply.catf("Move queue length %u, max used %u, started late %u, DMs %u min free %d\n",
+					DdaRingLength, maxDdasInUse, numStarvedMoves, NumDms, DriveMovement::MinFree());
+	maxDdasInUse = ddasInUse;
+	numStarvedMoves = 0;
+	bool babystepped = babysteppingPending;
+	for (int32_t offset : babyStepOffsets)
+	{
+		if (offset != 0)
+		{
+			babystepped = true;
+		}
+	}
+	if (babystepped)
+	{
+		reply.cat("Babystep offsets");
+		for (size_t driver = 0; driver < NumDrivers; ++driver)
+		{
+			reply.catf(" %" PRIi32 "/%" PRIi32, babyStepOffsets[driver], pendingBabySteps[driver]);
+		}
+		reply.cat(" (applied/pending)\n");
+	}
+	DriveMovement::ResetMinFree();
 	StepTimer::Diagnostics(reply);
+#if SUPPORT_INPUT_SHAPING
+	DDA::ShapingDiagnostics(reply);
+#endif
+#if SUPPORT_FIXED_POINT_PREPARE
+	DDA::PrepareDiagnostics(reply);
+#endif
+#if SUPPORT_STEP_TIME_BUFFER
+	reply.catf("Step time buffer underruns %u\n", DriveMovement::GetAndClearUnderruns());
+	{
+		const uint32_t oldPrio = ChangeBasePriority(NvicPriorityStep);
+		const uint32_t calls = numStepInterrupts;
+		const uint32_t maxCycles = maxStepInterruptCycles;
+		const uint64_t totalCycles = totalStepInterruptCycles;
+		numStepInterrupts = maxStepInterruptCycles = 0;
+		totalStepInterruptCycles = 0;
+		RestoreBasePriority(oldPrio);
+
+		// Each step interrupt generates at least one step, so the mean time per interrupt limits the step rate when one motor is moving
+		const float cyclesPerMicrosecond = (float)SystemCoreClock * 1.0e-6;
+		const float meanCycles = (calls == 0) ? 0.0 : (float)totalCycles/(float)calls;
+		reply.catf("Step ISR calls %" PRIu32 ", mean %.2fus, max %.2fus, max step rate %" PRIu32 " steps/sec\n",
+					calls, (double)(meanCycles/cyclesPerMicrosecond), (double)((float)maxCycles/cyclesPerMicrosecond),
+					(calls == 0) ? 0 : (uint32_t)((float)SystemCoreClock/meanCycles));
+	}
+#endif
+#if SUPPORT_SLOW_DRIVERS
+	DDA::SlowDriverDiagnostics(reply);
+#endif
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	HardwareStepGenerator::Diagnostics(reply);
+#endif
+#if SAMC21
+	StepMath::Diagnostics(reply);
+#endif
 }
 
 // This is called from the step ISR when the current move has been completed
 void Move::CurrentMoveCompleted()
 {
+#if SUPPORT_DRIVER_TELEMETRY
+	const DDA * const cdda = currentDda;		// capture volatile variable
+	if (cdda != nullptr)
+	{
+		for (size_t driver = 0; driver < NumDrivers; ++driver)
+		{
+			completedDriverSteps[driver] += cdda->GetStepsTaken(driver);
+		}
+	}
+#endif
 	currentDda = nullptr;
 	ddaRingGetPointer = ddaRingGetPointer->GetNext();
 	completedMoves++;
 }
 
+#if SUPPORT_STEP_TIME_BUFFER
+
+void Move::PrecomputeSteps()
+{
+	DDA * const cdda = currentDda;				// capture volatile variable
+	if (cdda != nullptr)
+	{
+		cdda->PrecomputeSteps();
+	}
+}
+
+/*static*/ void Move::WakeStepCalculator()
+{
+	stepCalcTask.GiveFromISR();
+}
+
+#endif
+
+#if SUPPORT_DRIVER_TELEMETRY
+
+// Get the position of a driver in microsteps since we started up, including the steps taken so far in the specified move.
+// Must be called with the step interrupt disabled.
+int32_t Move::GetDriverPosition(size_t driver, const DDA *dda) const
+{
+	int32_t position = completedDriverSteps[driver] + ((dda != nullptr) ? dda->GetStepsTaken(driver) : 0);
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	if (HardwareStepGenerator::IsHardwareStepped(driver))
+	{
+		position -= HardwareStepGenerator::GetNetStepsNotGenerated();	// the move counts steps when it queues them, so allow for those not generated
+	}
+#endif
+	return position;
+}
+
+// Get the position of a driver in microsteps since we started up, including the steps taken so far in the current move
+int32_t Move::GetLiveDriverPosition(size_t driver) const
+{
+	const uint32_t oldPrio = ChangeBasePriority(NvicPriorityStep);		// stop the step ISR completing the current move while we read the position
+	const int32_t position = GetDriverPosition(driver, currentDda);
+	RestoreBasePriority(oldPrio);
+	return position;
+}
+
+#endif
+
+#if SUPPORT_POWER_FAIL_DETECTION
+
+// Stop all the drivers where they are and don't start any more moves, then return the position of each driver in microsteps.
+// The positions are made up from completedDriverSteps and the steps output so far in the stopped move, less any steps that the hardware step generator discarded.
+// This is called from the ADC interrupt when we detect a power failure, so that the main board can resume from the position we stopped at.
+// The steps stay frozen until we are reset, because the moves we already have were planned to start where the stopped move would have ended.
+void Move::FreezeForPowerFail(int32_t positions[NumDrivers])
+{
+	const uint32_t oldPrio = ChangeBasePriority(NvicPriorityStep);		// stop the step ISR running while we stop the move and read the positions
+	stepsFrozen = true;
+	DDA * const cdda = currentDda;										// capture volatile variable
+	if (cdda != nullptr)
+	{
+		cdda->StopDrivers((1u << NumDrivers) - 1);
+		if (cdda->GetState() == DDA::completed)
+		{
+			CurrentMoveCompleted();										// this adds the steps taken to completedDriverSteps and clears currentDda
+		}
+	}
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	HardwareStepGenerator::Cancel();									// the generator may still have steps queued from a move that has completed
+#endif
+
+	const DDA * const stoppedDda = currentDda;							// normally null now, unless the move hadn't started executing
+	for (size_t driver = 0; driver < NumDrivers; ++driver)
+	{
+		positions[driver] = GetDriverPosition(driver, stoppedDda);
+	}
+	RestoreBasePriority(oldPrio);
+}
+
+#endif
+
 void Move::StopDrivers(uint16_t whichDrivers)
 {
 #if SAME5x
@@ -458,9 +1103,29 @@ void Move::PrintCurrentDda() const
 	}
 }
 
+#if SUPPORT_STEP_TIME_BUFFER
+
+// This is the function that is called by the timer interrupt to step the motors. We time it for the diagnostics.
+void Move::Interrupt()
+{
+	const uint32_t startCycles = DWT->CYCCNT;
+	StepInterrupt();
+	const uint32_t cycles = DWT->CYCCNT - startCycles;
+	++numStepInterrupts;
+	totalStepInterruptCycles += cycles;
+	if (cycles > maxStepInterruptCycles)
+	{
+		maxStepInterruptCycles = cycles;
+	}
+}
+
+// Generate the steps. This may occasionally get called prematurely.
+void Move::StepInterrupt()
+#else
 // This is the function that is called by the timer interrupt to step the motors.
 // This may occasionally get called prematurely.
 void Move::Interrupt()
+#endif
 {
 	const uint32_t isrStartTime = StepTimer::GetTimerTicks();
 	uint32_t now = isrStartTime;
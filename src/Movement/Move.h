@@ -12,14 +12,26 @@
 #include "MessageType.h"
 #include "DDA.h"								// needed because of our inline functions
 #include "Kinematics/Kinematics.h"
+#include "Kinematics/ZPositionTracker.h"
+#include "GCodes/GCodeResult.h"
+
+struct CanMessageMovement;
+struct CanMessageGeneric;
 
 // Define the number of DDAs and DMs.
 // A DDA represents a move in the queue.
 // Each DDA needs one DM per drive that it moves.
-// However, DM's are large, so we provide fewer than DRIVES * DdaRingLength of them. The planner checks that enough DMs are available before filling in a new DDA.
+// We size the ring from the RAM budget for the board, so that boards with more RAM can queue more moves to absorb delays in receiving them.
+// We allow for one DM per driver per DDA, and for the overhead of allocating each object on the heap.
+// Spin checks that enough DMs are available before filling in a new DDA.
+
+constexpr size_t HeapOverheadPerObject = 8;
+constexpr size_t RamPerQueuedMove = sizeof(DDA) + NumDrivers * sizeof(DriveMovement) + (NumDrivers + 1) * HeapOverheadPerObject;
+constexpr unsigned int MinDdaRingLength = 8;
+constexpr unsigned int DdaRingLength = MoveQueueRamBudget/RamPerQueuedMove;
+constexpr unsigned int NumDms = DdaRingLength * NumDrivers;
 
-const unsigned int DdaRingLength = 20;
-const unsigned int NumDms = DdaRingLength * NumDrivers;
+static_assert(DdaRingLength >= MinDdaRingLength, "MoveQueueRamBudget is too small");
 
 /**
  * This is the master movement class.  It controls all movement in the machine.
@@ -42,6 +54,19 @@ public:
 	Kinematics& GetKinematics() const { return *kinematics; }
 	bool SetKinematics(KinematicsType k);											// Set kinematics, return true if successful
 																					// Convert Cartesian coordinates to delta motor coordinates, return true if successful
+	GCodeResult ProcessM669(const CanMessageGeneric& msg, const StringRef& reply);	// Configure the kinematics used to calculate local motor steps
+	void GetKinematicMotorSteps(const CanMessageMovement& msg, int32_t motorSteps[NumDrivers]);	// Calculate motor steps from the Cartesian coordinates in a movement message
+
+#if SUPPORT_INPUT_SHAPING
+	GCodeResult ProcessM593(const CanMessageGeneric& msg, const StringRef& reply);	// Configure input shaping for a driver
+	const InputShaper& GetInputShaper(size_t drive) const { return shapers[drive]; }
+#endif
+
+	// Babystepping
+	GCodeResult ProcessBabystep(const CanMessageGeneric& msg, const StringRef& reply);	// Add a babystep offset to a driver
+	bool IsBabysteppingPending() const { return babysteppingPending; }
+	void AddBabySteps(const CanMessageMovement& msg, int32_t steps[NumDrivers], int32_t maxNetSteps, uint32_t excludedDrives);	// Superimpose pending babysteps on the steps of a move
+
 	// Temporary kinematics functions
 	bool IsDeltaMode() const { return kinematics->GetKinematicsType() == KinematicsType::linearDelta; }
 	// End temporary functions
@@ -55,6 +80,11 @@ public:
 
 	void CurrentMoveCompleted() __attribute__ ((hot));								// Signal that the current move has just been completed
 
+#if SUPPORT_STEP_TIME_BUFFER
+	void PrecomputeSteps();															// Top up the step time buffers of the current move
+	static void WakeStepCalculator();												// Called from the step ISR when step time buffers need topping up
+#endif
+
 	void PrintCurrentDda() const;													// For debugging
 
 	void ResetMoveCounters() { scheduledMoves = completedMoves = 0; }
@@ -63,9 +93,27 @@ public:
 	uint32_t GetStepInterval(size_t axis, uint32_t microstepShift) const;			// Get the current step interval for this axis or extruder
 #endif
 
+#if SUPPORT_DRIVER_TELEMETRY
+	int32_t GetLiveDriverPosition(size_t driver) const;								// Get the position of a driver in microsteps
+#endif
+
+#if SUPPORT_POWER_FAIL_DETECTION
+	void FreezeForPowerFail(int32_t positions[NumDrivers]);							// Stop all drivers and don't start any more moves. Called from an ISR.
+	bool IsFrozen() const { return stepsFrozen; }
+#endif
+
 private:
 	bool DDARingAdd();									// Add a processed look-ahead entry to the DDA ring
 	DDA* DDARingGet();									// Get the next DDA ring entry to be run
+	bool MakeBabystepMove(CanMessageMovement& msg);		// Set up a move to do the pending babysteps if we are idle
+	void AddBabyStepsToQueuedMove();					// Superimpose pending babysteps on a move that is queued but won't start soon
+	void StopBabystepMove(uint32_t whenNextMoveDue);	// Withdraw or stop our own babystep move so that it doesn't delay a move from the main board
+#if SUPPORT_DRIVER_TELEMETRY
+	int32_t GetDriverPosition(size_t driver, const DDA *dda) const;	// Get the position of a driver including the steps output so far in a move
+#endif
+#if SUPPORT_STEP_TIME_BUFFER
+	void StepInterrupt() __attribute__ ((hot));			// Generate the steps, called by Interrupt which times it
+#endif
 
 	// Variables that are in the DDARing class in RepRapFirmware (we have only one DDARing so they are here)
 	DDA* volatile currentDda;
@@ -80,12 +128,48 @@ private:
 
 	Kinematics *kinematics;								// What kinematics we are using
 
+	static constexpr uint8_t NoMotor = 0xFF;
+	uint8_t driverMotors[NumDrivers];					// which kinematic motor each local driver is connected to, or NoMotor
+	float motorStepsPerMm[XYZ_AXES];					// steps/mm of the kinematic motors
+	ZPositionTracker kinematicZ;						// the Z coordinate at the end of the last move, set by M669 and updated by each move
+	uint32_t canMovesTaken;								// the number of movement messages we have taken from the CAN interface, used to apply M669 Z resets at the right move
+
+#if SUPPORT_INPUT_SHAPING
+	InputShaper shapers[NumDrivers];					// the input shaper configured for each driver
+#endif
+
+	int32_t pendingBabySteps[NumDrivers];				// babysteps that have been requested but not yet added to a move
+	int32_t babyStepOffsets[NumDrivers];				// the net babysteps added to moves for each driver
+	float babystepMaxSpeeds[NumDrivers];				// the speed limit for babystepping each driver, in steps per step clock
+	float babystepMaxAccelerations[NumDrivers];			// the acceleration limit for babystepping each driver, in steps per step clock squared
+	volatile bool babysteppingPending;					// true if any driver has pending babysteps
+	DDA *babystepDda;									// the DDA of the move that MakeBabystepMove set up, until it is completed or stopped
+	int32_t babystepMoveSteps[NumDrivers];				// the babysteps in that move
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	int32_t babystepMoveNotGenerated;					// HardwareStepGenerator::GetNetStepsNotGenerated when we set up that move
+#endif
+
+#if SUPPORT_DRIVER_TELEMETRY
+	int32_t completedDriverSteps[NumDrivers];			// the net steps taken by each driver in completed moves
+#endif
+
 	unsigned int stepErrors;							// count of step errors, for diagnostics
+	unsigned int ddasInUse;								// the number of DDAs between the check pointer and the add pointer
+	unsigned int maxDdasInUse;							// the high water mark of ddasInUse, for diagnostics
+	unsigned int numStarvedMoves;						// how many moves started late because we didn't have them ready in time
 	uint32_t scheduledMoves;							// Move counters for the code queue
 	volatile uint32_t completedMoves;					// This one is modified by an ISR, hence volatile
 	uint32_t numHiccups;								// How many times we delayed an interrupt to avoid using too much CPU time in interrupts
+#if SUPPORT_STEP_TIME_BUFFER
+	uint32_t numStepInterrupts;							// how many times the step ISR has run since the last diagnostics
+	uint32_t maxStepInterruptCycles;					// the longest step ISR in CPU cycles since the last diagnostics
+	uint64_t totalStepInterruptCycles;					// the total CPU cycles spent in the step ISR since the last diagnostics
+#endif
 
 	bool active;										// Are we live and running?
+#if SUPPORT_POWER_FAIL_DETECTION
+	volatile bool stepsFrozen;							// true if we stopped the steps because of a power failure
+#endif
 };
 
 //******************************************************************************************************
@@ -0,0 +1,43 @@
+/*
+ * SlowDriverTiming.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  The timing rules for step pulses to slow external drivers. The step ISR uses these to decide whether to wait for a slow driver
+ *  or to hold the step or direction change off and schedule another interrupt, and to decide how long the step pulse must still stay high.
+ *  All times are in the same units, normally step clocks, and may wrap around. This file doesn't depend on the hardware, so that the
+ *  scheduling can be simulated on a PC.
+ */
+
+#ifndef SRC_MOVEMENT_SLOWDRIVERTIMING_H_
+#define SRC_MOVEMENT_SLOWDRIVERTIMING_H_
+
+#include <cstdint>
+
+namespace SlowDriverTiming
+{
+	// Return how long we must wait from 'now' before we can start a step pulse, given when the last pulse ended and when DIR last changed
+	inline uint32_t GetStepWait(uint32_t now, uint32_t lastStepLowTime, uint32_t lastDirChangeTime, uint32_t stepLowTime, uint32_t dirSetupTime)
+	{
+		const uint32_t sinceStepLow = now - lastStepLowTime;
+		const uint32_t sinceDirChange = now - lastDirChangeTime;
+		const uint32_t stepLowWait = (sinceStepLow < stepLowTime) ? stepLowTime - sinceStepLow : 0;
+		const uint32_t dirSetupWait = (sinceDirChange < dirSetupTime) ? dirSetupTime - sinceDirChange : 0;
+		return (stepLowWait > dirSetupWait) ? stepLowWait : dirSetupWait;
+	}
+
+	// Return true if a wait is long enough that we should schedule an interrupt for the end of it rather than wait in the ISR
+	inline bool ShouldHoldOff(uint32_t wait, uint32_t minInterruptInterval)
+	{
+		return wait >= minInterruptInterval;
+	}
+
+	// Return how long we must wait from 'now' until 'duration' has passed since 'startTime', for example for the step high time or the direction hold time
+	inline uint32_t GetRemainingTime(uint32_t now, uint32_t startTime, uint32_t duration)
+	{
+		const uint32_t elapsed = now - startTime;
+		return (elapsed < duration) ? duration - elapsed : 0;
+	}
+}
+
+#endif /* SRC_MOVEMENT_SLOWDRIVERTIMING_H_ */
@@ -0,0 +1,109 @@
+/*
+ * StepMath.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "StepMath.h"
+
+#if SAMC21
+
+// We access the DIVAS through the IOBUS because that is faster than the AHB. The caller must disable interrupts.
+static inline uint32_t DivasSqrt(uint32_t num)
+{
+	DIVAS_IOBUS->SQRNUM.reg = num;
+	while ((DIVAS_IOBUS->STATUS.reg & DIVAS_STATUS_BUSY) != 0) { }
+	return DIVAS_IOBUS->RESULT.reg;
+}
+
+// Unsigned division. We leave the leading zero optimisation as hpl_divas.c configured it.
+static inline uint32_t DivasDivide(uint32_t num, uint32_t den)
+{
+	DIVAS_IOBUS->CTRLA.reg &= ~DIVAS_CTRLA_SIGNED;
+	DIVAS_IOBUS->DIVIDEND.reg = num;
+	DIVAS_IOBUS->DIVISOR.reg = den;
+	while ((DIVAS_IOBUS->STATUS.reg & DIVAS_STATUS_BUSY) != 0) { }
+	return DIVAS_IOBUS->RESULT.reg;
+}
+
+// The DIVAS only handles 32-bit square roots. For larger numbers we take the square root of the top 31 or 32 bits and do one Newton-Raphson step.
+// Starting from at least 15 correct bits, the Newton-Raphson step leaves the result at most 1 too high, which the final check corrects.
+uint32_t StepMath::Isqrt64(uint64_t num)
+{
+	if ((num >> 32) == 0)
+	{
+		AtomicCriticalSectionLocker lock;
+		return DivasSqrt((uint32_t)num);
+	}
+
+	const unsigned int k = (64 - __builtin_clzll(num) - 31)/2;			// from 1 to 16
+	uint32_t s;															// the square root of num >> 2k, from 2^15 to 2^16 - 1
+	uint32_t correction;
+	{
+		AtomicCriticalSectionLocker lock;
+		s = DivasSqrt((uint32_t)(num >> (2 * k)));
+		const uint64_t r0 = (uint64_t)s << k;
+		// The Newton-Raphson correction is (num - r0^2)/(2 * r0). num - r0^2 < (2s + 1) * 2^2k, so shifting it right by k + 1 makes it fit in 32 bits.
+		correction = DivasDivide((uint32_t)((num - r0 * r0) >> (k + 1)), s);
+	}
+
+	uint64_t root = ((uint64_t)s << k) + correction;
+	if (root > 0xFFFFFFFF)
+	{
+		root = 0xFFFFFFFF;
+	}
+	while (root * root > num)
+	{
+		--root;
+	}
+	while (root < 0xFFFFFFFF && (root + 1) * (root + 1) <= num)
+	{
+		++root;
+	}
+	return (uint32_t)root;
+}
+
+// Time the DIVAS and generic square roots over a range of values, using the SysTick counter to count CPU cycles.
+// Interrupts are disabled only while timing a single call, so that we don't hold up the step interrupt for long.
+void StepMath::Diagnostics(const StringRef& reply)
+{
+	constexpr unsigned int NumTestValues = 64;
+
+	uint32_t divasCycles = 0, genericCycles = 0, maxDivasCycles = 0, maxGenericCycles = 0;
+	unsigned int mismatches = 0;
+	uint64_t testValue = 0x0123456789ABCDEF;
+	for (unsigned int i = 0; i < NumTestValues; ++i)
+	{
+		testValue = testValue * 6364136223846793005u + 1442695040888963407u;	// pseudo random sequence
+		const uint64_t num = testValue >> (i % 40);							// cover numbers of 24 to 64 bits
+		const uint32_t reload = SysTick->LOAD + 1;
+		uint32_t divasResult, genericResult, startCount, divasTaken, genericTaken;
+		{
+			AtomicCriticalSectionLocker lock;
+			startCount = SysTick->VAL;
+			divasResult = Isqrt64(num);
+			divasTaken = (startCount + reload - SysTick->VAL) % reload;		// SysTick counts down
+		}
+		{
+			AtomicCriticalSectionLocker lock;
+			startCount = SysTick->VAL;
+			genericResult = isqrt64(num);
+			genericTaken = (startCount + reload - SysTick->VAL) % reload;
+		}
+		if (divasResult != genericResult)
+		{
+			++mismatches;
+		}
+		divasCycles += divasTaken;
+		genericCycles += genericTaken;
+		maxDivasCycles = max<uint32_t>(maxDivasCycles, divasTaken);
+		maxGenericCycles = max<uint32_t>(maxGenericCycles, genericTaken);
+	}
+
+	reply.catf("Square root cycles: DIVAS average %" PRIu32 " max %" PRIu32 ", generic average %" PRIu32 " max %" PRIu32 ", mismatches %u\n",
+				divasCycles/NumTestValues, maxDivasCycles, genericCycles/NumTestValues, maxGenericCycles, mismatches);
+}
+
+#endif
+
+// End
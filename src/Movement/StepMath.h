@@ -0,0 +1,29 @@
+/*
+ * StepMath.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Integer arithmetic used in the step time calculations. On the SAMC21 the square root is done by the DIVAS accelerator,
+ *  elsewhere we use the generic library function. The results are the same in both cases.
+ *  The DIVAS is also used by the compiler's 32-bit division support functions in hpl_divas.c. Those disable interrupts from writing the
+ *  operands to reading the result, and so do we, so the step ISR can't use the DIVAS part way through a division in a lower priority task
+ *  or ISR, nor the other way round.
+ */
+
+#ifndef SRC_MOVEMENT_STEPMATH_H_
+#define SRC_MOVEMENT_STEPMATH_H_
+
+#include "RepRapFirmware.h"
+#include "Math/Isqrt.h"
+
+namespace StepMath
+{
+#if SAMC21
+	uint32_t Isqrt64(uint64_t num) __attribute__ ((hot));			// return the integer square root of num, rounded down
+	void Diagnostics(const StringRef& reply);						// compare the speed of the DIVAS and the generic functions and check that they agree
+#else
+	inline uint32_t Isqrt64(uint64_t num) { return isqrt64(num); }
+#endif
+}
+
+#endif /* SRC_MOVEMENT_STEPMATH_H_ */
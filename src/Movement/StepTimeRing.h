@@ -0,0 +1,73 @@
+/*
+ * StepTimeRing.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  A ring buffer of step times with one producer, the step calculation task, and one consumer, the step ISR.
+ *  The producer owns the write index and the consumer owns the read index, so neither side needs to disable interrupts.
+ *  The acquire and release ordering makes an entry visible to the consumer only after it has been written.
+ *  The producer marks the ring finished after writing the last entry, so a consumer that finds the ring empty and then sees
+ *  the finished flag knows that there are no more entries to come.
+ */
+
+#ifndef SRC_MOVEMENT_STEPTIMERING_H_
+#define SRC_MOVEMENT_STEPTIMERING_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+class StepTimeRing
+{
+public:
+	static constexpr size_t Length = 16;				// must be a power of 2, one entry is always left empty
+
+	// Empty the ring. Only call this when neither the producer nor the consumer can be using it.
+	void Clear()
+	{
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		finished.store(false, std::memory_order_relaxed);
+	}
+
+	size_t NumEntries() const { return (head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire)) & (Length - 1); }
+	bool IsFull() const { return NumEntries() == Length - 1; }
+	bool IsFinished() const { return finished.load(std::memory_order_acquire); }
+
+	// Producer functions
+	bool Push(uint32_t entry)
+	{
+		const uint8_t h = head.load(std::memory_order_relaxed);
+		const uint8_t next = (h + 1) & (Length - 1);
+		if (next == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		entries[h] = entry;
+		head.store(next, std::memory_order_release);
+		return true;
+	}
+
+	void SetFinished() { finished.store(true, std::memory_order_release); }
+
+	// Consumer function
+	bool Pop(uint32_t& entry)
+	{
+		const uint8_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		entry = entries[t];
+		tail.store((t + 1) & (Length - 1), std::memory_order_release);
+		return true;
+	}
+
+private:
+	uint32_t entries[Length];
+	std::atomic<uint8_t> head;							// the index of the next entry that the producer will write
+	std::atomic<uint8_t> tail;							// the index of the next entry that the consumer will read
+	std::atomic<bool> finished;							// set by the producer when it has written all the entries
+};
+
+#endif /* SRC_MOVEMENT_STEPTIMERING_H_ */
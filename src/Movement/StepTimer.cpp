@@ -40,7 +40,11 @@ void StepTimer::Init()
 
 	hri_tc_write_CTRLA_reg(StepTc, TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV64);
 	hri_tc_write_DBGCTRL_reg(StepTc, 0);
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	hri_tc_write_EVCTRL_reg(StepTc, TC_EVCTRL_MCEO1);			// CC1 generates the hardware step events
+#else
 	hri_tc_write_EVCTRL_reg(StepTc, 0);
+#endif
 	hri_tc_write_WAVE_reg(StepTc, TC_WAVE_WAVEGEN_NFRQ);
 
 	hri_tc_set_CTRLA_ENABLE_bit(StepTc);
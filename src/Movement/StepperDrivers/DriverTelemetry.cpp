@@ -0,0 +1,202 @@
+/*
+ * DriverTelemetry.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "DriverTelemetry.h"
+
+#if SUPPORT_DRIVER_TELEMETRY
+
+#if !SUPPORT_TMC51xx
+# error Driver telemetry is only supported with TMC51xx drivers
+#endif
+
+#include "TMC51xx.h"
+#include <Movement/Move.h>
+#include <Movement/StepTimer.h>
+#include <CAN/CanInterface.h>
+#include <CAN/CanDriverTelemetryMessages.h>
+#include <CanMessageBuffer.h>
+#include <CanMessageGenericParser.h>
+
+namespace DriverTelemetry
+{
+	constexpr uint16_t DefaultSampleInterval = 10;					// milliseconds
+	constexpr uint16_t MinSampleInterval = 2;						// the TMC task doesn't read DRV_STATUS much more often than this
+	constexpr uint32_t MaxBatchDelay = 50;							// the longest we hold a sample while waiting to fill a message, in milliseconds
+	constexpr size_t SampleBufferSize = 32;
+
+	struct Sample
+	{
+		uint32_t time;
+		int32_t position;
+		uint16_t sgResult;
+		uint16_t fullStepsPerSecond;
+		uint8_t driver;
+		uint8_t currentScale;
+	};
+
+	// The TMC task adds samples at the head and the main task removes them from the tail
+	static Sample samples[SampleBufferSize];
+	static volatile size_t samplesHead = 0;
+	static volatile size_t samplesTail = 0;
+
+	static uint16_t sampleIntervals[NumDrivers] = { 0 };				// the sample interval for each driver in milliseconds, or 0 if disabled
+	static uint32_t lastSampleTimes[NumDrivers];
+	static uint32_t samplesTaken = 0, samplesDropped = 0, messagesSent = 0;
+
+	static void AppendDriverConfig(size_t driver, const StringRef& reply)
+	{
+		if (sampleIntervals[driver] == 0)
+		{
+			reply.lcatf("Driver %u.%u telemetry off", CanInterface::GetCanAddress(), driver);
+		}
+		else
+		{
+			reply.lcatf("Driver %u.%u telemetry every %ums", CanInterface::GetCanAddress(), driver, sampleIntervals[driver]);
+		}
+	}
+}
+
+// Enable telemetry for the drivers in the P parameter at the sample interval in the R parameter. An interval of zero disables telemetry.
+GCodeResult DriverTelemetry::Configure(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, DriverTelemetryParams);
+	size_t numDrivers;
+	const uint8_t *drivers;
+	if (!parser.GetUint8ArrayParam('P', numDrivers, drivers))
+	{
+		for (size_t driver = 0; driver < NumDrivers; ++driver)
+		{
+			AppendDriverConfig(driver, reply);
+		}
+		return GCodeResult::ok;
+	}
+
+	for (size_t i = 0; i < numDrivers; ++i)
+	{
+		if (drivers[i] >= NumDrivers)
+		{
+			reply.printf("Driver number %u.%u out of range", CanInterface::GetCanAddress(), drivers[i]);
+			return GCodeResult::error;
+		}
+	}
+
+	uint16_t interval = DefaultSampleInterval;
+	if (parser.GetUintParam('R', interval) && interval != 0 && interval < MinSampleInterval)
+	{
+		interval = MinSampleInterval;
+	}
+
+	bool wasEnabled = false;
+	for (uint16_t si : sampleIntervals)
+	{
+		if (si != 0)
+		{
+			wasEnabled = true;
+		}
+	}
+	if (!wasEnabled)
+	{
+		samplesTaken = samplesDropped = messagesSent = 0;
+	}
+
+	for (size_t i = 0; i < numDrivers; ++i)
+	{
+		const size_t driver = drivers[i];
+		lastSampleTimes[driver] = millis() - interval;
+		sampleIntervals[driver] = interval;
+		AppendDriverConfig(driver, reply);
+	}
+	return GCodeResult::ok;
+}
+
+bool DriverTelemetry::IsEnabled(size_t driver)
+{
+	return sampleIntervals[driver] != 0;
+}
+
+// Record a sample if telemetry is enabled for this driver and it is time to take one. Called from the TMC task.
+void DriverTelemetry::AddSample(size_t driver, uint32_t drvStatus, uint32_t fullStepInterval)
+{
+	const uint32_t now = millis();
+	if (sampleIntervals[driver] == 0 || now - lastSampleTimes[driver] < sampleIntervals[driver])
+	{
+		return;
+	}
+	lastSampleTimes[driver] = now;
+
+	const size_t head = samplesHead;
+	const size_t nextHead = (head + 1) % SampleBufferSize;
+	if (nextHead == samplesTail)
+	{
+		++samplesDropped;											// the main task isn't keeping up or the CAN bus is busy
+		return;
+	}
+
+	Sample& s = samples[head];
+	s.time = now;
+	s.position = moveInstance->GetLiveDriverPosition(driver);
+	s.sgResult = drvStatus & TMC_RR_SGRESULT;
+	s.fullStepsPerSecond = (fullStepInterval == 0) ? 0 : min<uint32_t>(StepTimer::StepClockRate/fullStepInterval, 65535);
+	s.driver = driver;
+	s.currentScale = ((drvStatus & TMC_RR_CSACTUAL) >> TMC_RR_CSACTUAL_SHIFT) | (((drvStatus & TMC_RR_STST) != 0) ? CanDriverTelemetrySample::StandstillFlag : 0);
+	samplesHead = nextHead;
+	++samplesTaken;
+}
+
+// Send the samples we have collected. We wait until we can fill a message unless the oldest sample has been waiting too long.
+void DriverTelemetry::Spin()
+{
+	for (;;)
+	{
+		size_t tail = samplesTail;
+		const size_t numAvailable = (samplesHead + SampleBufferSize - tail) % SampleBufferSize;
+		if (numAvailable == 0 || (numAvailable < CanMessageDriverTelemetry::MaxSamples && millis() - samples[tail].time < MaxBatchDelay))
+		{
+			return;
+		}
+
+		CanMessageBuffer * const buf = CanMessageBuffer::Allocate();
+		if (buf == nullptr)
+		{
+			return;													// try again next time
+		}
+
+		auto msg = buf->SetupStatusMessage<CanMessageDriverTelemetry>(CanInterface::GetCanAddress(), CanId::MasterAddress);
+		msg->timeStamp = samples[tail].time;
+		msg->zero = 0;
+		msg->samplesDropped = min<uint32_t>(samplesDropped, 65535);
+		const size_t numToSend = min<size_t>(numAvailable, CanMessageDriverTelemetry::MaxSamples);
+		for (size_t i = 0; i < numToSend; ++i)
+		{
+			const Sample& s = samples[tail];
+			CanDriverTelemetrySample& ms = msg->samples[i];
+			ms.timeOffset = s.time - msg->timeStamp;
+			ms.driver = s.driver;
+			ms.currentScale = s.currentScale;
+			ms.sgResult = s.sgResult;
+			ms.fullStepsPerSecond = s.fullStepsPerSecond;
+			ms.position = s.position;
+			tail = (tail + 1) % SampleBufferSize;
+		}
+		msg->numSamples = numToSend;
+		samplesTail = tail;
+		buf->dataLength = msg->GetActualDataLength();
+		CanInterface::SendAndFree(buf);
+		++messagesSent;
+	}
+}
+
+void DriverTelemetry::Diagnostics(const StringRef& reply)
+{
+	if (samplesTaken != 0)
+	{
+		reply.lcatf("Driver telemetry: samples %" PRIu32 ", dropped %" PRIu32 ", messages %" PRIu32, samplesTaken, samplesDropped, messagesSent);
+	}
+}
+
+#endif
+
+// End
@@ -0,0 +1,32 @@
+/*
+ * DriverTelemetry.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Streaming of stepper driver load telemetry to the main board. For each selected driver we sample SG_RESULT and CS_ACTUAL from the DRV_STATUS
+ *  register along with the driver position and speed, and send the samples to the main board in batches.
+ */
+
+#ifndef SRC_MOVEMENT_STEPPERDRIVERS_DRIVERTELEMETRY_H_
+#define SRC_MOVEMENT_STEPPERDRIVERS_DRIVERTELEMETRY_H_
+
+#include "RepRapFirmware.h"
+
+#if SUPPORT_DRIVER_TELEMETRY
+
+#include "GCodes/GCodeResult.h"
+
+struct CanMessageGeneric;
+
+namespace DriverTelemetry
+{
+	GCodeResult Configure(const CanMessageGeneric& msg, const StringRef& reply);
+	bool IsEnabled(size_t driver);
+	void AddSample(size_t driver, uint32_t drvStatus, uint32_t fullStepInterval);		// called from the TMC task when DRV_STATUS has been read
+	void Spin();																		// called from the main task to send batches of samples
+	void Diagnostics(const StringRef& reply);
+}
+
+#endif
+
+#endif /* SRC_MOVEMENT_STEPPERDRIVERS_DRIVERTELEMETRY_H_ */
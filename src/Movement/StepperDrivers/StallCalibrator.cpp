@@ -0,0 +1,179 @@
+/*
+ * StallCalibrator.cpp
+ *
+ *  Created on: 18 Oct 2026
+ */
+
+#include "StallCalibrator.h"
+#include <cmath>
+
+constexpr uint32_t MinSamplesPerBand = 20;				// we don't trust the statistics of bands with fewer samples than this
+constexpr float MaxVariation = 0.25;					// bands in which the standard deviation of SG_RESULT is more than this fraction of the mean are too noisy to use
+constexpr uint32_t LowPercentile = 10;					// the percentile of the no-load SG_RESULT distribution that we keep above the safety margin
+constexpr int SafetyMargin = 128;						// how far above zero we want the low percentile of SG_RESULT to be
+constexpr int SgResultPerThresholdStep = 32;			// our estimate of how much SG_RESULT changes when the threshold changes by 1
+constexpr int MaxAdjustment = 16;						// the most we change the threshold by in one calibration
+constexpr int MinThreshold = -64, MaxThreshold = 63;
+
+const uint16_t StallCalibrator::BandLowerLimits[NumSpeedBands] = { 25, 50, 100, 200, 400, 800, 1600, 3200 };
+
+void StallCalibrator::Reset()
+{
+	for (BandData& b : bands)
+	{
+		b.numSamples = 0;
+		b.minResult = MaxSgResult;
+		b.maxResult = 0;
+		b.sum = 0;
+		b.sumOfSquares = 0;
+		for (uint16_t& h : b.histogram)
+		{
+			h = 0;
+		}
+	}
+}
+
+/*static*/ int StallCalibrator::GetSpeedBand(uint32_t fullStepsPerSecond)
+{
+	int band = -1;
+	while (band + 1 < (int)NumSpeedBands && fullStepsPerSecond >= BandLowerLimits[band + 1])
+	{
+		++band;
+	}
+	return band;
+}
+
+void StallCalibrator::AddSample(uint32_t sgResult, uint32_t fullStepsPerSecond)
+{
+	const int band = GetSpeedBand(fullStepsPerSecond);
+	if (band < 0)
+	{
+		return;
+	}
+
+	BandData& b = bands[band];
+	if (b.numSamples == UINT16_MAX)
+	{
+		return;
+	}
+
+	if (sgResult > MaxSgResult)
+	{
+		sgResult = MaxSgResult;
+	}
+	++b.numSamples;
+	if (sgResult < b.minResult)
+	{
+		b.minResult = sgResult;
+	}
+	if (sgResult > b.maxResult)
+	{
+		b.maxResult = sgResult;
+	}
+	b.sum += sgResult;
+	b.sumOfSquares += sgResult * sgResult;
+	++b.histogram[sgResult/BinWidth];
+}
+
+// Return the lower edge of the histogram bin that contains the low percentile, so we err on the low side
+uint32_t StallCalibrator::GetLowPercentileResult(size_t band) const
+{
+	const BandData& b = bands[band];
+	const uint32_t target = (b.numSamples * LowPercentile + 99)/100;
+	uint32_t count = 0;
+	for (size_t bin = 0; bin < NumHistogramBins; ++bin)
+	{
+		count += b.histogram[bin];
+		if (count >= target && count != 0)
+		{
+			return bin * BinWidth;
+		}
+	}
+	return 0;
+}
+
+// Calculate the recommended settings, returning false if we don't have enough data in any speed band.
+// The thresholds that were in use during the calibration may differ between speed bands if a table from an earlier calibration was applied.
+bool StallCalibrator::Calculate(const int8_t *currentThresholds, StallRecommendation& rec) const
+{
+	bool anyUsable = false;
+	int overall = MinThreshold;
+	int highestCurrent = MinThreshold;
+	rec.minimumStepsPerSecond = 0;
+	for (size_t band = 0; band < NumSpeedBands; ++band)
+	{
+		const BandData& b = bands[band];
+		const int currentThreshold = currentThresholds[band];
+		if (currentThreshold > highestCurrent)
+		{
+			highestCurrent = currentThreshold;
+		}
+		rec.bandUsable[band] = false;
+		rec.thresholds[band] = currentThreshold;
+		if (b.numSamples < MinSamplesPerBand)
+		{
+			continue;
+		}
+
+		const int lowResult = (int)GetLowPercentileResult(band);
+		if (lowResult != 0)
+		{
+			// SG_RESULT isn't being held at zero by too low a threshold, so we can tell whether it is steady enough to use
+			const float mean = (float)b.sum/(float)b.numSamples;
+			const float variance = (float)b.sumOfSquares/(float)b.numSamples - mean * mean;
+			if (variance > 0.0 && sqrtf(variance) > MaxVariation * mean)
+			{
+				continue;
+			}
+		}
+
+		// Work out how far to move the threshold to put the low percentile at the safety margin, rounding towards a higher threshold.
+		// If the low percentile is zero then we don't know how far below zero it would be, so this gives the largest step we allow.
+		const int shortfall = (lowResult == 0) ? MaxAdjustment * SgResultPerThresholdStep : SafetyMargin - lowResult;
+		int adjustment = (shortfall >= 0) ? (shortfall + SgResultPerThresholdStep - 1)/SgResultPerThresholdStep : -((-shortfall)/SgResultPerThresholdStep);
+		if (adjustment > MaxAdjustment)
+		{
+			adjustment = MaxAdjustment;
+		}
+		else if (adjustment < -MaxAdjustment)
+		{
+			adjustment = -MaxAdjustment;
+		}
+
+		int threshold = currentThreshold + adjustment;
+		if (threshold < MinThreshold)
+		{
+			threshold = MinThreshold;
+		}
+		else if (threshold > MaxThreshold)
+		{
+			threshold = MaxThreshold;
+		}
+
+		rec.thresholds[band] = threshold;
+		rec.bandUsable[band] = true;
+		if (!anyUsable)
+		{
+			rec.minimumStepsPerSecond = BandLowerLimits[band];
+			anyUsable = true;
+		}
+		if (threshold > overall)
+		{
+			overall = threshold;							// a higher threshold is less sensitive, so it is safe in all the bands
+		}
+	}
+
+	rec.overallThreshold = (anyUsable) ? overall : highestCurrent;
+
+	// Bands that we couldn't use get the overall threshold, so that the whole table can be used
+	for (size_t band = 0; band < NumSpeedBands; ++band)
+	{
+		if (!rec.bandUsable[band])
+		{
+			rec.thresholds[band] = rec.overallThreshold;
+		}
+	}
+	return anyUsable;
+}
+
+// End
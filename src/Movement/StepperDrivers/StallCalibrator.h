@@ -0,0 +1,70 @@
+/*
+ * StallCalibrator.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Collects the StallGuard results of a driver running without load over a range of speeds, and recommends stall detection settings.
+ *  StallGuard reports a stall when SG_RESULT reaches zero, and raising the SGT threshold raises SG_RESULT. So for each speed band we look at
+ *  the low end of the no-load SG_RESULT distribution and recommend the threshold that leaves a safety margin above zero. At low speeds
+ *  SG_RESULT is too noisy to be useful, which determines the recommended minimum speed for stall detection.
+ *  The effect of SGT on SG_RESULT depends on the motor, so the recommended threshold is an estimate. Running the calibration again
+ *  with the recommended threshold refines it.
+ *
+ *  This file doesn't depend on the hardware, so that the algorithm can be exercised on a PC using recorded data.
+ */
+
+#ifndef SRC_MOVEMENT_STEPPERDRIVERS_STALLCALIBRATOR_H_
+#define SRC_MOVEMENT_STEPPERDRIVERS_STALLCALIBRATOR_H_
+
+#include <cstdint>
+#include <cstddef>
+
+struct StallRecommendation;
+
+class StallCalibrator
+{
+public:
+	static constexpr size_t NumSpeedBands = 8;
+	static constexpr size_t NumHistogramBins = 32;
+	static constexpr uint32_t MaxSgResult = 1023;
+
+	StallCalibrator() { Reset(); }
+
+	void Reset();
+	void AddSample(uint32_t sgResult, uint32_t fullStepsPerSecond);
+	bool Calculate(const int8_t *currentThresholds, StallRecommendation& rec) const;	// currentThresholds are those in use in each band during the calibration
+
+	uint32_t GetNumSamples(size_t band) const { return bands[band].numSamples; }
+	uint32_t GetMinResult(size_t band) const { return bands[band].minResult; }
+	uint32_t GetMaxResult(size_t band) const { return bands[band].maxResult; }
+	uint32_t GetLowPercentileResult(size_t band) const;
+
+	static int GetSpeedBand(uint32_t fullStepsPerSecond);			// returns -1 if the speed is below the lowest band
+	static uint32_t GetBandLowerLimit(size_t band) { return BandLowerLimits[band]; }
+
+private:
+	static constexpr uint32_t BinWidth = (MaxSgResult + 1)/NumHistogramBins;
+	static const uint16_t BandLowerLimits[NumSpeedBands];			// in full steps per second
+
+	struct BandData
+	{
+		uint16_t numSamples;
+		uint16_t minResult;
+		uint16_t maxResult;
+		uint32_t sum;
+		uint64_t sumOfSquares;
+		uint16_t histogram[NumHistogramBins];
+	};
+
+	BandData bands[NumSpeedBands];
+};
+
+struct StallRecommendation
+{
+	int8_t thresholds[StallCalibrator::NumSpeedBands];				// the recommended threshold for each speed band
+	bool bandUsable[StallCalibrator::NumSpeedBands];				// true if StallGuard is reliable in this speed band
+	int8_t overallThreshold;										// a single threshold that is safe in all the usable speed bands
+	uint16_t minimumStepsPerSecond;									// the lowest speed at which we recommend using stall detection
+};
+
+#endif /* SRC_MOVEMENT_STEPPERDRIVERS_STALLCALIBRATOR_H_ */
@@ -15,6 +15,9 @@
 #include <Movement/Move.h>
 #include <Hardware/DmacManager.h>
 #include <General/Portability.h>
+#include "DriverTelemetry.h"
+#include "StallCalibrator.h"
+#include <Movement/HardwareStepGenerator.h>
 
 #if SAME5x || SAMC21
 
@@ -260,6 +263,13 @@ enum class DriversState : uint8_t
 
 static DriversState driversState = DriversState::noPower;
 
+#if SUPPORT_STALL_CALIBRATION
+constexpr uint8_t NoStallCalibrationDriver = 0xFF;
+static StallCalibrator stallCalibrator;
+static volatile uint8_t stallCalibrationDriver = NoStallCalibrationDriver;	// the driver whose StallGuard results we are collecting
+static volatile bool stallCalibrationResetPending = false;					// set by the main task to ask the TMC task to clear the results before collecting new ones
+#endif
+
 //----------------------------------------------------------------------------------------------------------------------------------
 // Private types and methods
 
@@ -279,6 +289,11 @@ public:
 	void AppendDriverStatus(const StringRef& reply, bool clearGlobalStats);
 	bool UpdatePending() const { return (registersToUpdate | newRegistersToUpdate) != 0; }
 	void SetStallDetectThreshold(int sgThreshold);
+	int GetStallDetectThreshold() const;
+#if SUPPORT_STALL_CALIBRATION
+	void SetStallThresholdTable(const int8_t *table);
+	void GetStallThresholds(int8_t *thresholds) const;
+#endif
 	void SetStallDetectFilter(bool sgFilter);
 	void SetStallMinimumStepsPerSecond(unsigned int stepsPerSecond);
 	void AppendStallConfig(const StringRef& reply) const;
@@ -301,6 +316,7 @@ public:
 private:
 	bool SetChopConf(uint32_t newVal);
 	void UpdateRegister(size_t regIndex, uint32_t regVal);
+	void FlagRegistersForUpdate(uint32_t regMask);
 	void UpdateChopConfRegister();							// calculate the chopper control register and flag it for sending
 	void UpdateCurrent();
 
@@ -349,6 +365,11 @@ private:
 	uint32_t configuredChopConfReg;							// the configured chopper control register, in the Enabled state, without the microstepping bits
 	uint32_t minSgLoadRegister;								// the minimum value of the StallGuard bits we read
 	uint32_t maxSgLoadRegister;								// the maximum value of the StallGuard bits we read
+#if SUPPORT_STALL_CALIBRATION
+	int8_t stallThresholdTable[StallCalibrator::NumSpeedBands];	// the stall threshold to use in each speed band
+	int8_t stallThresholdBand;								// the speed band whose threshold we last set
+	bool useStallThresholdTable;
+#endif
 
 	volatile uint32_t newRegistersToUpdate;					// bitmap of register indices whose values need to be sent to the driver chip
 	uint32_t registersToUpdate;								// bitmap of register indices whose values need to be sent to the driver chip
@@ -360,6 +381,7 @@ private:
 	uint16_t numReads, numWrites;							// how many successful reads and writes we had
 	static uint16_t numTimeouts;							// how many times a transfer timed out
 
+	uint8_t driverNumber;
 	uint8_t standstillCurrentFraction;						// divide this by 256 to get the motor current standstill fraction
 	uint8_t regIndexBeingUpdated;							// which register we are sending
 	uint8_t regIndexRequested;								// the register we asked to read in the previous transaction, or 0xFF
@@ -399,6 +421,7 @@ void TmcDriverState::Init(uint32_t p_driverNumber)
 pre(!driversPowered)
 {
 	axisNumber = p_driverNumber;										// axes are mapped straight through to drivers initially
+	driverNumber = p_driverNumber;
 	driverBit = DriversBitmap::MakeFromBits(p_driverNumber);
 	enabled = false;
 	registersToUpdate = newRegistersToUpdate = 0;
@@ -416,6 +439,12 @@ pre(!driversPowered)
 	UpdateRegister(WriteTpwmthrs, DefaultTpwmthrsReg);
 	UpdateRegister(WriteThigh, DefaultThighReg);
 	configuredChopConfReg = DefaultChopConfReg;
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	if (HardwareStepGenerator::IsHardwareStepped(p_driverNumber))
+	{
+		configuredChopConfReg |= CHOPCONF_DEDGE;						// the hardware step generator toggles the step pin once per step
+	}
+#endif
 	SetMicrostepping(DefaultMicrosteppingShift, DefaultInterpolation);	// this also updates the chopper control register
 	SetStallDetectThreshold(DefaultStallDetectThreshold);				// this also updates the CoolConf register
 	SetStallMinimumStepsPerSecond(DefaultMinimumStepsPerSecond);
@@ -428,13 +457,23 @@ pre(!driversPowered)
 
 	regIndexBeingUpdated = regIndexRequested = previousRegIndexRequested = NoRegIndex;
 	numReads = numWrites = 0;
+#if SUPPORT_STALL_CALIBRATION
+	useStallThresholdTable = false;
+#endif
 }
 
 // Set a register value and flag it for updating
 void TmcDriverState::UpdateRegister(size_t regIndex, uint32_t regVal)
 {
 	writeRegisters[regIndex] = regVal;
-	newRegistersToUpdate |= (1u << regIndex);							// flag it for sending
+	FlagRegistersForUpdate(1u << regIndex);							// flag it for sending
+}
+
+// Flag registers for sending. The TMC task changes the stall threshold as well as the main task changing the configuration, so this must be atomic.
+void TmcDriverState::FlagRegistersForUpdate(uint32_t regMask)
+{
+	TaskCriticalSectionLocker lock;
+	newRegistersToUpdate |= regMask;
 }
 
 // Calculate the chopper control register and flag it for sending
@@ -446,10 +485,52 @@ void TmcDriverState::UpdateChopConfRegister()
 void TmcDriverState::SetStallDetectThreshold(int sgThreshold)
 {
 	const uint32_t sgVal = ((uint32_t)constrain<int>(sgThreshold, -64, 63)) & 127u;
+	TaskCriticalSectionLocker lock;										// the TMC task calls this when using a table of thresholds
 	writeRegisters[WriteCoolConf] = (writeRegisters[WriteCoolConf] & ~COOLCONF_SGT_MASK) | (sgVal << COOLCONF_SGT_SHIFT);
 	newRegistersToUpdate |= 1u << WriteCoolConf;
 }
 
+int TmcDriverState::GetStallDetectThreshold() const
+{
+	const int threshold = (int)((writeRegisters[WriteCoolConf] & COOLCONF_SGT_MASK) >> COOLCONF_SGT_SHIFT);
+	return (threshold >= 64) ? threshold - 128 : threshold;
+}
+
+#if SUPPORT_STALL_CALIBRATION
+
+// Set a table of stall thresholds to use in each speed band, or stop using the table if 'table' is null
+void TmcDriverState::SetStallThresholdTable(const int8_t *table)
+{
+	if (table == nullptr)
+	{
+		useStallThresholdTable = false;
+	}
+	else
+	{
+		memcpy(stallThresholdTable, table, sizeof(stallThresholdTable));
+		stallThresholdBand = -1;								// make sure we set the threshold next time we read the status
+		useStallThresholdTable = true;
+	}
+}
+
+// Get the stall threshold in use in each speed band
+void TmcDriverState::GetStallThresholds(int8_t *thresholds) const
+{
+	if (useStallThresholdTable)
+	{
+		memcpy(thresholds, stallThresholdTable, sizeof(stallThresholdTable));
+	}
+	else
+	{
+		for (size_t band = 0; band < StallCalibrator::NumSpeedBands; ++band)
+		{
+			thresholds[band] = GetStallDetectThreshold();
+		}
+	}
+}
+
+#endif
+
 inline void TmcDriverState::SetAxisNumber(size_t p_axisNumber)
 {
 	axisNumber = p_axisNumber;
@@ -458,7 +539,7 @@ inline void TmcDriverState::SetAxisNumber(size_t p_axisNumber)
 // Write all registers. This is called when the drivers are known to be powered up.
 inline void TmcDriverState::WriteAll()
 {
-	newRegistersToUpdate = (1u << NumWriteRegisters) - 1;
+	FlagRegistersForUpdate((1u << NumWriteRegisters) - 1);
 }
 
 float TmcDriverState::GetStandstillCurrentPercent() const
@@ -761,6 +842,7 @@ void TmcDriverState::AppendDriverStatus(const StringRef& reply, bool clearGlobal
 
 void TmcDriverState::SetStallDetectFilter(bool sgFilter)
 {
+	TaskCriticalSectionLocker lock;										// the TMC task may be changing the stall threshold in the same register
 	if (sgFilter)
 	{
 		writeRegisters[WriteCoolConf] |= COOLCONF_SGFILT;
@@ -780,13 +862,18 @@ void TmcDriverState::SetStallMinimumStepsPerSecond(unsigned int stepsPerSecond)
 void TmcDriverState::AppendStallConfig(const StringRef& reply) const
 {
 	const bool filtered = ((writeRegisters[WriteCoolConf] & COOLCONF_SGFILT) != 0);
-	int threshold = (int)((writeRegisters[WriteCoolConf] & COOLCONF_SGT_MASK) >> COOLCONF_SGT_SHIFT);
-	if (threshold >= 64)
+	reply.catf("stall threshold %d, filter %s, steps/sec %" PRIu32 ", coolstep %" PRIx32,
+				GetStallDetectThreshold(), ((filtered) ? "on" : "off"), 12000000 / (256 * writeRegisters[WriteTcoolthrs]), writeRegisters[WriteCoolConf] & 0xFFFF);
+#if SUPPORT_STALL_CALIBRATION
+	if (useStallThresholdTable)
 	{
-		threshold -= 128;
+		reply.cat(", speed-dependent thresholds");
+		for (int8_t t : stallThresholdTable)
+		{
+			reply.catf(" %d", t);
+		}
 	}
-	reply.catf("stall threshold %d, filter %s, steps/sec %" PRIu32 ", coolstep %" PRIx32,
-				threshold, ((filtered) ? "on" : "off"), 12000000 / (256 * writeRegisters[WriteTcoolthrs]), writeRegisters[WriteCoolConf] & 0xFFFF);
+#endif
 }
 
 void TmcDriverState::GetSpiCommand(uint8_t *sendDataBlock)
@@ -864,6 +951,29 @@ void TmcDriverState::TransferSucceeded(const uint8_t *rcvDataBlock)
 				}
 			}
 
+#if SUPPORT_STALL_CALIBRATION
+			if (driverNumber == stallCalibrationDriver && (regVal & TMC_RR_STST) == 0 && interval != 0)
+			{
+				TaskCriticalSectionLocker lock;									// stop the main task stopping the calibration and reading the results part way through
+				if (stallCalibrationResetPending)
+				{
+					stallCalibrator.Reset();
+					stallCalibrationResetPending = false;
+				}
+				if (driverNumber == stallCalibrationDriver)
+				{
+					stallCalibrator.AddSample(regVal & TMC_RR_SGRESULT, StepTimer::StepClockRate/interval);
+				}
+			}
+#endif
+
+#if SUPPORT_DRIVER_TELEMETRY
+			if (DriverTelemetry::IsEnabled(driverNumber))
+			{
+				DriverTelemetry::AddSample(driverNumber, regVal, interval);
+			}
+#endif
+
 			// Only add bits to the accumulator if they appear in 2 successive samples. This is to avoid seeing transient S2G, S2VS, STST and open load errors.
 			const uint32_t oldDrvStat = readRegisters[ReadDrvStat];
 			readRegisters[ReadDrvStat] = regVal;
@@ -890,6 +1000,19 @@ void TmcDriverState::TransferSucceeded(const uint8_t *rcvDataBlock)
 		readRegisters[ReadDrvStat] &= ~TMC_RR_SG;
 	}
 
+#if SUPPORT_STALL_CALIBRATION
+	// If we have a table of stall thresholds, use the one for the current speed
+	if (useStallThresholdTable)
+	{
+		const int speedBand = (interval == 0) ? 0 : max<int>(StallCalibrator::GetSpeedBand(StepTimer::StepClockRate/interval), 0);
+		if (speedBand != stallThresholdBand)
+		{
+			stallThresholdBand = speedBand;
+			SetStallDetectThreshold(stallThresholdTable[speedBand]);
+		}
+	}
+#endif
+
 	previousRegIndexRequested = (regIndexBeingUpdated == NoRegIndex) ? regIndexRequested : NoRegIndex;
 }
 
@@ -1456,10 +1579,70 @@ void SmartDrivers::SetStallThreshold(size_t driver, int sgThreshold)
 {
 	if (driver < numTmc51xxDrivers)
 	{
+#if SUPPORT_STALL_CALIBRATION
+		driverStates[driver].SetStallThresholdTable(nullptr);			// an explicit threshold replaces any speed-dependent thresholds
+#endif
 		driverStates[driver].SetStallDetectThreshold(sgThreshold);
 	}
 }
 
+int SmartDrivers::GetStallThreshold(size_t driver)
+{
+	return (driver < numTmc51xxDrivers) ? driverStates[driver].GetStallDetectThreshold() : 0;
+}
+
+#if SUPPORT_STALL_CALIBRATION
+
+// Start collecting the StallGuard results of a driver. Only one driver can be calibrated at a time.
+// The TMC task adds the results, so we ask it to clear the old ones before it adds the first new one.
+void SmartDrivers::StartStallCalibration(size_t driver)
+{
+	TaskCriticalSectionLocker lock;
+	stallCalibrationResetPending = true;
+	stallCalibrationDriver = driver;
+}
+
+// Stop collecting StallGuard results and return the calibrator so that the caller can examine them
+const StallCalibrator& SmartDrivers::StopStallCalibration()
+{
+	TaskCriticalSectionLocker lock;
+	stallCalibrationDriver = NoStallCalibrationDriver;
+	if (stallCalibrationResetPending)
+	{
+		// The TMC task didn't get any results, so it didn't clear the old ones. It can't be using the calibrator now, so we can clear them here.
+		stallCalibrator.Reset();
+		stallCalibrationResetPending = false;
+	}
+	return stallCalibrator;
+}
+
+bool SmartDrivers::IsCalibratingStall(size_t driver)
+{
+	return stallCalibrationDriver == driver;
+}
+
+void SmartDrivers::SetStallThresholdTable(size_t driver, const int8_t *table)
+{
+	if (driver < numTmc51xxDrivers)
+	{
+		driverStates[driver].SetStallThresholdTable(table);
+	}
+}
+
+void SmartDrivers::GetStallThresholds(size_t driver, int8_t *thresholds)
+{
+	if (driver < numTmc51xxDrivers)
+	{
+		driverStates[driver].GetStallThresholds(thresholds);
+	}
+	else
+	{
+		memset(thresholds, 0, StallCalibrator::NumSpeedBands);
+	}
+}
+
+#endif
+
 void SmartDrivers::SetStallFilter(size_t driver, bool sgFilter)
 {
 	if (driver < numTmc51xxDrivers)
@@ -14,6 +14,8 @@
 
 #include "DriverMode.h"
 
+class StallCalibrator;
+
 // TMC51xx DRV_STATUS register bit assignments
 const uint32_t TMC_RR_SG = 1 << 24;					// stall detected
 const uint32_t TMC_RR_OT = 1 << 25;					// over temperature shutdown
@@ -23,6 +25,8 @@ const uint32_t TMC_RR_OLA = 1 << 29;				// open load A
 const uint32_t TMC_RR_OLB = 1 << 30;				// open load B
 const uint32_t TMC_RR_STST = 1 << 31;				// standstill detected
 const uint32_t TMC_RR_SGRESULT = 0x3FF;				// 10-bit stallGuard2 result
+const uint32_t TMC_RR_CSACTUAL_SHIFT = 16;
+const uint32_t TMC_RR_CSACTUAL = 31 << TMC_RR_CSACTUAL_SHIFT;	// actual motor current scaling, 0 to 31
 
 namespace SmartDrivers
 {
@@ -41,6 +45,14 @@ namespace SmartDrivers
 	bool SetDriverMode(size_t driver, unsigned int mode);
 	DriverMode GetDriverMode(size_t driver);
 	void SetStallThreshold(size_t driver, int sgThreshold);
+	int GetStallThreshold(size_t driver);
+#if SUPPORT_STALL_CALIBRATION
+	void StartStallCalibration(size_t driver);
+	const StallCalibrator& StopStallCalibration();
+	bool IsCalibratingStall(size_t driver);
+	void SetStallThresholdTable(size_t driver, const int8_t *table);
+	void GetStallThresholds(size_t driver, int8_t *thresholds);
+#endif
 	void SetStallFilter(size_t driver, bool sgFilter);
 	void SetStallMinimumStepsPerSecond(size_t driver, unsigned int stepsPerSecond);
 	void AppendStallConfig(size_t driver, const StringRef& reply);
@@ -14,17 +14,30 @@
 #include <Movement/Move.h>
 #include "Movement/StepperDrivers/TMC51xx.h"
 #include "Movement/StepperDrivers/TMC22xx.h"
+#include "Movement/StepperDrivers/DriverTelemetry.h"
 #include <atmel_start.h>
 #include <Config/peripheral_clk_config.h>
 #include "AdcAveragingFilter.h"
 #include "Movement/StepTimer.h"
+#include "Movement/HardwareStepGenerator.h"
+#include "Movement/SlowDriverTiming.h"
 #include <CAN/CanInterface.h>
 #include "Tasks.h"
 #include "Heating/Heat.h"
 #include "Heating/Sensors/TemperatureSensor.h"
 #include "Fans/FansManager.h"
+#include "Fans/HardwareTacho.h"
+#include "GPIO/GpioPorts.h"
+#include "InputMonitors/InputMonitor.h"
+#include "EventLog.h"
+#include "FirmwareUpdater.h"
 #include <CanMessageFormats.h>
 
+#if SUPPORT_POWER_FAIL_DETECTION
+# include <CanMessageGenericParser.h>
+# include <CAN/CanPowerFailMessages.h>
+#endif
+
 #if SUPPORT_CLOSED_LOOP
 # include <ClosedLoop/ClockGen.h>
 # include <ClosedLoop/QuadratureDecoder.h>
@@ -81,7 +94,10 @@ enum class DeferredCommand : uint8_t
 	firmwareUpdate,
 	reset,
 	testWatchdog,
-	testDivideByZero
+	testDivideByZero,
+#if SAME5x
+	bankSwap
+#endif
 };
 
 static volatile DeferredCommand deferredCommand = DeferredCommand::none;
@@ -90,8 +106,6 @@ static bool deliberateError = false;
 
 namespace Platform
 {
-	static constexpr float DefaultStepsPerMm = 80.0;
-
 	Mutex messageMutex;
 
 	static uint32_t errorCodeBits = 0;
@@ -113,6 +127,8 @@ namespace Platform
 # else
 	DriversBitmap slowDriversBitmap;
 # endif
+	uint32_t pendingDirectionDrivers = 0;						// bitmap of slow drivers whose direction change we deferred
+	static uint32_t pendingDirectionLevels = 0;					// the levels to set the direction pins of those drivers to
 #endif
 
 #if !SINGLE_DRIVER
@@ -219,6 +235,61 @@ namespace Platform
 
 #endif
 
+#if SUPPORT_POWER_FAIL_DETECTION
+
+	// Power fail detection. The ADC interrupt compares every raw VIN and V12 reading with the thresholds, so that we freeze the steps within one ADC sequence
+	// of the supply failing instead of waiting for Spin to see the averaged readings fall. Once triggered, the detection stays latched until we are reset.
+	constexpr float PowerFailV12Threshold = 10.0;				// V12 below this is too low for the drivers, the same as the under-voltage threshold in Spin
+	constexpr float PowerFailArmMargin = 0.5;					// VIN must be this far above the threshold before we arm the detection
+
+	static float powerFailThreshold = 0.0;						// the VIN threshold set by the main board, or 0 if power fail detection is disabled
+	static bool powerFailArmed = false;
+	static bool powerFailLogged = false;
+	static volatile bool powerFailDetected = false;
+	static volatile bool powerFailReportPending = false;
+	static volatile uint8_t powerFailCause = 0;
+	static volatile uint32_t whenPowerFailed;					// the step clock time of the reading that fell below the threshold
+	static int32_t powerFailPositions[NumDrivers];				// the driver positions after we froze the steps
+	static_assert(NumDrivers <= CanMessagePowerFailEvent::MaxDrivers, "Too many drivers for the power fail message");
+
+	// Called from the ADC DMA interrupt when a monitored supply crosses its threshold
+	static void PowerFailCallback(CallbackParameter cp, bool state, uint32_t whenChanged)
+	{
+		if (!state && !powerFailDetected)
+		{
+			moveInstance->FreezeForPowerFail(powerFailPositions);
+			whenPowerFailed = whenChanged;
+			powerFailCause = (uint8_t)cp.u32;
+			powerFailDetected = true;
+			powerFailReportPending = true;
+			CanInterface::WakeAsyncSenderFromIsr();
+		}
+	}
+
+	static void SetPowerFailDetection(bool arm)
+	{
+		if (arm)
+		{
+			// The state changes when the reading falls below the lower threshold. We don't re-arm after a power failure, so we don't need any hysteresis.
+			const uint16_t vinThreshold = PowerVoltageToAdcReading(powerFailThreshold);
+			(void)AnalogIn::SetThresholdCallback(VinMonitorPin, PowerFailCallback, CallbackParameter(CanMessagePowerFailEvent::CauseVin), vinThreshold, vinThreshold, true, false);
+# if HAS_12V_MONITOR
+			const uint16_t v12Threshold = (uint16_t)(PowerFailV12Threshold * ((1u << AnalogIn::AdcBits)/V12MonitorVoltageRange));
+			(void)AnalogIn::SetThresholdCallback(V12MonitorPin, PowerFailCallback, CallbackParameter(CanMessagePowerFailEvent::CauseV12), v12Threshold, v12Threshold, true, false);
+# endif
+		}
+		else
+		{
+			(void)AnalogIn::SetThresholdCallback(VinMonitorPin, nullptr, CallbackParameter(), 0, 0, false, false);
+# if HAS_12V_MONITOR
+			(void)AnalogIn::SetThresholdCallback(V12MonitorPin, nullptr, CallbackParameter(), 0, 0, false, false);
+# endif
+		}
+		powerFailArmed = arm;
+	}
+
+#endif
+
 #if HAS_SMART_DRIVERS
 	static void UpdateMotorCurrent(size_t driver)
 	{
@@ -369,6 +440,17 @@ namespace Platform
 		ResetProcessor();
 	}
 
+#if SAME5x
+	// Swap the flash banks and reset. Execute this from RAM because the bank we are executing from is about to be unmapped.
+	[[noreturn]] RAMFUNC static void SwapBanksAndReset()
+	{
+		while (!hri_nvmctrl_get_STATUS_READY_bit(NVMCTRL)) { }
+		hri_nvmctrl_write_CTRLB_reg(NVMCTRL, NVMCTRL_CTRLB_CMD_BKSWRST | NVMCTRL_CTRLB_CMDEX_KEY);
+		while (!hri_nvmctrl_get_STATUS_READY_bit(NVMCTRL)) { }
+		ResetProcessor();									// we only get here if the bank swap command didn't reset the processor
+	}
+#endif
+
 	static void ShutdownAll()
 	{
 #if SUPPORT_TMC51xx
@@ -419,6 +501,16 @@ namespace Platform
 		EraseAndReset();
 	}
 
+#if SAME5x
+	[[noreturn]] static void DoBankSwap()
+	{
+		ShutdownAll();
+		__disable_irq();
+		SysTick->CTRL = (1 << SysTick_CTRL_CLKSOURCE_Pos);	// disable the system tick exception
+		SwapBanksAndReset();
+	}
+#endif
+
 	static void SetupThermistorFilter(Pin pin, size_t filterIndex, bool useAlternateAdc)
 	{
 		thermistorFilters[filterIndex].Init(0);
@@ -429,12 +521,11 @@ namespace Platform
 
 void Platform::SoftwareReset(uint16_t reason, const uint32_t *stk)
 {
+	// stk[1] is the stacked program counter when we were called from a fault handler
 #if SAME5x
-	//TODO save reset data in NVM
-	//	qq;
+	EventLog::RecordImmediate(EventLogType::softwareReset, reason, (stk != nullptr) ? stk[1] : 0, SCB->CFSR);
 #elif SAMC21
-	//TODO save reset data in NVM
-	//	qq;
+	EventLog::RecordImmediate(EventLogType::softwareReset, reason, (stk != nullptr) ? stk[1] : 0, 0);		// the Cortex M0+ doesn't have a CFSR
 #else
 # error Unsupported processor
 #endif
@@ -509,6 +600,9 @@ void Platform::Init()
 	AnalogIn::Init();
 	AnalogOut::Init();
 	InitialisePinChangeInterrupts();
+#if SUPPORT_HARDWARE_TACHO
+	HardwareTacho::Init();
+#endif
 
 #if SAME5x
 	ADC_temperature_init();
@@ -624,7 +718,12 @@ void Platform::Init()
 		driverIsEnabled[i] = false;
 #endif
 #if !SINGLE_DRIVER
+# if SUPPORT_HARDWARE_STEP_GENERATION
+		// The step ISR mustn't touch the step pin of the driver that the hardware steps
+		const uint32_t driverBit = (HardwareStepGenerator::IsHardwareStepped(i)) ? 0 : 1u << (StepPins[i] & 31);
+# else
 		const uint32_t driverBit = 1u << (StepPins[i] & 31);
+# endif
 		driveDriverBits[i] = driverBit;
 		allDriverBits |= driverBit;
 #endif
@@ -701,6 +800,12 @@ void Platform::Init()
 
 	InitialiseInterrupts();
 
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	HardwareStepGenerator::Init();								// this needs the step timer to have been initialised
+#endif
+
+	GpioPorts::Init();
+
 	// Read the unique ID
 	for (unsigned int i = 0; i < 4; ++i)
 	{
@@ -712,6 +817,11 @@ void Platform::Init()
 	uniqueId[4] = uniqueId[0] ^ uniqueId[1] ^ uniqueId[2] ^ uniqueId[3];
 	uniqueId[4] ^= (uniqueId[4] >> 10);
 
+	EventLog::Init();
+#if SAME5x
+	FirmwareUpdater::Init();
+#endif
+
 	lastPollTime = millis();
 }
 
@@ -743,6 +853,12 @@ void Platform::Spin()
 			(void)Tasks::DoDivide(1, 0);
 			break;
 
+#if SAME5x
+		case DeferredCommand::bankSwap:
+			DoBankSwap();
+			break;
+#endif
+
 		default:
 			break;
 		}
@@ -766,6 +882,7 @@ void Platform::Spin()
 	{
 		powered = false;
 		++numUnderVoltageEvents;
+		EventLog::Record(EventLogType::underVoltage, currentVin, currentV12);
 	}
 #elif HAS_VOLTAGE_MONITOR
 
@@ -776,6 +893,24 @@ void Platform::Spin()
 	else if (powered && voltsVin < 10.0)
 	{
 		powered = false;
+		EventLog::Record(EventLogType::underVoltage, currentVin);
+	}
+#endif
+
+#if SUPPORT_POWER_FAIL_DETECTION
+	// Arm the power fail detection once VIN is comfortably above the threshold, so that it doesn't trigger while the supply is coming up
+	if (!powerFailArmed && !powerFailDetected && powerFailThreshold > 0.0 && powered && voltsVin >= powerFailThreshold + PowerFailArmMargin)
+	{
+		SetPowerFailDetection(true);
+	}
+	else if (powerFailDetected && !powerFailLogged)
+	{
+		powerFailLogged = true;
+# if HAS_12V_MONITOR
+		EventLog::Record(EventLogType::powerFail, powerFailCause, currentVin, currentV12);
+# else
+		EventLog::Record(EventLogType::powerFail, powerFailCause, currentVin);
+# endif
 	}
 #endif
 
@@ -783,6 +918,18 @@ void Platform::Spin()
 	SmartDrivers::Spin(powered);
 #endif
 
+#if SUPPORT_DRIVER_TELEMETRY
+	DriverTelemetry::Spin();
+#endif
+
+#if SUPPORT_HARDWARE_STEP_GENERATION
+	HardwareStepGenerator::Spin();
+#endif
+
+	EventLog::Spin();
+	CanInterface::Spin();
+	GpioPorts::Spin();
+
 	// Thermostatically-controlled fans (do this after getting TMC driver status)
 	const uint32_t now = millis();
 	const bool checkSensors = (now - lastFanCheckTime >= FanCheckInterval);
@@ -798,14 +945,26 @@ void Platform::Spin()
 			const DriversBitmap mask = DriversBitmap::MakeFromBits(nextDriveToPoll);
 			if (stat & TMC_RR_OT)
 			{
+				if (temperatureShutdownDrivers.Disjoint(mask))
+				{
+					EventLog::Record(EventLogType::driverOverTemperature, mask.GetRaw(), 1);
+				}
 				temperatureShutdownDrivers |= mask;
 			}
 			else if (stat & TMC_RR_OTPW)
 			{
+				if (temperatureWarningDrivers.Disjoint(mask))
+				{
+					EventLog::Record(EventLogType::driverOverTemperature, mask.GetRaw(), 0);
+				}
 				temperatureWarningDrivers |= mask;
 			}
 			if (stat & TMC_RR_S2G)
 			{
+				if (shortToGroundDrivers.Disjoint(mask))
+				{
+					EventLog::Record(EventLogType::driverShortToGround, mask.GetRaw());
+				}
 				shortToGroundDrivers |= mask;
 			}
 			else
@@ -858,7 +1017,8 @@ void Platform::Spin()
 			{
 				if (stalledDrivers.Disjoint(mask))
 				{
-					// This stall is new so check whether we need to perform some action in response to the stall
+					// This stall is new so log it and check whether we need to perform some action in response to the stall
+					EventLog::Record(EventLogType::driverStall, mask.GetRaw());
 					if (rehomeOnStallDrivers.Intersects(mask))
 					{
 						stalledDriversToRehome |= mask;
@@ -1082,6 +1242,7 @@ uint32_t Platform::GetHeatTaskIdleTicks()
 
 void Platform::HandleHeaterFault(unsigned int heater)
 {
+	EventLog::Record(EventLogType::heaterFault, heater);
 	//TODO report the heater fault to the main board
 }
 
@@ -1218,7 +1379,23 @@ void Platform::SetDirection(size_t driver, bool direction)
 # endif
 		if (isSlowDriver)
 		{
-			while (StepTimer::GetTimerTicks() - DDA::lastStepLowTime < GetSlowDriverDirHoldClocks()) { }
+			// Some external drivers don't like the direction being changed before the end of the step pulse
+			if (DDA::IsSlowDriverStepPulseActive())
+			{
+				DDA::EndSlowDriverStepPulse();
+			}
+
+			// If the direction hold time hasn't passed, leave the step interrupt to change the direction after it has calculated the step times,
+			// or in a later interrupt if the hold time is long, instead of waiting here
+			const uint32_t driverBit = 1u << driver;
+			if (SlowDriverTiming::GetRemainingTime(StepTimer::GetTimerTicks(), DDA::lastStepLowTime, GetSlowDriverDirHoldClocks()) != 0)
+			{
+				pendingDirectionDrivers |= driverBit;
+				pendingDirectionLevels = (d) ? pendingDirectionLevels | driverBit : pendingDirectionLevels & ~driverBit;
+				DDA::DeferSlowDriverDirectionChange(DDA::lastStepLowTime + GetSlowDriverDirHoldClocks());
+				return;
+			}
+			pendingDirectionDrivers &= ~driverBit;
 		}
 #endif
 		digitalWrite(DirectionPins[driver], d);
@@ -1231,6 +1408,24 @@ void Platform::SetDirection(size_t driver, bool direction)
 	}
 }
 
+#if SUPPORT_SLOW_DRIVERS
+
+// Make the direction changes that SetDirection deferred. Called from the step ISR once the direction hold time has passed.
+void Platform::ApplyPendingDirectionChanges()
+{
+	for (size_t driver = 0; driver < NumDrivers; ++driver)
+	{
+		if (pendingDirectionDrivers & (1u << driver))
+		{
+			digitalWrite(DirectionPins[driver], (pendingDirectionLevels & (1u << driver)) != 0);
+		}
+	}
+	pendingDirectionDrivers = 0;
+	DDA::lastDirChangeTime = StepTimer::GetTimerTicks();
+}
+
+#endif
+
 // The following don't do anything yet
 void Platform::SetEnableValue(size_t driver, int8_t eVal)
 {
@@ -1401,6 +1596,9 @@ float Platform::GetTmcDriversTemperature()
 void Platform::Tick()
 {
 	++heatTaskIdleTicks;
+#if SUPPORT_INPUT_SCANNER
+	InputMonitor::ScanInputs();
+#endif
 }
 
 void Platform::StartFirmwareUpdate()
@@ -1415,6 +1613,16 @@ void Platform::StartReset()
 	deferredCommand = DeferredCommand::reset;
 }
 
+#if SAME5x
+
+void Platform::StartBankSwap()
+{
+	whenDeferredCommandRequested = millis();
+	deferredCommand = DeferredCommand::bankSwap;
+}
+
+#endif
+
 [[noreturn]] void Platform::EmergencyStop()
 {
 	ShutdownAndReset();
@@ -1445,6 +1653,10 @@ GCodeResult Platform::DoDiagnosticTest(const CanMessageDiagnosticTest& msg, cons
 		deferredCommand = DeferredCommand::testDivideByZero;
 		return GCodeResult::ok;
 
+	case 1010:	// clear the event log
+		EventLog::Clear();
+		return GCodeResult::ok;
+
 	default:
 		reply.printf("Unknown test type %u", msg.testType);
 		return GCodeResult::error;
@@ -1452,6 +1664,65 @@ GCodeResult Platform::DoDiagnosticTest(const CanMessageDiagnosticTest& msg, cons
 }
 
 
+#if SUPPORT_POWER_FAIL_DETECTION
+
+// Handle the power fail configuration sent by the main board when it processes M911.
+// S is the VIN voltage below which we freeze the steps and report a power failure, or 0 to disable power fail detection.
+GCodeResult Platform::ConfigurePowerFail(const CanMessageGeneric& msg, const StringRef& reply)
+{
+	CanMessageGenericParser parser(msg, PowerFailParams);
+	float threshold;
+	if (parser.GetFloatParam('S', threshold))
+	{
+		if (threshold < 0.0 || threshold >= VinMonitorVoltageRange)
+		{
+			reply.printf("Power fail threshold must be less than %.1fV", (double)VinMonitorVoltageRange);
+			return GCodeResult::error;
+		}
+		if (powerFailArmed)
+		{
+			SetPowerFailDetection(false);						// Spin arms it again with the new threshold
+		}
+		powerFailThreshold = threshold;
+	}
+
+	if (powerFailDetected)
+	{
+		reply.printf("Board %u detected a power failure and froze the steps", CanInterface::GetCanAddress());
+	}
+	else if (powerFailThreshold <= 0.0)
+	{
+		reply.printf("Board %u power fail detection is disabled", CanInterface::GetCanAddress());
+	}
+	else
+	{
+		reply.printf("Board %u power fail threshold %.1fV, %s", CanInterface::GetCanAddress(), (double)powerFailThreshold, (powerFailArmed) ? "armed" : "waiting for VIN to rise");
+	}
+	return GCodeResult::ok;
+}
+
+// If we have detected a power failure that we haven't reported yet, fill in the message and return true. Called by the CAN async sender task.
+bool Platform::GetPowerFailReport(CanMessagePowerFailEvent& msg)
+{
+	if (!powerFailReportPending)
+	{
+		return false;
+	}
+
+	powerFailReportPending = false;
+	msg.whenDetected = StepTimer::ConvertToMasterTime(whenPowerFailed);
+	msg.cause = powerFailCause;
+	msg.numDrivers = NumDrivers;
+	msg.zero = 0;
+	for (size_t driver = 0; driver < NumDrivers; ++driver)
+	{
+		msg.positions[driver] = powerFailPositions[driver];
+	}
+	return true;
+}
+
+#endif
+
 #if HAS_VOLTAGE_MONITOR
 
 float Platform::GetMinVinVoltage()
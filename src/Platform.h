@@ -17,6 +17,8 @@
 #endif
 
 class CanMessageDiagnosticTest;
+struct CanMessageGeneric;
+struct CanMessagePowerFailEvent;
 
 // Define the number of temperature readings we average for each thermistor. This should be a power of 2 and at least 4 ^ AD_OVERSAMPLE_BITS.
 constexpr size_t ThermistorReadingsAveraged = 64;
@@ -64,6 +66,8 @@ class IoPort;
 
 namespace Platform
 {
+	constexpr float DefaultStepsPerMm = 80.0;
+
 	// The data would ideally be private, but they are used by inline functions so they can't be unless we convert this namespace to a static class
 #if SINGLE_DRIVER
 	constexpr uint32_t DriverBit = 1u << (StepPins[0] & 31);
@@ -83,6 +87,11 @@ namespace Platform
 
 	void SetDriverStepTiming(size_t drive, const float timings[4]);
 
+	// Direction changes to slow drivers that SetDirection deferred because the direction hold time after the last step pulse hadn't passed
+	extern uint32_t pendingDirectionDrivers;
+	inline bool HasPendingDirectionChanges() { return pendingDirectionDrivers != 0; }
+	void ApplyPendingDirectionChanges();
+
 # if SINGLE_DRIVER
 	extern bool isSlowDriver;
 	inline bool IsSlowDriver() { return isSlowDriver; }
@@ -204,6 +213,9 @@ namespace Platform
 
 	void StartFirmwareUpdate();
 	void StartReset();
+#if SAME5x
+	void StartBankSwap();
+#endif
 
 	void OnProcessingCanMessage();
 
@@ -229,6 +241,11 @@ namespace Platform
 	float GetCurrentV12Voltage();
 	float GetMaxV12Voltage();
 #endif
+
+#if SUPPORT_POWER_FAIL_DETECTION
+	GCodeResult ConfigurePowerFail(const CanMessageGeneric& msg, const StringRef& reply);
+	bool GetPowerFailReport(CanMessagePowerFailEvent& msg);
+#endif
 }
 
 #endif /* SRC_PLATFORM_H_ */
@@ -358,11 +358,13 @@ namespace TaskPriority
 	static constexpr int TmcPriority = 2;
 	static constexpr int AinPriority = 2;
 	static constexpr int HeightFollowingPriority = 2;
+	static constexpr int FirmwareUpdatePriority = 2;
 	static constexpr int DueXPriority = 3;
 	static constexpr int LaserPriority = 3;
 	static constexpr int CanSenderPriority = 3;
 	static constexpr int CanReceiverPriority = 3;
 	static constexpr int CanAsyncSenderPriority = 4;
+	static constexpr int StepCalcPriority = 4;
 }
 
 #endif /* SRC_REPRAPFIRMWARE_H_ */
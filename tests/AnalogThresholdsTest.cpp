@@ -0,0 +1,138 @@
+/*
+ * AnalogThresholdsTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Feeds synthetic waveforms through AnalogThresholds, sampled the way the ADC DMA sequence samples them, and checks that every threshold
+ *  crossing is detected once, that hysteresis suppresses chatter on a noisy slow signal, and that the time stamp of a crossing is never
+ *  later than one conversion cycle after the true crossing.
+ */
+
+#include "AnalogThresholds.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Times are in step clocks (750kHz). numChannels readings are converted back to back taking conversionTicks each, and the next sequence starts gapTicks later.
+constexpr double StepClocksPerMicrosecond = 0.75;
+constexpr int NumChannels = 8;
+constexpr double ConversionTicks = 128;
+constexpr double GapTicks = 1500;
+constexpr double CycleTicks = ConversionTicks * NumChannels + GapTicks;
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+struct RunResult
+{
+	int detections = 0;
+	double maxStampError = 0;						// the largest difference between the time stamp and the time the reading was taken
+	double maxLatency = 0;							// the largest delay from the true crossing to the time stamp
+};
+
+static RunResult Run(std::function<double(double)> signal, const std::vector<double>& crossings, int channel, uint16_t lower, uint16_t upper, double duration)
+{
+	AnalogThresholds thresholds;
+	thresholds.Enable(channel, lower, upper, signal(0) >= upper);
+
+	RunResult result;
+	size_t nextCrossing = 0;
+	for (double t = 0; t + ConversionTicks * NumChannels < duration; t += CycleTicks)
+	{
+		uint16_t readings[NumChannels];
+		double sampleTimes[NumChannels];
+		for (int i = 0; i < NumChannels; ++i)
+		{
+			sampleTimes[i] = t + ConversionTicks * (i + 1);
+			readings[i] = (uint16_t)std::max(0.0, std::min(65535.0, signal(sampleTimes[i])));
+		}
+
+		if ((thresholds.Check(readings, NumChannels) & (1u << channel)) != 0)
+		{
+			// Interpolate the time stamp in the same way as AdcClass::ResultReadyCallback
+			const uint32_t start = (uint32_t)t;
+			const uint32_t now = (uint32_t)(t + ConversionTicks * NumChannels);
+			const uint32_t when = start + ((now - start) * (channel + 1))/NumChannels;
+			++result.detections;
+			result.maxStampError = std::max(result.maxStampError, std::fabs(when - sampleTimes[channel]));
+			while (nextCrossing + 1 < crossings.size() && crossings[nextCrossing + 1] <= sampleTimes[channel])
+			{
+				++nextCrossing;
+			}
+			if (nextCrossing < crossings.size() && crossings[nextCrossing] <= sampleTimes[channel])
+			{
+				result.maxLatency = std::max(result.maxLatency, when - crossings[nextCrossing]);
+				++nextCrossing;
+			}
+		}
+	}
+	return result;
+}
+
+int main()
+{
+	// A square wave with an edge every 20ms must have every edge detected, in the first and last positions of the conversion sequence
+	{
+		std::vector<double> edges;
+		for (double e = 15000; e < 750000; e += 15000)
+		{
+			edges.push_back(e);
+		}
+		auto square = [](double t) { return ((int)(t/15000) & 1) ? 60000.0 : 5000.0; };
+		for (int channel : { 0, NumChannels - 1 })
+		{
+			const RunResult r = Run(square, edges, channel, 32768 - 256, 32768, 750000);
+			printf("square wave, channel %d: %d/%zu edges, max latency %.0fus\n", channel, r.detections, edges.size(), r.maxLatency/StepClocksPerMicrosecond);
+			Check(r.detections == (int)edges.size(), "every square wave edge detected once");
+			Check(r.maxLatency <= CycleTicks, "square wave edges detected within one conversion cycle");
+			Check(r.maxStampError <= 1, "time stamp is the time of the reading");
+		}
+	}
+
+	// A slow noisy triangle wave must give exactly one detection per crossing when there is hysteresis
+	{
+		constexpr double Period = 3000000;
+		std::vector<double> crossings;
+		for (int i = 0; i < 6; ++i)
+		{
+			crossings.push_back(Period * i + Period/4);
+			crossings.push_back(Period * i + 3 * Period/4);
+		}
+		auto triangle = [](double t) { const double phase = fmod(t/Period, 1.0); return 32768 + 20000 * ((phase < 0.5) ? 4 * phase - 1 : 3 - 4 * phase); };
+		std::mt19937 rng(1);
+		std::normal_distribution<double> noise(0, 60);
+		const RunResult r = Run([&](double t) { return triangle(t) + noise(rng); }, crossings, 2, 32768 - 256, 32768, 6 * Period);
+		printf("noisy triangle wave: %d detections for %zu crossings\n", r.detections, crossings.size());
+		Check(r.detections == (int)crossings.size(), "hysteresis gives one detection per crossing of a noisy signal");
+	}
+
+	// A step placed anywhere in the conversion cycle must be detected once, within one cycle
+	{
+		double worstLatency = 0;
+		for (double offset = 0; offset < CycleTicks; offset += 37)
+		{
+			const double edge = 5 * CycleTicks + offset;
+			const RunResult r = Run([edge](double t) { return (t >= edge) ? 60000.0 : 0.0; }, { edge }, 5, 32768 - 256, 32768, 10 * CycleTicks);
+			Check(r.detections == 1, "step detected once");
+			worstLatency = std::max(worstLatency, r.maxLatency);
+		}
+		printf("step anywhere in the cycle: worst latency %.0fus\n", worstLatency/StepClocksPerMicrosecond);
+		Check(worstLatency <= CycleTicks, "step detected within one conversion cycle");
+	}
+
+	printf("AnalogThresholds: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,169 @@
+/*
+ * CanDataPhaseTimingTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Checks the CAN-FD data phase timing calculation for the bit rates that the main board asks for, and for every period and sample point
+ *  up to 1Mbps that it could ask for: an accepted timing must give exactly the requested bit rate, fit the DBTP register fields, and put the
+ *  sample point within half a time quantum of the one requested. Then runs the trial: it passes when the bus stays healthy for the trial
+ *  period, fails on too many errors or on going error passive, and falls back to the timing from before the first of several trials.
+ */
+
+#include "CAN/CanDataPhaseTiming.h"
+#include <cstdio>
+#include <cstdlib>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+static CanTiming MakeTiming(uint32_t period, uint32_t tseg1, uint32_t jumpWidth)
+{
+	CanTiming timing;
+	timing.period = period;
+	timing.tseg1 = tseg1;
+	timing.jumpWidth = jumpWidth;
+	timing.zero = 0;
+	return timing;
+}
+
+// Check that a calculated timing is valid and matches the request. Return false and say why if it doesn't.
+static bool TimingMatches(const DataBitTiming& dbt, const CanTiming& requested, const char *&why)
+{
+	if (   dbt.prescaler < 1 || dbt.prescaler > DataBitTiming::MaxPrescaler
+		|| dbt.tseg1 < 1 || dbt.tseg1 > DataBitTiming::MaxTseg1
+		|| dbt.tseg2 < 1 || dbt.tseg2 > DataBitTiming::MaxTseg2
+		|| dbt.jumpWidth < 1 || dbt.jumpWidth > DataBitTiming::MaxJumpWidth || dbt.jumpWidth > dbt.tseg2
+		|| dbt.tdcOffset > DataBitTiming::MaxTdcOffset
+	   )
+	{
+		why = "register field out of range";
+		return false;
+	}
+
+	CanTiming actual;
+	dbt.GetTiming(actual);
+	if (actual.period != requested.period)
+	{
+		why = "bit rate not exact";
+		return false;
+	}
+
+	// The sample point can only move further if it had to be moved to leave at least one quantum on each side of it
+	if (2 * abs((int32_t)actual.tseg1 - (int32_t)requested.tseg1) > dbt.prescaler && dbt.tseg1 != 1 && dbt.tseg2 != 1)
+	{
+		why = "sample point moved by more than half a time quantum";
+		return false;
+	}
+
+	if (dbt.UsesDelayCompensation() && (dbt.prescaler > DataBitTiming::MaxTdcPrescaler || dbt.GetBitRate() < 1000000))
+	{
+		why = "delay compensation used where it can't work or isn't needed";
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	// Rates that divide the CAN clock exactly, with a 75% sample point
+	const uint32_t rates[] = { 1000000, 2000000, 3000000, 4000000 };
+	for (uint32_t rate : rates)
+	{
+		const uint32_t period = CanTiming::ClockFrequency/rate;
+		const CanTiming requested = MakeTiming(period, (3 * period)/4, period/4);
+		DataBitTiming dbt;
+		const char *why = "";
+		const bool ok = dbt.Calculate(requested);
+		Check(ok, "standard rate accepted");
+		if (ok)
+		{
+			Check(TimingMatches(dbt, requested, why), why);
+			Check(dbt.UsesDelayCompensation(), "delay compensation used at 1Mbps and above");
+			printf("%.1fMbps: prescaler %u tseg1 %u tseg2 %u sjw %u tdc offset %u\n",
+					rate * 1.0e-6, dbt.prescaler, dbt.tseg1, dbt.tseg2, dbt.jumpWidth, dbt.tdcOffset);
+		}
+	}
+
+	// Requests that we must refuse
+	DataBitTiming dbt;
+	Check(!dbt.Calculate(MakeTiming(8, 6, 2)), "6Mbps refused");
+	Check(!dbt.Calculate(MakeTiming(0, 0, 0)), "zero period refused");
+	Check(!dbt.Calculate(MakeTiming(48, 48, 4)), "sample point at end of bit refused");
+	Check(!dbt.Calculate(MakeTiming(48, 36, 0)), "zero jump width refused");
+	Check(!dbt.Calculate(MakeTiming(53, 40, 4)), "prime period too long for one prescaler refused");
+
+	// Every period and sample point from 5Mbps down to 1Mbps
+	unsigned int numAccepted = 0, numRefused = 0;
+	bool allMatch = true;
+	const char *firstFailure = "";
+	for (uint32_t period = CanTiming::ClockFrequency/DataBitTiming::MaxBitRate; period <= CanTiming::ClockFrequency/1000000; ++period)
+	{
+		for (uint32_t tseg1 = 1; tseg1 < period; ++tseg1)
+		{
+			const CanTiming requested = MakeTiming(period, tseg1, (period - tseg1 + 1)/2);
+			if (dbt.Calculate(requested))
+			{
+				++numAccepted;
+				const char *why;
+				if (!TimingMatches(dbt, requested, why) && allMatch)
+				{
+					allMatch = false;
+					firstFailure = why;
+					printf("period %u tseg1 %u: %s\n", period, tseg1, why);
+				}
+			}
+			else
+			{
+				++numRefused;
+			}
+		}
+	}
+	Check(allMatch, firstFailure);
+	printf("timings from 1 to 5Mbps: %u accepted, %u refused because no exact prescaler gives register fields within their limits\n", numAccepted, numRefused);
+
+	// A trial passes if the bus stays healthy for the whole trial period
+	DataBitTiming original, fast, faster;
+	Check(original.Calculate(MakeTiming(48, 36, 12)) && fast.Calculate(MakeTiming(12, 9, 3)) && faster.Calculate(MakeTiming(10, 7, 3)), "trial timings");
+	DataPhaseTrial trial;
+	Check(!trial.IsRunning() && trial.GetLastResult() == DataPhaseTrial::Result::running, "no trials yet");
+	trial.Start(1000, 500, 3, fast, original, false);
+	Check(trial.Check(1200, 2, false) == DataPhaseTrial::Result::running, "trial running");
+	Check(trial.Check(1499, 1, false) == DataPhaseTrial::Result::running, "trial running at the allowed error limit");
+	Check(trial.Check(1500, 0, false) == DataPhaseTrial::Result::passed && !trial.IsRunning(), "trial passed");
+	Check(trial.GetLastResult() == DataPhaseTrial::Result::passed && trial.GetLastErrors() == 3 && trial.GetFallbacks() == 0, "pass recorded");
+
+	// Too many errors fail it, and we fall back to the timing from before the trial
+	trial.Start(0xFFFFFF00, 1000, 3, faster, fast, true);					// the trial period spans the wrap of millis()
+	Check(trial.Check(0xFFFFFFF0, 1, false) == DataPhaseTrial::Result::running, "trial running across millis wrap");
+	Check(trial.Check(0x00000010, 3, false) == DataPhaseTrial::Result::failed, "too many errors fail the trial");
+	Check(trial.GetFallbackTiming().GetBitRate() == fast.GetBitRate() && trial.GetFallbackBitRateSwitch(), "fall back to the timing before the trial");
+	Check(trial.GetTrialTiming().GetBitRate() == faster.GetBitRate() && trial.GetFallbacks() == 1 && trial.GetLastErrors() == 4, "failure recorded");
+
+	// Going error passive fails it at once
+	trial.Start(0, 1000, 100, fast, original, false);
+	Check(trial.Check(1, 0, true) == DataPhaseTrial::Result::failed && trial.GetFallbacks() == 2, "error passive fails the trial");
+
+	// A second request while a trial is running keeps the timing from before the first trial as the fallback
+	trial.Start(0, 1000, 0, fast, original, false);
+	trial.Start(100, 1000, 0, faster, fast, true);
+	Check(trial.Check(200, 1, false) == DataPhaseTrial::Result::failed, "second trial fails");
+	Check(trial.GetFallbackTiming().GetBitRate() == original.GetBitRate() && !trial.GetFallbackBitRateSwitch(), "fall back to the timing before the first trial");
+
+	// A cancelled trial doesn't change the last result
+	trial.Start(0, 1000, 0, fast, original, false);
+	trial.Cancel();
+	Check(!trial.IsRunning() && trial.GetLastResult() == DataPhaseTrial::Result::failed && trial.GetFallbacks() == 3, "cancel");
+
+	printf("CanDataPhaseTiming: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,300 @@
+/*
+ * CoreKinematicsTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Compares the kinematic motor steps that we calculate locally with those of the main board for CoreXY, CoreXZ and Markforged kinematics.
+ *  The main board keeps its machine position in float and sets the motor positions from the Cartesian coordinates at the end of each move,
+ *  using A = X + Y, B = X - Y for CoreXY, A = X + Z, C = X - Z for CoreXZ and A = X + Y, B = Y for Markforged. It sends the start and end X
+ *  and Y and the Z movement of each move. We add up the steps that each move gives and check that every motor stays within one step of the
+ *  main board over long random sequences, including runs of Z moves shorter than half a step. Also checks that an M669 Z reset is applied
+ *  after the moves that were queued before it and not before, and that changing the Z steps/mm keeps the Z coordinate.
+ */
+
+#include "Movement/Kinematics/CoreKinematics.h"
+#include "Movement/Kinematics/ZPositionTracker.h"
+#include <cmath>
+#include <random>
+
+// Kinematics.cpp needs most of the firmware, so provide the base class constructor here
+Kinematics::Kinematics(KinematicsType t, float segsPerSecond, float minSegLength, bool doUseRawG0)
+	: segmentsPerSecond(segsPerSecond), minSegmentLength(minSegLength), useSegmentation(segsPerSecond > 0.0), useRawG0(doUseRawG0), type(t)
+{
+}
+
+static int failures = 0;
+static std::mt19937 rng(1);
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+static float Random(float low, float high)
+{
+	return std::uniform_real_distribution<float>(low, high)(rng);
+}
+
+// The main board's motor positions for a machine position
+static void MainBoardMotorPositions(KinematicsType k, const float pos[XYZ_AXES], const float stepsPerMm[XYZ_AXES], int32_t motorPos[XYZ_AXES])
+{
+	float motorMm[XYZ_AXES] = { pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS] };
+	switch (k)
+	{
+	case KinematicsType::coreXY:
+		motorMm[X_AXIS] = pos[X_AXIS] + pos[Y_AXIS];
+		motorMm[Y_AXIS] = pos[X_AXIS] - pos[Y_AXIS];
+		break;
+
+	case KinematicsType::coreXZ:
+		motorMm[X_AXIS] = pos[X_AXIS] + pos[Z_AXIS];
+		motorMm[Z_AXIS] = pos[X_AXIS] - pos[Z_AXIS];
+		break;
+
+	case KinematicsType::markForged:
+		motorMm[X_AXIS] = pos[X_AXIS] + pos[Y_AXIS];
+		break;
+
+	default:
+		break;
+	}
+	for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+	{
+		motorPos[axis] = (int32_t)lrint((double)motorMm[axis] * (double)stepsPerMm[axis]);
+	}
+}
+
+// The local side: the steps for one move, calculated as Move::GetKinematicMotorSteps does
+class ExpansionBoard
+{
+public:
+	ExpansionBoard(KinematicsType k, const float spm[XYZ_AXES]) : kinematics(k), movesTaken(0)
+	{
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			stepsPerMm[axis] = spm[axis];
+			motorPos[axis] = 0;
+		}
+		zTracker.SetStepsPerMm(stepsPerMm[Z_AXIS]);
+	}
+
+	void TakeMove(float initialX, float initialY, float finalX, float finalY, float zMovement)
+	{
+		zTracker.ApplyPendingReset(movesTaken);
+		++movesTaken;
+		float initialZ, finalZ;
+		zTracker.AddMove(zMovement, initialZ, finalZ);
+		lastInitialZ = initialZ;
+		const float initialCoords[XYZ_AXES] = { initialX, initialY, initialZ };
+		const float finalCoords[XYZ_AXES] = { finalX, finalY, finalZ };
+		int32_t initialMotorPos[XYZ_AXES], finalMotorPos[XYZ_AXES];
+		(void)kinematics.CartesianToMotorSteps(initialCoords, stepsPerMm, XYZ_AXES, XYZ_AXES, initialMotorPos, true);
+		(void)kinematics.CartesianToMotorSteps(finalCoords, stepsPerMm, XYZ_AXES, XYZ_AXES, finalMotorPos, true);
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			motorPos[axis] += finalMotorPos[axis] - initialMotorPos[axis];
+		}
+	}
+
+	CoreKinematics kinematics;
+	ZPositionTracker zTracker;
+	float stepsPerMm[XYZ_AXES];
+	int32_t motorPos[XYZ_AXES];				// the sum of the steps of all the moves
+	uint32_t movesTaken;
+	float lastInitialZ;
+};
+
+// The main board: it keeps the machine position and the motor positions, and sends moves to the expansion board
+class MainBoard
+{
+public:
+	MainBoard(KinematicsType k, const float spm[XYZ_AXES]) : kinematics(k)
+	{
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			stepsPerMm[axis] = spm[axis];
+			pos[axis] = 0.0;
+		}
+		MainBoardMotorPositions(k, pos, stepsPerMm, motorPos);
+	}
+
+	void MoveTo(ExpansionBoard& eb, float x, float y, float z)
+	{
+		const float zMovement = z - pos[Z_AXIS];
+		eb.TakeMove(pos[X_AXIS], pos[Y_AXIS], x, y, zMovement);
+		pos[X_AXIS] = x;
+		pos[Y_AXIS] = y;
+		pos[Z_AXIS] = z;
+		int32_t newMotorPos[XYZ_AXES];
+		MainBoardMotorPositions(kinematics, pos, stepsPerMm, newMotorPos);
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			netSteps[axis] += newMotorPos[axis] - motorPos[axis];
+			motorPos[axis] = newMotorPos[axis];
+		}
+	}
+
+	// Return the largest difference between the net steps of the two boards
+	int32_t MaxError(const ExpansionBoard& eb) const
+	{
+		int32_t maxError = 0;
+		for (size_t axis = 0; axis < XYZ_AXES; ++axis)
+		{
+			maxError = max<int32_t>(maxError, labs(eb.motorPos[axis] - netSteps[axis]));
+		}
+		return maxError;
+	}
+
+	KinematicsType kinematics;
+	float stepsPerMm[XYZ_AXES];
+	float pos[XYZ_AXES];
+	int32_t motorPos[XYZ_AXES];
+	int32_t netSteps[XYZ_AXES] = { 0, 0, 0 };
+};
+
+static const char *Name(KinematicsType k)
+{
+	return CoreKinematics(k).GetName(false);
+}
+
+// Long sequences of random moves like those of a print: XY moves, layer changes, Z hops, runs of Z moves shorter than half a step
+// such as those of a spiral vase print, and occasional large Z moves
+static void TestRandomMoves(KinematicsType k)
+{
+	const float stepsPerMm[XYZ_AXES] = { 80.0, 80.0, 400.0 };
+	MainBoard mb(k, stepsPerMm);
+	ExpansionBoard eb(k, stepsPerMm);
+	mb.MoveTo(eb, 0.0, 0.0, 0.2);
+	int32_t worstError = 0;
+	for (unsigned int i = 0; i < 1000000; ++i)
+	{
+		const unsigned int choice = rng() % 1000;
+		if (choice < 10)
+		{
+			// A run of moves that each raise Z by less than half a step
+			const float dz = Random(0.05, 0.45)/stepsPerMm[Z_AXIS];
+			for (unsigned int j = 0; j < 50; ++j)
+			{
+				mb.MoveTo(eb, mb.pos[X_AXIS] + Random(-0.5, 0.5), mb.pos[Y_AXIS] + Random(-0.5, 0.5), mb.pos[Z_AXIS] + dz);
+				worstError = max<int32_t>(worstError, mb.MaxError(eb));
+			}
+		}
+		else if (choice < 20)
+		{
+			// A layer change
+			mb.MoveTo(eb, mb.pos[X_AXIS], mb.pos[Y_AXIS], mb.pos[Z_AXIS] + Random(0.05, 0.4));
+		}
+		else if (choice < 40)
+		{
+			// A Z hop and travel move
+			const float hop = Random(0.2, 2.0);
+			mb.MoveTo(eb, mb.pos[X_AXIS], mb.pos[Y_AXIS], mb.pos[Z_AXIS] + hop);
+			mb.MoveTo(eb, Random(-150.0, 150.0), Random(-150.0, 150.0), mb.pos[Z_AXIS]);
+			mb.MoveTo(eb, mb.pos[X_AXIS], mb.pos[Y_AXIS], mb.pos[Z_AXIS] - hop);
+		}
+		else if (choice == 40)
+		{
+			// A large Z move, for example to park the head or to start another print
+			mb.MoveTo(eb, mb.pos[X_AXIS], mb.pos[Y_AXIS], Random(0.2, 250.0));
+		}
+		else
+		{
+			mb.MoveTo(eb, Random(-150.0, 150.0), Random(-150.0, 150.0), mb.pos[Z_AXIS]);
+		}
+		worstError = max<int32_t>(worstError, mb.MaxError(eb));
+	}
+	printf("%s: worst difference from the main board over %u moves: %d step(s)\n", Name(k), (unsigned int)eb.movesTaken, (int)worstError);
+	Check(worstError <= 1, "random moves within one step of the main board");
+}
+
+// Z moves of a fraction of a step must add up. Rounding each move to whole steps would never move Z at all.
+static void TestSubStepZMoves()
+{
+	const float stepsPerMm[XYZ_AXES] = { 80.0, 80.0, 400.0 };
+	MainBoard mb(KinematicsType::coreXZ, stepsPerMm);
+	ExpansionBoard eb(KinematicsType::coreXZ, stepsPerMm);
+	const float dz = 0.3/stepsPerMm[Z_AXIS];
+	for (unsigned int i = 0; i < 10000; ++i)
+	{
+		mb.MoveTo(eb, 10.0, 0.0, mb.pos[Z_AXIS] + dz);
+	}
+	printf("CoreXZ: 10000 Z moves of 0.3 step moved motor C to %d steps and the main board's to %d\n", (int)eb.motorPos[Z_AXIS], (int)mb.netSteps[Z_AXIS]);
+	Check(mb.MaxError(eb) <= 1 && labs(mb.netSteps[Z_AXIS] - 1000) <= 2, "sub-step Z moves add up");			// C = X - Z = 10 - 7.5 mm
+}
+
+// M669 Z resets take effect after the moves that the main board sent before them, even if those moves are still queued
+static void TestReset(uint32_t initialMoveCount)
+{
+	const float stepsPerMm[XYZ_AXES] = { 80.0, 80.0, 400.0 };
+	ExpansionBoard eb(KinematicsType::coreXZ, stepsPerMm);
+	eb.movesTaken = initialMoveCount;
+	uint32_t movesSent = initialMoveCount;
+
+	// The main board sends 5 moves, then a G92 Z10 changes its Z coordinate without moving, then it sends 3 more moves.
+	// The expansion board receives the M669 before it has taken any of the first 5 moves from its queue.
+	struct Move { float x, z; };
+	Move queued[8];
+	float mainZ = 0.0, mainX = 0.0;
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		queued[i] = { mainX + 1.0f, mainZ + 0.5f };
+		mainX += 1.0;
+		mainZ += 0.5;
+		++movesSent;
+	}
+	eb.zTracker.ScheduleReset(10.0, movesSent);
+	mainZ = 10.0;
+	for (unsigned int i = 5; i < 8; ++i)
+	{
+		queued[i] = { mainX + 1.0f, mainZ + 0.5f };
+		mainX += 1.0;
+		mainZ += 0.5;
+	}
+
+	float prevX = 0.0, prevZ = 0.0;
+	bool ok = true;
+	for (unsigned int i = 0; i < 8; ++i)
+	{
+		const float expectedInitialZ = (i == 5) ? 10.0 : prevZ;
+		eb.TakeMove(prevX, 0.0, queued[i].x, 0.0, queued[i].z - expectedInitialZ);
+		ok = ok && fabsf(eb.lastInitialZ - expectedInitialZ) < 0.5/stepsPerMm[Z_AXIS];
+		ok = ok && (i >= 5 || eb.zTracker.IsResetPending());
+		prevX = queued[i].x;
+		prevZ = queued[i].z;
+	}
+	ok = ok && !eb.zTracker.IsResetPending() && fabsf(eb.zTracker.GetZ() - 11.5) < 0.5/stepsPerMm[Z_AXIS];
+	Check(ok, "M669 Z reset applied at the move boundary where it was sent");
+}
+
+// Changing the Z steps/mm keeps the Z coordinate
+static void TestStepsPerMmChange()
+{
+	ZPositionTracker z;
+	z.SetStepsPerMm(400.0);
+	float initialZ, finalZ;
+	z.AddMove(123.456, initialZ, finalZ);
+	z.SetStepsPerMm(1600.0);
+	Check(fabsf(z.GetZ() - 123.456) < 0.5/400.0, "Z coordinate kept when the steps/mm change");
+	z.AddMove(-0.001, initialZ, finalZ);
+	Check(fabsf(initialZ - 123.456) < 0.5/400.0 && fabsf(finalZ - initialZ + 0.001) < 0.5/1600.0, "moves continue after the steps/mm change");
+}
+
+int main()
+{
+	TestRandomMoves(KinematicsType::coreXY);
+	TestRandomMoves(KinematicsType::coreXZ);
+	TestRandomMoves(KinematicsType::markForged);
+	TestSubStepZMoves();
+	TestReset(0);
+	TestReset(0xFFFFFFFE);						// the move counters wrap round between the reset being scheduled and applied
+	TestStepsPerMmChange();
+
+	printf("CoreKinematics: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,133 @@
+/*
+ * DhtDecoderTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Builds DHT frames as edge times with +-3us jitter and checks that DhtDecoder accepts good frames, with and without the spurious edge
+ *  at the end of the start signal, and rejects truncated, glitched, stretched, bad checksum and noise streams with the right result.
+ */
+
+#include "DhtDecoder.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+constexpr uint32_t ClockRate = 750000;
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static double Jitter()
+{
+	return (double)((int)(rng() % 2001) - 1000) * 0.003;
+}
+
+// Return the edge times of a frame carrying 'data', starting at 'start'
+static std::vector<uint16_t> MakeFrame(const uint8_t data[DhtDecoder::NumDataBytes], uint16_t start, bool spuriousEdge, bool releaseEdge)
+{
+	std::vector<double> microseconds;
+	double t = 0;
+	if (spuriousEdge)
+	{
+		microseconds.push_back(t);
+		t += 25;
+	}
+	microseconds.push_back(t);
+	t += 80 + Jitter();
+	microseconds.push_back(t);
+	t += 80 + Jitter();
+	for (size_t bit = 0; bit < DhtDecoder::NumDataBits; ++bit)
+	{
+		microseconds.push_back(t);
+		t += 50 + Jitter();
+		microseconds.push_back(t);
+		t += (((data[bit/8] >> (7 - bit % 8)) & 1) ? 70 : 27) + Jitter();
+	}
+	microseconds.push_back(t);
+	t += 50;
+	if (releaseEdge)
+	{
+		microseconds.push_back(t);
+	}
+
+	std::vector<uint16_t> edges;
+	for (double us : microseconds)
+	{
+		edges.push_back((uint16_t)(start + (uint32_t)(us * ClockRate/1.0e6)));
+	}
+	return edges;
+}
+
+static void Expect(const char *name, const std::vector<uint16_t>& edges, DhtDecodeResult expected, const uint8_t *expectedData = nullptr)
+{
+	const DhtDecoder decoder(ClockRate);
+	uint8_t data[DhtDecoder::NumDataBytes];
+	const size_t numEdges = (edges.size() > DhtDecoder::MaxEdges) ? DhtDecoder::MaxEdges : edges.size();
+	const DhtDecodeResult rslt = decoder.Decode(edges.data(), numEdges, data);
+	if (rslt != expected || (expectedData != nullptr && rslt == DhtDecodeResult::ok && memcmp(data, expectedData, sizeof(data)) != 0))
+	{
+		++failures;
+		printf("%s: got %s, expected %s\n", name, DhtDecoder::ResultText(rslt), DhtDecoder::ResultText(expected));
+	}
+}
+
+int main()
+{
+	for (int i = 0; i < 2000; ++i)
+	{
+		uint8_t data[DhtDecoder::NumDataBytes];
+		for (size_t j = 0; j < 4; ++j)
+		{
+			data[j] = (uint8_t)rng();
+		}
+		data[4] = data[0] + data[1] + data[2] + data[3];
+		const uint16_t start = (uint16_t)rng();
+
+		Expect("good frame", MakeFrame(data, start, false, true), DhtDecodeResult::ok, data);
+		Expect("spurious edge", MakeFrame(data, start, true, true), DhtDecodeResult::ok, data);
+		Expect("no release edge", MakeFrame(data, start, false, false), DhtDecodeResult::ok, data);
+
+		const std::vector<uint16_t> frame = MakeFrame(data, start, false, true);
+
+		std::vector<uint16_t> truncated = frame;
+		truncated.resize(40);
+		Expect("truncated", truncated, DhtDecodeResult::tooFewEdges);
+
+		std::vector<uint16_t> missingEdge = frame;
+		missingEdge.erase(missingEdge.begin() + 4 + 2 * (rng() % 39));
+		Expect("missing edge", missingEdge, DhtDecodeResult::badTiming);
+
+		std::vector<uint16_t> glitched = frame;
+		const size_t k = 3 + 2 * (rng() % 39);
+		const uint16_t glitchTime = glitched[k] + 3;
+		glitched.insert(glitched.begin() + k + 1, { glitchTime, (uint16_t)(glitchTime + 2) });
+		Expect("glitch", glitched, DhtDecodeResult::badTiming);
+
+		std::vector<uint16_t> stretched = frame;
+		for (size_t j = 10; j < stretched.size(); ++j)
+		{
+			stretched[j] += (uint16_t)((35 * ClockRate/1000000) * (j - 9)/2);
+		}
+		Expect("stretched", stretched, DhtDecodeResult::badTiming);
+
+		uint8_t badData[DhtDecoder::NumDataBytes];
+		memcpy(badData, data, sizeof(badData));
+		badData[4] ^= 1u << (rng() % 8);
+		Expect("bad checksum", MakeFrame(badData, start, false, true), DhtDecodeResult::badChecksum);
+
+		Expect("no edges", {}, DhtDecodeResult::noResponse);
+
+		std::vector<uint16_t> noise;
+		for (int j = 0; j < 84; ++j)
+		{
+			noise.push_back((uint16_t)(start + j * 7));
+		}
+		Expect("noise", noise, DhtDecodeResult::noResponse);
+	}
+
+	printf("DhtDecoder: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,288 @@
+/*
+ * DriverTelemetryTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Drives the telemetry with a synthetic load: two of the three drivers move through a speed profile and one of them passes through a
+ *  region of binding, where SG_RESULT falls. The TMC task and the main task are called every millisecond as on the board. The messages
+ *  sent are decoded as the main board would decode them, and the samples are checked against the model: the right drivers at the
+ *  configured interval, positions and speeds that match the motion, standstill flagged, the binding found at the right positions,
+ *  samples held no longer than the batching limit, and samples dropped while the CAN buffers are all in use counted correctly.
+ */
+
+#include "Movement/StepperDrivers/DriverTelemetry.h"
+#include "Movement/StepperDrivers/TMC51xx.h"
+#include "CanMessageBuffer.h"
+#include <CanMessageGenericParser.h>
+#include <CAN/CanDriverTelemetryMessages.h>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+static uint32_t now = 0;
+
+uint32_t millis()
+{
+	return now;
+}
+
+// Motion model. Driver 0 accelerates to 2000 full steps/sec, cruises and decelerates to a stop; driver 2 runs at half that speed.
+constexpr uint32_t Microsteps = 16;
+constexpr int32_t BindingStart = 20000, BindingEnd = 25000;			// driver 0 positions in microsteps where the mechanism binds
+constexpr uint16_t FreeLoad = 500, BindingLoad = 80;
+
+static double FullStepsPerSecond(size_t driver, uint32_t t)
+{
+	double speed;
+	if (t < 100)
+	{
+		speed = 0.0;
+	}
+	else if (t < 300)
+	{
+		speed = 2000.0 * (t - 100)/200;
+	}
+	else if (t < 1500)
+	{
+		speed = 2000.0;
+	}
+	else if (t < 1700)
+	{
+		speed = 2000.0 * (1700 - t)/200;
+	}
+	else
+	{
+		speed = 0.0;
+	}
+	return (driver == 2) ? speed/2 : speed;
+}
+
+static double positions[NumDrivers] = { 0.0 };
+
+static int32_t ModelPosition(size_t driver)
+{
+	return (int32_t)positions[driver];
+}
+
+Move *moveInstance = nullptr;
+
+int32_t Move::GetLiveDriverPosition(size_t driver) const
+{
+	return ModelPosition(driver);
+}
+
+// The DRV_STATUS value that the driver would report
+static uint32_t DrvStatus(size_t driver, uint32_t t)
+{
+	const bool standstill = FullStepsPerSecond(driver, t) == 0.0;
+	const int32_t pos = ModelPosition(driver);
+	const uint32_t sg = (driver == 0 && pos >= BindingStart && pos < BindingEnd) ? BindingLoad : FreeLoad + driver;
+	const uint32_t cs = (standstill) ? 10 : 20;
+	return sg | (cs << TMC_RR_CSACTUAL_SHIFT) | ((standstill) ? TMC_RR_STST : 0);
+}
+
+// Main board end
+struct DecodedSample
+{
+	uint32_t time;
+	uint32_t timeReceived;
+	size_t driver;
+	bool standstill;
+	uint8_t currentScale;
+	uint16_t sgResult;
+	uint16_t fullStepsPerSecond;
+	int32_t position;
+	int32_t expectedPosition;
+	double expectedSpeed;
+};
+
+static std::vector<DecodedSample> decoded;
+static std::vector<uint32_t> expectedPositionsAt[NumDrivers];			// model position of each driver at each millisecond
+static unsigned int numMessages = 0;
+static uint16_t lastSamplesDropped = 0;
+static bool messagesOk = true;
+
+void CanInterface::SendAndFree(CanMessageBuffer *buf)
+{
+	const CanMessageDriverTelemetry& msg = reinterpret_cast<const CanMessageDriverTelemetry&>(buf->msg);
+	if (   buf->id.MsgType() != CanMessageType::driverTelemetryReport || buf->id.Dst() != CanId::MasterAddress
+		|| msg.numSamples == 0 || msg.numSamples > CanMessageDriverTelemetry::MaxSamples || buf->dataLength != msg.GetActualDataLength()
+		|| msg.samplesDropped < lastSamplesDropped
+	   )
+	{
+		messagesOk = false;
+	}
+	lastSamplesDropped = msg.samplesDropped;
+	for (size_t i = 0; i < msg.numSamples; ++i)
+	{
+		const CanDriverTelemetrySample& s = msg.samples[i];
+		DecodedSample d;
+		d.time = msg.timeStamp + s.timeOffset;
+		d.timeReceived = now;
+		d.driver = s.driver;
+		d.standstill = (s.currentScale & CanDriverTelemetrySample::StandstillFlag) != 0;
+		d.currentScale = s.currentScale & ~CanDriverTelemetrySample::StandstillFlag;
+		d.sgResult = s.sgResult;
+		d.fullStepsPerSecond = s.fullStepsPerSecond;
+		d.position = s.position;
+		d.expectedPosition = (d.driver < NumDrivers && d.time < expectedPositionsAt[d.driver].size()) ? expectedPositionsAt[d.driver][d.time] : 0;
+		d.expectedSpeed = FullStepsPerSecond(d.driver, d.time);
+		decoded.push_back(d);
+	}
+	++numMessages;
+	CanMessageBuffer::Free(buf);
+}
+
+static GCodeResult Configure(std::initializer_list<uint8_t> drivers, int interval, const StringRef& reply)
+{
+	CanMessageGeneric msg;
+	msg.hasP = drivers.size() != 0;
+	msg.numP = 0;
+	for (uint8_t d : drivers)
+	{
+		msg.p[msg.numP++] = d;
+	}
+	msg.hasR = interval >= 0;
+	msg.r = (uint16_t)interval;
+	reply.Clear();
+	return DriverTelemetry::Configure(msg, reply);
+}
+
+int main()
+{
+	constexpr unsigned int NumBuffers = 8;
+	constexpr uint32_t SampleInterval = 5;
+	constexpr uint32_t BusBusyStart = 1000, BusBusyEnd = 1200;		// all the CAN buffers are in use during this time
+	constexpr uint32_t RunTime = 2000;
+
+	CanMessageBuffer::Init(NumBuffers);
+	char replyBuffer[200];
+	const StringRef reply(replyBuffer, sizeof(replyBuffer));
+
+	// Configuration
+	now = 10;
+	Check(Configure({ 3 }, 5, reply) == GCodeResult::error && strstr(reply.c_str(), "out of range") != nullptr, "driver number checked");
+	Check(Configure({ 0, 2 }, SampleInterval, reply) == GCodeResult::ok && strstr(reply.c_str(), "every 5ms") != nullptr, "telemetry enabled");
+	Check(DriverTelemetry::IsEnabled(0) && !DriverTelemetry::IsEnabled(1) && DriverTelemetry::IsEnabled(2), "drivers enabled");
+	Check(Configure({ }, -1, reply) == GCodeResult::ok && strstr(reply.c_str(), "21.1 telemetry off") != nullptr, "configuration reported");
+
+	// Run the motion, calling the TMC task and the main task every millisecond
+	std::vector<CanMessageBuffer*> heldBuffers;
+	for (now = 11; now < RunTime; ++now)
+	{
+		for (size_t driver = 0; driver < NumDrivers; ++driver)
+		{
+			positions[driver] += FullStepsPerSecond(driver, now) * Microsteps * 0.001;
+			expectedPositionsAt[driver].resize(now + 1, 0);
+			expectedPositionsAt[driver][now] = ModelPosition(driver);
+			const double speed = FullStepsPerSecond(driver, now);
+			const uint32_t fullStepInterval = (speed == 0.0) ? 0 : (uint32_t)lrint(StepTimer::StepClockRate/speed);
+			DriverTelemetry::AddSample(driver, DrvStatus(driver, now), fullStepInterval);
+		}
+
+		if (now == BusBusyStart)
+		{
+			CanMessageBuffer *buf;
+			while ((buf = CanMessageBuffer::Allocate()) != nullptr)
+			{
+				heldBuffers.push_back(buf);
+			}
+		}
+		else if (now == BusBusyEnd)
+		{
+			for (CanMessageBuffer *buf : heldBuffers)
+			{
+				CanMessageBuffer::Free(buf);
+			}
+		}
+		DriverTelemetry::Spin();
+	}
+
+	// Check the decoded samples against the model
+	Check(messagesOk, "messages well formed");
+	bool driversOk = true, intervalOk = true, positionOk = true, speedOk = true, standstillOk = true, latencyOk = true, bindingOk = true;
+	unsigned int numBinding = 0, numGaps = 0;
+	uint32_t lastTime[NumDrivers] = { 0 };
+	uint32_t maxLatency = 0;
+	for (const DecodedSample& d : decoded)
+	{
+		if (d.driver != 0 && d.driver != 2)
+		{
+			driversOk = false;
+			continue;
+		}
+		if (lastTime[d.driver] != 0)
+		{
+			const uint32_t interval = d.time - lastTime[d.driver];
+			if (interval > SampleInterval)
+			{
+				++numGaps;
+				if (d.time < BusBusyStart || interval % SampleInterval != 0)
+				{
+					intervalOk = false;
+				}
+			}
+			else if (interval != SampleInterval)
+			{
+				intervalOk = false;
+			}
+		}
+		lastTime[d.driver] = d.time;
+
+		positionOk = positionOk && d.position == d.expectedPosition;
+		// The speed comes from the full step interval in step clocks, so it is only as accurate as one step clock in that interval
+		speedOk = speedOk && fabs(d.fullStepsPerSecond - d.expectedSpeed) <= fsquare(d.expectedSpeed)/StepTimer::StepClockRate + 1.0;
+		standstillOk = standstillOk && d.standstill == (d.expectedSpeed == 0.0) && d.currentScale == ((d.standstill) ? 10 : 20);
+		const uint32_t latency = d.timeReceived - d.time;
+		maxLatency = max(maxLatency, latency);
+		if (latency > 50 && (d.time < BusBusyStart || d.time > BusBusyEnd))
+		{
+			latencyOk = false;
+		}
+
+		// The main board looks for binding as a fall in SG_RESULT while moving
+		if (!d.standstill && d.sgResult < FreeLoad/2)
+		{
+			++numBinding;
+			if (d.driver != 0 || d.position < BindingStart || d.position >= BindingEnd)
+			{
+				bindingOk = false;
+			}
+		}
+	}
+
+	// Driver 0 crosses the 5000 microsteps of the binding region at 32000 microsteps/sec, so we expect about 0.156 / 0.005 = 31 samples there
+	const unsigned int expectedBinding = (BindingEnd - BindingStart) * 1000/(2000 * Microsteps * SampleInterval);
+	Check(driversOk, "only the enabled drivers sampled");
+	Check(intervalOk, "samples at the configured interval");
+	Check(positionOk, "positions match the motion");
+	Check(speedOk, "speeds match the motion");
+	Check(standstillOk, "standstill and current scale reported");
+	Check(latencyOk, "samples held for no longer than the batching limit");
+	Check(bindingOk && numBinding + 2 >= expectedBinding && numBinding <= expectedBinding + 2, "binding found where the mechanism binds");
+
+	// While the buffers were in use the sample buffer filled, and the samples that didn't fit were dropped
+	const unsigned int expectedSamples = 2 * ((RunTime - 11 + SampleInterval - 1)/SampleInterval);
+	Check(numGaps != 0 && decoded.size() + lastSamplesDropped == expectedSamples, "dropped samples counted");
+	Check(decoded.size() <= numMessages * CanMessageDriverTelemetry::MaxSamples && numMessages * 3 < decoded.size(), "samples batched");
+
+	reply.Clear();
+	DriverTelemetry::Diagnostics(reply);
+	printf("%u samples in %u messages, %u dropped while the CAN buffers were in use, %u in the binding region, longest held %" PRIu32 "ms\n",
+			(unsigned int)decoded.size(), numMessages, lastSamplesDropped, numBinding, maxLatency);
+	printf("%s\n", reply.c_str());
+
+	printf("DriverTelemetry: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
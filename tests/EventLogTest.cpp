@@ -0,0 +1,237 @@
+/*
+ * EventLogTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs EventLog against an EEPROM held in RAM. Checks that the log wraps round, that the write rate is limited, that repeated events are merged,
+ *  that Init continues after the newest valid record and ignores a corrupted one, that reports are newest first, and that Clear empties the log.
+ *  Finally runs Clear in one thread while another thread records and writes events, and checks that the log is still consistent.
+ */
+
+#include "EventLog.h"
+#include "Hardware/EEPROM.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr size_t NumSlots = 8;
+
+static std::atomic<uint32_t> now(0);
+static char eeprom[NumSlots * sizeof(EventLogRecord)];
+static unsigned int eepromWrites = 0;
+static int failures = 0;
+
+uint32_t millis() { return now; }
+uint64_t millis64() { return now; }
+
+uint32_t EEPROM::GetSize() { return sizeof(eeprom); }
+
+bool EEPROM::Read(char *data, uint32_t offset, uint32_t length)
+{
+	if (offset + length > sizeof(eeprom))
+	{
+		return false;
+	}
+	memcpy(data, eeprom + offset, length);
+	return true;
+}
+
+bool EEPROM::Write(const char *data, uint32_t offset, uint32_t length)
+{
+	if (offset + length > sizeof(eeprom))
+	{
+		return false;
+	}
+	memcpy(eeprom + offset, data, length);
+	++eepromWrites;
+	std::this_thread::yield();					// NVM writes are slow, so give other threads the chance to run part way through a clear
+	return true;
+}
+
+struct ReportedRecord
+{
+	unsigned int sequence;
+	unsigned int session;
+	unsigned int d0;
+	unsigned int repeats;
+};
+
+// Get a report and parse the records in it
+static std::vector<ReportedRecord> GetReport(unsigned int& session)
+{
+	char buf[2048];
+	const StringRef reply(buf, sizeof(buf));
+	std::vector<ReportedRecord> records;
+	if (EventLog::Report(reply) != GCodeResult::ok || sscanf(buf, "Event log, session %u:", &session) != 1)
+	{
+		++failures;
+		printf("bad report: %s\n", buf);
+		return records;
+	}
+
+	for (const char *line = strchr(buf, '\n'); line != nullptr; line = strchr(line + 1, '\n'))
+	{
+		ReportedRecord rec = { };
+		unsigned int h, m, s;
+		char typeWord[32];
+		if (sscanf(line + 1, "%u s%u %u:%u:%u %31s", &rec.sequence, &rec.session, &h, &m, &s, typeWord) == 6)
+		{
+			// The type text may contain spaces, so find the data after the last but two space. Any repeat count follows.
+			const char *const end = strchr(line + 1, '\n');
+			const std::string text(line + 1, (end == nullptr) ? strlen(line + 1) : (size_t)(end - line - 1));
+			const size_t plus = text.find(" (+");
+			const std::string fields = text.substr(0, plus);
+			size_t pos = fields.size();
+			for (int i = 0; i < 3; ++i)
+			{
+				pos = fields.rfind(' ', pos - 1);
+			}
+			rec.d0 = (unsigned int)strtoul(fields.c_str() + pos + 1, nullptr, 16);
+			rec.repeats = (plus == std::string::npos) ? 0 : (unsigned int)strtoul(text.c_str() + plus + 3, nullptr, 10);
+			records.push_back(rec);
+		}
+	}
+	return records;
+}
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// Record an event and give the log time to write it
+static void RecordAndWrite(uint32_t d0)
+{
+	EventLog::Record(EventLogType::heaterFault, d0);
+	now += 2000;
+	EventLog::Spin();
+}
+
+int main()
+{
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	unsigned int session;
+
+	// A blank EEPROM gives an empty log, then the startup record is written
+	EventLog::Init();
+	Check(GetReport(session).empty() && session == 0, "blank log is empty");
+	now += 2000;
+	EventLog::Spin();
+	std::vector<ReportedRecord> records = GetReport(session);
+	Check(records.size() == 1 && records[0].sequence == 0 && records[0].d0 == 0x40, "startup record written");
+
+	// Events are written no more often than every 2 seconds
+	EventLog::Record(EventLogType::heaterFault, 1);
+	EventLog::Record(EventLogType::heaterFault, 2);
+	now += 2000;
+	const unsigned int writesBefore = eepromWrites;
+	EventLog::Spin();
+	EventLog::Spin();
+	now += 1999;
+	EventLog::Spin();
+	Check(eepromWrites == writesBefore + 1, "write rate is limited");
+	now += 1;
+	EventLog::Spin();
+	Check(eepromWrites == writesBefore + 2, "queued event written after the interval");
+
+	// Identical events queued together are merged
+	EventLog::Record(EventLogType::heaterFault, 3);
+	EventLog::Record(EventLogType::heaterFault, 3);
+	EventLog::Record(EventLogType::heaterFault, 3);
+	now += 2000;
+	EventLog::Spin();
+	records = GetReport(session);
+	Check(records.size() == 4 && records[0].d0 == 3 && records[0].repeats == 2, "repeated events merged");
+
+	// Fill the log several times over. The report holds the newest NumSlots records, newest first.
+	for (uint32_t i = 100; i < 120; ++i)
+	{
+		RecordAndWrite(i);
+	}
+	records = GetReport(session);
+	bool ordered = records.size() == NumSlots && records[0].d0 == 119;
+	for (size_t i = 1; ordered && i < records.size(); ++i)
+	{
+		ordered = records[i].sequence + 1 == records[i - 1].sequence && records[i].d0 + 1 == records[i - 1].d0;
+	}
+	Check(ordered, "log wraps round and reports newest first");
+	const unsigned int lastSequence = records[0].sequence;
+
+	// A restart continues after the newest record in a new session
+	EventLog::Init();
+	now += 2000;
+	EventLog::Spin();
+	records = GetReport(session);
+	Check(session == 1 && records.size() == NumSlots && records[0].sequence == lastSequence + 1 && records[0].session == 1 && records[1].d0 == 119,
+			"restart continues the sequence");
+
+	// A record that was only partly written is ignored, and the next record goes in its slot
+	RecordAndWrite(200);
+	const size_t corruptSlot = (lastSequence + 2) % NumSlots;
+	eeprom[corruptSlot * sizeof(EventLogRecord) + offsetof(EventLogRecord, data)] ^= 0x01;
+	EventLog::Init();
+	records = GetReport(session);
+	Check(!records.empty() && records[0].sequence == lastSequence + 1, "corrupted record ignored");
+	now += 2000;
+	EventLog::Spin();
+	records = GetReport(session);
+	Check(!records.empty() && records[0].sequence == lastSequence + 2 && records[1].sequence == lastSequence + 1, "corrupted slot reused");
+
+	// RecordImmediate writes straight away
+	EventLog::RecordImmediate(EventLogType::softwareReset, 300, 0, 0);
+	records = GetReport(session);
+	Check(!records.empty() && records[0].d0 == 300, "immediate record written");
+
+	// Clear empties the log and restarts the sequence numbers
+	EventLog::Clear();
+	Check(GetReport(session).empty(), "log cleared");
+	RecordAndWrite(400);
+	records = GetReport(session);
+	Check(records.size() == 1 && records[0].sequence == 0 && records[0].d0 == 400, "sequence restarted after clear");
+
+	// Clear while another thread is writing records. Afterwards the valid records must be a run of consecutive sequence numbers, each in the
+	// slot given by its sequence number because the sequence restarts at slot 0. A record written part way through a clear would break the run.
+	{
+		std::atomic<bool> stop(false);
+		std::thread writer([&stop]()
+							{
+								for (uint32_t i = 0; !stop; ++i)
+								{
+									RecordAndWrite(i);
+								}
+							});
+		for (int i = 0; i < 2000; ++i)
+		{
+			EventLog::Clear();
+			std::this_thread::yield();
+		}
+		stop = true;
+		writer.join();
+
+		unsigned int numValid = 0, minSequence = ~0u, maxSequence = 0;
+		bool slotsMatch = true;
+		for (size_t slot = 0; slot < NumSlots; ++slot)
+		{
+			EventLogRecord rec;
+			memcpy(&rec, eeprom + slot * sizeof(EventLogRecord), sizeof(rec));
+			if (rec.IsValid())
+			{
+				++numValid;
+				minSequence = std::min<unsigned int>(minSequence, rec.sequence);
+				maxSequence = std::max<unsigned int>(maxSequence, rec.sequence);
+				slotsMatch = slotsMatch && rec.sequence % NumSlots == slot;
+			}
+		}
+		Check(numValid == 0 || (slotsMatch && maxSequence - minSequence + 1 == numValid), "log consistent after concurrent clears");
+	}
+
+	printf("EventLog: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
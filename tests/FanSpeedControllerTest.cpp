@@ -0,0 +1,180 @@
+/*
+ * FanSpeedControllerTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs FanSpeedController with its default gains against a simple model of a fan, with a nonlinear PWM to speed curve, a start threshold,
+ *  a range of time constants and supply voltages, and a tacho reading averaged over 0.3 seconds as the firmware measures it.
+ *  Checks settling time, overshoot and steady state error, recovery from an unreachable request without integral windup, and stall detection.
+ */
+
+#include "FanSpeedController.h"
+#include <cmath>
+#include <cstdio>
+#include <deque>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+constexpr double RatedRpm = 5000;
+constexpr uint32_t KickTime = 100;
+
+// A fan whose steady speed is rated * supply * ((pwm - 0.2)/0.8)^0.8, which starts at 35% PWM and stops below 15%
+struct FanModel
+{
+	double supply;
+	double tau;
+	double rpm = 0;
+	bool running = false;
+	bool jammed = false;
+
+	double SteadyRpm(double pwm) const
+	{
+		const double x = (pwm - 0.2)/0.8;
+		return (x <= 0) ? 0 : RatedRpm * supply * pow(x, 0.8);
+	}
+
+	void Step(double pwm, double dt)
+	{
+		if (!running && pwm >= 0.35)
+		{
+			running = true;
+		}
+		if (running && pwm < 0.15 && rpm < 0.1 * RatedRpm)
+		{
+			running = false;
+		}
+		const double target = (running && !jammed) ? SteadyRpm(pwm) : 0;
+		rpm += (target - rpm) * dt/tau;
+		if (rpm < 1)
+		{
+			rpm = 0;
+		}
+	}
+};
+
+// Runs the fan and controller together, one millisecond per step
+class FanRig
+{
+public:
+	FanRig(double supply, double tau) : fan{supply, tau}, now(0) { controller.SetRatedRpm((uint32_t)RatedRpm); }
+
+	// Run for 'duration' milliseconds. Return the time at which the speed last came within 2% of the request and stayed there, or -1 if it didn't.
+	double Run(double requestedSpeed, uint32_t duration, double& maxOvershootPercent, double& finalErrorPercent)
+	{
+		const double target = requestedSpeed * RatedRpm;
+		double settledAt = -1;
+		maxOvershootPercent = 0;
+		for (uint32_t t = 0; t < duration; ++t)
+		{
+			++now;
+			history.push_back(fan.rpm);
+			if (history.size() > 300)
+			{
+				history.pop_front();
+			}
+			double measured = 0;
+			for (double h : history)
+			{
+				measured += h;
+			}
+			measured /= history.size();
+
+			if (controller.IsUpdateDue(now, requestedSpeed))
+			{
+				controller.Update(now, requestedSpeed, (measured < 100) ? 0 : (int32_t)measured, KickTime);
+			}
+			fan.Step(controller.GetPwm(), 0.001);
+
+			if (fabs(fan.rpm - target) > 0.02 * target)
+			{
+				settledAt = -1;
+			}
+			else if (settledAt < 0)
+			{
+				settledAt = t * 0.001;
+			}
+			maxOvershootPercent = fmax(maxOvershootPercent, 100 * (fan.rpm - target)/target);
+			finalErrorPercent = 100 * (fan.rpm - target)/target;
+		}
+		return settledAt;
+	}
+
+	FanModel fan;
+	FanSpeedController controller;
+
+private:
+	std::deque<double> history;
+	uint32_t now;
+};
+
+int main()
+{
+	// Step response from standstill. The requested speed is reachable in all these cases.
+	double worstSettle = 0, worstOvershoot = 0, worstError = 0;
+	for (double supply : { 0.8, 1.0, 1.15 })
+	{
+		for (double tau : { 0.3, 0.8, 1.5 })
+		{
+			for (double requestedSpeed : { 0.3, 0.6, 0.9 })
+			{
+				if (requestedSpeed > 0.85 * supply)
+				{
+					continue;
+				}
+				FanRig rig(supply, tau);
+				double overshoot, error;
+				const double settle = rig.Run(requestedSpeed, 20000, overshoot, error);
+				const bool ok = settle >= 0 && settle <= 10 && overshoot <= 25 && fabs(error) <= 1 && rig.controller.GetNumStalls() == 0;
+				Check(ok, "step response settles without excessive overshoot or stalls");
+				if (!ok)
+				{
+					printf("supply %.2f tau %.1f request %.1f: settle %.2fs overshoot %.1f%% error %.2f%% stalls %u\n",
+							supply, tau, requestedSpeed, settle, overshoot, error, (unsigned int)rig.controller.GetNumStalls());
+				}
+				worstSettle = fmax(worstSettle, settle);
+				worstOvershoot = fmax(worstOvershoot, overshoot);
+				worstError = fmax(worstError, fabs(error));
+			}
+		}
+	}
+	printf("step response: worst settle %.2fs, worst overshoot %.1f%%, worst steady state error %.2f%%\n", worstSettle, worstOvershoot, worstError);
+
+	// An unreachable request saturates the PWM. The integral term must not wind up, so a reachable request afterwards settles as quickly as from standstill.
+	{
+		FanRig rig(0.8, 0.8);
+		double overshoot, error;
+		(void)rig.Run(0.95, 10000, overshoot, error);
+		const bool saturated = rig.controller.GetPwm() >= 0.99;
+		const double settle = rig.Run(0.5, 20000, overshoot, error);
+		printf("after saturation: PWM saturated %s, settle %.2fs, error %.2f%%\n", (saturated) ? "yes" : "no", settle, error);
+		Check(saturated && settle >= 0 && settle <= 10 && fabs(error) <= 1, "no integral windup while saturated");
+	}
+
+	// A jammed fan must be kicked repeatedly, and must settle once it is freed
+	{
+		FanRig rig(1.0, 0.8);
+		double overshoot, error;
+		(void)rig.Run(0.5, 10000, overshoot, error);
+		rig.fan.jammed = true;
+		(void)rig.Run(0.5, 10000, overshoot, error);
+		const uint32_t stalls = rig.controller.GetNumStalls();
+		rig.fan.jammed = false;
+		const double settle = rig.Run(0.5, 20000, overshoot, error);
+		printf("jammed fan: %u stalls detected, settle after freeing %.2fs\n", (unsigned int)stalls, settle);
+		Check(stalls != 0 && settle >= 0 && settle <= 15, "jammed fan detected and recovers");
+	}
+
+	printf("FanSpeedController: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,237 @@
+/*
+ * FirmwareUpdaterTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs the firmware stream protocol of FirmwareUpdater against flash held in RAM, with the writer task as a thread and block erases that
+ *  take time. The sender behaves like the main board: it streams the image, commits, and re-sends from the offset in the error reply until
+ *  the commit succeeds. Checks that Start replies before the image area is erased, that every page is written to erased flash, that lost
+ *  chunks are recovered, that the bootloader is copied and the image in flash is correct, and that bad requests and corrupt images are rejected.
+ */
+
+#include "FirmwareUpdater.h"
+#include "CAN/CanFirmwareStreamMessages.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+
+static int failures = 0;
+static std::mt19937 rng(1);
+
+static const auto startTime = std::chrono::steady_clock::now();
+uint32_t millis() { return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count(); }
+uint64_t millis64() { return millis(); }
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+// Fake flash and platform
+constexpr uint32_t BootloaderSize = 0x00010000;
+constexpr uint32_t ImageStart = Flash::OtherBankStart + BootloaderSize;
+constexpr uint32_t EraseMicroseconds = 1000;		// the time to erase one block
+
+static uint8_t *const flash = reinterpret_cast<uint8_t*>(FLASH_ADDR);
+static std::atomic<unsigned int> imageBlocksErased(0), badErases(0), writesToUnerasedFlash(0), badWrites(0), bankSwaps(0);
+static std::atomic<bool> failNextWrite(false);
+
+bool Flash::Init() { return true; }
+bool Flash::Unlock(uint32_t start, uint32_t length) { return true; }
+
+bool Flash::EraseOtherBank(uint32_t start, uint32_t length)
+{
+	if (start % FlashBlockSize != 0 || length % FlashBlockSize != 0 || start < OtherBankStart || start + length > FLASH_ADDR + FLASH_SIZE)
+	{
+		++badErases;
+		return false;
+	}
+	std::this_thread::sleep_for(std::chrono::microseconds(EraseMicroseconds * (length/FlashBlockSize)));
+	memset(flash + (start - FLASH_ADDR), 0xFF, length);
+	if (start >= ImageStart)
+	{
+		imageBlocksErased += length/FlashBlockSize;
+	}
+	return true;
+}
+
+bool Flash::WriteOtherBank(uint32_t start, uint32_t length, const uint8_t *data)
+{
+	if (start % FlashPageSize != 0 || length % FlashPageSize != 0 || start < OtherBankStart || start + length > FLASH_ADDR + FLASH_SIZE)
+	{
+		++badWrites;
+		return false;
+	}
+	if (failNextWrite.exchange(false))
+	{
+		return false;
+	}
+	uint8_t *const dest = flash + (start - FLASH_ADDR);
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		if (dest[i] != 0xFF)
+		{
+			++writesToUnerasedFlash;
+			break;
+		}
+	}
+	memcpy(dest, data, length);
+	return true;
+}
+
+void Platform::StartBankSwap() { ++bankSwaps; }
+uint8_t CanInterface::GetCanAddress() { return 5; }
+
+// Reference CRC32 with the zlib polynomial
+static uint32_t Crc32(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; ++i)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+		}
+	}
+	return ~crc;
+}
+
+static void Check(bool ok, const char *what, const char *reply = "")
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s %s\n", what, reply);
+	}
+}
+
+static GCodeResult Start(uint32_t size, uint32_t crc, const char *boardType, char *buf, size_t bufLen)
+{
+	CanMessageFirmwareStreamStart msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.imageSize = size;
+	msg.imageCrc = crc;
+	memcpy(msg.boardType, boardType, std::min(strlen(boardType) + 1, sizeof(msg.boardType)));
+	const StringRef reply(buf, bufLen);
+	return FirmwareUpdater::Start(msg, reply);
+}
+
+static GCodeResult Commit(uint32_t size, uint32_t crc, char *buf, size_t bufLen)
+{
+	CanMessageFirmwareStreamCommit msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.imageSize = size;
+	msg.imageCrc = crc;
+	const StringRef reply(buf, bufLen);
+	return FirmwareUpdater::Commit(msg, reply);
+}
+
+// Send the image from 'offset' to the end, dropping a fraction of the chunks as a busy bus might
+static void SendFrom(const std::vector<uint8_t>& image, uint32_t offset, unsigned int dropPercent)
+{
+	for (uint32_t pos = offset; pos < image.size(); pos += CanMessageFirmwareStreamData::MaxDataLength)
+	{
+		if (rng() % 100 < dropPercent)
+		{
+			continue;
+		}
+		CanMessageFirmwareStreamData msg;
+		msg.offset = pos;
+		const size_t length = std::min<size_t>(CanMessageFirmwareStreamData::MaxDataLength, image.size() - pos);
+		memcpy(msg.data, image.data() + pos, length);
+		FirmwareUpdater::ProcessData(msg, sizeof(msg.offset) + length);
+		std::this_thread::sleep_for(std::chrono::microseconds(20));		// a 60-byte chunk takes at least this long at 5Mbps
+	}
+}
+
+// Stream an image until the commit is accepted or fails for a reason other than missing data. Return the number of commits and the last reply.
+static unsigned int Update(const std::vector<uint8_t>& image, uint32_t crc, unsigned int dropPercent, GCodeResult& rslt, char *buf, size_t bufLen)
+{
+	uint32_t offset = 0;
+	for (unsigned int commits = 1; commits <= 100; ++commits)
+	{
+		SendFrom(image, offset, dropPercent);
+		rslt = Commit(image.size(), crc, buf, bufLen);
+		const char *const resend = strstr(buf, "resend from offset ");
+		if (rslt == GCodeResult::ok || resend == nullptr)
+		{
+			return commits;
+		}
+		const uint32_t newOffset = (uint32_t)strtoul(resend + strlen("resend from offset "), nullptr, 10);
+		Check(newOffset >= offset && newOffset < image.size(), "resend offset in range", buf);
+		offset = newOffset;
+	}
+	return 0;
+}
+
+int main()
+{
+	// Map the flash and the user row at the addresses that FirmwareUpdater reads directly
+	if (mmap(flash, FLASH_SIZE + 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != flash)
+	{
+		printf("FirmwareUpdater: can't map the fake flash\n");
+		return 1;
+	}
+	for (uint32_t i = 0; i < Flash::BankSize; ++i)
+	{
+		flash[i] = (uint8_t)rng();													// our bootloader and firmware
+	}
+	memset(flash + Flash::BankSize, 0x5A, Flash::BankSize);							// an old image in the other bank
+	memset(flash + FLASH_SIZE, 0, 8);												// no SmartEEPROM
+
+	FirmwareUpdater::Init();
+	char buf[200];
+
+	std::vector<uint8_t> image(150001);
+	for (uint8_t& b : image)
+	{
+		b = (uint8_t)rng();
+	}
+	const uint32_t crc = Crc32(image.data(), image.size());
+	const unsigned int imageBlocks = (image.size() + Flash::FlashBlockSize - 1)/Flash::FlashBlockSize;
+
+	// Bad start requests
+	Check(Start(image.size(), crc, "EXP1XD", buf, sizeof(buf)) == GCodeResult::error, "wrong board type rejected", buf);
+	Check(Start(0, crc, "EXP3HC", buf, sizeof(buf)) == GCodeResult::error, "zero size rejected", buf);
+	Check(Start(Flash::BankSize, crc, "EXP3HC", buf, sizeof(buf)) == GCodeResult::error, "oversize image rejected", buf);
+	Check(Commit(image.size(), crc, buf, sizeof(buf)) == GCodeResult::error && strstr(buf, "not been prepared") != nullptr, "commit without start rejected", buf);
+
+	// A good update with lost chunks. Start must reply before the image area has been erased.
+	Check(Start(image.size(), crc, "exp3hc", buf, sizeof(buf)) == GCodeResult::ok, "start accepted", buf);
+	const unsigned int erasedAtReply = imageBlocksErased;
+	printf("image area blocks erased when Start replied: %u of %u\n", erasedAtReply, imageBlocks);
+	Check(erasedAtReply < imageBlocks, "Start replies before the image area is erased");
+	Check(memcmp(flash, flash + Flash::BankSize, BootloaderSize) == 0, "bootloader copied");
+
+	GCodeResult rslt;
+	unsigned int commits = Update(image, crc, 1, rslt, buf, sizeof(buf));
+	printf("update with 1%% of chunks lost: %u commits, %s\n", commits, buf);
+	Check(rslt == GCodeResult::ok && bankSwaps == 1, "update with lost chunks succeeds", buf);
+	Check(memcmp(flash + (ImageStart - FLASH_ADDR), image.data(), image.size()) == 0, "image in flash is correct");
+	Check(imageBlocksErased - erasedAtReply <= imageBlocks, "image area erased once");
+	Check(writesToUnerasedFlash == 0 && badWrites == 0 && badErases == 0, "every page written to erased flash");
+
+	// An image that doesn't match its CRC is rejected, and so is one whose page write fails
+	std::vector<uint8_t> corrupt = image;
+	corrupt[12345] ^= 0x10;
+	Check(Start(corrupt.size(), crc, "EXP3HC", buf, sizeof(buf)) == GCodeResult::ok, "restart accepted", buf);
+	commits = Update(corrupt, crc, 0, rslt, buf, sizeof(buf));
+	Check(rslt == GCodeResult::error && strstr(buf, "CRC mismatch") != nullptr && bankSwaps == 1, "corrupt image rejected", buf);
+
+	Check(Start(image.size(), crc, "EXP3HC", buf, sizeof(buf)) == GCodeResult::ok, "restart after failure accepted", buf);
+	failNextWrite = true;
+	commits = Update(image, crc, 0, rslt, buf, sizeof(buf));
+	Check(rslt == GCodeResult::error && strstr(buf, "failed to write") != nullptr && bankSwaps == 1, "write failure reported", buf);
+
+	// A clean update after the failures
+	Check(Start(image.size(), crc, "EXP3HC", buf, sizeof(buf)) == GCodeResult::ok, "restart after write failure accepted", buf);
+	commits = Update(image, crc, 0, rslt, buf, sizeof(buf));
+	Check(rslt == GCodeResult::ok && bankSwaps == 2 && memcmp(flash + (ImageStart - FLASH_ADDR), image.data(), image.size()) == 0, "clean update succeeds", buf);
+	Check(writesToUnerasedFlash == 0 && badWrites == 0 && badErases == 0, "every page written to erased flash after restarts");
+
+	printf("FirmwareUpdater: %s\n", (failures == 0) ? "passed" : "FAILED");
+	fflush(stdout);
+	_Exit((failures == 0) ? 0 : 1);										// the writer thread never returns, so don't run the static destructors
+}
+
+// End
@@ -0,0 +1,374 @@
+/*
+ * GpioPortsTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs GPIO/GpioPorts.cpp with a model of the step timer, and sends it a random stream of batched GPIO writes, some timed to a step clock time
+ *  and some not, mixed with single writes, port reconfiguration and loss of clock sync. It watches the model compare register of each port,
+ *  and checks that every timed write reaches the register at or after its due time and within a few ticks of it, that none is lost unless a
+ *  later write to the same port supersedes it or the port is reconfigured, and that a batch that can't be queued is not written at all.
+ *  Finally it checks that a timed write to a servo port stops a servo move in progress, and that the next servo move starts from there.
+ *
+ *  The step timer model fires the callback up to MaxLatency ticks late, and tells the caller to call it directly if it is due within
+ *  MinInterruptInterval ticks, as StepTimer does. Each read of the step clock takes a tick, so that code that waits for a time makes progress.
+ */
+
+#include <GPIO/GpioPorts.h>
+#include <CanMessageGenericParser.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+constexpr uint32_t MaxLatency = 3;								// the most ticks late that the step timer interrupt runs
+constexpr uint32_t MaxDelay = MaxLatency + StepTimer::MinInterruptInterval + 4;	// allowing for the time taken in the callback
+constexpr uint32_t MasterTimeOffset = 123456;					// master clock time minus local clock time
+constexpr uint32_t SpinInterval = 100;
+constexpr size_t ServoPort = 7;
+constexpr size_t NoPrepPort = 6;								// a port that can be written but can't have a write prepared
+constexpr size_t NumRandomPorts = 7;							// ports 0 to 6 get random writes
+
+static std::mt19937 rng(1);
+static uint32_t now = 0xFFF00000;								// the step clock wraps early in the test
+static bool synced = true;
+
+static StepTimer::TimerCallbackFunction timerCallback = nullptr;
+static CallbackParameter timerParam;
+static bool timerScheduled = false;
+static uint32_t timerFiresAt;
+
+StepTimer::Ticks StepTimer::GetTimerTicks()
+{
+	return now++;
+}
+
+bool StepTimer::IsSynced()
+{
+	return synced;
+}
+
+uint32_t StepTimer::ConvertToLocalTime(uint32_t masterTime)
+{
+	return masterTime - MasterTimeOffset;
+}
+
+void StepTimer::SetCallback(TimerCallbackFunction cb, CallbackParameter param)
+{
+	timerCallback = cb;
+	timerParam = param;
+}
+
+bool StepTimer::ScheduleCallbackFromIsr(Ticks when)
+{
+	timerScheduled = false;
+	if ((int32_t)(when - GetTimerTicks()) < (int32_t)MinInterruptInterval)
+	{
+		return true;
+	}
+	timerScheduled = true;
+	timerFiresAt = when + rng() % (MaxLatency + 1);
+	return false;
+}
+
+// A timed write that we expect to reach the compare register
+struct ExpectedWrite
+{
+	uint32_t due;
+	uint32_t sequence;
+	uint8_t port;
+	uint32_t compare;
+};
+
+static std::vector<ExpectedWrite> expected;
+static uint32_t lastSeen[MaxGpOutPorts];
+static uint32_t nextSequence = 0, nextValue = 1;
+static unsigned int numTimedWritesSeen = 0, numSuperseded = 0;
+static uint32_t maxDelaySeen = 0;
+
+static uint32_t Compare(size_t port)
+{
+	return fakePwmPorts[port]->GetCompare();
+}
+
+// Check the compare registers of the ports that get random writes for writes that have arrived, and check that none is overdue
+static void Observe()
+{
+	for (size_t p = 0; p < NumRandomPorts; ++p)
+	{
+		const uint32_t c = Compare(p);
+		if (c != lastSeen[p])
+		{
+			lastSeen[p] = c;
+			auto w = std::find_if(expected.begin(), expected.end(), [p, c](const ExpectedWrite& e) { return e.port == p && e.compare == c; });
+			if (w == expected.end())
+			{
+				Check(false, "register written with a value that wasn't due");
+				continue;
+			}
+			const int32_t delay = (int32_t)(now - w->due);
+			Check(delay >= 0, "timed write not applied early");
+			if ((uint32_t)delay > maxDelaySeen)
+			{
+				maxDelaySeen = delay;
+			}
+			++numTimedWritesSeen;
+
+			// Any writes to this port that were due earlier, or at the same time but queued before, have been superseded
+			const ExpectedWrite arrived = *w;
+			const size_t before = expected.size();
+			expected.erase(std::remove_if(expected.begin(), expected.end(),
+											[&arrived](const ExpectedWrite& e)
+											{
+												return e.port == arrived.port
+													&& ((int32_t)(e.due - arrived.due) < 0 || (e.due == arrived.due && e.sequence <= arrived.sequence));
+											}),
+							expected.end());
+			numSuperseded += before - expected.size() - 1;
+		}
+	}
+
+	for (auto w = expected.begin(); w != expected.end(); )
+	{
+		if ((int32_t)(now - w->due) > (int32_t)MaxDelay)
+		{
+			Check(false, "timed write applied within MaxDelay ticks of its due time");
+			w = expected.erase(w);
+		}
+		else
+		{
+			++w;
+		}
+	}
+}
+
+// Run the step timer interrupt and the main loop for the specified number of ticks
+static void Run(uint32_t ticks)
+{
+	const uint32_t end = now + ticks;
+	uint32_t lastSpin = now;
+	while ((int32_t)(end - now) > 0)
+	{
+		if (timerScheduled && (int32_t)(now - timerFiresAt) >= 0)
+		{
+			timerScheduled = false;
+			timerCallback(timerParam);
+			Observe();
+		}
+		if (now - lastSpin >= SpinInterval)
+		{
+			lastSpin = now;
+			GpioPorts::Spin();
+			Observe();
+		}
+		++now;
+		Observe();
+	}
+}
+
+static GCodeResult ConfigurePort(size_t port, const char *pin, bool servo)
+{
+	CanMessageGeneric msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.hasP = true;
+	msg.numP = 1;
+	msg.p[0] = port;
+	msg.hasS = true;
+	msg.s = servo;
+	msg.c = pin;
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	return GpioPorts::HandleM950Gpio(msg, reply);
+}
+
+// Send a batch of writes, timed if 'timed' is true
+static GCodeResult WriteMultiple(const std::vector<uint8_t>& ports, const std::vector<float>& pwms, bool timed, uint32_t localTime)
+{
+	CanMessageGeneric msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.hasP = true;
+	msg.numP = ports.size();
+	msg.hasS = true;
+	msg.numSValues = pwms.size();
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		msg.p[i] = ports[i];
+		msg.sValues[i] = pwms[i];
+	}
+	msg.hasT = timed;
+	msg.t = localTime + MasterTimeOffset;
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	return GpioPorts::HandleGpioWriteMultiple(msg, reply);
+}
+
+static GCodeResult ServoMove(size_t port, float pulseWidth, float speed)
+{
+	CanMessageGeneric msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.hasP = true;
+	msg.numP = 1;
+	msg.p[0] = port;
+	msg.hasT = true;
+	msg.tf = pulseWidth;
+	msg.hasV = (speed > 0.0);
+	msg.v = speed;
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	return GpioPorts::HandleServoMove(msg, reply);
+}
+
+static float NewPwm()
+{
+	const float pwm = (float)nextValue/1.0e6;
+	nextValue = nextValue % 999999 + 1;
+	return pwm;
+}
+
+// Send a random batch of writes to distinct ports, and record what we expect to happen
+static void RandomBatch(uint32_t lastTime)
+{
+	std::vector<uint8_t> ports;
+	std::vector<float> pwms;
+	const size_t numPorts = 1 + rng() % 4;
+	while (ports.size() < numPorts)
+	{
+		const uint8_t p = rng() % NumRandomPorts;
+		if (std::find(ports.begin(), ports.end(), p) == ports.end())
+		{
+			ports.push_back(p);
+			pwms.push_back(NewPwm());
+		}
+	}
+
+	const unsigned int kind = rng() % 10;
+	const bool timed = (kind != 0);
+	const uint32_t when = (kind == 1) ? now - rng() % 50								// already due, so written immediately
+						: (kind == 2) ? now + 1 + rng() % StepTimer::MinInterruptInterval	// due too soon to schedule an interrupt
+						: (kind == 3 && (int32_t)(lastTime - now) > 0) ? lastTime			// due at the same time as the previous batch
+						: now + 10 + rng() % 3000;
+	const bool queued = timed && synced && (int32_t)(when - now) > 0;
+	const bool canQueue = std::find(ports.begin(), ports.end(), NoPrepPort) == ports.end();
+
+	const GCodeResult rslt = WriteMultiple(ports, pwms, timed, when);
+	if (!queued)
+	{
+		Check(rslt == ((timed && !synced) ? GCodeResult::warning : GCodeResult::ok), "batch written immediately");
+		for (size_t i = 0; i < ports.size(); ++i)
+		{
+			Check(Compare(ports[i]) == PwmPort::PwmToCompare(pwms[i]), "immediate write reached the register");
+			lastSeen[ports[i]] = Compare(ports[i]);
+		}
+	}
+	else if (rslt == GCodeResult::ok)
+	{
+		Check(canQueue, "a batch with a port that can't be prepared is rejected");
+		for (size_t i = 0; i < ports.size(); ++i)
+		{
+			expected.push_back({ when, nextSequence++, ports[i], PwmPort::PwmToCompare(pwms[i]) });
+		}
+	}
+	else
+	{
+		Check(rslt == GCodeResult::error, "batch rejected with an error");
+	}
+	Observe();
+}
+
+int main()
+{
+	GpioPorts::Init();
+	for (size_t p = 0; p < NumRandomPorts; ++p)
+	{
+		Check(ConfigurePort(p, (p == NoPrepPort) ? "nopwm" : "pwm", false) == GCodeResult::ok, "port created");
+	}
+
+	// Random traffic
+	unsigned int numBatches = 0, numRejected = 0;
+	uint32_t lastTime = now;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const unsigned int action = rng() % 20;
+		if (action < 14)
+		{
+			const size_t numExpected = expected.size();
+			RandomBatch(lastTime);
+			++numBatches;
+			if (expected.size() != numExpected)
+			{
+				lastTime = expected.back().due;
+			}
+			else
+			{
+				++numRejected;
+			}
+		}
+		else if (action < 17)
+		{
+			// A single write, which is always immediate. Queued writes to the port still happen later.
+			CanMessageWriteGpio msg;
+			msg.portNumber = rng() % NumRandomPorts;
+			msg.pwm = NewPwm();
+			char buf[200];
+			const StringRef reply(buf, sizeof(buf));
+			Check(GpioPorts::HandleGpioWrite(msg, reply) == GCodeResult::ok, "single write");
+			Check(Compare(msg.portNumber) == PwmPort::PwmToCompare(msg.pwm), "single write reached the register");
+			lastSeen[msg.portNumber] = Compare(msg.portNumber);
+		}
+		else if (action == 17)
+		{
+			// Reconfiguring a port discards its pending writes
+			const uint8_t p = rng() % (NumRandomPorts - 1);
+			Check(ConfigurePort(p, "pwm", false) == GCodeResult::ok, "port reconfigured");
+			expected.erase(std::remove_if(expected.begin(), expected.end(), [p](const ExpectedWrite& e) { return e.port == p; }), expected.end());
+		}
+		else if (action == 18)
+		{
+			synced = !synced || rng() % 4 != 0;
+		}
+		Run(rng() % 400);
+	}
+	synced = true;
+	Run(5000);
+	Check(expected.empty(), "no timed writes outstanding");
+
+	printf("%u batches, %u not queued, %u timed writes seen, %u superseded, longest delay %" PRIu32 " ticks\n",
+			numBatches, numRejected, numTimedWritesSeen, numSuperseded, maxDelaySeen);
+	Check(numTimedWritesSeen > 10000, "enough timed writes tested");
+
+	// A timed write to a servo port stops a servo move in progress
+	Check(ConfigurePort(ServoPort, "servo", true) == GCodeResult::ok, "servo port created");
+	Check(ServoMove(ServoPort, 1000.0, 0.0) == GCodeResult::ok, "servo sent to 1000us");
+	Check(Compare(ServoPort) == PwmPort::PwmToCompare(0.05), "servo at 1000us");
+	Check(ServoMove(ServoPort, 2000.0, 200.0) == GCodeResult::ok, "servo move to 2000us started");
+	Run(StepTimer::StepClockRate/2);
+	const uint32_t moving = Compare(ServoPort);
+	Check(moving > PwmPort::PwmToCompare(0.05) && moving < PwmPort::PwmToCompare(0.1), "servo moving");
+
+	const float timedPwm = 0.061234;
+	Check(WriteMultiple({ ServoPort }, { timedPwm }, true, now + 1000) == GCodeResult::ok, "timed write to the servo port queued");
+	Run(StepTimer::StepClockRate/2);
+	Check(Compare(ServoPort) == PwmPort::PwmToCompare(timedPwm), "timed write stopped the servo move");
+
+	// The next servo move starts from where the timed write put the servo
+	Check(ServoMove(ServoPort, 1500.0, 1000.0) == GCodeResult::ok, "servo move to 1500us started");
+	Run(StepTimer::StepClockRate/20);
+	const uint32_t afterOneFrame = Compare(ServoPort);
+	Check(afterOneFrame >= PwmPort::PwmToCompare(timedPwm) && afterOneFrame < PwmPort::PwmToCompare(0.065), "servo move starts from the timed write position");
+	Run(StepTimer::StepClockRate);
+	Check(Compare(ServoPort) == PwmPort::PwmToCompare(0.075), "servo arrived at 1500us");
+
+	printf("GpioPorts: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,185 @@
+/*
+ * GpioWriteQueueTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Checks GpioWriteQueue against a simple reference model over random sequences of batches, discards and time steps.
+ *  The batches are due at times either side of the step clock wrapping round, and the queue is often full.
+ *  The reference model keeps every write with its due time and a sequence number, and when time advances it picks out the writes
+ *  that are due, in the order of their due times and then the order in which they were added.
+ */
+
+#include "GpioWriteQueue.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+struct ModelWrite
+{
+	uint32_t when;
+	uint32_t sequence;
+	GpioWrite write;
+};
+
+class ReferenceQueue
+{
+public:
+	bool Add(uint32_t when, const GpioWrite *writes, size_t numWrites)
+	{
+		if (pending.size() + numWrites > GpioWriteQueue::MaxPendingWrites)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < numWrites; ++i)
+		{
+			pending.push_back({ when, nextSequence++, writes[i] });
+		}
+		return true;
+	}
+
+	std::vector<GpioWrite> TakeDue(uint32_t now)
+	{
+		std::vector<ModelWrite> due;
+		std::vector<ModelWrite> notDue;
+		for (const ModelWrite& w : pending)
+		{
+			((int32_t)(now - w.when) >= 0 ? due : notDue).push_back(w);
+		}
+		std::sort(due.begin(), due.end(),
+					[now](const ModelWrite& a, const ModelWrite& b) { return (a.when != b.when) ? (int32_t)(a.when - now) < (int32_t)(b.when - now) : a.sequence < b.sequence; });
+		pending = notDue;
+		std::vector<GpioWrite> result;
+		for (const ModelWrite& w : due)
+		{
+			result.push_back(w.write);
+		}
+		return result;
+	}
+
+	void Discard(uint8_t portNumber)
+	{
+		pending.erase(std::remove_if(pending.begin(), pending.end(), [portNumber](const ModelWrite& w) { return w.write.portNumber == portNumber; }), pending.end());
+	}
+
+	size_t Size() const { return pending.size(); }
+
+	uint32_t NextDue(uint32_t now) const
+	{
+		uint32_t next = pending[0].when;
+		for (const ModelWrite& w : pending)
+		{
+			if ((int32_t)(w.when - now) < (int32_t)(next - now))
+			{
+				next = w.when;
+			}
+		}
+		return next;
+	}
+
+private:
+	std::vector<ModelWrite> pending;
+	uint32_t nextSequence = 0;
+};
+
+static bool SameWrite(const GpioWrite& a, const GpioWrite& b)
+{
+	return a.portNumber == b.portNumber && a.pwm == b.pwm && a.prepared.value == b.prepared.value;
+}
+
+int main()
+{
+	unsigned int numAdded = 0, numRejected = 0, numApplied = 0;
+	for (int sequence = 0; sequence < 20000; ++sequence)
+	{
+		GpioWriteQueue queue;
+		ReferenceQueue model;
+		uint32_t now = (sequence % 2 == 0) ? 0xFFFFFF00u - (rng() % 256) : rng();		// half the sequences wrap round early on
+		uint32_t value = 0;
+		for (int op = 0; op < 100; ++op)
+		{
+			switch (rng() % 8)
+			{
+			case 0:
+			case 1:
+			case 2:
+				{
+					// Add a batch of 1 to 6 writes, due soon and often at the same time as earlier batches
+					GpioWrite writes[6];
+					const size_t numWrites = 1 + rng() % 6;
+					for (size_t i = 0; i < numWrites; ++i)
+					{
+						writes[i].portNumber = rng() % 8;
+						writes[i].pwm = (float)(rng() % 1000)/1000.0;
+						writes[i].prepared = { nullptr, ++value, false };
+					}
+					const uint32_t when = now + (rng() % 8) * 32;
+					const bool added = queue.Add(when, writes, numWrites);
+					Check(added == model.Add(when, writes, numWrites), "batch accepted when there is room for all of it");
+					if (added)
+					{
+						++numAdded;
+					}
+					else
+					{
+						++numRejected;
+					}
+				}
+				break;
+
+			case 3:
+				{
+					const uint8_t port = rng() % 8;
+					queue.Discard(port);
+					model.Discard(port);
+				}
+				break;
+
+			default:
+				{
+					now += rng() % 100;
+					GpioWrite writes[GpioWriteQueue::MaxPendingWrites];
+					const size_t numDue = queue.TakeDue(now, writes);
+					const std::vector<GpioWrite> expected = model.TakeDue(now);
+					bool same = (numDue == expected.size());
+					for (size_t i = 0; same && i < numDue; ++i)
+					{
+						same = SameWrite(writes[i], expected[i]);
+					}
+					Check(same, "the writes that are due are taken in order");
+					numApplied += numDue;
+				}
+				break;
+			}
+
+			Check(queue.GetNumPending() == model.Size(), "number pending");
+			Check(queue.IsEmpty() == (model.Size() == 0), "empty");
+			Check(queue.IsEmpty() || queue.GetNextDue() == model.NextDue(now), "next due time");
+			if (failures != 0)
+			{
+				printf("sequence %d operation %d\n", sequence, op);
+				printf("GpioWriteQueue: FAILED\n");
+				return 1;
+			}
+		}
+	}
+
+	printf("%u batches added, %u rejected because the queue was full, %u writes taken\n", numAdded, numRejected, numApplied);
+	Check(numRejected != 0, "the queue was filled");
+	printf("GpioWriteQueue: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
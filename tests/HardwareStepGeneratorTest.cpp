@@ -0,0 +1,271 @@
+/*
+ * HardwareStepGeneratorTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs the hardware step generator against a model of the step timer's CC1 compare match and the circular DMA transfer that reloads it.
+ *  Every read of the step clock advances it by one clock, so the DMA can read the queue while QueueStep is part way through, as on the board.
+ *  The step ISR is modelled by queueing steps until the generator refuses one and calling again at the retry time, as
+ *  DriveMovement::FeedHardwareStepGenerator does. We check that each step is generated once, at the time asked for unless that was too
+ *  soon after the previous one, in the right direction; that nothing is generated while idle for longer than the timer takes to wrap;
+ *  and that cancelled steps are not generated and are accounted for.
+ */
+
+#include "Movement/HardwareStepGenerator.h"
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// Hardware model
+constexpr uint32_t DmaLatency = 1;						// the new compare value is loaded this many clocks after a compare match
+
+struct GeneratedStep
+{
+	uint32_t time;
+	bool forwards;
+};
+
+static uint32_t simTime = 0;
+static uint32_t matchFloor = 0;							// the compare register can only match after this time
+static const volatile uint32_t *dmaSource = nullptr;
+static volatile uint32_t *dmaDestination = nullptr;
+static uint32_t dmaLength = 0, dmaIndex = 0;
+static bool dmaEnabled = false;
+static bool directionPin = false;
+static std::vector<GeneratedStep> generated;
+
+// Run the timer, the event system and the DMA up to the specified time, which must be less than 2^31 clocks ahead
+static void RunHardware(uint32_t until)
+{
+	for (;;)
+	{
+		// The compare register matches if its value comes after matchFloor and not after 'until'
+		const uint32_t cc = StepTc->CC[1].reg;
+		if (until - matchFloor >= (1u << 31) || cc - matchFloor == 0 || cc - matchFloor > until - matchFloor)
+		{
+			break;
+		}
+		generated.push_back({ cc, directionPin });		// the event toggles the step pin and the driver steps on both edges
+		matchFloor = cc + DmaLatency;
+		if (dmaEnabled)
+		{
+			*dmaDestination = dmaSource[dmaIndex];
+			dmaIndex = (dmaIndex + 1) % dmaLength;
+		}
+	}
+	if (until - matchFloor < (1u << 31))
+	{
+		matchFloor = until;
+	}
+	simTime = until;
+}
+
+StepTimer::Ticks StepTimer::GetTimerTicks()
+{
+	RunHardware(simTime + 1);
+	return simTime;
+}
+
+void Platform::SetDirection(size_t driver, bool direction)
+{
+	if (driver == HardwareStepDriver)
+	{
+		directionPin = direction;
+	}
+}
+
+void DmacManager::SetBtctrl(uint8_t channel, uint16_t val) { }
+void DmacManager::SetSourceAddress(uint8_t channel, const volatile void *const src) { dmaSource = static_cast<const volatile uint32_t*>(src); }
+void DmacManager::SetDestinationAddress(uint8_t channel, volatile void *const dst) { dmaDestination = static_cast<volatile uint32_t*>(dst); }
+void DmacManager::SetDataLength(uint8_t channel, uint32_t amount) { dmaLength = amount; }
+void DmacManager::SetCircular(uint8_t channel) { }
+void DmacManager::SetTriggerSource(uint8_t channel, DmaTrigSource source) { }
+void DmacManager::EnableChannel(uint8_t channel, uint8_t priority) { dmaIndex = 0; dmaEnabled = true; }
+void DmacManager::DisableChannel(uint8_t channel) { dmaEnabled = false; }
+
+// Step ISR model
+struct RequestedStep
+{
+	uint32_t time;
+	bool forwards;
+};
+
+// Queue the steps from 'first' up to 'last' as the step ISR would, running the hardware in between, until they have all been queued
+static void FeedSteps(const std::vector<RequestedStep>& steps, size_t first, size_t last)
+{
+	size_t next = first;
+	while (next < last)
+	{
+		uint32_t retryTime;
+		while (next < last && HardwareStepGenerator::QueueStep(steps[next].time, steps[next].forwards, retryTime))
+		{
+			++next;
+		}
+		if (next < last)
+		{
+			RunHardware(((int32_t)(retryTime - simTime) > 0) ? retryTime : simTime + 1);
+		}
+	}
+}
+
+static void FeedSteps(const std::vector<RequestedStep>& steps)
+{
+	FeedSteps(steps, 0, steps.size());
+}
+
+// Run the hardware for a long time, calling Spin as the main task would
+static void RunIdle(uint64_t clocks)
+{
+	constexpr uint32_t SpinInterval = 1u << 26;
+	while (clocks != 0)
+	{
+		const uint32_t chunk = (clocks > SpinInterval) ? SpinInterval : (uint32_t)clocks;
+		RunHardware(simTime + chunk);
+		HardwareStepGenerator::Spin();
+		clocks -= chunk;
+	}
+}
+
+// Check the steps generated from 'first' onwards against the steps requested
+static void CheckSteps(const std::vector<RequestedStep>& steps, size_t first, unsigned int maxLate, const char *what)
+{
+	bool countOk = (generated.size() - first == steps.size()), timesOk = true, directionsOk = true;
+	unsigned int numLate = 0;
+	for (size_t i = 0; countOk && i < steps.size(); ++i)
+	{
+		const GeneratedStep& g = generated[first + i];
+		directionsOk = directionsOk && g.forwards == steps[i].forwards;
+		if (g.time != steps[i].time)
+		{
+			++numLate;
+			timesOk = timesOk && (int32_t)(g.time - steps[i].time) > 0;
+		}
+		if (i != 0 && (int32_t)(g.time - generated[first + i - 1].time) <= (int32_t)DmaLatency)
+		{
+			timesOk = false;
+		}
+	}
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%s: each step generated once", what);
+	Check(countOk, buf);
+	snprintf(buf, sizeof(buf), "%s: steps on time unless too close together", what);
+	Check(timesOk && numLate <= maxLate, buf);
+	snprintf(buf, sizeof(buf), "%s: directions", what);
+	Check(directionsOk, buf);
+}
+
+int main()
+{
+	simTime = matchFloor = 0xFFFF0000;					// start close to the wrap of the step clock
+	HardwareStepGenerator::Init();
+
+	// Accelerate from 1k to about 94k steps/sec and back, then reverse, then ask for a burst of steps too close together, then go forwards again
+	std::vector<RequestedStep> steps;
+	uint32_t t = simTime + 1000;
+	for (int i = 0; i < 4000; ++i)
+	{
+		const int fromEnd = (i < 2000) ? i : 3999 - i;
+		const uint32_t interval = 8 + 742/(1 + fromEnd/10);
+		t += interval;
+		steps.push_back({ t, true });
+	}
+	for (int i = 0; i < 1000; ++i)
+	{
+		t += 100;
+		steps.push_back({ t, false });
+	}
+	constexpr unsigned int BurstLength = 10;
+	t += 100;
+	for (unsigned int i = 0; i < BurstLength; ++i)
+	{
+		steps.push_back({ t + i, false });
+	}
+	t += 1000;
+	for (int i = 0; i < 500; ++i)
+	{
+		t += 20;
+		steps.push_back({ t, true });
+	}
+
+	FeedSteps(steps);
+	RunHardware(t + 10);
+	CheckSteps(steps, 0, BurstLength - 1, "profile");
+	Check(HardwareStepGenerator::GetNetStepsNotGenerated() == 0, "all steps generated");
+
+	// The step calculation falls behind, so that each step is queued just before the last one queued is generated, when the DMA is about to read
+	// the queue entry that we want to write to
+	steps.clear();
+	t = simTime + 1000;
+	for (int i = 0; i < 200; ++i)
+	{
+		t += 30;
+		steps.push_back({ t, true });
+	}
+	const size_t numBeforeUnderrun = generated.size();
+	FeedSteps(steps, 0, 1);
+	for (size_t i = 1; i < steps.size(); ++i)
+	{
+		const uint32_t feedTime = steps[i - 1].time - (uint32_t)(i % 8);
+		if ((int32_t)(feedTime - simTime) > 0)
+		{
+			RunHardware(feedTime);
+		}
+		FeedSteps(steps, i, i + 1);
+	}
+	RunHardware(t + 10);
+	CheckSteps(steps, numBeforeUnderrun, 0, "steps queued just in time");
+
+	// Nothing may be generated while idle, even though the compare register would match when the timer wraps if Spin didn't move it
+	const size_t numBeforeIdle = generated.size();
+	RunIdle(1ull << 34);
+	Check(generated.size() == numBeforeIdle, "no steps while idle");
+
+	// Cancel part way through a move. The cancelled steps must not be generated and must be reported as not generated.
+	steps.clear();
+	t = simTime + 1000;
+	for (int i = 0; i < 20; ++i)
+	{
+		t += 200;
+		steps.push_back({ t, true });
+	}
+	const size_t numBeforeCancel = generated.size();
+	FeedSteps(steps);
+	RunHardware(steps[4].time + 50);
+	HardwareStepGenerator::Cancel();
+	RunHardware(t + 1000);
+	Check(generated.size() == numBeforeCancel + 5, "cancelled steps not generated");
+	Check(HardwareStepGenerator::GetNetStepsNotGenerated() == 15, "cancelled steps accounted for");
+
+	// Carry on after the cancellation, backwards this time
+	steps.clear();
+	t = simTime + 1000;
+	for (int i = 0; i < 100; ++i)
+	{
+		t += 50;
+		steps.push_back({ t, false });
+	}
+	const size_t numAfterCancel = generated.size();
+	FeedSteps(steps);
+	RunHardware(t + 10);
+	CheckSteps(steps, numAfterCancel, 0, "after cancelling");
+	Check(HardwareStepGenerator::GetNetStepsNotGenerated() == 15, "nothing more left ungenerated");
+
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	HardwareStepGenerator::Diagnostics(reply);
+	printf("%u steps generated. %s", (unsigned int)generated.size(), reply.c_str());
+
+	printf("HardwareStepGenerator: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,264 @@
+/*
+ * HardwareTachoTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs Fans/HardwareTacho.cpp against a model of the EIC, event system, DMAC and RTC, and checks the fan speeds that it reports.
+ *  Each falling edge on a tacho pin is routed through the event channel and DMA channel that Attach set up, and copies the RTC count
+ *  into the next entry of the time stamp buffer. The RTC runs at 31kHz instead of the nominal 32.768kHz to show that the calibration
+ *  against the step clock works, and starts just below 2^32 so that it wraps early in the test.
+ */
+
+#include <Fans/HardwareTacho.h>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+constexpr double RtcRate = 31000.0;
+constexpr uint32_t RtcStart = 0xFFFFF000;
+constexpr size_t NumFans = 4;
+constexpr size_t NumDmaChannels = 32;
+
+static double now = 0.0;									// simulated time in seconds
+
+StepTimer::Ticks StepTimer::GetTimerTicks()
+{
+	return (Ticks)(uint64_t)(now * StepTimer::StepClockRate);
+}
+
+static void SetTime(double t)
+{
+	now = t;
+	RTC->MODE0.COUNT.reg = RtcStart + (uint32_t)(uint64_t)(t * RtcRate);
+}
+
+// The external interrupt controller maps each pin to the EXTINT with the same number modulo 16
+bool AttachEvent(Pin pin, InterruptMode mode, unsigned int& exintNumber)
+{
+	if (mode != InterruptMode::falling)
+	{
+		return false;
+	}
+	exintNumber = pin & 15;
+	return true;
+}
+
+// DMA channels triggered by events, copying one word from the source to the next destination entry on each trigger
+struct DmaChannelModel
+{
+	const volatile void *src;
+	volatile uint32_t *dst;
+	uint32_t length;
+	uint32_t index;
+	bool enabled;
+	bool circular;
+	bool eventTriggered;
+};
+
+static DmaChannelModel dmaChannels[NumDmaChannels];
+
+void DmacManager::SetBtctrl(uint8_t channel, uint16_t val) { }
+void DmacManager::SetSourceAddress(uint8_t channel, const volatile void *const src) { dmaChannels[channel].src = src; }
+void DmacManager::SetDestinationAddress(uint8_t channel, volatile void *const dst) { dmaChannels[channel].dst = (volatile uint32_t *)dst; }
+void DmacManager::SetDataLength(uint8_t channel, uint32_t amount) { dmaChannels[channel].length = amount; }
+void DmacManager::SetCircular(uint8_t channel) { dmaChannels[channel].circular = true; }
+void DmacManager::SetEventTrigger(uint8_t channel) { dmaChannels[channel].eventTriggered = true; }
+void DmacManager::DisableChannel(uint8_t channel) { dmaChannels[channel].enabled = false; }
+
+void DmacManager::EnableChannel(uint8_t channel, uint8_t priority)
+{
+	dmaChannels[channel].index = 0;
+	dmaChannels[channel].enabled = true;
+}
+
+// A falling edge on a pin generates an event on every event channel whose generator is its EXTINT, which triggers every DMA channel that uses that event channel
+static void FallingEdge(Pin pin)
+{
+	for (unsigned int evChan = 0; evChan < ARRAY_SIZE(EVSYS->Channel); ++evChan)
+	{
+		if ((EVSYS->Channel[evChan].CHANNEL.reg & 0x7F) == EVSYS_ID_GEN_EIC_EXTINT_0 + (pin & 15u))
+		{
+			for (unsigned int d = 0; d < NumDmaChannels; ++d)
+			{
+				DmaChannelModel& dc = dmaChannels[d];
+				if (EVSYS->USER[EVSYS_ID_USER_DMAC_CH_0 + d].reg == evChan + 1 && dc.enabled && dc.eventTriggered)
+				{
+					dc.dst[dc.index] = *(const volatile uint32_t *)dc.src;
+					++dc.index;
+					if (dc.index == dc.length)
+					{
+						dc.index = 0;
+						dc.enabled = dc.circular;
+					}
+				}
+			}
+		}
+	}
+}
+
+struct Fan
+{
+	Pin pin;
+	double period;											// time between falling edges, two per revolution
+	double nextEdge;
+	bool running;
+};
+
+static Fan fans[NumFans] = { { 20 }, { 21 }, { 38 }, { 39 } };
+static double nextSpin = 0.0;
+
+static void SetFanSpeed(size_t fan, double rpm)
+{
+	Fan& f = fans[fan];
+	if (rpm == 0.0)
+	{
+		f.running = false;
+	}
+	else
+	{
+		f.period = 30.0/rpm;
+		if (!f.running)
+		{
+			f.nextEdge = now + f.period;
+			f.running = true;
+		}
+	}
+}
+
+// Run the fans and call Spin every spinInterval seconds until the specified time
+static void RunUntil(double endTime, double spinInterval = 0.01)
+{
+	for (;;)
+	{
+		double t = nextSpin;
+		size_t edgeFan = NumFans;
+		for (size_t i = 0; i < NumFans; ++i)
+		{
+			if (fans[i].running && fans[i].nextEdge < t)
+			{
+				t = fans[i].nextEdge;
+				edgeFan = i;
+			}
+		}
+		if (t > endTime)
+		{
+			break;
+		}
+
+		SetTime(t);
+		if (edgeFan < NumFans)
+		{
+			FallingEdge(fans[edgeFan].pin);
+			fans[edgeFan].nextEdge += fans[edgeFan].period;
+		}
+		else
+		{
+			HardwareTacho::Spin();
+			nextSpin += spinInterval;
+		}
+	}
+	SetTime(endTime);
+}
+
+static bool Near(int32_t rpm, double expected, double tolerance)
+{
+	return fabs((double)rpm - expected) <= expected * tolerance;
+}
+
+int main()
+{
+	SetTime(0.0);
+	HardwareTacho::Init();
+
+	const int ch0 = HardwareTacho::Attach(fans[0].pin);
+	const int ch1 = HardwareTacho::Attach(fans[1].pin);
+	const int ch2 = HardwareTacho::Attach(fans[2].pin);
+	Check(ch0 == 0 && ch1 == 1 && ch2 == 2, "attach the first free channels");
+	Check(HardwareTacho::Attach(fans[3].pin) == -1, "no more than NumHardwareTachos channels");
+	Check(dmaChannels[DmacChanTachoBase].src == &RTC->MODE0.COUNT.reg, "DMA copies the RTC count");
+
+	RunUntil(0.5);
+	Check(HardwareTacho::GetRPM(ch0) == 0, "no edges gives zero RPM");
+
+	// Before the first calibration we assume the nominal RTC rate, so the speed reads high by the ratio of the nominal to the real rate
+	SetFanSpeed(0, 3000.0);
+	RunUntil(1.5);
+	const int32_t uncalibrated = HardwareTacho::GetRPM(ch0);
+	Check(Near(uncalibrated, 3000.0 * 32768.0/RtcRate, 0.01), "uncalibrated speed uses the nominal RTC rate");
+	Check(!Near(uncalibrated, 3000.0, 0.03), "uncalibrated speed is inaccurate");
+
+	// After calibration the speeds are accurate across the range, on all channels at once
+	RunUntil(4.5);
+	const double speeds[] = { 200.0, 500.0, 1000.0, 3000.0, 8000.0, 20000.0 };
+	for (double rpm : speeds)
+	{
+		SetFanSpeed(0, rpm);
+		SetFanSpeed(1, rpm * 0.7);
+		SetFanSpeed(2, rpm * 1.3);
+		RunUntil(now + 1.0);
+		const int32_t rpm0 = HardwareTacho::GetRPM(ch0), rpm1 = HardwareTacho::GetRPM(ch1), rpm2 = HardwareTacho::GetRPM(ch2);
+		printf("%6.0f RPM: read %6" PRIi32 " %6" PRIi32 " %6" PRIi32 "\n", rpm, rpm0, rpm1, rpm2);
+		Check(Near(rpm0, rpm, 0.005) && Near(rpm1, rpm * 0.7, 0.005) && Near(rpm2, rpm * 1.3, 0.005), "calibrated speed within 0.5%");
+		RunUntil(fans[0].nextEdge);
+		Check(Near(HardwareTacho::GetRPM(ch0), rpm, 0.005), "speed read in the same RTC tick as an edge");
+	}
+
+	// When a fan stops, the speed falls with the time since the last edge, then reads zero
+	SetFanSpeed(0, 3000.0);
+	SetFanSpeed(1, 0.0);
+	SetFanSpeed(2, 0.0);
+	RunUntil(now + 1.0);
+	SetFanSpeed(0, 0.0);
+	const double lastEdge = fans[0].nextEdge - fans[0].period;
+	RunUntil(lastEdge + 0.005);
+	Check(Near(HardwareTacho::GetRPM(ch0), 3000.0, 0.005), "speed held until an edge is overdue");
+	RunUntil(lastEdge + 0.1);
+	Check(Near(HardwareTacho::GetRPM(ch0), 300.0, 0.01), "slowing fan speed estimated from the time since the last edge");
+	RunUntil(lastEdge + 2.9);
+	Check(HardwareTacho::GetRPM(ch0) > 0, "stopped fan not reported as stopped too soon");
+	RunUntil(lastEdge + 3.1);
+	Check(HardwareTacho::GetRPM(ch0) == 0, "stopped fan reads zero");
+
+	// A detached channel is reused, and the time stamps from the fan that had it are ignored
+	SetFanSpeed(1, 1000.0);
+	RunUntil(now + 1.0);
+	SetFanSpeed(1, 0.0);
+	HardwareTacho::Detach(ch1);
+	SetFanSpeed(3, 2000.0);
+	const int ch3 = HardwareTacho::Attach(fans[3].pin);
+	Check(ch3 == ch1, "detached channel reused");
+	RunUntil(now + 0.02);
+	Check(HardwareTacho::GetRPM(ch3) == 0, "old time stamps ignored after reattaching");
+	RunUntil(now + 0.5);
+	Check(Near(HardwareTacho::GetRPM(ch3), 2000.0, 0.005), "reattached channel reads the new fan");
+
+	// Stopped fans keep reading zero for longer than it takes the RTC to wrap, which is 38 hours at 31kHz
+	SetFanSpeed(3, 0.0);
+	RunUntil(now + 3.1);
+	bool stayedStopped = true;
+	const double endTime = now + 48.0 * 3600.0;
+	while (now < endTime)
+	{
+		RunUntil(now + 1.0, 1.0);
+		stayedStopped = stayedStopped && HardwareTacho::GetRPM(ch0) == 0 && HardwareTacho::GetRPM(ch3) == 0 && HardwareTacho::GetRPM(ch2) == 0;
+	}
+	Check(stayedStopped, "stopped fans read zero when the RTC wraps");
+
+	// The calibration still holds after the step clock has wrapped many times
+	SetFanSpeed(0, 5000.0);
+	RunUntil(now + 1.0);
+	Check(Near(HardwareTacho::GetRPM(ch0), 5000.0, 0.005), "speed accurate after a long idle");
+
+	printf("HardwareTacho: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
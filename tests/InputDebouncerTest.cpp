@@ -0,0 +1,134 @@
+/*
+ * InputDebouncerTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Checks the bit-sliced counters of InputDebouncer against a simple per-bit integrator, including partial resets, and checks that
+ *  a switch that bounces for a few samples is reported exactly once, in the right final state, soon after it stops bouncing.
+ */
+
+#include "InputDebouncer.h"
+#include <cstdio>
+#include <random>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1);
+
+	// Compare with a scalar reference over random samples
+	unsigned long mismatches = 0;
+	for (int trial = 0; trial < 2000; ++trial)
+	{
+		InputDebouncer debouncer;
+		unsigned int counts[32] = { 0 };
+		uint32_t state = 0;
+		for (int sample = 0; sample < 2000; ++sample)
+		{
+			uint32_t raw = rng();
+			if (trial & 1)
+			{
+				raw &= rng();											// bias the inputs towards zero
+			}
+
+			uint32_t expectedChanges = 0;
+			for (unsigned int bit = 0; bit < 32; ++bit)
+			{
+				const bool level = (raw >> bit) & 1, current = (state >> bit) & 1;
+				if (level != current)
+				{
+					if (++counts[bit] == InputDebouncer::SamplesToChange)
+					{
+						counts[bit] = 0;
+						state ^= 1u << bit;
+						expectedChanges |= 1u << bit;
+					}
+				}
+				else if (counts[bit] != 0)
+				{
+					--counts[bit];
+				}
+			}
+
+			if (debouncer.Update(raw) != expectedChanges || debouncer.GetState() != state)
+			{
+				++mismatches;
+			}
+
+			if (sample % 500 == 0)
+			{
+				const uint32_t mask = rng();
+				debouncer.Reset(mask, raw);
+				state = (state & ~mask) | (raw & mask);
+				for (unsigned int bit = 0; bit < 32; ++bit)
+				{
+					if ((mask >> bit) & 1)
+					{
+						counts[bit] = 0;
+					}
+				}
+			}
+		}
+	}
+	printf("reference mismatches %lu\n", mismatches);
+	Check(mismatches == 0, "same changes and state as the per-bit reference");
+
+	// Rising edges with up to 5 samples of random chatter before the input settles
+	unsigned long extraReports = 0, missedReports = 0, wrongFinalStates = 0;
+	int maxDelay = 0;
+	for (int trial = 0; trial < 200000; ++trial)
+	{
+		InputDebouncer debouncer;
+		debouncer.Reset(~0u, 0);
+		const int bounceSamples = rng() % 6;
+		const unsigned int highPercent = 30 + rng() % 60;
+		int reports = 0, lastReport = -1;
+		for (int sample = 0; sample < 20; ++sample)
+		{
+			const uint32_t raw = (sample < bounceSamples) ? ((rng() % 100 < highPercent) ? 1 : 0) : 1;
+			if (debouncer.Update(raw) & 1)
+			{
+				++reports;
+				lastReport = sample + 1;
+			}
+		}
+
+		if (reports == 0)
+		{
+			++missedReports;
+		}
+		else
+		{
+			extraReports += reports - 1;
+		}
+		if ((debouncer.GetState() & 1) != 1)
+		{
+			++wrongFinalStates;
+		}
+		if (lastReport - bounceSamples > maxDelay)
+		{
+			maxDelay = lastReport - bounceSamples;
+		}
+	}
+	printf("bouncing edges: missed %lu, extra reports %lu, wrong final state %lu, max delay after settling %d samples\n",
+			missedReports, extraReports, wrongFinalStates, maxDelay);
+	Check(missedReports == 0, "every bouncing edge reported");
+	Check(extraReports == 0, "each bouncing edge reported once");
+	Check(wrongFinalStates == 0, "state after bouncing");
+	Check(maxDelay <= (int)InputDebouncer::SamplesToChange, "reported within SamplesToChange samples of settling");
+
+	printf("InputDebouncer: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
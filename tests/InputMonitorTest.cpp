@@ -0,0 +1,385 @@
+/*
+ * InputMonitorTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs InputMonitors/InputMonitor.cpp with a model of the async sender task, and measures how many CAN frames it takes to report
+ *  a bouncing filament sensor and a group of endstops that change together, in the original format and in the timed format with a report window.
+ *  Checks that the timed reports carry the right number of changes, state and time of the latest change for each input, and that no report
+ *  is held back for longer than its report window. Also checks that inputs sampled by the input scanner get their own change times,
+ *  and that deactivating a monitor removes its callbacks.
+ */
+
+#include <InputMonitors/InputMonitor.h>
+#include <CanMessageFormats.h>
+#include <CAN/CanInputChangesMessages.h>
+#include <map>
+#include <random>
+#include <vector>
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+constexpr uint64_t TicksPerMs = StepTimer::StepClockRate/1000;
+constexpr uint32_t MasterTimeOffset = 123456;
+constexpr uint64_t Never = UINT64_MAX;
+
+static uint64_t now = (1ull << 32) - 3000 * TicksPerMs;				// the step clock wraps 3 seconds into the test
+
+StepTimer::Ticks StepTimer::GetTimerTicks()
+{
+	return (Ticks)now;
+}
+
+uint32_t StepTimer::ConvertToMasterTime(uint32_t localTime)
+{
+	return localTime - MasterTimeOffset;
+}
+
+uint32_t millis()
+{
+	return (uint32_t)(now/TicksPerMs);
+}
+
+// Async sender model. When an ISR wakes it, it runs straight away, as it would on the board because it has a higher priority than the tasks that are running.
+static bool senderWoken = false;
+static uint64_t senderWakeTime = Never;
+
+void CanInterface::WakeAsyncSenderFromIsr()
+{
+	senderWoken = true;
+}
+
+// What we expect each input to report. Times are in step clocks.
+struct ExpectedInput
+{
+	uint16_t handle;
+	Pin pin;
+	bool state;
+	unsigned int numChanges;										// changes since the last report
+	uint64_t whenFirstChanged;
+	uint32_t whenChanged;
+	bool exactTime;													// false if the input is scanned, so the change time is the time of the scan
+};
+
+static std::vector<ExpectedInput> inputs;
+static unsigned int numFrames = 0;
+static uint64_t maxTimedLatency = 0;
+static bool entriesCorrect = true;
+static std::vector<CanInputChangeEntry> lastTimedEntries;
+
+static ExpectedInput *FindInput(uint16_t handle)
+{
+	for (ExpectedInput& in : inputs)
+	{
+		if (in.handle == handle)
+		{
+			return &in;
+		}
+	}
+	return nullptr;
+}
+
+static void RunSender()
+{
+	senderWoken = false;
+	uint32_t timeToWait;
+	if (InputMonitor::UseTimedReports())
+	{
+		CanMessageInputChangesTimed msg;
+		msg.Init();
+		timeToWait = InputMonitor::AddStateChanges(&msg);
+		if (msg.numEntries != 0)
+		{
+			++numFrames;
+			lastTimedEntries.assign(msg.entries, msg.entries + msg.numEntries);
+			for (size_t i = 0; i < msg.numEntries; ++i)
+			{
+				const CanInputChangeEntry& entry = msg.entries[i];
+				ExpectedInput * const in = FindInput(entry.handle);
+				if (in != nullptr)
+				{
+					entriesCorrect = entriesCorrect
+										&& entry.state == in->state
+										&& entry.numChanges == min<unsigned int>(in->numChanges, CanInputChangeEntry::MaxChanges)
+										&& (!in->exactTime || entry.whenChanged == StepTimer::ConvertToMasterTime(in->whenChanged));
+					if (in->numChanges != 0)
+					{
+						maxTimedLatency = max<uint64_t>(maxTimedLatency, now - in->whenFirstChanged);
+					}
+					in->numChanges = 0;
+				}
+			}
+		}
+	}
+	else
+	{
+		CanMessageInputChanged msg;
+		msg.states = 0;
+		msg.spare = 0;
+		msg.numHandles = 0;
+		timeToWait = InputMonitor::AddStateChanges(&msg);
+		if (msg.numHandles != 0)
+		{
+			++numFrames;
+			for (size_t i = 0; i < msg.numHandles; ++i)
+			{
+				ExpectedInput * const in = FindInput(msg.handles[i]);
+				if (in != nullptr)
+				{
+					entriesCorrect = entriesCorrect && ((msg.states >> i) & 1) == in->state;
+					in->numChanges = 0;
+				}
+			}
+		}
+	}
+	senderWakeTime = (timeToWait == TaskBase::TimeoutUnlimited) ? Never : now + timeToWait * TicksPerMs;
+}
+
+// Input edges and ADC threshold crossings waiting to happen
+struct Edge
+{
+	Pin pin;
+	bool level;
+	bool analog;
+};
+
+static std::multimap<uint64_t, Edge> edges;
+static uint64_t nextScanTime = 0;
+
+static void AddEdge(uint64_t when, Pin pin, bool level, bool analog = false)
+{
+	edges.insert({ when, { pin, level, analog } });
+}
+
+static void ApplyEdge(const Edge& edge)
+{
+	ExpectedInput * const in = [&edge]() -> ExpectedInput* { for (ExpectedInput& i : inputs) { if (i.pin == edge.pin) { return &i; } } return nullptr; }();
+	if (edge.analog)
+	{
+		if (IoPort::thresholdCallbacks[edge.pin] != nullptr)
+		{
+			IoPort::thresholdCallbacks[edge.pin](IoPort::thresholdCallbackParams[edge.pin], edge.level, (uint32_t)now);
+		}
+	}
+	else
+	{
+		SetFakePinLevel(edge.pin, edge.level);
+		if (IoPort::pinCallbacks[edge.pin] != nullptr)
+		{
+			IoPort::pinCallbacks[edge.pin](IoPort::pinCallbackParams[edge.pin]);
+		}
+	}
+
+	if (in != nullptr && in->state != edge.level)
+	{
+		in->state = edge.level;
+		if (in->numChanges == 0)
+		{
+			in->whenFirstChanged = now;
+		}
+		++in->numChanges;
+		in->whenChanged = (uint32_t)now;
+	}
+}
+
+// Run the inputs, the input scanner in the tick interrupt and the async sender until the specified time
+static void RunUntil(uint64_t endTime)
+{
+	for (;;)
+	{
+		const uint64_t nextEdgeTime = (edges.empty()) ? Never : edges.begin()->first;
+		const uint64_t t = min<uint64_t>(min<uint64_t>(nextEdgeTime, nextScanTime), senderWakeTime);
+		if (t > endTime)
+		{
+			break;
+		}
+
+		now = t;
+		if (t == nextEdgeTime)
+		{
+			const Edge edge = edges.begin()->second;
+			edges.erase(edges.begin());
+			ApplyEdge(edge);
+		}
+		else if (t == nextScanTime)
+		{
+			InputMonitor::ScanInputs();
+			nextScanTime += TicksPerMs;
+		}
+
+		if (senderWoken || now >= senderWakeTime)
+		{
+			RunSender();
+		}
+	}
+	now = endTime;
+}
+
+static void CreateMonitor(uint16_t handle, const char *pinName, uint16_t threshold, uint16_t minInterval)
+{
+	CanMessageCreateInputMonitor msg;
+	msg.handle.u.all = handle;
+	msg.threshold = threshold;
+	msg.minInterval = minInterval;
+	strcpy(msg.pinName, pinName);
+	String<StringLength50> reply;
+	uint8_t extra;
+	Check(InputMonitor::Create(msg, offsetof(CanMessageCreateInputMonitor, pinName) + strlen(pinName) + 1, reply.GetRef(), extra) == GCodeResult::ok, "create monitor");
+
+	const Pin pin = atoi(pinName);
+	inputs.push_back({ handle, pin, extra != 0, 0, 0, 0, true });
+}
+
+static void ChangeMonitor(uint16_t handle, uint8_t action, uint16_t param)
+{
+	CanMessageChangeInputMonitor msg;
+	msg.handle.u.all = handle;
+	msg.action = action;
+	msg.param = param;
+	String<StringLength50> reply;
+	uint8_t extra;
+	Check(InputMonitor::Change(msg, reply.GetRef(), extra) == GCodeResult::ok, "change monitor");
+}
+
+constexpr uint16_t FilamentHandle = 1;
+constexpr Pin FilamentPin = 5;
+constexpr uint16_t EndstopHandleBase = 10;
+constexpr Pin EndstopPinBase = 40;
+constexpr size_t NumEndstops = 6;
+constexpr unsigned int NumCycles = 100;
+constexpr uint16_t ReportWindow = 5;
+
+// Each cycle the filament sensor changes state with up to 6 bounces over up to 2.4ms, and the endstops change state within 2ms of each other
+static unsigned int QueueCycles(uint64_t start)
+{
+	unsigned int numEdges = 0;
+	bool level = false;
+	for (unsigned int cycle = 0; cycle < NumCycles; ++cycle)
+	{
+		const uint64_t cycleStart = start + cycle * 100 * TicksPerMs;
+		level = !level;
+		uint64_t t = cycleStart;
+		const unsigned int bounces = rng() % 7;
+		for (unsigned int i = 0; i < bounces; ++i)
+		{
+			AddEdge(t, FilamentPin, (i % 2 == 0) ? level : !level);
+			t += TicksPerMs/10 + rng() % (3 * TicksPerMs/10);
+		}
+		AddEdge(t, FilamentPin, (bounces % 2 == 0) ? level : !level);
+		if (bounces % 2 != 0)
+		{
+			AddEdge(t + TicksPerMs/10, FilamentPin, level);
+			++numEdges;
+		}
+		numEdges += bounces + 1;
+
+		for (size_t i = 0; i < NumEndstops; ++i)
+		{
+			AddEdge(cycleStart + rng() % (2 * TicksPerMs), EndstopPinBase + i, level);
+			++numEdges;
+		}
+	}
+	return numEdges;
+}
+
+int main()
+{
+	RunUntil(now);
+	char pinName[8];
+	CreateMonitor(FilamentHandle, "5", 0, 0);
+	for (size_t i = 0; i < NumEndstops; ++i)
+	{
+		snprintf(pinName, sizeof(pinName), "%u", (unsigned int)(EndstopPinBase + i));
+		CreateMonitor(EndstopHandleBase + i, pinName, 0, 0);
+	}
+
+	// In the original format the async sender sends a frame each time it is woken by a change
+	const unsigned int numEdges = QueueCycles(now + TicksPerMs);
+	RunUntil(now + (NumCycles * 100 + 100) * TicksPerMs);
+	const unsigned int originalFrames = numFrames;
+	printf("%u changes: %u frames in the original format\n", numEdges, originalFrames);
+	Check(!InputMonitor::UseTimedReports(), "original format until a report window is set");
+	Check(entriesCorrect, "original format reports the current states");
+	Check(originalFrames > numEdges/2, "original format sends about one frame per change");
+
+	// In the timed format the changes of each cycle are reported together when the earliest has waited for its report window
+	ChangeMonitor(FilamentHandle, CanMessageChangeInputMonitor::actionChangeReportWindow, ReportWindow);
+	for (size_t i = 0; i < NumEndstops; ++i)
+	{
+		ChangeMonitor(EndstopHandleBase + i, CanMessageChangeInputMonitor::actionChangeReportWindow, ReportWindow);
+	}
+	Check(InputMonitor::UseTimedReports(), "timed format once a report window is set");
+	numFrames = 0;
+	QueueCycles(now + TicksPerMs);
+	RunUntil(now + (NumCycles * 100 + 100) * TicksPerMs);
+	printf("%u changes: %u frames in the timed format with a %ums report window, worst added latency %.2fms\n",
+			numEdges, numFrames, ReportWindow, (double)maxTimedLatency/TicksPerMs);
+	Check(entriesCorrect, "timed entries have the state, number of changes and time of the latest change");
+	Check(numFrames == NumCycles, "one timed frame per cycle");
+	Check(maxTimedLatency < (ReportWindow + 1) * TicksPerMs, "changes held back for less than the report window plus the millisecond resolution of the sender timeout");
+	bool allReported = true;
+	for (const ExpectedInput& in : inputs)
+	{
+		allReported = allReported && in.numChanges == 0;
+	}
+	Check(allReported, "all changes reported");
+
+	// The minimum interval still applies to inputs that have a report window
+	ChangeMonitor(FilamentHandle, CanMessageChangeInputMonitor::actionChangeMinInterval, 50);
+	numFrames = 0;
+	for (unsigned int i = 0; i < 40; ++i)
+	{
+		AddEdge(now + (i + 1) * 10 * TicksPerMs, FilamentPin, i % 2 == 0);
+	}
+	RunUntil(now + 500 * TicksPerMs);
+	Check(numFrames <= 9 && FindInput(FilamentHandle)->numChanges == 0, "reports of one input limited by its minimum interval");
+
+	// Scanned inputs in the same port group that change at different times are reported with their own change times
+	constexpr Pin ScannedPinA = 64 + 3, ScannedPinB = 64 + 9;
+	CreateMonitor(20, "67", 0, 0);
+	CreateMonitor(21, "73", 0, 0);
+	ChangeMonitor(20, CanMessageChangeInputMonitor::actionChangeDebounce, 1);
+	ChangeMonitor(21, CanMessageChangeInputMonitor::actionChangeDebounce, 1);
+	FindInput(20)->exactTime = FindInput(21)->exactTime = false;
+	ChangeMonitor(20, CanMessageChangeInputMonitor::actionChangeReportWindow, 10);
+	ChangeMonitor(21, CanMessageChangeInputMonitor::actionChangeReportWindow, 10);
+	Check(IoPort::pinCallbacks[ScannedPinA] == nullptr, "debounced input doesn't use the pin change interrupt");
+	AddEdge(now + TicksPerMs/2, ScannedPinA, true);
+	AddEdge(now + TicksPerMs/2 + 4 * TicksPerMs, ScannedPinB, true);
+	RunUntil(now + 50 * TicksPerMs);
+	Check(lastTimedEntries.size() == 2, "scanned changes reported together");
+	if (lastTimedEntries.size() == 2)
+	{
+		const uint32_t whenA = lastTimedEntries[(lastTimedEntries[0].handle == 20) ? 0 : 1].whenChanged;
+		const uint32_t whenB = lastTimedEntries[(lastTimedEntries[0].handle == 20) ? 1 : 0].whenChanged;
+		Check(whenB - whenA == 4 * TicksPerMs, "each scanned input has its own change time");
+	}
+
+	// Analog inputs are reported with the time stamp from the ADC interrupt, and deactivating a monitor removes its callbacks
+	constexpr Pin AnalogPin = 80;
+	CreateMonitor(30, "80", 2000, 0);
+	ChangeMonitor(30, CanMessageChangeInputMonitor::actionChangeReportWindow, 2);
+	Check(IoPort::thresholdCallbacks[AnalogPin] != nullptr, "analog monitor uses the ADC threshold callback");
+	AddEdge(now + 3 * TicksPerMs, AnalogPin, true, true);
+	RunUntil(now + 20 * TicksPerMs);
+	Check(entriesCorrect && lastTimedEntries.size() == 1 && lastTimedEntries[0].handle == 30, "analog change reported");
+	ChangeMonitor(30, CanMessageChangeInputMonitor::actionDontMonitor, 0);
+	Check(IoPort::thresholdCallbacks[AnalogPin] == nullptr, "analog callback removed when the monitor is deactivated");
+	ChangeMonitor(EndstopHandleBase, CanMessageChangeInputMonitor::actionDelete, 0);
+	Check(IoPort::pinCallbacks[EndstopPinBase] == nullptr, "pin change interrupt removed when the monitor is deleted");
+
+	printf("InputMonitor: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,284 @@
+/*
+ * InputShaperTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Shapes the acceleration and deceleration phases of a trapezoidal move as DDA::Prepare does, and checks the velocity profile: the step times
+ *  increase, each phase keeps its duration and distance, the speed is continuous and the peak acceleration is within the allowed increase.
+ *  Then works out the spectrum of the residual vibration. A damped oscillator is driven by the position of the motor, sampled at 20000 points
+ *  per phase as the steps would be, and the vibration left at the end of the move is compared with that of the unshaped move over a range of
+ *  ringing frequencies. Finally times the shaping calculations against the unshaped ones. The times are for this PC, not for the board.
+ */
+
+#include "Movement/InputShaper.h"
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+constexpr float ShaperFrequency = 40.0;
+constexpr float ShaperDamping = 0.1;
+constexpr unsigned int PointsPerPhase = 20000;
+
+// A move with a trapezoidal speed profile that starts and ends at rest. Distances are fractions of the move and speeds are fractions per step clock.
+struct Move
+{
+	Move(float accel, float steady, float decel)
+		: accelClocks(accel), steadyClocks(steady), decelClocks(decel),
+		  topSpeed(2.0/(2.0 * steady + accel + decel)), accelDistance(0.5 * topSpeed * accel), decelDistance(0.5 * topSpeed * decel)
+	{
+	}
+
+	float accelClocks, steadyClocks, decelClocks;
+	float topSpeed, accelDistance, decelDistance;
+};
+
+// The times at which the move reaches a set of points, either shaped as DDA::Prepare does or unshaped
+struct Trajectory
+{
+	std::vector<double> distances, times;
+	bool accelShaped = false, decelShaped = false;
+};
+
+static Trajectory MakeTrajectory(const Move& m, const InputShaper *shaper)
+{
+	Trajectory tr;
+	ShapedPhase accel, decel;
+	if (shaper != nullptr)
+	{
+		tr.accelShaped = accel.Build(*shaper, 0.0, 0.0, 0.0, m.topSpeed, m.accelClocks);
+		tr.decelShaped = decel.Build(*shaper, m.accelClocks + m.steadyClocks, 1.0 - m.decelDistance, m.topSpeed, -m.topSpeed, m.decelClocks);
+	}
+
+	uint8_t accelSeg = 0, decelSeg = 0;
+	const double acceleration = m.topSpeed/m.accelClocks, deceleration = m.topSpeed/m.decelClocks;
+	const double decelStartDistance = 1.0 - m.decelDistance, decelStartTime = m.accelClocks + m.steadyClocks;
+	auto timeAt = [&](double d) -> double
+	{
+		if (d < m.accelDistance)
+		{
+			return (tr.accelShaped) ? accel.GetTimeAtDistance(d, accelSeg) : sqrt(2.0 * d/acceleration);
+		}
+		if (d < decelStartDistance)
+		{
+			return m.accelClocks + (d - m.accelDistance)/m.topSpeed;
+		}
+		if (tr.decelShaped)
+		{
+			return decel.GetTimeAtDistance(d, decelSeg);
+		}
+		const double remaining = max<double>(1.0 - d, 0.0);
+		return decelStartTime + m.decelClocks - sqrt(2.0 * remaining/deceleration);
+	};
+
+	// Sample each phase at the same number of points, and the steady part at the same spacing as the acceleration phase
+	auto addPoints = [&](double from, double to, unsigned int n)
+	{
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			const double d = from + (to - from) * i/n;
+			tr.distances.push_back(d);
+			tr.times.push_back(timeAt(d));
+		}
+	};
+	addPoints(0.0, m.accelDistance, PointsPerPhase);
+	addPoints(m.accelDistance, decelStartDistance, (unsigned int)(PointsPerPhase * (decelStartDistance - m.accelDistance)/m.accelDistance));
+	addPoints(decelStartDistance, 1.0, PointsPerPhase);
+	tr.distances.push_back(1.0);
+	tr.times.push_back(m.accelClocks + m.steadyClocks + m.decelClocks);		// the end of the move is fixed
+	return tr;
+}
+
+// Check the velocity profile of a shaped move. The distances and times are calculated in float as on the board, so near the end of the move
+// the time of each point is only accurate to a few hundredths of a clock. Estimate the speed and acceleration over groups of points, which are
+// much shorter than the shaper segments, to keep that noise out.
+static void CheckProfile(const Move& m, const Trajectory& tr, const char *name)
+{
+	constexpr size_t Stride = 200;
+	bool increasing = true;
+	for (size_t i = 1; i < tr.times.size(); ++i)
+	{
+		increasing = increasing && tr.times[i] > tr.times[i - 1];
+	}
+
+	double maxSpeed = 0.0, maxAccel = 0.0, prevSpeed = 0.0, prevMidTime = 0.0;
+	for (size_t i = Stride; i < tr.times.size(); i += Stride)
+	{
+		const double dt = tr.times[i] - tr.times[i - Stride];
+		const double speed = (tr.distances[i] - tr.distances[i - Stride])/dt;
+		const double midTime = 0.5 * (tr.times[i] + tr.times[i - Stride]);
+		maxSpeed = max<double>(maxSpeed, speed);
+		if (i > Stride)
+		{
+			maxAccel = max<double>(maxAccel, fabs(speed - prevSpeed)/(midTime - prevMidTime));
+		}
+		prevSpeed = speed;
+		prevMidTime = midTime;
+	}
+
+	// The time of the last point before the end of each phase shows whether the phase keeps its duration
+	const double lastAccelPointTime = tr.times[PointsPerPhase - 1];
+	const double lastAccelPointExpected = m.accelClocks - (m.accelDistance/PointsPerPhase)/m.topSpeed;
+	const double accelTimeError = fabs(lastAccelPointTime - lastAccelPointExpected);
+	const double finalGap = tr.times.back() - tr.times[tr.times.size() - 2];
+	const double nominalAccel = m.topSpeed/min<float>(m.accelClocks, m.decelClocks);
+	printf("  %-9s peak speed %.4f of nominal, peak acceleration %.2f of nominal, acceleration phase end error %.2f clocks\n",
+			name, maxSpeed/m.topSpeed, maxAccel/nominalAccel, accelTimeError);
+
+	Check(tr.accelShaped && tr.decelShaped, "both phases shaped");
+	Check(increasing, "step times increase");
+	Check(maxSpeed <= m.topSpeed * 1.001, "speed doesn't exceed the top speed");
+	Check(maxAccel <= 2.1 * nominalAccel, "peak acceleration within the allowed increase");
+	Check(accelTimeError < 2.0, "acceleration phase keeps its duration");
+	Check(finalGap < 0.1 * m.decelClocks, "deceleration phase ends with the move");
+}
+
+// The vibration left at the end of the move in a damped oscillator whose base follows the trajectory, relative to the move length.
+// The base moves at constant speed between points, so the speed changes are impulses and the response between them is the free response.
+static double ResidualVibration(const Trajectory& tr, double frequency, double zeta)
+{
+	const double omega = 2.0 * Pi * frequency/StepTimer::StepClockRate;
+	const double omegaD = omega * sqrt(1.0 - zeta * zeta);
+	double y = 0.0, v = 0.0, baseSpeed = 0.0;				// position and speed of the mass relative to the base
+	for (size_t i = 0; i + 1 < tr.times.size(); ++i)
+	{
+		const double dt = tr.times[i + 1] - tr.times[i];
+		const double newBaseSpeed = (tr.distances[i + 1] - tr.distances[i])/dt;
+		v -= newBaseSpeed - baseSpeed;
+		baseSpeed = newBaseSpeed;
+
+		const double decay = exp(-zeta * omega * dt), c = cos(omegaD * dt), s = sin(omegaD * dt);
+		const double newY = decay * (y * c + (v + zeta * omega * y)/omegaD * s);
+		const double newV = decay * (v * c - (omega * omega * y + zeta * omega * v)/omegaD * s);
+		y = newY;
+		v = newV;
+	}
+	v += baseSpeed;											// the base stops at the end of the move
+	return sqrt(y * y + fsquare((v + zeta * omega * y)/omegaD));
+}
+
+// The ratio of the shaped to the unshaped residual vibration that each shaper must achieve at ringing frequencies within the given
+// fractions of the shaper frequency. The limits are the theoretical residuals of the shapers with a margin for the shortened pulse.
+struct SpectrumLimit
+{
+	InputShaperType type;
+	float withinFivePercent;
+	float withinFifteenPercent;
+};
+
+static const SpectrumLimit spectrumLimits[] =
+{
+	{ InputShaperType::zv,	0.15,	0.40 },
+	{ InputShaperType::zvd,	0.05,	0.15 },
+	{ InputShaperType::ei,	0.10,	0.15 },
+	{ InputShaperType::ei2,	0.10,	0.15 },
+};
+
+static void TestShaper(const SpectrumLimit& limit, const Move& m, const Trajectory& unshaped)
+{
+	InputShaper shaper;
+	Check(shaper.Configure(limit.type, ShaperFrequency, ShaperDamping), "shaper configured");
+	const Trajectory shaped = MakeTrajectory(m, &shaper);
+	CheckProfile(m, shaped, InputShaper::GetTypeName(limit.type));
+
+	printf("  %-9s residual vibration relative to unshaped:", InputShaper::GetTypeName(limit.type));
+	double worstNear = 0.0, worstWide = 0.0;
+	for (double ratio = 0.7; ratio < 1.31; ratio += 0.05)
+	{
+		const double f = ShaperFrequency * ratio;
+		const double rel = ResidualVibration(shaped, f, ShaperDamping)/ResidualVibration(unshaped, f, ShaperDamping);
+		printf(" %.0fHz %.3f", f, rel);
+		if (fabs(ratio - 1.0) < 0.051)
+		{
+			worstNear = max<double>(worstNear, rel);
+		}
+		if (fabs(ratio - 1.0) < 0.151)
+		{
+			worstWide = max<double>(worstWide, rel);
+		}
+	}
+	printf("\n");
+	Check(worstNear <= limit.withinFivePercent && worstWide <= limit.withinFifteenPercent, "residual vibration reduced");
+}
+
+// Time the calculations. Build runs once per phase in DDA::Prepare and GetTimeAtDistance runs once per step.
+static void TimeCalculations(const Move& m)
+{
+	InputShaper shaper;
+	(void)shaper.Configure(InputShaperType::ei2, ShaperFrequency, ShaperDamping);
+	constexpr unsigned int NumBuilds = 100000;
+	volatile float sink = 0.0;
+
+	auto start = std::chrono::steady_clock::now();
+	ShapedPhase phase;
+	for (unsigned int i = 0; i < NumBuilds; ++i)
+	{
+		(void)phase.Build(shaper, 0.0, 0.0, 0.0, m.topSpeed * (1.0 + i * 1e-9), m.accelClocks);
+	}
+	const double buildNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/NumBuilds;
+
+	start = std::chrono::steady_clock::now();
+	uint8_t seg = 0;
+	for (unsigned int i = 0; i < PointsPerPhase * 10; ++i)
+	{
+		if (i % PointsPerPhase == 0)
+		{
+			seg = 0;
+		}
+		sink = sink + phase.GetTimeAtDistance(m.accelDistance * (i % PointsPerPhase)/PointsPerPhase, seg);
+	}
+	const double shapedStepNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/(PointsPerPhase * 10);
+
+	start = std::chrono::steady_clock::now();
+	const float acceleration = m.topSpeed/m.accelClocks;
+	for (unsigned int i = 0; i < PointsPerPhase * 10; ++i)
+	{
+		sink = sink + sqrtf(2.0 * (m.accelDistance * (i % PointsPerPhase)/PointsPerPhase)/acceleration);
+	}
+	const double unshapedStepNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/(PointsPerPhase * 10);
+
+	printf("  on this PC: 2-hump EI Build %.0fns per phase, step time %.1fns shaped and %.1fns unshaped\n", buildNs, shapedStepNs, unshapedStepNs);
+}
+
+int main()
+{
+	// A 0.1s acceleration, 0.2s at constant speed and a 0.09s deceleration. The phases are not a whole number of ringing periods long,
+	// because then the unshaped move would leave almost no vibration at that frequency.
+	const Move m(0.1 * StepTimer::StepClockRate, 0.2 * StepTimer::StepClockRate, 0.09 * StepTimer::StepClockRate);
+	const Trajectory unshaped = MakeTrajectory(m, nullptr);
+
+	printf("Shapers at %.0fHz damping %.2f\n", (double)ShaperFrequency, (double)ShaperDamping);
+	for (const SpectrumLimit& limit : spectrumLimits)
+	{
+		TestShaper(limit, m, unshaped);
+	}
+
+	// Phases too short to shape within the acceleration limit are left unshaped
+	InputShaper shaper;
+	(void)shaper.Configure(InputShaperType::zvd, ShaperFrequency, ShaperDamping);
+	ShapedPhase phase;
+	Check(!phase.Build(shaper, 0.0, 0.0, 0.0, 1e-6, 1.5 * shaper.GetDuration()), "short phase not shaped");
+	Check(phase.Build(shaper, 0.0, 0.0, 0.0, 1e-6, 2.5 * shaper.GetDuration()), "long enough phase shaped");
+
+	// Bad parameters are rejected and leave the configuration alone
+	Check(!shaper.Configure(InputShaperType::zv, 1.0, ShaperDamping) && shaper.GetType() == InputShaperType::zvd, "low frequency rejected");
+	Check(!shaper.Configure(InputShaperType::zv, ShaperFrequency, 1.5) && shaper.GetType() == InputShaperType::zvd, "bad damping rejected");
+	Check(shaper.Configure(InputShaperType::none, 0.0, 0.0) && !shaper.IsEnabled(), "shaping disabled");
+
+	TimeCalculations(m);
+
+	printf("InputShaper: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,390 @@
+/*
+ * MoveBabystepTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs Move, DDA and DriveMovement as built for a single driver SAMC21 board against a simulated step clock, with the step ISR called at the times
+ *  it schedules and Spin called every 100us as the Move task would, and records the time and direction of every step.
+ *  The main board's moves arrive a fixed lead time before they are due. We send babystep requests while moves are queued and while idle, and check:
+ *  - that babysteps requested while moves are queued are done in the moves already queued, not left for the moves received after the request;
+ *  - that when we are idle and a move arrives while our own babystep move is queued or executing, the move still starts on time;
+ *  - that the speed never changes between steps by more than the babystep speed limit plus what the acceleration and step timing allow;
+ *  - that the final position is the sum of the steps in the moves and the babysteps.
+ */
+
+#include "Movement/Move.h"
+#include "Movement/Kinematics/CartesianKinematics.h"
+#include "CanMessageFormats.h"
+#include "CanMessageGenericParser.h"
+#include <deque>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// Kinematics.cpp needs most of the firmware, so provide the base class constructor and the factory here
+Kinematics::Kinematics(KinematicsType t, float segsPerSecond, float minSegLength, bool doUseRawG0)
+	: segmentsPerSecond(segsPerSecond), minSegmentLength(minSegLength), useSegmentation(segsPerSecond > 0.0), useRawG0(doUseRawG0), type(t)
+{
+}
+
+Kinematics *Kinematics::Create(KinematicsType k)
+{
+	return (k == KinematicsType::cartesian) ? new CartesianKinematics() : nullptr;
+}
+
+Move *moveInstance = nullptr;
+
+extern "C" void debugPrintf(const char* fmt, ...)
+{
+	va_list vargs;
+	va_start(vargs, fmt);
+	vprintf(fmt, vargs);
+	va_end(vargs);
+}
+
+constexpr uint32_t Ms = StepTimer::StepClockRate/1000;
+constexpr uint32_t SpinInterval = StepTimer::StepClockRate/10000;			// the Move task runs every 100us
+constexpr uint32_t LeadTime = 300 * Ms;										// how long before a move is due the main board sends it
+constexpr float StepsPerSecond = (float)StepTimer::StepClockRate;
+
+// Simulated step clock and step timer
+static uint32_t simTime = 0;
+static uint32_t nextSpinTime = 0;
+static bool callbackScheduled = false;
+static uint32_t callbackTime = 0;
+static StepTimer::TimerCallbackFunction callbackFunction = nullptr;
+static CallbackParameter callbackParam;
+
+StepTimer::Ticks StepTimer::GetTimerTicks()
+{
+	return simTime;
+}
+
+void StepTimer::SetCallback(TimerCallbackFunction cb, CallbackParameter param)
+{
+	callbackFunction = cb;
+	callbackParam = param;
+}
+
+bool StepTimer::ScheduleCallbackFromIsr(Ticks when)
+{
+	callbackScheduled = ((int32_t)(when - simTime) >= (int32_t)MinInterruptInterval);
+	callbackTime = when;
+	return !callbackScheduled;
+}
+
+void StepTimer::DisableTimerInterrupt() { }
+void StepTimer::Diagnostics(const StringRef& reply) { }
+
+// Steps
+struct Step
+{
+	uint32_t time;
+	bool forwards;
+};
+
+static std::vector<Step> steps;
+static bool directionPin = true;
+
+void Platform::SetDirection(size_t driver, bool direction)
+{
+	directionPin = direction;
+}
+
+void Platform::StepDriverHigh()
+{
+	steps.push_back({ simTime, directionPin });
+}
+
+void Platform::StepDriverLow() { }
+
+// The position of the driver just after 'when'
+static int32_t PositionAt(uint32_t when)
+{
+	int32_t position = 0;
+	for (const Step& s : steps)
+	{
+		if ((int32_t)(s.time - when) > 0)
+		{
+			break;
+		}
+		position += (s.forwards) ? 1 : -1;
+	}
+	return position;
+}
+
+// Moves from the main board
+struct SentMove
+{
+	uint32_t sendTime;
+	CanMessageMovement msg;
+};
+
+static std::deque<SentMove> movesToSend;
+static uint32_t movesSent = 0;
+
+bool CanInterface::GetCanMove(CanMessageMovement& move)
+{
+	if (movesToSend.empty() || (int32_t)(movesToSend.front().sendTime - simTime) > 0)
+	{
+		return false;
+	}
+	move = movesToSend.front().msg;
+	movesToSend.pop_front();
+	++movesSent;
+	return true;
+}
+
+uint32_t CanInterface::GetMovesReceivedBeforeM669()
+{
+	return movesSent;
+}
+
+// A trapezoidal move of one driver. Speeds are in steps/sec and times in step clocks.
+struct PlannedMove
+{
+	uint32_t start;
+	uint32_t duration;
+	int32_t steps;
+};
+
+static PlannedMove QueueMove(uint32_t start, float startSpeed, float topSpeed, float endSpeed, uint32_t accelClocks, uint32_t steadyClocks, uint32_t decelClocks, uint32_t lead)
+{
+	SentMove m;
+	memset(&m, 0, sizeof(m));
+	m.sendTime = start - lead;
+	m.msg.whenToExecute = start;
+	m.msg.accelerationClocks = accelClocks;
+	m.msg.steadyClocks = steadyClocks;
+	m.msg.decelClocks = decelClocks;
+	m.msg.initialSpeedFraction = startSpeed/topSpeed;
+	m.msg.finalSpeedFraction = endSpeed/topSpeed;
+	const float distance = ((startSpeed + topSpeed) * accelClocks + 2 * topSpeed * steadyClocks + (topSpeed + endSpeed) * decelClocks)/(2 * StepsPerSecond);
+	m.msg.perDrive[0].steps = (int32_t)lrintf(distance);
+	movesToSend.push_back(m);
+	return { start, accelClocks + steadyClocks + decelClocks, m.msg.perDrive[0].steps };
+}
+
+static void Babystep(int32_t amount, float speed, float acceleration)
+{
+	CanMessageGeneric msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.hasP = true;
+	msg.numP = 1;
+	msg.p[0] = 0;
+	msg.hasS = true;
+	msg.s = amount;
+	msg.hasV = true;
+	msg.v = speed;
+	msg.hasA = true;
+	msg.a = acceleration;
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	Check(moveInstance->ProcessBabystep(msg, reply) == GCodeResult::ok, "babystep request accepted");
+}
+
+// Run the step ISR and the Move task up to the specified time
+static void RunUntil(uint32_t until)
+{
+	for (;;)
+	{
+		const bool callbackNext = callbackScheduled && (int32_t)(callbackTime - nextSpinTime) < 0;
+		const uint32_t next = (callbackNext) ? callbackTime : nextSpinTime;
+		if ((int32_t)(next - until) > 0)
+		{
+			simTime = until;
+			return;
+		}
+		simTime = next;
+		if (callbackNext)
+		{
+			callbackScheduled = false;
+			callbackFunction(callbackParam);
+		}
+		else
+		{
+			nextSpinTime += SpinInterval;
+			moveInstance->Spin();
+		}
+	}
+}
+
+static void Start()
+{
+	steps.clear();
+	movesToSend.clear();
+	movesSent = 0;
+	callbackScheduled = false;
+	directionPin = true;
+	moveInstance = new Move();
+	moveInstance->Init();
+	nextSpinTime = simTime;
+}
+
+// Check that the speed never changes from one step to the next by more than maxSpeedChange, allowing for the acceleration and for each step
+// being generated up to StepTimer::MinInterruptInterval early when the ISR generates the steps that are due soon.
+// Speeds are in steps/sec and accelerations in steps/sec^2.
+static void CheckContinuity(float maxSpeedChange, float maxAcceleration, const char *what)
+{
+	constexpr float Jitter = (float)(StepTimer::MinInterruptInterval + 1);
+	float worst = 0.0;
+	for (size_t i = 2; i < steps.size(); ++i)
+	{
+		const float dt1 = (float)(steps[i - 1].time - steps[i - 2].time), dt2 = (float)(steps[i].time - steps[i - 1].time);
+		const float v1 = ((steps[i - 1].forwards) ? StepsPerSecond : -StepsPerSecond)/max<float>(dt1, 1.0);
+		const float v2 = ((steps[i].forwards) ? StepsPerSecond : -StepsPerSecond)/max<float>(dt2, 1.0);
+		const float allowed = maxSpeedChange
+							+ maxAcceleration * (dt1 + dt2)/(2 * StepsPerSecond)
+							+ Jitter * (fabsf(v1)/max<float>(dt1 - Jitter, 1.0) + fabsf(v2)/max<float>(dt2 - Jitter, 1.0));
+		worst = max<float>(worst, fabsf(v2 - v1) - allowed);
+	}
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%s: no sudden speed change (%.0f steps/sec more than allowed)", what, (double)worst);
+	Check(worst <= 0.0, buf);
+}
+
+static void CheckFinished(int32_t expectedPosition, const char *what)
+{
+	char msg[300];
+	snprintf(msg, sizeof(msg), "%s: final position %" PRIi32 " expected %" PRIi32, what, PositionAt(simTime), expectedPosition);
+	Check(PositionAt(simTime) == expectedPosition, msg);
+	snprintf(msg, sizeof(msg), "%s: no babysteps pending", what);
+	Check(!moveInstance->IsBabysteppingPending(), msg);
+}
+
+// Babysteps requested while moves are queued must be done in the moves already queued.
+static void TestQueuedMoves()
+{
+	constexpr float TopSpeed = 2000.0, Acceleration = 20000.0;
+	constexpr float BabystepSpeed = 400.0, BabystepAcceleration = 20000.0;
+	constexpr uint32_t AccelClocks = (uint32_t)(StepsPerSecond * TopSpeed/Acceleration);
+	constexpr uint32_t SegmentClocks = 20 * Ms;
+	constexpr unsigned int NumSegments = 100;
+
+	Start();
+	std::vector<PlannedMove> moves;
+	uint32_t t = simTime + LeadTime + 10 * Ms;
+	auto add = [&moves, &t](const PlannedMove& m) { moves.push_back(m); t += m.duration; };
+	add(QueueMove(t, 0.0, TopSpeed, TopSpeed, AccelClocks, 0, 0, LeadTime));
+	for (unsigned int i = 0; i < NumSegments; ++i)
+	{
+		add(QueueMove(t, TopSpeed, TopSpeed, TopSpeed, 0, SegmentClocks, 0, LeadTime));
+	}
+	add(QueueMove(t, TopSpeed, TopSpeed, 0.0, 0, 0, AccelClocks, LeadTime));
+
+	auto positionBefore = [&moves](size_t n) { int32_t pos = 0; for (size_t i = 0; i < n; ++i) { pos += moves[i].steps; } return pos; };
+	auto firstMoveSentAfter = [&moves](uint32_t when) { size_t i = 0; while ((int32_t)(moves[i].start - LeadTime - when) <= 0) { ++i; } return i; };
+
+	// Ask for 60 steps while about 15 moves are queued. We can add 8 to each 20ms segment, so they should all be done in the queued moves.
+	const uint32_t firstRequest = moves[30].start - 250 * Ms;
+	RunUntil(firstRequest);
+	Babystep(60, BabystepSpeed, BabystepAcceleration);
+	const size_t afterFirst = firstMoveSentAfter(firstRequest);
+	RunUntil(moves[afterFirst].start);
+	char buf[200];
+	snprintf(buf, sizeof(buf), "queued moves: babysteps done before the moves sent after the request start (%" PRIi32 " of 60)",
+				PositionAt(moves[afterFirst].start) - positionBefore(afterFirst));
+	Check(PositionAt(moves[afterFirst].start) == positionBefore(afterFirst) + 60, buf);
+
+	// Ask for more than the queued moves can take, in the other direction, so some are left for the moves that arrive later
+	const uint32_t secondRequest = moves[60].start - 250 * Ms;
+	RunUntil(secondRequest);
+	Babystep(-200, BabystepSpeed, BabystepAcceleration);
+	const size_t afterSecond = firstMoveSentAfter(secondRequest);
+	RunUntil(moves[afterSecond].start);
+	const int32_t doneInQueuedMoves = PositionAt(moves[afterSecond].start) - positionBefore(afterSecond) - 60;
+	snprintf(buf, sizeof(buf), "queued moves: queued moves take as many babysteps as they can (%" PRIi32 " of -200)", doneInQueuedMoves);
+	Check(doneInQueuedMoves < -80 && doneInQueuedMoves > -200, buf);
+
+	RunUntil(t + 1000 * Ms);
+	CheckFinished(positionBefore(moves.size()) + 60 - 200, "queued moves");
+	CheckContinuity(BabystepSpeed, Acceleration + BabystepAcceleration, "queued moves");
+
+	char diagnostics[500];
+	const StringRef reply(diagnostics, sizeof(diagnostics));
+	moveInstance->Diagnostics(reply);
+	printf("queued moves: %s", reply.c_str());
+}
+
+// When idle we make our own move to do the babysteps. A move that arrives from the main board while it is queued or executing must not be delayed.
+// We try the move arriving at a range of times, so that it arrives before the babystep move has been set up, while it is queued and while it is executing.
+static void TestIdle()
+{
+	constexpr float TopSpeed = 2000.0, Acceleration = 20000.0;
+	constexpr float BabystepSpeed = 400.0, BabystepAcceleration = 4000.0;
+	constexpr int32_t BabystepAmount = 600;
+	constexpr uint32_t AccelClocks = (uint32_t)(StepsPerSecond * TopSpeed/Acceleration);
+	constexpr uint32_t ShortLead = 50 * Ms;
+
+	const uint32_t arrivalDelays[] =
+	{
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 25, 30, 50, 100, 500, 1000, 5000, 15000, 17000, 30000
+	};
+	unsigned int numNotMade = 0, numQueued = 0, numExecuting = 0;
+	for (uint32_t delay : arrivalDelays)
+	{
+		Start();
+		RunUntil(simTime + 100 * Ms);										// get the idle count up
+		const uint32_t requestTime = simTime + SpinInterval/2;
+		RunUntil(requestTime);
+		Babystep(BabystepAmount, BabystepSpeed, BabystepAcceleration);
+
+		// The main board sends a move that is due soon
+		const uint32_t arrival = requestTime + delay * SpinInterval/2;
+		const PlannedMove m = QueueMove(arrival + ShortLead, 0.0, TopSpeed, 0.0, AccelClocks, 400 * Ms, AccelClocks, ShortLead);
+		RunUntil(arrival - 1);
+		char buf[200];
+		const StringRef reply(buf, sizeof(buf));
+		moveInstance->Diagnostics(reply);
+		unsigned int scheduled, completed;
+		int inProgress;
+		if (sscanf(buf, "Moves scheduled %u, completed %u, in progress %d", &scheduled, &completed, &inProgress) == 3)
+		{
+			if (scheduled == 0)
+			{
+				++numNotMade;
+			}
+			else if (completed == 0)
+			{
+				((inProgress != 0) ? numExecuting : numQueued) += 1;
+			}
+		}
+
+		// By the time the move should have finished, its steps and some of the babysteps must have been done
+		RunUntil(m.start + m.duration + 2 * Ms);
+		const int32_t babystepsDone = PositionAt(simTime) - m.steps;
+		char what[100];
+		snprintf(what, sizeof(what), "idle, move arriving after %.2fms", (double)(arrival - requestTime)/Ms);
+		char msg[300];
+		snprintf(msg, sizeof(msg), "%s: move not delayed (%" PRIi32 " steps done)", what, PositionAt(simTime));
+		Check(babystepsDone >= 0 && babystepsDone <= BabystepAmount, msg);
+
+		RunUntil(simTime + 3000 * Ms);
+		CheckFinished(m.steps + BabystepAmount, what);
+		CheckContinuity(BabystepSpeed, Acceleration + BabystepAcceleration, what);
+	}
+
+	printf("idle: move arrived %u times before the babystep move was set up, %u while it was queued and %u while it was executing\n",
+			numNotMade, numQueued, numExecuting);
+	Check(numNotMade != 0 && numQueued != 0 && numExecuting != 0, "idle: move arrived before, while queued and while executing");
+}
+
+int main()
+{
+	simTime = 0xFFFF0000;													// start close to the wrap of the step clock
+	TestQueuedMoves();
+	TestIdle();
+	printf("MoveBabystep: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
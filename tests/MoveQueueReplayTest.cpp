@@ -0,0 +1,248 @@
+/*
+ * MoveQueueReplayTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replays a move stream with a dense section of very short segments, as sent by the main board when printing finely tessellated curves,
+ *  through a model of how the expansion board queues moves, and counts the moves that start late because they had not reached the DDA ring
+ *  in time. That is what Move::Spin counts as "started late" in M122.
+ *
+ *  The model follows Move::Spin and the step ISR: moves wait in CAN buffers until Spin takes them, Spin adds at most one move to the ring
+ *  each time it is called and only recycles completed DDAs when it runs, the ISR chains straight on to the next move if it is in the ring,
+ *  and otherwise Spin starts it when it gets there. A move that Spin starts after its start time counts as late.
+ *  The main board sends each move a fixed lead time before it is due. We treat the CAN transport as flow controlled: the main board doesn't
+ *  send a move while all the buffers for moves are in use, because the receiver task waits for a buffer and the message waits in the CAN
+ *  controller. The main board sometimes stops sending for a while, and the Move task is sometimes held up by other work.
+ *
+ *  The lead time, message time, Spin period and the lengths and frequency of the hold-ups are estimates, not measurements.
+ *  The ring lengths include 20, which the SAMC21 boards get from their RAM budget, and 100, about what the EXP3HC budget allows.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// All times are in microseconds
+constexpr uint32_t Tick = 10;								// simulation time step
+constexpr uint32_t LeadTime = 250000;						// how long before its start time the main board sends a move
+constexpr uint32_t MessageTime = 150;						// time to send one movement message
+constexpr unsigned int MoveBuffers = 36;					// of the 40 CAN buffers, the ones available for moves
+constexpr uint32_t SpinPeriod = 100;						// time round the main task loop, including preparing a move
+constexpr unsigned int IdleSpinsBeforeStart = 10;			// as in Move::Spin
+constexpr unsigned int NumRuns = 20;						// number of different sets of hold-ups to replay the moves with
+
+struct QueuedMove
+{
+	uint32_t startTime;
+	uint32_t duration;
+};
+
+struct HoldUp
+{
+	uint32_t start;
+	uint32_t end;
+};
+
+struct Result
+{
+	unsigned int numLate;
+	unsigned int numLateOutsideDenseSection;
+	uint32_t maxLateness;
+	unsigned int maxDdasInUse;
+};
+
+static uint32_t randomState = 2026;
+
+static uint32_t Random(uint32_t low, uint32_t high)
+{
+	randomState = randomState * 1103515245u + 12345u;
+	return low + (randomState >> 8) % (high - low + 1);
+}
+
+static std::vector<HoldUp> MakeHoldUps(uint32_t endTime, uint32_t meanInterval, uint32_t minLength, uint32_t maxLength)
+{
+	std::vector<HoldUp> holdUps;
+	uint32_t t = 0;
+	for (;;)
+	{
+		t += Random(meanInterval/2, meanInterval * 3/2);
+		if (t >= endTime)
+		{
+			return holdUps;
+		}
+		const uint32_t length = Random(minLength, maxLength);
+		holdUps.push_back({ t, t + length });
+		t += length;
+	}
+}
+
+static bool IsHeldUp(const std::vector<HoldUp>& holdUps, size_t& index, uint32_t now)
+{
+	while (index < holdUps.size() && holdUps[index].end <= now)
+	{
+		++index;
+	}
+	return index < holdUps.size() && holdUps[index].start <= now;
+}
+
+static Result Replay(const std::vector<QueuedMove>& moves, size_t denseStart, size_t denseEnd, unsigned int ringLength,
+						const std::vector<HoldUp>& senderHoldUps, const std::vector<HoldUp>& spinHoldUps)
+{
+	Result r = { 0, 0, 0, 0 };
+	size_t nextToSend = 0, nextToAdd = 0, nextToFree = 0;	// moves before nextToSend are in CAN buffers or the ring, moves before nextToAdd are in the ring
+	size_t senderHoldUp = 0, spinHoldUp = 0;
+	uint32_t senderFreeAt = 0, nextSpin = 0;
+	unsigned int idleCount = 0;
+	bool executing = false;
+	size_t current = 0;										// the move executing, or the next one to execute
+	uint32_t currentEnd = 0;
+
+	const uint32_t endTime = moves.back().startTime + moves.back().duration + LeadTime;
+	for (uint32_t now = 0; now < endTime && current < moves.size(); now += Tick)
+	{
+		// Main board
+		if (   nextToSend < moves.size()
+			&& now >= senderFreeAt
+			&& now + LeadTime >= moves[nextToSend].startTime
+			&& nextToSend - nextToAdd < MoveBuffers
+			&& !IsHeldUp(senderHoldUps, senderHoldUp, now)
+		   )
+		{
+			++nextToSend;
+			senderFreeAt = now + MessageTime;
+		}
+
+		// Step ISR. When a move finishes it starts the next one if it is in the ring.
+		if (executing && now >= currentEnd)
+		{
+			++current;
+			executing = (current < nextToAdd);
+			if (executing)
+			{
+				const uint32_t start = (moves[current].startTime > currentEnd) ? moves[current].startTime : currentEnd;
+				currentEnd = start + moves[current].duration;
+			}
+		}
+
+		// Move task
+		if (now >= nextSpin && !IsHeldUp(spinHoldUps, spinHoldUp, now))
+		{
+			nextSpin = now + SpinPeriod;
+			if (idleCount <= IdleSpinsBeforeStart)
+			{
+				++idleCount;
+			}
+			nextToFree = current;							// recycle the DDAs of completed moves
+			const bool canAddMove = (nextToAdd - nextToFree < ringLength);
+			if (canAddMove && nextToAdd < nextToSend)
+			{
+				++nextToAdd;
+				idleCount = 0;
+				if (nextToAdd - nextToFree > r.maxDdasInUse)
+				{
+					r.maxDdasInUse = nextToAdd - nextToFree;
+				}
+			}
+
+			if (!executing && current < nextToAdd && (!canAddMove || idleCount > IdleSpinsBeforeStart))
+			{
+				const QueuedMove& m = moves[current];
+				if (m.startTime < now)
+				{
+					++r.numLate;
+					if (current < denseStart || current >= denseEnd)
+					{
+						++r.numLateOutsideDenseSection;
+					}
+					if (now - m.startTime > r.maxLateness)
+					{
+						r.maxLateness = now - m.startTime;
+					}
+				}
+				executing = true;
+				currentEnd = ((m.startTime > now) ? m.startTime : now) + m.duration;
+			}
+		}
+	}
+	Check(current == moves.size(), "all moves executed");
+	return r;
+}
+
+int main()
+{
+	// 100 moves of 20ms, then 3000 segments of 0.4 to 1.2ms, then 100 moves of 20ms
+	std::vector<QueuedMove> moves;
+	uint32_t t = 500000;
+	auto addMove = [&moves, &t](uint32_t duration) { moves.push_back({ t, duration }); t += duration; };
+	for (int i = 0; i < 100; ++i)
+	{
+		addMove(20000);
+	}
+	const size_t denseStart = moves.size();
+	for (int i = 0; i < 3000; ++i)
+	{
+		addMove(Random(400, 1200));
+	}
+	const size_t denseEnd = moves.size();
+	for (int i = 0; i < 100; ++i)
+	{
+		addMove(20000);
+	}
+	const uint32_t endTime = t + LeadTime;
+
+	// Without hold-ups even a short ring keeps up
+	const std::vector<HoldUp> none;
+	const Result smooth = Replay(moves, denseStart, denseEnd, 20, none, none);
+	Check(smooth.numLate == 0, "no late moves without hold-ups");
+
+	// The main board stops sending for 5 to 60ms about every 300ms, and the Move task is held up for 2 to 20ms about every 200ms.
+	// Each ring length is replayed with the same sets of hold-ups.
+	std::vector<std::vector<HoldUp>> senderHoldUps, spinHoldUps;
+	for (unsigned int run = 0; run < NumRuns; ++run)
+	{
+		senderHoldUps.push_back(MakeHoldUps(endTime, 300000, 5000, 60000));
+		spinHoldUps.push_back(MakeHoldUps(endTime, 200000, 2000, 20000));
+	}
+
+	const unsigned int ringLengths[] = { 8, 12, 20, 30, 40, 60, 80, 100, 120 };
+	Result results[sizeof(ringLengths)/sizeof(ringLengths[0])];
+	for (size_t i = 0; i < sizeof(ringLengths)/sizeof(ringLengths[0]); ++i)
+	{
+		Result r = { 0, 0, 0, 0 };
+		for (unsigned int run = 0; run < NumRuns; ++run)
+		{
+			const Result rr = Replay(moves, denseStart, denseEnd, ringLengths[i], senderHoldUps[run], spinHoldUps[run]);
+			r.numLate += rr.numLate;
+			r.numLateOutsideDenseSection += rr.numLateOutsideDenseSection;
+			r.maxLateness = (rr.maxLateness > r.maxLateness) ? rr.maxLateness : r.maxLateness;
+			r.maxDdasInUse = (rr.maxDdasInUse > r.maxDdasInUse) ? rr.maxDdasInUse : r.maxDdasInUse;
+		}
+		results[i] = r;
+		printf("ring length %3u: %4u moves started late, longest %5.1fms, %u outside the dense section, max %3u DDAs in use\n",
+				ringLengths[i], r.numLate, (double)r.maxLateness/1000.0, r.numLateOutsideDenseSection, r.maxDdasInUse);
+		Check(r.numLateOutsideDenseSection == 0, "long moves never start late");
+		Check(r.maxDdasInUse <= ringLengths[i], "ring length respected");
+		Check(i == 0 || r.numLate <= results[i - 1].numLate, "a longer ring never starves more");
+	}
+
+	const Result& shortRing = results[2];
+	const Result& longRing = results[7];
+	Check(shortRing.numLate != 0, "a 20 entry ring starves in the dense section");
+	Check(longRing.numLate == 0, "a 100 entry ring rides out the hold-ups");
+
+	printf("MoveQueueReplay: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,162 @@
+/*
+ * PowerFailReactionTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Measures how soon the power fail detection on the EXP3HC freezes the steps after VIN falls through the power fail threshold.
+ *  VIN falls exponentially from 24V and is sampled in an ADC conversion sequence timed as in AnalogThresholdsTest. The freeze happens when
+ *  AnalogThresholds, called from the DMA completion interrupt at the end of the sequence, sees the raw reading fall below the threshold.
+ *  For comparison we also find when the 8-reading average that Platform::Spin uses falls below the same threshold, assuming that Spin
+ *  sees each new average as soon as the AIN task has fed in the reading.
+ */
+
+#include "AnalogThresholds.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// As in Config/EXP3HC.h and Platform.h
+constexpr double VinDividerRatio = (60.4 + 4.7)/4.7;
+constexpr double VinMonitorVoltageRange = VinDividerRatio * 3.3;
+constexpr unsigned int AdcBits = 16;
+constexpr size_t VinReadingsAveraged = 8;
+
+// Times are in step clocks (750kHz). The sequence timing is the same as in AnalogThresholdsTest.
+constexpr double StepClocksPerMillisecond = 750.0;
+constexpr size_t NumChannels = 8;
+constexpr double ConversionTicks = 128;
+constexpr double GapTicks = 1500;
+constexpr double CycleTicks = ConversionTicks * NumChannels + GapTicks;
+
+constexpr double SupplyVoltage = 24.0;
+constexpr double ThresholdVoltage = 20.0;
+
+static uint16_t VoltsToReading(double volts)
+{
+	return (uint16_t)std::max(0.0, std::min(65535.0, volts * ((1u << AdcBits)/VinMonitorVoltageRange)));
+}
+
+struct Reaction
+{
+	double freeze;									// step clocks from VIN crossing the threshold to the freeze in the DMA interrupt
+	double averaged;								// step clocks from VIN crossing the threshold to the average seen by Spin falling below it
+};
+
+// Simulate a supply that starts to fail at failTime and falls with time constant tau, with VIN at position vinPosition in the conversion sequence
+static Reaction Simulate(double tau, double failTime, size_t vinPosition)
+{
+	const uint16_t threshold = VoltsToReading(ThresholdVoltage);	// PowerVoltageToAdcReading in Platform.cpp does the same
+	AnalogThresholds thresholds;
+	thresholds.Enable(vinPosition, threshold, threshold, true);
+
+	uint16_t filter[VinReadingsAveraged];
+	std::fill(filter, filter + VinReadingsAveraged, VoltsToReading(SupplyVoltage));
+	size_t filterIndex = 0;
+
+	const double crossing = failTime + tau * log(SupplyVoltage/ThresholdVoltage);
+	Reaction r = { -1.0, -1.0 };
+	for (double t = 0.0; r.freeze < 0.0 || r.averaged < 0.0; t += CycleTicks)
+	{
+		uint16_t readings[NumChannels];
+		std::fill(readings, readings + NumChannels, 30000);
+		const double sampleTime = t + ConversionTicks * (vinPosition + 1);
+		readings[vinPosition] = VoltsToReading((sampleTime < failTime) ? SupplyVoltage : SupplyVoltage * exp(-(sampleTime - failTime)/tau));
+
+		const double sequenceEnd = t + ConversionTicks * NumChannels;
+		if (r.freeze < 0.0 && (thresholds.Check(readings, NumChannels) & (1u << vinPosition)) != 0)
+		{
+			r.freeze = sequenceEnd - crossing;
+		}
+
+		filter[filterIndex] = readings[vinPosition];
+		filterIndex = (filterIndex + 1) % VinReadingsAveraged;
+		uint32_t sum = 0;
+		for (uint16_t reading : filter)
+		{
+			sum += reading;
+		}
+		if (r.averaged < 0.0 && sum/VinReadingsAveraged < threshold)
+		{
+			r.averaged = sequenceEnd - crossing;
+		}
+	}
+	return r;
+}
+
+int main()
+{
+	// The supply fails at 64 points through the conversion cycle, with VIN first and last in the sequence
+	constexpr int NumPhases = 64;
+	const double taus[] = { 5.0, 20.0, 50.0, 200.0 };
+	double worstFreeze = 0.0;
+	bool withinOneCycle = true, neverLater = true;
+	printf("   tau  freeze mean/max   averaged mean/max   VIN reaches 10V\n");
+	for (double tauMs : taus)
+	{
+		const double tau = tauMs * StepClocksPerMillisecond;
+		double freezeSum = 0.0, freezeMax = 0.0, averagedSum = 0.0, averagedMax = 0.0;
+		int numRuns = 0;
+		for (size_t vinPosition : { (size_t)0, NumChannels - 1 })
+		{
+			for (int phase = 0; phase < NumPhases; ++phase)
+			{
+				const Reaction r = Simulate(tau, 10 * CycleTicks + (CycleTicks * phase)/NumPhases, vinPosition);
+				freezeSum += r.freeze;
+				averagedSum += r.averaged;
+				freezeMax = std::max(freezeMax, r.freeze);
+				averagedMax = std::max(averagedMax, r.averaged);
+				++numRuns;
+
+				// The crossing is caught by the next VIN reading, and the interrupt comes at the end of that sequence
+				withinOneCycle = withinOneCycle && r.freeze >= 0.0 && r.freeze <= CycleTicks + ConversionTicks * (NumChannels - 1 - vinPosition);
+				neverLater = neverLater && r.freeze <= r.averaged;
+			}
+		}
+		worstFreeze = std::max(worstFreeze, freezeMax);
+		printf("%4.0fms  %5.1f/%5.1fms       %5.1f/%5.1fms       %5.1fms\n", tauMs,
+				freezeSum/numRuns/StepClocksPerMillisecond, freezeMax/StepClocksPerMillisecond,
+				averagedSum/numRuns/StepClocksPerMillisecond, averagedMax/StepClocksPerMillisecond, tauMs * log(ThresholdVoltage/10.0));
+	}
+	printf("worst freeze %.2fms after VIN crossed the threshold, ADC cycle %.2fms\n", worstFreeze/StepClocksPerMillisecond, CycleTicks/StepClocksPerMillisecond);
+	Check(withinOneCycle, "freeze within one ADC cycle of the crossing, plus the conversions after VIN in the sequence");
+	Check(neverLater, "freeze never later than the averaged reading falls below the threshold");
+
+	// Noise on a healthy supply doesn't trigger the detection
+	{
+		AnalogThresholds thresholds;
+		const uint16_t threshold = VoltsToReading(ThresholdVoltage);
+		thresholds.Enable(0, threshold, threshold, true);
+		std::mt19937 rng(1);
+		std::normal_distribution<double> noise(0.0, 0.3);
+		unsigned int falseTriggers = 0;
+		for (int sequence = 0; sequence < 1000000; ++sequence)
+		{
+			uint16_t readings[NumChannels];
+			std::fill(readings, readings + NumChannels, 30000);
+			readings[0] = VoltsToReading(SupplyVoltage + noise(rng));
+			if (thresholds.Check(readings, NumChannels) != 0)
+			{
+				++falseTriggers;
+			}
+		}
+		printf("%u false triggers in 1000000 sequences at %.0fV with 0.3V rms noise\n", falseTriggers, SupplyVoltage);
+		Check(falseTriggers == 0, "no false triggers");
+	}
+
+	printf("PowerFailReaction: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
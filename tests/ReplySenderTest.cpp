@@ -0,0 +1,376 @@
+/*
+ * ReplySenderTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replays bursts of requests from the main board through the reply sender, with the same number of CAN buffers as the board has or fewer,
+ *  and models the time that each frame takes on the bus and that each request takes to process. The main board keeps a few requests
+ *  outstanding at once and checks that every reply arrives once, in order, with its fragments in order and its text intact or, if we
+ *  ran out of buffers, cut short with "..." on the end. Reports the time from the first request to the last reply with and without packing:
+ *  packing saves bus time, but because replies are held until no more requests are waiting, a main board that waits for replies before
+ *  sending more requests may see them later.
+ *  The reply sender must never wait for a buffer, so delay() counts as a failure.
+ */
+
+#include "CommandProcessing/ReplySender.h"
+#include "CanMessageBuffer.h"
+#include <CAN/CanMultipleRepliesMessages.h>
+#include <CAN/CanMainBoardCapabilitiesMessages.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+static unsigned int numDelays = 0;
+
+void delay(uint32_t ms)
+{
+	++numDelays;
+}
+
+// Bus and processing time model, in nanoseconds
+constexpr uint32_t NominalBitTime = 1000;									// 1Mbps arbitration phase
+constexpr uint32_t DataBitTime = 250;										// 4Mbps data phase
+constexpr uint32_t NominalBits = 30;										// SOF, ID, control bits and the end of frame
+constexpr uint32_t DataPhaseOverheadBits = 30;								// DLC, stuff count and CRC
+constexpr uint32_t RequestLength = 16;										// data length of a typical request
+constexpr uint32_t ProcessingTime = 200000;								// time to process one configuration request
+constexpr unsigned int MaxRequestsPerSpin = 16;								// as in CommandProcessor.cpp
+constexpr CanAddress MainBoardAddress = 0;
+
+static uint32_t FdLength(size_t dataLength)
+{
+	static const uint32_t lengths[] = { 8, 12, 16, 20, 24, 32, 48, 64 };
+	for (uint32_t len : lengths)
+	{
+		if (dataLength <= len)
+		{
+			return len;
+		}
+	}
+	return 64;
+}
+
+static uint32_t FrameTime(size_t dataLength)
+{
+	return NominalBits * NominalBitTime + (FdLength(dataLength) * 8 + DataPhaseOverheadBits) * DataBitTime;
+}
+
+static std::deque<CanMessageBuffer*> txQueue;
+
+void CanInterface::QueueResponse(CanMessageBuffer *buf)
+{
+	txQueue.push_back(buf);
+}
+
+struct BurstResult
+{
+	uint32_t endToEndTime;
+	unsigned int replyFrames;
+	unsigned int requestsLost;
+	unsigned int truncated;
+	bool allOk;
+};
+
+// The main board end: reassembles fragmented replies and unpacks packed ones, and checks them against what we expect
+class MainBoard
+{
+public:
+	MainBoard(const std::vector<std::string>& p_replies) : replies(p_replies), received(p_replies.size()), complete(p_replies.size(), false) { }
+
+	void Receive(const CanMessageBuffer *buf);
+	size_t NumComplete() const { return numComplete; }
+	bool IsComplete(size_t rid) const { return complete[rid]; }
+
+	bool ok = true;
+	unsigned int truncated = 0;
+
+private:
+	void Completed(size_t rid);
+
+	const std::vector<std::string>& replies;
+	std::vector<std::string> received;
+	std::vector<bool> complete;
+	size_t numComplete = 0;
+	size_t nextExpected = 0;
+	unsigned int nextFragment = 0;
+};
+
+void MainBoard::Receive(const CanMessageBuffer *buf)
+{
+	if (buf->id.Dst() != MainBoardAddress)
+	{
+		ok = false;
+		return;
+	}
+
+	if (buf->id.MsgType() == CanMessageType::multipleStandardReplies)
+	{
+		const CanMessageMultipleStandardReplies& msg = reinterpret_cast<const CanMessageMultipleStandardReplies&>(buf->msg);
+		size_t offset = 0;
+		for (unsigned int i = 0; i < msg.numReplies; ++i)
+		{
+			CanReplyEntryHeader hdr;
+			memcpy(&hdr, msg.data + offset, sizeof(hdr));
+			offset += sizeof(hdr);
+			if (hdr.requestId >= replies.size() || nextFragment != 0 || offset + hdr.textLength > CanMessageMultipleStandardReplies::MaxDataLength)
+			{
+				ok = false;
+				return;
+			}
+			received[hdr.requestId].assign((const char*)msg.data + offset, hdr.textLength);
+			offset += hdr.textLength;
+			Completed(hdr.requestId);
+		}
+		if (msg.GetActualDataLength(offset) != buf->dataLength)
+		{
+			ok = false;
+		}
+		return;
+	}
+
+	const CanMessageStandardReply& msg = buf->msg.standardReply;
+	if (msg.requestId >= replies.size() || msg.fragmentNumber != nextFragment)
+	{
+		ok = false;
+		return;
+	}
+	const size_t textLength = buf->dataLength - msg.GetActualDataLength(0);
+	received[msg.requestId].append(msg.text, strnlen(msg.text, textLength));
+	if (msg.moreFollows)
+	{
+		++nextFragment;
+	}
+	else
+	{
+		nextFragment = 0;
+		Completed(msg.requestId);
+	}
+}
+
+void MainBoard::Completed(size_t rid)
+{
+	// Replies must arrive in the order of the requests, once each
+	if (rid != nextExpected || complete[rid])
+	{
+		ok = false;
+		return;
+	}
+	const std::string& expected = replies[rid];
+	const std::string& got = received[rid];
+	if (got != expected)
+	{
+		// A reply may be cut short if we ran out of buffers, but then it must end in "..." and start with what we sent
+		if (   got.size() < 3 || got.size() >= expected.size() || got.compare(got.size() - 3, 3, "...") != 0
+			|| expected.compare(0, got.size() - 3, got, 0, got.size() - 3) != 0
+		   )
+		{
+			ok = false;
+		}
+		++truncated;
+	}
+	complete[rid] = true;
+	++nextExpected;
+	++numComplete;
+}
+
+// Replay a burst of requests that produce the specified replies, with the main board keeping up to 'window' requests outstanding
+static BurstResult RunBurst(const std::vector<std::string>& replies, unsigned int numBuffers, unsigned int window, bool packing)
+{
+	CanMessageBuffer::Init(numBuffers);
+	ReplySender::SetMainBoardCapabilities((packing) ? CanMessageMainBoardCapabilities::CapabilityMultipleStandardReplies : 0);
+	txQueue.clear();
+	numDelays = 0;
+
+	MainBoard mainBoard(replies);
+	std::deque<CanMessageBuffer*> rxQueue;									// requests received and waiting to be processed
+	std::deque<size_t> rxRequestIds;
+	size_t nextToSend = 0;
+	size_t lastSentIncomplete = 0;
+	BurstResult result = { 0, 0, 0, 0, true };
+
+	uint64_t now = 0, busFreeAt = 0, processorFreeAt = 0;
+	CanMessageBuffer *onBus = nullptr;										// our reply that is being transmitted
+	bool requestOnBus = false;
+	size_t requestOnBusId = 0;
+	CanMessageBuffer *processing = nullptr;									// the request that the command processor is working on
+	size_t processingId = 0;
+	unsigned int numProcessedThisSpin = 0;
+	while (mainBoard.NumComplete() < replies.size())
+	{
+		if (now > 1000000000)
+		{
+			result.allOk = false;											// taking more than a second means something is stuck
+			break;
+		}
+
+		// Events at the end of each frame on the bus
+		if (now >= busFreeAt)
+		{
+			if (onBus != nullptr)
+			{
+				mainBoard.Receive(onBus);
+				CanMessageBuffer::Free(onBus);
+				onBus = nullptr;
+				result.endToEndTime = now;
+			}
+			else if (requestOnBus)
+			{
+				requestOnBus = false;
+				CanMessageBuffer * const buf = CanMessageBuffer::Allocate();
+				if (buf == nullptr)
+				{
+					++result.requestsLost;										// the main board will time out and send it again
+					nextToSend = requestOnBusId;
+				}
+				else
+				{
+					rxQueue.push_back(buf);
+					rxRequestIds.push_back(requestOnBusId);
+				}
+			}
+
+			// Start the next frame. In this model our replies win arbitration over the main board's requests.
+			while (lastSentIncomplete < nextToSend && mainBoard.IsComplete(lastSentIncomplete))
+			{
+				++lastSentIncomplete;
+			}
+			if (!txQueue.empty())
+			{
+				onBus = txQueue.front();
+				txQueue.pop_front();
+				++result.replyFrames;
+				busFreeAt = now + FrameTime(onBus->dataLength);
+			}
+			else if (nextToSend < replies.size() && nextToSend - lastSentIncomplete < window)
+			{
+				requestOnBus = true;
+				requestOnBusId = nextToSend++;
+				busFreeAt = now + FrameTime(RequestLength);
+			}
+		}
+
+		// The command processor works through the waiting requests as CommandProcessor::Spin does. It replies to each one when it has
+		// processed it, and sends any replies that it is holding on to when no more are waiting or it has processed the maximum number.
+		if (processing != nullptr && now >= processorFreeAt)
+		{
+			char text[FormatStringLength];
+			const StringRef replyRef(text, sizeof(text));
+			replyRef.copy(replies[processingId].c_str());
+			ReplySender::AddReply(processing, processing->id.Src(), (CanRequestId)processingId, GCodeResult::ok, 0, replyRef);
+			processing = nullptr;
+			++numProcessedThisSpin;
+		}
+		if (processing == nullptr)
+		{
+			if (!rxQueue.empty() && numProcessedThisSpin < MaxRequestsPerSpin)
+			{
+				processing = rxQueue.front();
+				rxQueue.pop_front();
+				processingId = rxRequestIds.front();
+				rxRequestIds.pop_front();
+				processing->id.SetReply(CanMessageType::standardReply, MainBoardAddress, CanInterface::GetCanAddress());
+				processorFreeAt = now + ProcessingTime;
+			}
+			else if (numProcessedThisSpin != 0)
+			{
+				ReplySender::FlushReplies();
+				numProcessedThisSpin = 0;
+			}
+		}
+
+		// Move on to the next event
+		if (busFreeAt <= now && !txQueue.empty())
+		{
+			continue;														// start sending the replies just queued
+		}
+		uint64_t next = (busFreeAt > now) ? busFreeAt : now + 1000;
+		if (processing != nullptr && processorFreeAt < next)
+		{
+			next = processorFreeAt;
+		}
+		now = next;
+	}
+
+	result.truncated = mainBoard.truncated;
+	result.allOk = result.allOk && mainBoard.ok && numDelays == 0 && CanMessageBuffer::GetFreeBuffers() == numBuffers;
+	return result;
+}
+
+static void Report(const char *what, const BurstResult& r, size_t numRequests)
+{
+	printf("%s: %zu replies in %.2fms, %u reply frames, %u requests lost for lack of buffers, %u replies truncated\n",
+			what, numRequests, r.endToEndTime * 1.0e-6, r.replyFrames, r.requestsLost, r.truncated);
+}
+
+int main()
+{
+	constexpr unsigned int BoardBuffers = 40;								// NumCanBuffers in CanInterface.cpp
+
+	// A burst of configuration commands with empty or short replies
+	std::vector<std::string> configReplies;
+	for (unsigned int i = 0; i < 100; ++i)
+	{
+		configReplies.push_back((i % 10 == 9) ? "Warning: parameter out of range, limit applied" : "");
+	}
+	const BurstResult unpacked = RunBurst(configReplies, BoardBuffers, 8, false);
+	Check(unpacked.allOk && unpacked.truncated == 0 && unpacked.requestsLost == 0, "configuration burst without packing");
+	Check(unpacked.replyFrames == configReplies.size(), "one frame per reply without packing");
+	Report("configuration burst, no packing", unpacked, configReplies.size());
+
+	const BurstResult packed = RunBurst(configReplies, BoardBuffers, 8, true);
+	Check(packed.allOk && packed.truncated == 0 && packed.requestsLost == 0, "configuration burst with packing");
+	Check(packed.replyFrames * 4 <= unpacked.replyFrames, "packing saves frames");
+	Report("configuration burst, packing", packed, configReplies.size());
+
+	// Long replies that need several fragments each, mixed with short ones
+	std::vector<std::string> longReplies;
+	for (unsigned int i = 0; i < 40; ++i)
+	{
+		std::string s;
+		if (i % 2 == 0)
+		{
+			while (s.size() < FormatStringLength - 20)
+			{
+				s += "Driver " + std::to_string(i) + ": position 1234, ok, ";
+			}
+			s.resize(FormatStringLength - 20);
+		}
+		longReplies.push_back(s);
+	}
+	const BurstResult fragmented = RunBurst(longReplies, BoardBuffers, 8, true);
+	Check(fragmented.allOk && fragmented.truncated == 0, "fragmented replies with enough buffers");
+	Report("long replies, 40 buffers", fragmented, longReplies.size());
+
+	// Too few buffers for the long replies: they must be cut short rather than wait for buffers, and nothing must get out of order
+	const BurstResult starved = RunBurst(longReplies, 4, 4, true);
+	Check(starved.allOk, "replies in order and intact or cut short cleanly with 4 buffers");
+	Check(starved.truncated != 0, "replies truncated when short of buffers");
+	Report("long replies, 4 buffers", starved, longReplies.size());
+
+	// A single reply exactly filling the fragments, and one just over
+	const std::string exact(2 * CanMessageStandardReply::MaxTextLength, 'x');
+	const std::string over = exact + "y";
+	const BurstResult edges = RunBurst({ exact, over, std::string(FormatStringLength - 1, 'z') }, BoardBuffers, 1, false);
+	Check(edges.allOk && edges.truncated == 0 && edges.replyFrames == 2 + 3 + 5, "fragment boundaries");
+
+	char text[200];
+	const StringRef diag(text, sizeof(text));
+	ReplySender::Diagnostics(diag);
+	printf("%s\n", diag.c_str());
+
+	printf("ReplySender: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,140 @@
+/*
+ * ServoTrajectoryTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Drives ServoTrajectory with random targets, speeds and accelerations, including new targets set part way through a move, and checks that
+ *  the speed and acceleration limits are respected, that the servo never passes the target, and that it arrives in a bounded number of frames.
+ */
+
+#include "ServoTrajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+static std::mt19937 rng(1);
+static int failures = 0;
+
+static int32_t RandomIn(int32_t low, int32_t high)
+{
+	return low + (int32_t)(rng() % (uint32_t)(high - low + 1));
+}
+
+// Advance until the servo stops or 'frames' frames have elapsed, checking the limits. Return the number of frames taken.
+// If the target was changed to one that is closer than the braking distance then the servo stops at the target rather than overshoot it,
+// so the acceleration limit can't be met in the frame in which it arrives. Pass smoothArrival = false in that case.
+static unsigned int Follow(ServoTrajectory& traj, int32_t maxSpeed, int32_t acceleration, unsigned int frames, bool smoothArrival)
+{
+	const int32_t target = traj.GetTarget();
+	unsigned int frame = 0;
+	while (traj.IsMoving() && frame < frames)
+	{
+		const int32_t oldPosition = traj.GetPosition();
+		const int32_t oldSpeed = traj.GetSpeed();
+		const bool wasBehind = (oldPosition < target), wasAhead = (oldPosition > target);
+		const bool movedAway = (wasBehind && oldSpeed < 0) || (wasAhead && oldSpeed > 0);
+		(void)traj.Advance();
+		++frame;
+
+		// In the frame in which the servo arrives it moves less than a full step at the new speed, then stops
+		const int32_t position = traj.GetPosition();
+		const int32_t speed = (traj.IsMoving()) ? traj.GetSpeed() : position - oldPosition;
+		if (   abs(speed) > std::max(maxSpeed, abs(oldSpeed))
+			|| (abs(speed - oldSpeed) > acceleration && (smoothArrival || traj.IsMoving()))
+			|| position - oldPosition != speed
+			|| (!traj.IsMoving() && position != target)
+			|| (!movedAway && ((wasBehind && position > target) || (wasAhead && position < target)))
+		   )
+		{
+			++failures;
+			printf("limit violated: position %d -> %d, speed %d -> %d, target %d, max speed %d, acceleration %d\n",
+					(int)oldPosition, (int)position, (int)oldSpeed, (int)speed, (int)target, (int)maxSpeed, (int)acceleration);
+			return frame;
+		}
+	}
+	return frame;
+}
+
+// The number of frames that an ideal trapezoidal profile takes to cover 'distance', plus a margin for the integer arithmetic
+static unsigned int FrameBound(int32_t distance, int32_t maxSpeed, int32_t acceleration)
+{
+	const double d = fabs((double)distance);
+	const double accelDistance = (double)maxSpeed * maxSpeed/acceleration;
+	const double ideal = (d < accelDistance) ? 2 * sqrt(d/acceleration) : d/maxSpeed + (double)maxSpeed/acceleration;
+	return (unsigned int)(ideal * 1.1) + 4;
+}
+
+int main()
+{
+	constexpr int32_t MinPosition = 500 * ServoTrajectory::UnitsPerMicrosecond;
+	constexpr int32_t MaxPosition = 2500 * ServoTrajectory::UnitsPerMicrosecond;
+
+	// Single moves from rest
+	unsigned int slowMoves = 0;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const int32_t maxSpeed = RandomIn(1, 20000), acceleration = RandomIn(1, 2000);
+		const int32_t start = RandomIn(MinPosition, MaxPosition), target = RandomIn(MinPosition, MaxPosition);
+		ServoTrajectory traj;
+		traj.SetPosition(start);
+		traj.SetTarget(target, maxSpeed, acceleration);
+		const unsigned int bound = FrameBound(target - start, maxSpeed, acceleration);
+		const unsigned int frames = Follow(traj, maxSpeed, acceleration, 2 * bound + 100, true);
+		if (traj.IsMoving() || traj.GetPosition() != target || traj.GetSpeed() != 0)
+		{
+			++failures;
+			printf("move %d -> %d did not finish at the target: position %d speed %d\n", (int)start, (int)target, (int)traj.GetPosition(), (int)traj.GetSpeed());
+		}
+		else if (frames > bound)
+		{
+			++slowMoves;
+		}
+	}
+	printf("single moves: %u of 20000 took longer than the trapezoidal profile allows\n", slowMoves);
+	if (slowMoves != 0)
+	{
+		++failures;
+	}
+
+	// New targets set while moving, possibly behind the servo, with different limits each time
+	for (int i = 0; i < 5000; ++i)
+	{
+		ServoTrajectory traj;
+		traj.SetPosition(RandomIn(MinPosition, MaxPosition));
+		int32_t maxSpeed = 0, acceleration = 0;
+		for (int leg = 0; leg < 5; ++leg)
+		{
+			maxSpeed = RandomIn(1, 20000);
+			acceleration = RandomIn(1, 2000);
+			traj.SetTarget(RandomIn(MinPosition, MaxPosition), maxSpeed, acceleration);
+			(void)Follow(traj, maxSpeed, acceleration, RandomIn(0, 200), false);
+		}
+		(void)Follow(traj, maxSpeed, acceleration, 1000000, false);
+		if (traj.IsMoving() || traj.GetPosition() != traj.GetTarget() || traj.GetSpeed() != 0)
+		{
+			++failures;
+			printf("retargeted move did not finish at the target\n");
+		}
+	}
+
+	// Setting the position directly stops the servo there
+	{
+		ServoTrajectory traj;
+		traj.SetPosition(MinPosition);
+		traj.SetTarget(MaxPosition, 1000, 10);
+		(void)Follow(traj, 1000, 10, 50, true);
+		traj.SetPosition(MinPosition + 1234);
+		if (traj.IsMoving() || traj.GetSpeed() != 0 || traj.GetPosition() != MinPosition + 1234 || traj.Advance())
+		{
+			++failures;
+			printf("SetPosition did not stop the servo\n");
+		}
+	}
+
+	printf("ServoTrajectory: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
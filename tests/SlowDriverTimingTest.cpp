@@ -0,0 +1,257 @@
+/*
+ * SlowDriverTimingTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Simulates the step ISR driving one slow external driver, as on the EXP1XD, in two ways: the way it used to work, waiting in the ISR for
+ *  the step low time, the direction setup and hold times and the whole step high time; and the way it works now, using SlowDriverTiming to
+ *  hold off steps and defer direction changes whose wait is long enough to schedule another interrupt, and ending the step pulse after the
+ *  next step time has been calculated.
+ *  The motor runs at a range of step rates and reverses direction every few steps. For each driver timing and step rate we check that every
+ *  pulse meets the driver timing, and report the longest ISR, the fraction of the time spent in the ISR and the highest step rate at which
+ *  the steps keep to their schedule.
+ *
+ *  The time for the ISR to be entered and left and for the next step time to be calculated are estimates for the SAMC21, not measurements.
+ */
+
+#include "Movement/SlowDriverTiming.h"
+#include <cstdio>
+#include <cstdint>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// The simulation runs in sixteenths of a step clock, so that the CPU times can be shorter than a step clock
+constexpr uint32_t StepClockRate = 48000000/64;						// as in StepTimer.h
+constexpr uint32_t Sub = 16;
+constexpr uint32_t MinInterruptInterval = 6 * Sub;					// StepTimer::MinInterruptInterval
+constexpr uint32_t IsrEntryExit = Sub * 2 * StepClockRate/1000000;	// 2us to enter and leave the ISR and schedule the next interrupt
+constexpr uint32_t StepCalcTime = Sub * 6 * StepClockRate/1000000;	// 6us to calculate the next step time
+constexpr unsigned int StepsPerReversal = 20;
+
+struct DriverTiming
+{
+	const char *name;
+	float microseconds[4];											// step high, step low, direction setup, direction hold as in M569 T
+	uint32_t clocks[4];
+};
+
+struct Result
+{
+	uint32_t maxIsrTime;
+	uint64_t totalIsrTime;
+	uint64_t totalTime;
+	uint32_t maxLateness;
+	unsigned int holdoffs;
+	unsigned int directionChangesDeferred;
+	bool timingOk;
+};
+
+// Convert microseconds to step clocks, rounding up as Platform does
+static uint32_t ToClocks(float us)
+{
+	return (uint32_t)(((float)StepClockRate * us * 0.000001) + 0.99);
+}
+
+static Result Simulate(const DriverTiming& dt, uint32_t stepRate, bool scheduled, unsigned int numSteps)
+{
+	const uint32_t stepHigh = dt.clocks[0] * Sub, stepLow = dt.clocks[1] * Sub, dirSetup = dt.clocks[2] * Sub, dirHold = dt.clocks[3] * Sub;
+	const uint32_t interval = StepClockRate * Sub/stepRate;
+	Result r = { 0, 0, 0, 0, 0, 0, true };
+
+	uint32_t lastStepLowTime = 0, lastDirChangeTime = 0, lastStepHighTime = 0;
+	uint32_t isrFreeAt = 0;
+	uint32_t holdoffTime = 0;
+	bool holdoffPending = false;
+	bool directionChangePending = false;
+	unsigned int step = 0;
+	uint32_t due = interval;
+	while (step < numSteps)
+	{
+		// The ISR runs when the step is due or when the held off step or direction change is allowed, or as soon as the previous ISR has finished
+		const uint32_t wanted = (holdoffPending) ? holdoffTime : due;
+		const uint32_t start = (wanted > isrFreeAt) ? wanted : isrFreeAt;
+		uint32_t now = start + IsrEntryExit/2;
+		holdoffPending = false;
+
+		// Make a deferred direction change, as DDA::StepDrivers does before and after stepping. Returns false if we must hold off for it.
+		auto directionChangeDone = [&]() -> bool
+		{
+			const uint32_t holdWait = SlowDriverTiming::GetRemainingTime(now, lastStepLowTime, dirHold);
+			if (SlowDriverTiming::ShouldHoldOff(holdWait, MinInterruptInterval))
+			{
+				holdoffTime = now + holdWait;
+				holdoffPending = true;
+				return false;
+			}
+			now += holdWait;
+			lastDirChangeTime = now;
+			directionChangePending = false;
+			return true;
+		};
+
+		// See whether the step is due yet
+		const bool stepAllowed = (!directionChangePending || directionChangeDone()) && due <= now + MinInterruptInterval;
+		const uint32_t wait = SlowDriverTiming::GetStepWait(now, lastStepLowTime, lastDirChangeTime, stepLow, dirSetup);
+		if (stepAllowed && scheduled && wait != 0 && SlowDriverTiming::ShouldHoldOff(wait, MinInterruptInterval))
+		{
+			holdoffTime = now + wait;
+			holdoffPending = true;
+			++r.holdoffs;
+		}
+		else if (stepAllowed)
+		{
+			now += wait;												// wait in the ISR
+
+			// Start the step pulse and check the timing that led up to it
+			if (now - lastStepLowTime < stepLow || now - lastDirChangeTime < dirSetup)
+			{
+				r.timingOk = false;
+			}
+			lastStepHighTime = now;
+			const uint32_t lateness = now - due;
+			if (lateness > r.maxLateness)
+			{
+				r.maxLateness = lateness;
+			}
+
+			// Reverse at the end of each group of steps. The step time calculation calls Platform::SetDirection before anything else,
+			// which ends the step pulse and then waits for the direction hold time or defers the change.
+			++step;
+			const bool reversing = (step % StepsPerReversal == 0);
+			if (scheduled && !reversing)
+			{
+				now += StepCalcTime;									// calculate the next step time while the pulse is high
+				now += SlowDriverTiming::GetRemainingTime(now, lastStepHighTime, stepHigh);
+				lastStepLowTime = now;
+			}
+			else
+			{
+				now += SlowDriverTiming::GetRemainingTime(now, lastStepHighTime, stepHigh);		// wait for the rest of the step high time
+				lastStepLowTime = now;
+				if (reversing)
+				{
+					const uint32_t holdWait = SlowDriverTiming::GetRemainingTime(now, lastStepLowTime, dirHold);
+					if (scheduled && holdWait != 0)
+					{
+						directionChangePending = true;
+						holdoffTime = lastStepLowTime + dirHold;
+						holdoffPending = true;
+						++r.directionChangesDeferred;
+					}
+					else
+					{
+						now += holdWait;
+						lastDirChangeTime = now;
+					}
+				}
+				now += StepCalcTime;
+			}
+			if (lastStepLowTime - lastStepHighTime < stepHigh)
+			{
+				r.timingOk = false;
+			}
+
+			// Make the deferred direction change now if the hold time has passed during the calculation or will do so soon
+			if (directionChangePending && directionChangeDone())
+			{
+				holdoffPending = false;
+			}
+			due += interval;
+		}
+
+		now += IsrEntryExit/2;
+		const uint32_t isrTime = now - start;
+		r.totalIsrTime += isrTime;
+		if (isrTime > r.maxIsrTime)
+		{
+			r.maxIsrTime = isrTime;
+		}
+		isrFreeAt = now;
+	}
+	r.totalTime = due - interval;
+	return r;
+}
+
+// Find the highest step rate up to 200kHz at which no step is late by more than one step interval
+static uint32_t MaxStepRate(const DriverTiming& dt, bool scheduled)
+{
+	uint32_t best = 0;
+	for (uint32_t rate = 5000; rate <= 200000; rate += 1000)
+	{
+		const Result r = Simulate(dt, rate, scheduled, 2000);
+		if (!r.timingOk || r.maxLateness > StepClockRate * Sub/rate)
+		{
+			break;
+		}
+		best = rate;
+	}
+	return best;
+}
+
+static double ToMicroseconds(uint64_t t)
+{
+	return (double)t * 1.0e6/((double)StepClockRate * Sub);
+}
+
+int main()
+{
+	// The wait calculation, including across the wrap of the step clock
+	Check(SlowDriverTiming::GetStepWait(100, 98, 0, 2, 4) == 0, "no wait once the low and setup times have passed");
+	Check(SlowDriverTiming::GetStepWait(100, 99, 98, 2, 4) == 2, "wait for the longer of the low and setup times");
+	Check(SlowDriverTiming::GetStepWait(3, 0xFFFFFFFF, 0, 5, 0) == 1, "wait across the wrap of the step clock");
+	Check(!SlowDriverTiming::ShouldHoldOff(5, 6) && SlowDriverTiming::ShouldHoldOff(6, 6), "hold off only waits we can schedule");
+	Check(SlowDriverTiming::GetRemainingTime(10, 8, 5) == 3 && SlowDriverTiming::GetRemainingTime(20, 8, 5) == 0, "remaining time");
+
+	DriverTiming timings[] =
+	{
+		{ "EXP1XD default T2.7:2.7:2.7:2.7", { 2.7, 2.7, 2.7, 2.7 }, { } },
+		{ "T2.5:2.5:5:5", { 2.5, 2.5, 5.0, 5.0 }, { } },
+		{ "T5:5:10:10", { 5.0, 5.0, 10.0, 10.0 }, { } },
+		{ "T10:10:20:20", { 10.0, 10.0, 20.0, 20.0 }, { } },
+	};
+
+	for (DriverTiming& dt : timings)
+	{
+		for (size_t i = 0; i < 4; ++i)
+		{
+			dt.clocks[i] = ToClocks(dt.microseconds[i]);
+		}
+
+		const uint32_t spinMax = MaxStepRate(dt, false), scheduledMax = MaxStepRate(dt, true);
+		const uint32_t rate = 20000;
+		const Result spin = Simulate(dt, rate, false, 20000);
+		const Result sched = Simulate(dt, rate, true, 20000);
+		Check(spin.timingOk && sched.timingOk, "driver timing met");
+		Check(sched.maxIsrTime <= spin.maxIsrTime && sched.totalIsrTime <= spin.totalIsrTime, "no more ISR time than waiting in the ISR");
+		// Holding off a step costs another interrupt, so with long setup times the highest step rate may be a little lower
+		Check(scheduledMax * 100 >= spinMax * 95, "highest step rate no more than 5% lower");
+		printf("%s at %u steps/sec: longest ISR %.1fus waiting, %.1fus scheduled; time in ISR %.1f%% waiting, %.1f%% scheduled,"
+				" %u steps held off, %u direction changes deferred; highest step rate %u waiting, %u scheduled\n",
+				dt.name, rate, ToMicroseconds(spin.maxIsrTime), ToMicroseconds(sched.maxIsrTime),
+				100.0 * spin.totalIsrTime/spin.totalTime, 100.0 * sched.totalIsrTime/sched.totalTime,
+				sched.holdoffs, sched.directionChangesDeferred, spinMax, scheduledMax);
+	}
+
+	// With slow timing the direction hold time is long enough to schedule, so the longest ISR must be much shorter.
+	// At a high step rate the direction setup time is too, so steps are held off.
+	const Result spin = Simulate(timings[3], 20000, false, 20000);
+	const Result sched = Simulate(timings[3], 20000, true, 20000);
+	Check(sched.directionChangesDeferred != 0 && sched.maxIsrTime * 2 < spin.maxIsrTime, "long waits taken out of the ISR");
+	const Result fast = Simulate(timings[3], 30000, true, 20000);
+	Check(fast.timingOk && fast.holdoffs != 0, "steps held off at high step rates");
+	printf("%s at 30000 steps/sec: %u steps held off, longest ISR %.1fus\n", timings[3].name, fast.holdoffs, ToMicroseconds(fast.maxIsrTime));
+
+	printf("SlowDriverTiming: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,193 @@
+/*
+ * StallCalibratorTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs the stall calibration on data generated from a model of a motor running without load: SG_RESULT falls as the speed rises, is too
+ *  noisy to use at low speeds, and rises by a fixed amount for each step of the threshold. That amount differs from the calibrator's
+ *  estimate, as it will on a real motor, so the calibration is repeated with the recommended thresholds, as a user would, and must settle
+ *  with the low end of each usable band above the safety margin. Also checks the speed bands, the percentile and the corner cases.
+ */
+
+#include "Movement/StepperDrivers/StallCalibrator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// Motor model
+constexpr int SgResultPerThresholdStep = 24;			// the calibrator assumes 32
+constexpr int SafetyMargin = 128;						// as in StallCalibrator.cpp
+constexpr uint32_t BinWidth = (StallCalibrator::MaxSgResult + 1)/StallCalibrator::NumHistogramBins;
+
+static uint32_t randomState = 12345;
+
+static double Uniform()
+{
+	randomState = randomState * 1103515245u + 12345u;
+	return ((randomState >> 8) + 0.5)/16777216.0;
+}
+
+static double Gaussian()
+{
+	return sqrt(-2.0 * log(Uniform())) * cos(2.0 * M_PI * Uniform());
+}
+
+// SG_RESULT of the unloaded motor at the given speed and threshold
+static uint32_t ModelSgResult(uint32_t fullStepsPerSecond, int threshold)
+{
+	double mean, sd;
+	if (fullStepsPerSecond < 100)
+	{
+		mean = 300.0;
+		sd = 150.0;											// too noisy to use at low speeds
+	}
+	else
+	{
+		mean = 400.0 - 60.0 * log2(fullStepsPerSecond/100.0);
+		sd = 0.08 * mean;
+	}
+	const double v = mean + SgResultPerThresholdStep * threshold + sd * Gaussian();
+	return (v <= 0.0) ? 0 : (v >= StallCalibrator::MaxSgResult) ? StallCalibrator::MaxSgResult : (uint32_t)v;
+}
+
+// Run a speed sweep from 30 to 5000 full steps per second with a threshold for each band, as the driver does during calibration
+static void RunSweep(StallCalibrator& cal, const int8_t *thresholds)
+{
+	cal.Reset();
+	for (uint32_t speed = 30; speed <= 5000; speed += 5)
+	{
+		const int band = StallCalibrator::GetSpeedBand(speed);
+		for (unsigned int i = 0; i < 20; ++i)
+		{
+			cal.AddSample(ModelSgResult(speed, (band < 0) ? 0 : thresholds[band]), speed);
+		}
+	}
+}
+
+// Find the true 10th percentile of SG_RESULT in a band with a given threshold, from a large sample
+static uint32_t TrueLowPercentile(size_t band, int threshold)
+{
+	const uint32_t lower = StallCalibrator::GetBandLowerLimit(band);
+	const uint32_t upper = (band + 1 < StallCalibrator::NumSpeedBands) ? StallCalibrator::GetBandLowerLimit(band + 1) : 5001;
+	std::vector<uint32_t> results;
+	for (uint32_t speed = lower; speed < upper && speed <= 5000; speed += 5)
+	{
+		for (unsigned int i = 0; i < 200; ++i)
+		{
+			results.push_back(ModelSgResult(speed, threshold));
+		}
+	}
+	std::sort(results.begin(), results.end());
+	return results[results.size()/10];
+}
+
+int main()
+{
+	// Speed bands
+	Check(StallCalibrator::GetSpeedBand(0) == -1 && StallCalibrator::GetSpeedBand(24) == -1, "below the lowest band");
+	Check(StallCalibrator::GetSpeedBand(25) == 0 && StallCalibrator::GetSpeedBand(49) == 0 && StallCalibrator::GetSpeedBand(50) == 1, "band edges");
+	Check(StallCalibrator::GetSpeedBand(3199) == 6 && StallCalibrator::GetSpeedBand(3200) == 7 && StallCalibrator::GetSpeedBand(100000) == 7, "top band");
+
+	// Statistics and percentile
+	StallCalibrator cal;
+	StallRecommendation rec;
+	const int8_t zeroThresholds[StallCalibrator::NumSpeedBands] = { 0 };
+	Check(!cal.Calculate(zeroThresholds, rec) && rec.overallThreshold == 0, "no data, no recommendation");
+	cal.AddSample(500, 10);
+	Check(cal.GetNumSamples(0) == 0, "samples below the lowest band ignored");
+	for (uint32_t i = 0; i < 100; ++i)
+	{
+		cal.AddSample(200 + i, 1000);						// band 5
+	}
+	cal.AddSample(5000, 2000);
+	Check(cal.GetNumSamples(5) == 100 && cal.GetMinResult(5) == 200 && cal.GetMaxResult(5) == 299, "count, min and max");
+	Check(cal.GetNumSamples(6) == 1 && cal.GetMaxResult(6) == StallCalibrator::MaxSgResult, "result limited to 10 bits");
+	Check(cal.GetLowPercentileResult(5) == 192, "10th percentile rounded down to the histogram bin");
+	Check(cal.Calculate(zeroThresholds, rec) && rec.bandUsable[5] && rec.minimumStepsPerSecond == 800, "one usable band");
+	Check(rec.thresholds[5] == -2 && rec.overallThreshold == -2, "threshold lowered by 64/32 steps when the low end is 64 above the margin");
+	Check(!rec.bandUsable[6] && rec.thresholds[6] == -2, "band with too few samples gets the overall threshold");
+
+	// A threshold so low that SG_RESULT is held at zero moves the threshold up by the largest step allowed
+	cal.Reset();
+	for (uint32_t i = 0; i < 50; ++i)
+	{
+		cal.AddSample(0, 2000);
+	}
+	int8_t lowThresholds[StallCalibrator::NumSpeedBands];
+	memset(lowThresholds, -20, sizeof(lowThresholds));
+	Check(cal.Calculate(lowThresholds, rec) && rec.thresholds[6] == -4 && rec.overallThreshold == -4, "SG_RESULT stuck at zero");
+
+	// Sample counts saturate rather than wrap
+	cal.Reset();
+	for (uint32_t i = 0; i < 70000; ++i)
+	{
+		cal.AddSample(300, 400);
+	}
+	Check(cal.GetNumSamples(4) == UINT16_MAX, "sample count saturates");
+
+	// Calibrate the motor model, starting with a threshold of 0 in every band and repeating with the recommended thresholds applied as a table
+	int8_t thresholds[StallCalibrator::NumSpeedBands] = { 0 };
+	bool settled = false;
+	unsigned int runs = 0;
+	while (runs < 8 && !settled)
+	{
+		RunSweep(cal, thresholds);
+		Check(cal.Calculate(thresholds, rec), "calibration gives a recommendation");
+		++runs;
+		settled = true;
+		for (size_t band = 0; band < StallCalibrator::NumSpeedBands; ++band)
+		{
+			if (rec.bandUsable[band] && abs(rec.thresholds[band] - thresholds[band]) > 1)
+			{
+				settled = false;
+			}
+			thresholds[band] = rec.thresholds[band];
+		}
+	}
+	Check(settled, "calibration settles");
+	Check(!rec.bandUsable[0] && !rec.bandUsable[1] && rec.bandUsable[2] && rec.minimumStepsPerSecond == 100, "noisy low speed bands not used");
+
+	bool marginOk = true, overallOk = true;
+	for (size_t band = 0; band < StallCalibrator::NumSpeedBands; ++band)
+	{
+		if (rec.bandUsable[band])
+		{
+			// The calibration may settle up to one threshold step short of the margin, and the calibrator rounds the percentile down to
+			// the edge of a histogram bin and the threshold up to a whole step, so it may also end up that much above it
+			const uint32_t lowResult = TrueLowPercentile(band, rec.thresholds[band]);
+			printf("band %u from %u full steps/sec: threshold %d, 10th percentile of SG_RESULT %u\n",
+					(unsigned int)band, StallCalibrator::GetBandLowerLimit(band), rec.thresholds[band], lowResult);
+			if (lowResult + SgResultPerThresholdStep < SafetyMargin || lowResult > SafetyMargin + BinWidth + SgResultPerThresholdStep)
+			{
+				marginOk = false;
+			}
+			overallOk = overallOk && rec.overallThreshold >= rec.thresholds[band];
+		}
+		else
+		{
+			overallOk = overallOk && rec.thresholds[band] == rec.overallThreshold;
+		}
+	}
+	Check(marginOk, "usable bands have the low end of SG_RESULT at the safety margin");
+	Check(overallOk, "overall threshold safe in all bands");
+	printf("settled after %u runs, overall threshold %d, stall detection from %u full steps/sec\n", runs, rec.overallThreshold, rec.minimumStepsPerSecond);
+
+	printf("StallCalibrator: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,156 @@
+/*
+ * StepMathTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Compiles the SAMC21 version of StepMath against a model of the DIVAS, and checks Isqrt64 against an exact reference on edge cases,
+ *  on perfect squares and their neighbours, and on random numbers of every length. Also checks that Diagnostics finds no mismatches.
+ *  Then checks that the step ISR's use of the DIVAS and the divisions done by hpl_divas.c in other tasks and ISRs can't corrupt each other:
+ *  the model runs an interrupt that uses the DIVAS before every DIVAS access made with interrupts enabled.
+ */
+
+#include "Movement/StepMath.h"
+#include <random>
+
+uint32_t millis() { return 0; }
+uint64_t millis64() { return 0; }
+
+static int failures = 0;
+static unsigned long numChecked = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+static void CheckSqrt(uint64_t num)
+{
+	++numChecked;
+	const uint32_t expected = isqrt64(num);
+	const uint32_t actual = StepMath::Isqrt64(num);
+	if (actual != expected)
+	{
+		++failures;
+		printf("Isqrt64(%" PRIu64 ") returned %" PRIu32 ", expected %" PRIu32 "\n", num, actual, expected);
+	}
+}
+
+// __aeabi_uidiv and __aeabi_idiv as hpl_divas.c implements them, with interrupts disabled from setting the mode to reading the result
+static uint32_t HplDivide(bool isSigned, uint32_t num, uint32_t den)
+{
+	AtomicCriticalSectionLocker lock;
+	if (isSigned)
+	{
+		DIVAS->CTRLA.reg |= DIVAS_CTRLA_SIGNED;
+	}
+	else
+	{
+		DIVAS->CTRLA.reg &= ~DIVAS_CTRLA_SIGNED;
+	}
+	DIVAS->DIVIDEND.reg = num;
+	DIVAS->DIVISOR.reg = den;
+	while ((DIVAS->STATUS.reg & DIVAS_STATUS_BUSY) != 0) { }
+	return DIVAS->RESULT.reg;
+}
+
+// The same without disabling interrupts, to show that the model detects the corruption that would cause
+static uint32_t UnprotectedDivide(bool isSigned, uint32_t num, uint32_t den)
+{
+	DIVAS->CTRLA.reg = (isSigned) ? DIVAS_CTRLA_SIGNED : 0;
+	DIVAS->DIVIDEND.reg = num;
+	DIVAS->DIVISOR.reg = den;
+	while ((DIVAS->STATUS.reg & DIVAS_STATUS_BUSY) != 0) { }
+	return DIVAS->RESULT.reg;
+}
+
+static std::mt19937_64 rng(1);
+
+// A step interrupt that calculates a step time, and a higher priority interrupt that does a signed division
+static void StepInterrupt()
+{
+	(void)StepMath::Isqrt64(rng() >> (rng() % 40));
+}
+
+static void DivideInterrupt()
+{
+	(void)HplDivide(true, (uint32_t)-1000, 7);
+}
+
+int main()
+{
+	for (uint64_t num : { (uint64_t)0, (uint64_t)1, (uint64_t)2, (uint64_t)0xFFFFFFFF, (uint64_t)0x100000000, (uint64_t)0x100000001,
+						  (uint64_t)0x7FFFFFFFFFFFFFFF, (uint64_t)0x8000000000000000, (uint64_t)0xFFFFFFFE00000001, (uint64_t)0xFFFFFFFFFFFFFFFF })
+	{
+		CheckSqrt(num);
+	}
+
+	// Perfect squares and their neighbours, where rounding errors show up
+	for (int i = 0; i < 200000; ++i)
+	{
+		const uint64_t root = rng() >> (rng() % 33);
+		const uint64_t square = root * root;
+		CheckSqrt(square);
+		CheckSqrt(square - 1);
+		if (root < 0xFFFFFFFF)
+		{
+			CheckSqrt(square + 2 * root);			// the largest number with this root
+		}
+	}
+
+	// Random numbers of every length
+	for (int i = 0; i < 1000000; ++i)
+	{
+		CheckSqrt(rng() >> (i % 64));
+	}
+
+	char buf[200];
+	const StringRef reply(buf, sizeof(buf));
+	StepMath::Diagnostics(reply);
+	Check(strstr(buf, "mismatches 0\n") != nullptr, "diagnostics find no mismatches");
+
+	// The step ISR interrupting a division in a lower priority task or ISR
+	fakeDivas.CTRLA.reg.val = DIVAS_CTRLA_DLZ;		// as hpl_divas.c sets it up when the leading zero optimisation is disabled
+	fakeDivas.accessesWithInterruptsEnabled = 0;
+	fakeDivas.interruptHandler = StepInterrupt;
+	bool divideOk = true;
+	for (int i = 0; i < 100000; ++i)
+	{
+		const uint32_t num = (uint32_t)rng(), den = (uint32_t)(rng() >> (32 + i % 32)) | 1;
+		divideOk = divideOk && HplDivide(false, num, den) == num/den && (int32_t)HplDivide(true, num, den) == (int32_t)num/(int32_t)den;
+	}
+	Check(divideOk, "divisions not corrupted by the step ISR");
+
+	// A higher priority ISR interrupting the step ISR's square root
+	fakeDivas.interruptHandler = DivideInterrupt;
+	for (int i = 0; i < 100000; ++i)
+	{
+		CheckSqrt(rng() >> (i % 64));
+	}
+	Check(fakeDivas.accessesWithInterruptsEnabled == 0, "DIVAS only used with interrupts disabled");
+	Check((fakeDivas.CTRLA.reg.val & DIVAS_CTRLA_DLZ) != 0, "leading zero optimisation setting kept");
+
+	// Without disabling interrupts the step ISR would corrupt divisions
+	fakeDivas.interruptHandler = StepInterrupt;
+	unsigned int numCorrupted = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		const uint32_t num = (uint32_t)rng() | 0x80000000, den = (uint32_t)(rng() >> 40) | 1;
+		if (UnprotectedDivide(false, num, den) != num/den)
+		{
+			++numCorrupted;
+		}
+	}
+	Check(numCorrupted != 0, "model detects corruption");
+	fakeDivas.interruptHandler = nullptr;
+
+	printf("StepMath: %lu square roots checked, %u DIVAS square roots and %u divisions used, %u of 1000 unprotected divisions corrupted\n",
+			numChecked, fakeDivas.numSqrts, fakeDivas.numDivides, numCorrupted);
+	printf("StepMath: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
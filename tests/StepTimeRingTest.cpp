@@ -0,0 +1,152 @@
+/*
+ * StepTimeRingTest.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Runs the step time ring with a producer thread in place of the step calculation task and a consumer thread in place of the step ISR,
+ *  which run at the same time when the PC has more than one core. Checks that every entry arrives once and in order, and that a consumer
+ *  that finds the ring empty and then sees the finished flag never misses the last entries. Also times Push and Pop.
+ *  The ISR duration and the maximum step rate on the board are reported by M122.
+ */
+
+#include "StepTimeRing.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static int failures = 0;
+
+static void Check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		++failures;
+		printf("failed: %s\n", what);
+	}
+}
+
+// Run one move of numEntries steps. The consumer does what DriveMovement::PopStepTime does when the ring is empty.
+// Return the number of times the consumer found the ring empty before the end of the move.
+static unsigned int RunMove(StepTimeRing& ring, uint32_t numEntries, uint32_t firstEntry, bool& inOrder, uint32_t& numReceived)
+{
+	ring.Clear();
+	unsigned int underruns = 0;
+	inOrder = true;
+	numReceived = 0;
+
+	std::thread producer([&ring, numEntries, firstEntry]()
+		{
+			for (uint32_t i = 0; i < numEntries; ++i)
+			{
+				while (!ring.Push(firstEntry + i))
+				{
+					std::this_thread::yield();			// in case the test machine has only one core
+				}
+			}
+			ring.SetFinished();
+		});
+
+	uint32_t expected = firstEntry;
+	for (;;)
+	{
+		uint32_t entry;
+		if (!ring.Pop(entry))
+		{
+			if (!ring.IsFinished())
+			{
+				++underruns;
+				std::this_thread::yield();
+				continue;
+			}
+			if (!ring.Pop(entry))
+			{
+				break;
+			}
+		}
+		if (entry != expected)
+		{
+			inOrder = false;
+		}
+		++expected;
+		++numReceived;
+	}
+
+	producer.join();
+	return underruns;
+}
+
+int main()
+{
+	StepTimeRing ring;
+
+	// Single-threaded behaviour
+	ring.Clear();
+	uint32_t entry;
+	Check(!ring.Pop(entry) && ring.NumEntries() == 0 && !ring.IsFinished(), "new ring is empty");
+	for (uint32_t i = 0; i < StepTimeRing::Length - 1; ++i)
+	{
+		Check(ring.Push(i), "push into ring with space");
+	}
+	Check(ring.IsFull() && !ring.Push(99), "ring holds Length - 1 entries");
+	Check(ring.Pop(entry) && entry == 0 && !ring.IsFull() && ring.Push(15), "entry freed by pop can be reused");
+	ring.SetFinished();
+	uint32_t count = 0;
+	bool ordered = true;
+	while (ring.Pop(entry))
+	{
+		ordered = ordered && entry == count + 1;
+		++count;
+	}
+	Check(count == StepTimeRing::Length - 1 && ordered && ring.IsFinished(), "entries come out in order after finishing");
+
+	// Concurrent producer and consumer, including moves shorter than the ring and moves with no steps
+	const uint32_t moveLengths[] = { 0, 1, 2, StepTimeRing::Length - 1, StepTimeRing::Length, 1000, 5000000 };
+	uint32_t firstEntry = 0;
+	for (uint32_t length : moveLengths)
+	{
+		bool inOrder;
+		uint32_t numReceived;
+		const unsigned int underruns = RunMove(ring, length, firstEntry, inOrder, numReceived);
+		Check(inOrder, "concurrent entries in order");
+		Check(numReceived == length, "concurrent entries neither lost nor duplicated");
+		if (length == 5000000)
+		{
+			printf("5000000 entries passed between threads, consumer found the ring empty %u times\n", underruns);
+		}
+		firstEntry += length;
+	}
+
+	// Many short moves, to exercise the end of move handling
+	bool allInOrder = true, allReceived = true;
+	for (uint32_t i = 0; i < 20000; ++i)
+	{
+		bool inOrder;
+		uint32_t numReceived;
+		const uint32_t length = i % 40;
+		(void)RunMove(ring, length, i, inOrder, numReceived);
+		allInOrder = allInOrder && inOrder;
+		allReceived = allReceived && numReceived == length;
+	}
+	Check(allInOrder && allReceived, "short moves complete");
+
+	// Time push and pop without contention
+	constexpr uint32_t TimingLoops = 10000000;
+	volatile uint32_t sink = 0;
+	ring.Clear();
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < TimingLoops; ++i)
+	{
+		(void)ring.Push(i);
+		uint32_t e;
+		(void)ring.Pop(e);
+		sink = e;
+	}
+	const auto finish = std::chrono::steady_clock::now();
+	(void)sink;
+	printf("push + pop on this PC: %.1fns\n", std::chrono::duration<double, std::nano>(finish - start).count()/TimingLoops);
+
+	printf("StepTimeRing: %s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? 0 : 1;
+}
+
+// End
@@ -0,0 +1,45 @@
+/*
+ * CanId.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the CANlib header of the same name. Only the address and request ID types and the message types that the code under test uses
+ *  are provided. The main board address is the same as in the CANlib version.
+ */
+
+#ifndef TESTS_STUBS_CANID_H_
+#define TESTS_STUBS_CANID_H_
+
+#include <cstdint>
+
+typedef uint8_t CanAddress;
+typedef uint16_t CanRequestId;
+
+constexpr CanRequestId CanRequestIdAcceptAlways = 4095;
+
+enum class CanMessageType : uint16_t
+{
+	standardReply,
+	multipleStandardReplies,
+	mainBoardCapabilities,
+	driverTelemetryReport,
+	inputStateChanged,
+	inputChangesTimed,
+};
+
+class CanId
+{
+public:
+	static constexpr CanAddress MasterAddress = 0;
+
+	void SetReply(CanMessageType type, CanAddress src, CanAddress dst) { msgType = type; source = src; dest = dst; }
+	CanMessageType MsgType() const { return msgType; }
+	CanAddress Src() const { return source; }
+	CanAddress Dst() const { return dest; }
+
+private:
+	CanMessageType msgType;
+	CanAddress source, dest;
+};
+
+#endif /* TESTS_STUBS_CANID_H_ */
@@ -0,0 +1,30 @@
+/*
+ * CanInterfaceStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces CAN/CanInterface.h, which needs the CAN peripheral. Tests that send messages provide QueueResponse or SendAndFree, tests of input monitors provide WakeAsyncSenderFromIsr,
+ *  and tests that feed moves to the Move task provide GetCanMove and GetMovesReceivedBeforeM669.
+ */
+
+#ifndef TESTS_STUBS_CANINTERFACESTUBS_H_
+#define TESTS_STUBS_CANINTERFACESTUBS_H_
+
+#define SRC_CAN_CANINTERFACE_H_
+
+#include <CanId.h>
+
+class CanMessageBuffer;
+struct CanMessageMovement;
+
+namespace CanInterface
+{
+	inline CanAddress GetCanAddress() { return 21; }
+	void QueueResponse(CanMessageBuffer *buf);
+	void SendAndFree(CanMessageBuffer *buf);
+	void WakeAsyncSenderFromIsr();
+	bool GetCanMove(CanMessageMovement& move);
+	uint32_t GetMovesReceivedBeforeM669();
+}
+
+#endif /* TESTS_STUBS_CANINTERFACESTUBS_H_ */
@@ -0,0 +1,102 @@
+/*
+ * CanMessageBuffer.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the CANlib header of the same name. The buffers come from a fixed pool as they do on the board, so that tests can run out of them.
+ *  Only the standard reply format is provided, with the same layout as the CANlib version.
+ */
+
+#ifndef TESTS_STUBS_CANMESSAGEBUFFER_H_
+#define TESTS_STUBS_CANMESSAGEBUFFER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <CanId.h>
+
+struct __attribute__((packed)) CanMessageStandardReply
+{
+	static constexpr CanMessageType messageType = CanMessageType::standardReply;
+	static constexpr size_t MaxTextLength = 58;
+
+	void SetRequestId(CanRequestId rid) { requestId = rid; zero = 0; }
+	static constexpr size_t GetActualDataLength(size_t textLength) { return textLength + 6; }
+
+	uint16_t requestId : 12,
+			 zero : 4;
+	uint16_t resultCode;
+	uint8_t extra;
+	uint8_t fragmentNumber : 7,
+			moreFollows : 1;
+	char text[MaxTextLength];
+};
+
+union CanMessage
+{
+	uint8_t raw[64];
+	CanMessageStandardReply standardReply;
+};
+
+class CanMessageBuffer
+{
+public:
+	static void Init(unsigned int numBuffers)
+	{
+		delete[] pool;
+		pool = new CanMessageBuffer[numBuffers];
+		freeList = nullptr;
+		for (unsigned int i = 0; i < numBuffers; ++i)
+		{
+			pool[i].next = freeList;
+			freeList = &pool[i];
+		}
+		numFree = numBuffers;
+	}
+
+	static CanMessageBuffer *Allocate()
+	{
+		CanMessageBuffer * const buf = freeList;
+		if (buf != nullptr)
+		{
+			freeList = buf->next;
+			buf->next = nullptr;
+			--numFree;
+		}
+		return buf;
+	}
+
+	static void Free(CanMessageBuffer *buf)
+	{
+		buf->next = freeList;
+		freeList = buf;
+		++numFree;
+	}
+
+	static unsigned int GetFreeBuffers() { return numFree; }
+
+	template<class T> T *SetupResponseMessage(CanRequestId rid, CanAddress src, CanAddress dest)
+	{
+		id.SetReply(T::messageType, src, dest);
+		T * const m = reinterpret_cast<T*>(&msg);
+		m->SetRequestId(rid);
+		return m;
+	}
+
+	template<class T> T *SetupStatusMessage(CanAddress src, CanAddress dest)
+	{
+		id.SetReply(T::messageType, src, dest);
+		return reinterpret_cast<T*>(&msg);
+	}
+
+	CanMessageBuffer *next;
+	CanId id;
+	size_t dataLength;
+	CanMessage msg;
+
+private:
+	static inline CanMessageBuffer *pool = nullptr;
+	static inline CanMessageBuffer *freeList = nullptr;
+	static inline unsigned int numFree = 0;
+};
+
+#endif /* TESTS_STUBS_CANMESSAGEBUFFER_H_ */
@@ -0,0 +1,106 @@
+/*
+ * CanMessageFormats.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the CANlib header of the same name. Only the movement, GPIO write and input monitor messages are provided, with the fields that the code under test uses.
+ *  The generic message is declared in CanMessageGenericParser.h.
+ */
+
+#ifndef TESTS_STUBS_CANMESSAGEFORMATS_H_
+#define TESTS_STUBS_CANMESSAGEFORMATS_H_
+
+#include <cstdint>
+#include <CanId.h>
+
+constexpr size_t MaxDriversPerCanSlave = 3;
+
+struct CanMessageGeneric;
+
+struct CanMessageWriteGpio
+{
+	uint8_t portNumber;
+	float pwm;
+};
+
+struct CanMessageMovement
+{
+	uint32_t whenToExecute;
+	uint32_t accelerationClocks;
+	uint32_t steadyClocks;
+	uint32_t decelClocks;
+
+	uint32_t deltaDrives : 4,
+			 pressureAdvanceDrives : 4,
+			 endStopsToCheck : 4,
+			 moveType : 2,
+			 stopAllDrivesOnEndstopHit : 1,
+			 zero : 17;
+
+	float initialSpeedFraction;
+	float finalSpeedFraction;
+	float initialX;
+	float initialY;
+	float finalX;
+	float finalY;
+	float zMovement;
+
+	struct
+	{
+		int32_t steps;
+	} perDrive[MaxDriversPerCanSlave];
+};
+
+struct RemoteInputHandle
+{
+	union
+	{
+		uint16_t all;
+	} u;
+};
+
+struct CanMessageCreateInputMonitor
+{
+	RemoteInputHandle handle;
+	uint16_t threshold;
+	uint16_t minInterval;
+	char pinName[56];
+
+	size_t GetMaxPinNameLength(size_t dataLength) const { return dataLength - offsetof(CanMessageCreateInputMonitor, pinName); }
+};
+
+struct CanMessageChangeInputMonitor
+{
+	static constexpr uint8_t actionDontMonitor = 0, actionDoMonitor = 1, actionDelete = 2, actionReturnPinName = 3, actionChangeThreshold = 4,
+								actionChangeMinInterval = 5, actionChangeReportWindow = 6, actionChangeDebounce = 7;
+
+	RemoteInputHandle handle;
+	uint16_t param;
+	uint8_t action;
+};
+
+struct CanMessageInputChanged
+{
+	static constexpr CanMessageType messageType = CanMessageType::inputStateChanged;
+
+	uint32_t states;
+	uint8_t numHandles;
+	uint8_t spare;
+	uint16_t handles[29];
+
+	bool AddEntry(uint16_t h, bool state)
+	{
+		if (numHandles < ARRAY_SIZE(handles))
+		{
+			if (state)
+			{
+				states |= 1ul << numHandles;
+			}
+			handles[numHandles++] = h;
+			return true;
+		}
+		return false;
+	}
+};
+
+#endif /* TESTS_STUBS_CANMESSAGEFORMATS_H_ */
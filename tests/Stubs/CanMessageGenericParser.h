@@ -0,0 +1,179 @@
+/*
+ * CanMessageGenericParser.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the CANlib header of the same name. Instead of the packed parameters of the real generic message, the test sets the parameter
+ *  values directly in the message, so only the parameter letters that the code under test reads are provided.
+ */
+
+#ifndef TESTS_STUBS_CANMESSAGEGENERICPARSER_H_
+#define TESTS_STUBS_CANMESSAGEGENERICPARSER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// S is an integer, a bool or an array of floats depending on the message. T is an integer time or a float.
+struct CanMessageGeneric
+{
+	bool hasP;
+	size_t numP;
+	uint8_t p[16];
+	bool hasR;
+	uint16_t r;
+	bool hasS;
+	int32_t s;
+	size_t numSValues;
+	float sValues[16];
+	bool hasV;
+	float v;
+	bool hasA;
+	float a;
+	bool hasQ;
+	uint16_t q;
+	bool hasT;
+	uint32_t t;
+	float tf;
+	const char *c;
+};
+
+struct ParamDescriptor { };
+constexpr ParamDescriptor DriverTelemetryParams[1] = { };
+constexpr ParamDescriptor BabystepParams[1] = { };
+constexpr ParamDescriptor M669Params[1] = { };
+constexpr ParamDescriptor M950GpioParams[1] = { };
+constexpr ParamDescriptor WriteGpioMultipleParams[1] = { };
+constexpr ParamDescriptor ServoMoveParams[1] = { };
+
+class CanMessageGenericParser
+{
+public:
+	CanMessageGenericParser(const CanMessageGeneric& p_msg, const ParamDescriptor *) : msg(p_msg) { }
+
+	bool GetUint8ArrayParam(char c, size_t& numValues, const uint8_t *&values) const
+	{
+		if (c != 'P' || !msg.hasP)
+		{
+			return false;
+		}
+		numValues = msg.numP;
+		values = msg.p;
+		return true;
+	}
+
+	bool GetUintParam(char c, uint16_t& value) const
+	{
+		switch (c)
+		{
+		case 'P':
+			if (!msg.hasP || msg.numP == 0)
+			{
+				return false;
+			}
+			value = msg.p[0];
+			return true;
+
+		case 'Q':
+			value = msg.q;
+			return msg.hasQ;
+
+		case 'R':
+			value = msg.r;
+			return msg.hasR;
+
+		default:
+			return false;
+		}
+	}
+
+	bool GetUintParam(char c, uint32_t& value) const
+	{
+		if (c != 'T' || !msg.hasT)
+		{
+			return false;
+		}
+		value = msg.t;
+		return true;
+	}
+
+	bool GetBoolParam(char c, bool& value) const
+	{
+		if (c != 'S' || !msg.hasS)
+		{
+			return false;
+		}
+		value = (msg.s != 0);
+		return true;
+	}
+
+	bool GetStringParam(char c, const StringRef& str) const
+	{
+		if (c != 'C' || msg.c == nullptr)
+		{
+			return false;
+		}
+		str.copy(msg.c);
+		return true;
+	}
+
+	bool GetUintParam(char c, uint8_t& value) const
+	{
+		if (c != 'P' || !msg.hasP || msg.numP == 0)
+		{
+			return false;
+		}
+		value = msg.p[0];
+		return true;
+	}
+
+	bool GetIntParam(char c, int32_t& value) const
+	{
+		if (c != 'S' || !msg.hasS)
+		{
+			return false;
+		}
+		value = msg.s;
+		return true;
+	}
+
+	bool GetFloatParam(char c, float& value) const
+	{
+		switch (c)
+		{
+		case 'A':
+			value = msg.a;
+			return msg.hasA;
+
+		case 'T':
+			value = msg.tf;
+			return msg.hasT;
+
+		case 'V':
+			value = msg.v;
+			return msg.hasV;
+
+		default:
+			return false;
+		}
+	}
+
+	// On entry numValues is the size of the array
+	bool GetFloatArrayParam(char c, size_t& numValues, float *values) const
+	{
+		if (c != 'S' || !msg.hasS || msg.numSValues == 0 || msg.numSValues > numValues)
+		{
+			return false;
+		}
+		numValues = msg.numSValues;
+		for (size_t i = 0; i < numValues; ++i)
+		{
+			values[i] = msg.sValues[i];
+		}
+		return true;
+	}
+
+private:
+	const CanMessageGeneric& msg;
+};
+
+#endif /* TESTS_STUBS_CANMESSAGEGENERICPARSER_H_ */
@@ -0,0 +1,24 @@
+/*
+ * CanSettings.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the CANlib header of the same name. Only CanTiming is needed, with the same fields and CAN clock frequency as the CANlib version.
+ */
+
+#ifndef TESTS_STUBS_CANSETTINGS_H_
+#define TESTS_STUBS_CANSETTINGS_H_
+
+#include <cstdint>
+
+struct CanTiming
+{
+	static constexpr uint32_t ClockFrequency = 48000000;			// the CAN clock frequency that the timing is relative to
+
+	uint16_t period;												// the bit period in CAN clocks
+	uint16_t tseg1;													// the time from the start of the bit to the sample point in CAN clocks
+	uint16_t jumpWidth;												// the resynchronisation jump width in CAN clocks
+	uint16_t zero;
+};
+
+#endif /* TESTS_STUBS_CANSETTINGS_H_ */
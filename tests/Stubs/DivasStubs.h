@@ -0,0 +1,113 @@
+/*
+ * DivasStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  A model of the SAMC21 divide and square root accelerator for testing Movement/StepMath.cpp, and the SysTick counter that StepMath::Diagnostics reads.
+ *  The DIVAS computes the result as soon as the divisor or square root input is written, so STATUS never shows busy.
+ *  To show what would happen if an interrupt used the DIVAS part way through an operation, the test can set an interrupt handler.
+ *  It is called before every access to a DIVAS register that is made with interrupts enabled, and those accesses are counted.
+ */
+
+#ifndef TESTS_STUBS_DIVASSTUBS_H_
+#define TESTS_STUBS_DIVASSTUBS_H_
+
+void DivasAccess();
+
+struct DivasCtrlaReg
+{
+	DivasCtrlaReg& operator=(uint32_t v) { DivasAccess(); val = v; return *this; }
+	DivasCtrlaReg& operator&=(uint32_t v) { DivasAccess(); val &= v; return *this; }
+	DivasCtrlaReg& operator|=(uint32_t v) { DivasAccess(); val |= v; return *this; }
+	operator uint32_t() { DivasAccess(); return val; }
+	uint32_t val;
+};
+
+struct DivasStatusReg { operator uint32_t() { DivasAccess(); return 0; } };
+struct DivasResultReg { operator uint32_t() { DivasAccess(); return val; } uint32_t val; };
+struct DivasDividendReg { DivasDividendReg& operator=(uint32_t num) { DivasAccess(); val = num; return *this; } uint32_t val; };
+struct DivasDivisorReg { DivasDivisorReg& operator=(uint32_t den); };
+struct DivasSqrNumReg { DivasSqrNumReg& operator=(uint32_t num); };
+
+struct FakeDivas
+{
+	struct { DivasCtrlaReg reg; } CTRLA;
+	struct { DivasStatusReg reg; } STATUS;
+	struct { DivasDividendReg reg; } DIVIDEND;
+	struct { DivasDivisorReg reg; } DIVISOR;
+	struct { DivasSqrNumReg reg; } SQRNUM;
+	struct { DivasResultReg reg; } RESULT;
+
+	void (*interruptHandler)();
+	bool inInterrupt;
+	unsigned int accessesWithInterruptsEnabled;
+	unsigned int numSqrts;
+	unsigned int numDivides;
+};
+
+inline FakeDivas fakeDivas = { };
+
+#define DIVAS				(&fakeDivas)
+#define DIVAS_IOBUS			(&fakeDivas)
+#define DIVAS_CTRLA_SIGNED	(1u << 0)
+#define DIVAS_CTRLA_DLZ		(1u << 1)
+#define DIVAS_STATUS_BUSY	(1u << 0)
+
+inline void DivasAccess()
+{
+	if (criticalSectionDepth == 0 && !fakeDivas.inInterrupt)
+	{
+		++fakeDivas.accessesWithInterruptsEnabled;
+		if (fakeDivas.interruptHandler != nullptr)
+		{
+			fakeDivas.inInterrupt = true;
+			fakeDivas.interruptHandler();
+			fakeDivas.inInterrupt = false;
+		}
+	}
+}
+
+inline DivasDivisorReg& DivasDivisorReg::operator=(uint32_t den)
+{
+	DivasAccess();
+	const uint32_t num = fakeDivas.DIVIDEND.reg.val;
+	if ((fakeDivas.CTRLA.reg.val & DIVAS_CTRLA_SIGNED) != 0)
+	{
+		fakeDivas.RESULT.reg.val = (den == 0) ? 0 : (uint32_t)((int32_t)num/(int32_t)den);
+	}
+	else
+	{
+		fakeDivas.RESULT.reg.val = (den == 0) ? 0 : num/den;
+	}
+	++fakeDivas.numDivides;
+	return *this;
+}
+
+inline DivasSqrNumReg& DivasSqrNumReg::operator=(uint32_t num)
+{
+	DivasAccess();
+	uint32_t root = 0;
+	for (uint32_t bit = 1u << 15; bit != 0; bit >>= 1)
+	{
+		const uint32_t trial = root | bit;
+		if ((uint64_t)trial * trial <= num)
+		{
+			root = trial;
+		}
+	}
+	fakeDivas.RESULT.reg.val = root;
+	++fakeDivas.numSqrts;
+	return *this;
+}
+
+// SysTick doesn't count on the PC
+struct FakeSysTick
+{
+	uint32_t LOAD;
+	uint32_t VAL;
+};
+
+inline FakeSysTick fakeSysTick = { 0x00FFFFFF, 0 };
+#define SysTick	(&fakeSysTick)
+
+#endif /* TESTS_STUBS_DIVASSTUBS_H_ */
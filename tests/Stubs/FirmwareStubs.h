@@ -0,0 +1,221 @@
+/*
+ * FirmwareStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Minimal replacements for the parts of RepRapFirmware.h, RRFLibraries and the peripherals that the firmware files under test use,
+ *  so that those files can be compiled unchanged on a PC. The Makefile force-includes this file, and it defines the include guards of
+ *  RepRapFirmware.h and Peripherals.h so that the real versions, which need the hardware headers, are skipped.
+ */
+
+#ifndef TESTS_STUBS_FIRMWARESTUBS_H_
+#define TESTS_STUBS_FIRMWARESTUBS_H_
+
+#define SRC_REPRAPFIRMWARE_H_
+#define SRC_HARDWARE_SAME5X_H_								// the include guard of Hardware/Peripherals.h
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <cinttypes>
+#include <cctype>
+#include <cmath>
+#include <mutex>
+
+// Tests of SAME5x-only code define SAME5x=1 on the command line
+#ifndef SAME5x
+# define SAME5x	0
+#endif
+#define SAMC21	(!SAME5x)
+
+#define ARRAY_SIZE(_x)	(sizeof(_x)/sizeof((_x)[0]))
+#define pre(_x)												// RRFLibraries precondition annotation
+
+typedef double floatc_t;
+
+constexpr float Pi = 3.141592653589793;
+
+inline constexpr float fsquare(float arg)
+{
+	return arg * arg;
+}
+
+constexpr size_t FormatStringLength = 256;
+constexpr size_t StringLength50 = 50;
+
+constexpr size_t XYZ_AXES = 3;
+constexpr size_t X_AXIS = 0, Y_AXIS = 1, Z_AXIS = 2;
+
+template<class T> inline T max(T a, T b) { return (a > b) ? a : b; }
+template<class T> inline T min(T a, T b) { return (a < b) ? a : b; }
+inline constexpr uint64_t isquare64(uint32_t arg)
+{
+	return (uint64_t)arg * arg;
+}
+
+inline unsigned int LowestSetBit(uint32_t val)
+{
+	return __builtin_ctz(val);
+}
+
+template<class T> inline constexpr T constrain(T val, T vmin, T vmax) { return max<T>(min<T>(val, vmax), vmin); }
+
+enum Module : uint8_t
+{
+	moduleMove = 4,
+	moduleDda = 6
+};
+
+union CallbackParameter
+{
+	uint32_t u32;
+	int32_t i32;
+	void *vp;
+
+	CallbackParameter() { u32 = 0; }
+	CallbackParameter(void *p) { vp = p; }
+};
+
+class Move;
+extern Move *moveInstance;
+
+// Tests of code that prints debug messages provide this
+extern "C" void debugPrintf(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+// Time, provided by each test so that it can control it
+uint32_t millis();
+uint64_t millis64();
+void delay(uint32_t ms);
+
+// On the board, disabling interrupts stops any other task or ISR running. Tests that use threads get the same effect from one global lock.
+// Tests of peripheral models can check criticalSectionDepth to see whether interrupts would be disabled.
+inline std::recursive_mutex interruptsLock;
+inline int criticalSectionDepth = 0;
+
+class AtomicCriticalSectionLocker
+{
+public:
+	AtomicCriticalSectionLocker() { interruptsLock.lock(); ++criticalSectionDepth; }
+	~AtomicCriticalSectionLocker() { --criticalSectionDepth; interruptsLock.unlock(); }
+};
+
+typedef AtomicCriticalSectionLocker InterruptCriticalSectionLocker;
+
+typedef uint32_t irqflags_t;
+inline irqflags_t cpu_irq_save() { interruptsLock.lock(); ++criticalSectionDepth; return 0; }
+inline void cpu_irq_restore(irqflags_t flags) { --criticalSectionDepth; interruptsLock.unlock(); }
+
+namespace TaskPriority
+{
+	static constexpr int FirmwareUpdatePriority = 2;
+}
+
+inline bool StringEqualsIgnoreCase(const char *s1, const char *s2)
+{
+	while (*s1 != 0 && tolower(*s1) == tolower(*s2))
+	{
+		++s1;
+		++s2;
+	}
+	return tolower(*s1) == tolower(*s2);
+}
+
+// The subset of the RRFLibraries StringRef that the code under test uses
+class StringRef
+{
+public:
+	StringRef(char *pp, size_t pl) : p(pp), len(pl) { p[0] = 0; }
+
+	size_t Capacity() const { return len - 1; }
+	size_t strlen() const { return ::strlen(p); }
+	const char *c_str() const { return p; }
+	void Clear() const { p[0] = 0; }
+
+	int copy(const char *s) const { Clear(); return cat(s); }
+	int cat(const char *s) const
+	{
+		const size_t n = strlen();
+		snprintf(p + n, len - n, "%s", s);
+		return (int)strlen();
+	}
+	int lcat(const char *s) const { if (strlen() != 0) { cat("\n"); } return cat(s); }
+
+	int printf(const char *fmt, ...) const __attribute__ ((format (printf, 2, 3)))
+	{
+		Clear();
+		va_list vargs;
+		va_start(vargs, fmt);
+		vcatf(fmt, vargs);
+		va_end(vargs);
+		return (int)strlen();
+	}
+
+	int catf(const char *fmt, ...) const __attribute__ ((format (printf, 2, 3)))
+	{
+		va_list vargs;
+		va_start(vargs, fmt);
+		vcatf(fmt, vargs);
+		va_end(vargs);
+		return (int)strlen();
+	}
+
+	int lcatf(const char *fmt, ...) const __attribute__ ((format (printf, 2, 3)))
+	{
+		if (strlen() != 0)
+		{
+			cat("\n");
+		}
+		va_list vargs;
+		va_start(vargs, fmt);
+		vcatf(fmt, vargs);
+		va_end(vargs);
+		return (int)strlen();
+	}
+
+private:
+	void vcatf(const char *fmt, va_list vargs) const
+	{
+		const size_t n = strlen();
+		vsnprintf(p + n, len - n, fmt, vargs);
+	}
+
+	char *p;
+	size_t len;
+};
+
+// The subset of the RRFLibraries String that the code under test uses
+template<size_t Len> class String
+{
+public:
+	String() { storage[0] = 0; }
+
+	const char *c_str() const { return storage; }
+	StringRef GetRef() { return StringRef(storage, Len + 1); }
+	void copy(const char *s, size_t maxLen)
+	{
+		const size_t n = (maxLen < Len) ? maxLen : Len;
+		size_t i = 0;
+		while (i < n && s[i] != 0)
+		{
+			storage[i] = s[i];
+			++i;
+		}
+		storage[i] = 0;
+	}
+
+private:
+	char storage[Len + 1];
+};
+
+// Reset controller, read by EventLog::Init
+struct FakeRstc
+{
+	struct { uint8_t reg; } RCAUSE;
+};
+
+inline FakeRstc fakeRstc = { { 0x40 } };
+#define RSTC	(&fakeRstc)
+
+#endif /* TESTS_STUBS_FIRMWARESTUBS_H_ */
@@ -0,0 +1,46 @@
+/*
+ * FirmwareUpdaterStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replacements for the flash, platform and CAN interface headers that FirmwareUpdater.cpp uses. The flash is memory that the test maps
+ *  at FLASH_ADDR, so that FirmwareUpdater can read it directly as it does on the board. The test provides the functions declared here.
+ */
+
+#ifndef TESTS_STUBS_FIRMWAREUPDATERSTUBS_H_
+#define TESTS_STUBS_FIRMWAREUPDATERSTUBS_H_
+
+#define SRC_HARDWARE_FLASH_H_
+#define SRC_PLATFORM_H_
+#define SRC_CAN_CANINTERFACE_H_
+
+#define FLASH_ADDR		(0x10000000u)
+#define FLASH_SIZE		(0x00080000u)
+#define NVMCTRL_USER	(FLASH_ADDR + FLASH_SIZE)			// the user row is in an extra page after the flash
+
+constexpr const char* BoardTypeName = "EXP3HC";
+
+namespace Flash
+{
+	constexpr size_t FlashPageSize = 512;
+	constexpr size_t FlashBlockSize = FlashPageSize * 16;
+	constexpr uint32_t BankSize = FLASH_SIZE/2;
+	constexpr uint32_t OtherBankStart = FLASH_ADDR + BankSize;
+
+	bool Init();
+	bool Unlock(uint32_t start, uint32_t length);
+	bool EraseOtherBank(uint32_t start, uint32_t length);
+	bool WriteOtherBank(uint32_t start, uint32_t length, const uint8_t *data);
+}
+
+namespace Platform
+{
+	void StartBankSwap();
+}
+
+namespace CanInterface
+{
+	uint8_t GetCanAddress();
+}
+
+#endif /* TESTS_STUBS_FIRMWAREUPDATERSTUBS_H_ */
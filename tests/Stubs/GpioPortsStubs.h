@@ -0,0 +1,96 @@
+/*
+ * GpioPortsStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces Hardware/IoPorts.h and the configuration that GPIO/GpioPorts.cpp uses. The PWM port has no pin. Instead each port has a model
+ *  of its timer compare register, which WriteAnalog writes directly and which the register write made by PrepareWrite points to, so the
+ *  test can see when each write reaches the hardware. The compare value is the PWM times one million, so that each write can be recognised.
+ *  A port assigned to pin "nil" is released, and a port assigned to pin "nopwm" can be written but can't have a write prepared.
+ */
+
+#ifndef TESTS_STUBS_GPIOPORTSSTUBS_H_
+#define TESTS_STUBS_GPIOPORTSSTUBS_H_
+
+#define SRC_IOPORTS_H_
+
+#include <Hardware/PwmRegisterWrite.h>
+
+typedef uint16_t PwmFrequency;
+
+// As in Configuration.h
+constexpr PwmFrequency DefaultPinWritePwmFreq = 500;
+constexpr PwmFrequency ServoRefreshFrequency = 50;
+
+constexpr size_t MaxGpOutPorts = 8;								// fewer than in CANlib, which is enough for the test
+
+enum class PinAccess : int
+{
+	read,
+	readWithPullup_InternalUseOnly,
+	readAnalog,
+	write0,
+	write1,
+	pwm,
+	servo
+};
+
+enum class PinUsedBy : uint8_t
+{
+	unused = 0,
+	gpout
+};
+
+class PwmPort;
+inline PwmPort *fakePwmPorts[MaxGpOutPorts];						// the ports in the order they were constructed, which is the port number order
+inline size_t numFakePwmPorts = 0;
+
+class PwmPort
+{
+public:
+	PwmPort() : valid(false), canPrepare(false), frequency(0), compare(0)
+	{
+		fakePwmPorts[numFakePwmPorts++] = this;
+	}
+
+	bool AssignPort(const char *pinName, const StringRef& reply, PinUsedBy neededFor, PinAccess access)
+	{
+		valid = (strcmp(pinName, "nil") != 0);
+		canPrepare = valid && strcmp(pinName, "nopwm") != 0;
+		return true;
+	}
+
+	bool IsValid() const { return valid; }
+	void AppendDetails(const StringRef& str) const { }
+	void SetFrequency(PwmFrequency freq) { frequency = freq; }
+	PwmFrequency GetFrequency() const { return frequency; }
+
+	void WriteAnalog(float pwm) const
+	{
+		compare = PwmToCompare(pwm);
+	}
+
+	bool PrepareWrite(float pwm, PwmRegisterWrite& pw) const
+	{
+		if (!canPrepare)
+		{
+			return false;
+		}
+		pw.reg = &compare;
+		pw.value = PwmToCompare(pwm);
+		pw.is16Bit = false;
+		return true;
+	}
+
+	uint32_t GetCompare() const { return compare; }
+
+	static uint32_t PwmToCompare(float pwm) { return (uint32_t)lrintf(pwm * 1.0e6); }
+
+private:
+	bool valid;
+	bool canPrepare;
+	PwmFrequency frequency;
+	mutable volatile uint32_t compare;
+};
+
+#endif /* TESTS_STUBS_GPIOPORTSSTUBS_H_ */
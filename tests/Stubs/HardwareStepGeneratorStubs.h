@@ -0,0 +1,110 @@
+/*
+ * HardwareStepGeneratorStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the parts of the EXP3HC configuration, Platform, DmacManager and the SAME5x peripherals that Movement/HardwareStepGenerator.cpp uses.
+ *  The step timer's CC1 register is a plain variable. The test models the timer, the event system and the DMA channel that act on it,
+ *  and provides the DmacManager functions and Platform::SetDirection.
+ */
+
+#ifndef TESTS_STUBS_HARDWARESTEPGENERATORSTUBS_H_
+#define TESTS_STUBS_HARDWARESTEPGENERATORSTUBS_H_
+
+#define SRC_PLATFORM_H_
+#define SRC_HARDWARE_DMACMANAGER_H_
+
+#define SUPPORT_STEP_TIME_BUFFER			1
+#define SUPPORT_HARDWARE_STEP_GENERATION	1
+
+typedef uint8_t Pin;
+typedef uint8_t DmaChannel;
+typedef uint8_t DmaPriority;
+
+// As in Config/EXP3HC.h, except for the peripheral IDs
+constexpr size_t NumDrivers = 3;
+constexpr Pin StepPins[NumDrivers] = { 58, 59, 60 };
+constexpr size_t HardwareStepDriver = 2;
+constexpr unsigned int StepTcMc1EventGenerator = 0x4A;
+constexpr uint8_t StepTcMc1DmacId = 0x3F;
+constexpr unsigned int HardwareStepEventChannel = 0;
+constexpr unsigned int HardwarePortEventInput = 0;
+constexpr DmaChannel DmacChanStepGen = 7;
+constexpr DmaPriority DmacPrioStepGen = 3;
+constexpr uint32_t NvicPriorityStep = 3;
+
+inline uint32_t ChangeBasePriority(uint32_t prio) { interruptsLock.lock(); return 0; }
+inline void RestoreBasePriority(uint32_t prio) { interruptsLock.unlock(); }
+
+namespace Platform
+{
+	void SetDirection(size_t driver, bool direction);
+}
+
+enum class DmaTrigSource : uint8_t { };
+
+namespace DmacManager
+{
+	void SetBtctrl(uint8_t channel, uint16_t val);
+	void SetSourceAddress(uint8_t channel, const volatile void *const src);
+	void SetDestinationAddress(uint8_t channel, volatile void *const dst);
+	void SetDataLength(uint8_t channel, uint32_t amount);
+	void SetCircular(uint8_t channel);
+	void SetTriggerSource(uint8_t channel, DmaTrigSource source);
+	void EnableChannel(uint8_t channel, uint8_t priority);
+	void DisableChannel(uint8_t channel);
+}
+
+#define DMAC_BTCTRL_VALID				(1u << 0)
+#define DMAC_BTCTRL_EVOSEL_DISABLE		(0u << 1)
+#define DMAC_BTCTRL_BLOCKACT_NOACT		(0u << 3)
+#define DMAC_BTCTRL_BEATSIZE_WORD		(2u << 8)
+#define DMAC_BTCTRL_SRCINC				(1u << 10)
+#define DMAC_BTCTRL_STEPSEL_SRC			(1u << 12)
+#define DMAC_BTCTRL_STEPSIZE_X1			(0u << 13)
+
+// Step timer. Writes to CC1 take effect at once, so SYNCBUSY always reads zero.
+struct FakeTc
+{
+	struct { volatile uint32_t reg; } CC[2];
+	struct { volatile uint32_t reg; } SYNCBUSY;
+};
+
+inline FakeTc fakeStepTc;
+#define StepTc				(&fakeStepTc)
+#define TC_SYNCBUSY_CC1		(1u << 7)
+
+// Event system, PORT and main clock, which are only written during initialisation
+struct FakeMclk
+{
+	struct { uint32_t reg; } APBBMASK;
+};
+
+struct FakeEvsys
+{
+	struct { struct { uint32_t reg; } CHANNEL; } Channel[32];
+	struct { uint32_t reg; } USER[67];
+};
+
+struct FakePort
+{
+	struct { struct { uint32_t reg; } EVCTRL; } Group[4];
+};
+
+inline FakeMclk fakeMclk;
+inline FakeEvsys fakeEvsys;
+inline FakePort fakePort;
+#define MCLK							(&fakeMclk)
+#define EVSYS							(&fakeEvsys)
+#define PORT							(&fakePort)
+#define MCLK_APBBMASK_EVSYS				(1u << 7)
+#define EVSYS_CHANNEL_EVGEN(_x)			((uint32_t)(_x) & 0x7F)
+#define EVSYS_CHANNEL_PATH_ASYNCHRONOUS	(2u << 8)
+#define EVSYS_USER_CHANNEL(_x)			((uint32_t)(_x) & 0x3F)
+#define EVSYS_ID_USER_PORT_EV_0			1
+#define PORT_EVCTRL_PID0(_x)			((uint32_t)(_x) & 0x1F)
+#define PORT_EVCTRL_EVACT0(_x)			((uint32_t)(_x) << 5)
+#define PORT_EVCTRL_EVACT0_TGL_Val		3
+#define PORT_EVCTRL_PORTEI0				(1u << 7)
+
+#endif /* TESTS_STUBS_HARDWARESTEPGENERATORSTUBS_H_ */
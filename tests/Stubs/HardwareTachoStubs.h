@@ -0,0 +1,127 @@
+/*
+ * HardwareTachoStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the parts of the EXP3HC configuration, the pin interrupt functions, DmacManager and the SAME5x peripherals that Fans/HardwareTacho.cpp uses.
+ *  The RTC count is a plain variable that the test sets as its simulated time advances. The test models the DMA channels that copy the RTC count
+ *  into the time stamp buffers on each tacho edge, and provides AttachEvent and the DmacManager functions.
+ */
+
+#ifndef TESTS_STUBS_HARDWARETACHOSTUBS_H_
+#define TESTS_STUBS_HARDWARETACHOSTUBS_H_
+
+#define SRC_HARDWARE_DMACMANAGER_H_
+#define SRC_HARDWARE_PININTERRUPTS_H_							// the include guard of Hardware/Interrupts.h
+
+#define SUPPORT_HARDWARE_TACHO			1
+
+typedef uint8_t Pin;
+typedef uint8_t DmaChannel;
+typedef uint8_t DmaPriority;
+
+// As in Config/EXP3HC.h
+constexpr size_t NumHardwareTachos = 3;
+constexpr unsigned int TachoEventChannelBase = 1;
+constexpr DmaChannel DmacChanTachoBase = 4;
+constexpr DmaPriority DmacPrioTacho = 1;
+
+enum class InterruptMode : uint8_t
+{
+	none = 0,
+	low,
+	high,
+	change,
+	falling,
+	rising
+};
+
+bool AttachEvent(Pin pin, InterruptMode mode, unsigned int& exintNumber);
+
+namespace DmacManager
+{
+	void SetBtctrl(uint8_t channel, uint16_t val);
+	void SetSourceAddress(uint8_t channel, const volatile void *const src);
+	void SetDestinationAddress(uint8_t channel, volatile void *const dst);
+	void SetDataLength(uint8_t channel, uint32_t amount);
+	void SetCircular(uint8_t channel);
+	void SetEventTrigger(uint8_t channel);
+	void EnableChannel(uint8_t channel, uint8_t priority);
+	void DisableChannel(uint8_t channel);
+}
+
+#define DMAC_BTCTRL_VALID				(1u << 0)
+#define DMAC_BTCTRL_EVOSEL_DISABLE		(0u << 1)
+#define DMAC_BTCTRL_BLOCKACT_NOACT		(0u << 3)
+#define DMAC_BTCTRL_BEATSIZE_WORD		(2u << 8)
+#define DMAC_BTCTRL_DSTINC				(1u << 11)
+#define DMAC_BTCTRL_STEPSEL_DST			(0u << 12)
+#define DMAC_BTCTRL_STEPSIZE_X1			(0u << 13)
+
+// RTC in 32-bit counter mode. Synchronisation takes no time, so SYNCBUSY always reads zero.
+struct FakeRtc
+{
+	struct
+	{
+		struct { uint32_t reg; } CTRLA;
+		struct { uint32_t reg; } SYNCBUSY;
+		struct { volatile uint32_t reg; } COUNT;
+	} MODE0;
+};
+
+inline FakeRtc fakeRtc;
+#define RTC								(&fakeRtc)
+#define RTC_MODE0_CTRLA_SWRST			(1u << 0)
+#define RTC_MODE0_CTRLA_ENABLE			(1u << 1)
+#define RTC_MODE0_CTRLA_MODE_COUNT32	(0u << 2)
+#define RTC_MODE0_CTRLA_PRESCALER_DIV1	(1u << 8)
+#define RTC_MODE0_CTRLA_COUNTSYNC		(1u << 15)
+#define RTC_MODE0_SYNCBUSY_SWRST		(1u << 0)
+#define RTC_MODE0_SYNCBUSY_ENABLE		(1u << 1)
+#define RTC_MODE0_SYNCBUSY_COUNTSYNC	(1u << 15)
+
+// Clocks and the event system, which are only written when we start up and when a tacho is attached or detached
+struct FakeOsc32kctrl
+{
+	struct { uint32_t reg; } RTCCTRL;
+};
+
+struct FakeMclk
+{
+	struct { uint32_t reg; } APBAMASK;
+	struct { uint32_t reg; } APBBMASK;
+};
+
+struct FakeGclk
+{
+	struct { uint32_t reg; } PCHCTRL[48];
+};
+
+struct FakeEvsys
+{
+	struct { struct { uint32_t reg; } CHANNEL; } Channel[32];
+	struct { uint32_t reg; } USER[67];
+};
+
+inline FakeOsc32kctrl fakeOsc32kctrl;
+inline FakeMclk fakeMclk;
+inline FakeGclk fakeGclk;
+inline FakeEvsys fakeEvsys;
+#define OSC32KCTRL							(&fakeOsc32kctrl)
+#define MCLK								(&fakeMclk)
+#define GCLK								(&fakeGclk)
+#define EVSYS								(&fakeEvsys)
+#define OSC32KCTRL_RTCCTRL_RTCSEL_ULP32K	0
+#define MCLK_APBAMASK_RTC					(1u << 9)
+#define MCLK_APBBMASK_EVSYS					(1u << 7)
+#define EVSYS_GCLK_ID_0						11
+#define GCLK_PCHCTRL_GEN_GCLK0				0
+#define GCLK_PCHCTRL_CHEN					(1u << 6)
+#define EVSYS_CHANNEL_EVGEN(_x)				((uint32_t)(_x) & 0x7F)
+#define EVSYS_CHANNEL_PATH_RESYNCHRONIZED	(1u << 8)
+#define EVSYS_CHANNEL_EDGSEL_RISING_EDGE	(1u << 10)
+#define EVSYS_ID_GEN_EIC_EXTINT_0			0x12
+#define EVSYS_USER_CHANNEL(_x)				((uint32_t)(_x) & 0x3F)
+#define EVSYS_ID_USER_DMAC_CH_0				4
+
+#endif /* TESTS_STUBS_HARDWARETACHOSTUBS_H_ */
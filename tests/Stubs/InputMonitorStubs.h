@@ -0,0 +1,143 @@
+/*
+ * InputMonitorStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces Hardware/IoPorts.h, the ADC functions and the port input registers that InputMonitors/InputMonitor.cpp uses.
+ *  A pin name is the pin number, with a leading '!' to invert it. The test sets the pin levels in the port input registers using SetFakePinLevel
+ *  and the ADC readings in fakeAnalogReadings, and calls the pin change or ADC threshold callback that the port holds, as the interrupt would.
+ */
+
+#ifndef TESTS_STUBS_INPUTMONITORSTUBS_H_
+#define TESTS_STUBS_INPUTMONITORSTUBS_H_
+
+#define SRC_IOPORTS_H_
+
+#define SUPPORT_INPUT_SCANNER	1
+#define PORT_GROUPS				3								// as on the SAME51N
+
+typedef uint8_t Pin;
+constexpr size_t NumPins = PORT_GROUPS * 32;
+
+enum class PinAccess : int
+{
+	read,
+	readWithPullup_InternalUseOnly,
+	readAnalog,
+	write0,
+	write1,
+	pwm,
+	servo
+};
+
+enum class PinUsedBy : uint8_t
+{
+	unused = 0,
+	endstop
+};
+
+enum class InterruptMode : uint8_t
+{
+	none = 0,
+	low,
+	high,
+	change,
+	falling,
+	rising
+};
+
+typedef void (*StandardCallbackFunction)(CallbackParameter);
+typedef void (*AnalogInCallbackFunction)(CallbackParameter p, uint16_t reading);
+typedef void (*AnalogThresholdCallbackFunction)(CallbackParameter p, bool state, uint32_t whenChanged);
+
+namespace AnalogIn
+{
+	constexpr unsigned int AdcBits = 12;
+}
+
+// Port input registers, which the test keeps the same as the pin levels
+struct FakePort
+{
+	struct { struct { uint32_t reg; } IN; } Group[PORT_GROUPS];
+};
+
+inline FakePort fakePort;
+#define PORT	(&fakePort)
+
+inline void SetFakePinLevel(Pin pin, bool level)
+{
+	if (level)
+	{
+		fakePort.Group[pin >> 5].IN.reg |= 1ul << (pin & 31);
+	}
+	else
+	{
+		fakePort.Group[pin >> 5].IN.reg &= ~(1ul << (pin & 31));
+	}
+}
+
+inline uint16_t fakeAnalogReadings[NumPins];
+
+class IoPort
+{
+public:
+	IoPort() : pin(NumPins), invert(false) { }
+
+	bool AssignPort(const char *pinName, const StringRef& reply, PinUsedBy neededFor, PinAccess access)
+	{
+		invert = (pinName[0] == '!');
+		char *end;
+		const unsigned long p = strtoul(pinName + (invert ? 1 : 0), &end, 10);
+		if (*end != 0 || p >= NumPins)
+		{
+			reply.printf("Unknown pin name '%s'", pinName);
+			return false;
+		}
+		pin = p;
+		return true;
+	}
+
+	Pin GetPin() const { return pin; }
+	bool GetTotalInvert() const { return invert; }
+	void AppendPinName(const StringRef& str) const { str.catf("%s%u", (invert) ? "!" : "", pin); }
+
+	bool Read() const { return ((PORT->Group[pin >> 5].IN.reg & (1ul << (pin & 31))) != 0) != invert; }
+	uint16_t ReadAnalog() const { return fakeAnalogReadings[pin]; }
+
+	bool AttachInterrupt(StandardCallbackFunction callback, InterruptMode mode, CallbackParameter param) const
+	{
+		pinCallbacks[pin] = callback;
+		pinCallbackParams[pin] = param;
+		return true;
+	}
+
+	void DetachInterrupt() const { pinCallbacks[pin] = nullptr; }
+
+	bool SetAnalogCallback(AnalogInCallbackFunction fn, CallbackParameter cbp, uint32_t ticksPerCall) const
+	{
+		analogCallbacks[pin] = fn;
+		analogCallbackParams[pin] = cbp;
+		return true;
+	}
+
+	bool SetAnalogThresholdCallback(AnalogThresholdCallbackFunction fn, CallbackParameter cbp, uint16_t lowerThreshold, uint16_t upperThreshold, bool initialState) const
+	{
+		thresholdCallbacks[pin] = fn;
+		thresholdCallbackParams[pin] = cbp;
+		return true;
+	}
+
+	// The callbacks that the interrupts would make
+	static inline StandardCallbackFunction pinCallbacks[NumPins];
+	static inline CallbackParameter pinCallbackParams[NumPins];
+	static inline AnalogInCallbackFunction analogCallbacks[NumPins];
+	static inline CallbackParameter analogCallbackParams[NumPins];
+	static inline AnalogThresholdCallbackFunction thresholdCallbacks[NumPins];
+	static inline CallbackParameter thresholdCallbackParams[NumPins];
+
+private:
+	Pin pin;
+	bool invert;
+};
+
+#endif /* TESTS_STUBS_INPUTMONITORSTUBS_H_ */
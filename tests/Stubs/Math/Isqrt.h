@@ -0,0 +1,30 @@
+/*
+ * Isqrt.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Stands in for the RRFLibraries header of the same name when testing on a PC. This version is slow but obviously correct,
+ *  so the tests use it as the reference.
+ */
+
+#ifndef TESTS_STUBS_MATH_ISQRT_H_
+#define TESTS_STUBS_MATH_ISQRT_H_
+
+#include <cstdint>
+
+// Return the integer square root of num, rounded down
+inline uint32_t isqrt64(uint64_t num)
+{
+	uint32_t root = 0;
+	for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1)
+	{
+		const uint64_t trial = root | bit;
+		if (trial * trial <= num)
+		{
+			root = (uint32_t)trial;
+		}
+	}
+	return root;
+}
+
+#endif /* TESTS_STUBS_MATH_ISQRT_H_ */
@@ -0,0 +1,14 @@
+/*
+ * Matrix.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the RRFLibraries matrix header, which Kinematics.h includes only for the declaration of PrintMatrix.
+ */
+
+#ifndef TESTS_STUBS_MATH_MATRIX_H_
+#define TESTS_STUBS_MATH_MATRIX_H_
+
+template<class T> class MathMatrix;
+
+#endif /* TESTS_STUBS_MATH_MATRIX_H_ */
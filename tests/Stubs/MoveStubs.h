@@ -0,0 +1,25 @@
+/*
+ * MoveStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces Movement/Move.h, which needs the rest of the movement system. Tests that read driver positions provide GetLiveDriverPosition.
+ *  The number of drivers is the same as on the EXP3HC.
+ */
+
+#ifndef TESTS_STUBS_MOVESTUBS_H_
+#define TESTS_STUBS_MOVESTUBS_H_
+
+#define MOVE_H_
+
+constexpr size_t NumDrivers = 3;
+
+class Move
+{
+public:
+	int32_t GetLiveDriverPosition(size_t driver) const;
+};
+
+extern Move *moveInstance;
+
+#endif /* TESTS_STUBS_MOVESTUBS_H_ */
@@ -0,0 +1,53 @@
+/*
+ * MovementStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces the board configuration and the parts of Platform that Movement/Move.cpp, DDA.cpp and DriveMovement.cpp use, so that the movement
+ *  code can run on a PC. The configuration is that of the EXP1HCE: one driver, no FPU so moves are prepared in fixed point, and no step time buffer.
+ *  Tests provide the Platform functions that drive the step and direction pins.
+ */
+
+#ifndef TESTS_STUBS_MOVEMENTSTUBS_H_
+#define TESTS_STUBS_MOVEMENTSTUBS_H_
+
+#define SRC_PLATFORM_H_
+#define SRC_HARDWARE_PININTERRUPTS_H_							// the include guard of Hardware/Interrupts.h
+
+// As in Config/EXP1HCE.h, without the smart driver
+#define SINGLE_DRIVER					1
+#define SUPPORT_SLOW_DRIVERS			0
+#define SUPPORT_DELTA_MOVEMENT			1
+#define SUPPORT_FIXED_POINT_PREPARE		1
+#define USE_EVEN_STEPS					1
+#define HAS_SMART_DRIVERS				0
+#define SUPPORT_INPUT_SHAPING			0
+#define SUPPORT_STEP_TIME_BUFFER		0
+#define SUPPORT_HARDWARE_STEP_GENERATION	0
+#define SUPPORT_DRIVER_TELEMETRY		0
+#define SUPPORT_POWER_FAIL_DETECTION	0
+
+constexpr size_t NumDrivers = 1;
+constexpr size_t MoveQueueRamBudget = 3584;
+
+enum class ErrorCode : uint32_t
+{
+	BadMove = 1u << 1
+};
+
+namespace Platform
+{
+	constexpr float DefaultStepsPerMm = 80.0;
+
+	inline bool Debug(Module module) { return false; }
+	inline void LogError(ErrorCode e) { }
+	inline void EnableDrive(size_t driver) { }
+	inline float DriveStepsPerUnit(size_t drive) { return DefaultStepsPerMm; }
+	inline float GetPressureAdvance(size_t driver) { return 0.0; }
+
+	void SetDirection(size_t driver, bool direction);
+	void StepDriverHigh();
+	void StepDriverLow();
+}
+
+#endif /* TESTS_STUBS_MOVEMENTSTUBS_H_ */
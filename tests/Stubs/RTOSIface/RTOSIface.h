@@ -0,0 +1,139 @@
+/*
+ * RTOSIface.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Stands in for the RRFLibraries header of the same name when testing on a PC. Mutex is a real mutex and each task is a thread,
+ *  so that tests can run the code under test from more than one thread. ReadWriteLock is a shared mutex.
+ */
+
+#ifndef TESTS_STUBS_RTOSIFACE_RTOSIFACE_H_
+#define TESTS_STUBS_RTOSIFACE_RTOSIFACE_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+class Mutex
+{
+public:
+	void Create(const char *pName) { }
+	void Take() { m.lock(); }
+	void Release() { m.unlock(); }
+
+private:
+	std::recursive_mutex m;
+};
+
+class MutexLocker
+{
+public:
+	MutexLocker(Mutex& pm) : m(pm) { m.Take(); }
+	~MutexLocker() { m.Release(); }
+
+private:
+	Mutex& m;
+};
+
+// A task is a detached thread. Give and Take work like FreeRTOS direct to task notifications used as a binary semaphore.
+class TaskBase
+{
+public:
+	typedef void (*TaskFunction)(void *);
+
+	static constexpr uint32_t TimeoutUnlimited = 0xFFFFFFFF;
+
+	void Give()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		notified = true;
+		cv.notify_one();
+	}
+
+	static void Take()
+	{
+		TaskBase * const t = current;
+		std::unique_lock<std::mutex> lock(t->m);
+		t->cv.wait(lock, [t]() { return t->notified; });
+		t->notified = false;
+	}
+
+protected:
+	void Start(TaskFunction f, void *param)
+	{
+		std::thread([this, f, param]() { current = this; f(param); }).detach();
+	}
+
+private:
+	std::mutex m;
+	std::condition_variable cv;
+	bool notified = false;
+	static inline thread_local TaskBase *current = nullptr;
+};
+
+// Stops other tasks running, but not ISRs. Tests that use threads for tasks get the same effect from one lock.
+class TaskCriticalSectionLocker
+{
+public:
+	TaskCriticalSectionLocker() { lock.lock(); }
+	~TaskCriticalSectionLocker() { lock.unlock(); }
+
+private:
+	static inline std::recursive_mutex lock;
+};
+
+template<unsigned int StackWords> class Task : public TaskBase
+{
+public:
+	void Create(TaskFunction f, const char *name, void *param, int priority) { Start(f, param); }
+};
+
+class ReadWriteLock
+{
+public:
+	void LockForReading() { m.lock_shared(); }
+	void ReleaseReader() { m.unlock_shared(); }
+	void LockForWriting() { m.lock(); }
+	void ReleaseWriter() { m.unlock(); }
+
+private:
+	std::shared_mutex m;
+};
+
+class ReadLocker
+{
+public:
+	ReadLocker(ReadWriteLock& p) : lock(&p) { lock->LockForReading(); }
+	ReadLocker(ReadLocker&& other) : lock(other.lock) { other.lock = nullptr; }
+	~ReadLocker() { if (lock != nullptr) { lock->ReleaseReader(); } }
+
+private:
+	ReadWriteLock *lock;
+};
+
+class WriteLocker
+{
+public:
+	WriteLocker(ReadWriteLock& p) : lock(p) { lock.LockForWriting(); }
+	~WriteLocker() { lock.ReleaseWriter(); }
+
+private:
+	ReadWriteLock& lock;
+};
+
+template<class T> class ReadLockedPointer
+{
+public:
+	ReadLockedPointer(ReadLocker& p_locker, T *p_ptr) : locker(std::move(p_locker)), ptr(p_ptr) { }
+
+	bool IsNull() const { return ptr == nullptr; }
+	T *operator->() const { return ptr; }
+	T *Ptr() const { return ptr; }
+
+private:
+	ReadLocker locker;
+	T *ptr;
+};
+
+#endif /* TESTS_STUBS_RTOSIFACE_RTOSIFACE_H_ */
@@ -0,0 +1,38 @@
+/*
+ * StepTimerStubs.h
+ *
+ *  Created on: 18 Oct 2026
+ *
+ *  Replaces Movement/StepTimer.h, which needs the timer peripheral. The step clock rate is the same as on the board.
+ *  Tests that read the step clock provide GetTimerTicks, and tests of code that uses master clock times provide IsSynced, ConvertToLocalTime and ConvertToMasterTime.
+ *  Tests that run the step ISR provide the callback functions, and fire the callback at the scheduled time.
+ */
+
+#ifndef TESTS_STUBS_STEPTIMERSTUBS_H_
+#define TESTS_STUBS_STEPTIMERSTUBS_H_
+
+#define SRC_MOVEMENT_STEPTIMER_H_
+
+class StepTimer
+{
+public:
+	typedef uint32_t Ticks;
+	typedef void (*TimerCallbackFunction)(CallbackParameter);
+
+	void SetCallback(TimerCallbackFunction cb, CallbackParameter param);
+	bool ScheduleCallbackFromIsr(Ticks when);
+
+	static Ticks GetTimerTicks();
+	static bool IsSynced();
+	static uint32_t ConvertToLocalTime(uint32_t masterTime);
+	static uint32_t ConvertToMasterTime(uint32_t localTime);
+	static void DisableTimerInterrupt();
+	static void Diagnostics(const StringRef& reply);
+
+	static constexpr uint32_t StepClockRate = 48000000/64;						// 48MHz divided by 64
+	static constexpr uint64_t StepClockRateSquared = (uint64_t)StepClockRate * StepClockRate;
+	static constexpr float StepClocksToMillis = 1000.0/(float)StepClockRate;
+	static constexpr uint32_t MinInterruptInterval = 6;							// about 6us
+};
+
+#endif /* TESTS_STUBS_STEPTIMERSTUBS_H_ */